@@ -112,6 +112,24 @@ typedef struct _ffdb_dbt_{
   long size;                           /* data length in bytes */
 }FFDB_DBT;
 
+/**
+ * Read only view of a data item returned by ffdb_get_view.
+ * data points either into a cached page or into a private copy. 
+ * It stays valid until ffdb_release_view is called
+ */
+typedef struct _ffdb_view_{
+  const void *data;                    /* data                 */
+  long size;                           /* data length in bytes */
+  void *page;                          /* pinned page or 0     */
+  void *buffer;                        /* private copy or 0    */
+}ffdb_view_t;
+
+/**
+ * Streaming handle of a data item opened by ffdb_value_open_read or
+ * ffdb_value_open_write
+ */
+typedef struct _ffdb_value_ ffdb_value_t;
+
 /*
  * DB access method and cursor operation values.  Each value is an operation
  * code to which additional bit flags are added.
@@ -156,6 +174,12 @@ typedef struct _ffdb_dbt_{
 #define FFDB_KEY_CURSOR  0x1001
 #define FFDB_DATA_CURSOR 0x1004 
 
+/**
+ * Flag or'ed into flags of ffdb_cursor_get_bulk to pack keys only,
+ * each followed by a zero data length
+ */
+#define FFDB_BULK_KEYS 0x10000
+
 /**
  * Forward decleration of cursor
  */
@@ -176,6 +200,15 @@ typedef struct _ffdb_cursor_
 
 }ffdb_cursor_t;
 
+/**
+ * A range of buckets [first, last] a key cursor can be limited to
+ */
+typedef struct _ffdb_bucket_range_
+{
+  unsigned int first;
+  unsigned int last;
+}ffdb_bucket_range_t;
+
 
 
 
@@ -197,19 +230,62 @@ typedef struct __ffdb {
  */
 #define FFDB_HASHMAGIC 0xcece3434
 
-#define FFDB_VERSION 6
+#define FFDB_VERSION 10
 
 #define FFDB_VERSION_5 5
 #define FFDB_VERSION_6 6
+#define FFDB_VERSION_7 7
+#define FFDB_VERSION_8 8
+#define FFDB_VERSION_9 9
+#define FFDB_VERSION_10 10
+
+/*
+ * Built-in hash functions. The identifier of the function used by
+ * a database is recorded in its header from version 8 on, so that
+ * reopening a database picks the same function automatically, and
+ * opening it with a user supplied function fails with EINVAL.
+ * Files of older versions and databases created with a user supplied
+ * hash function record FFDB_HASH_USER: they have to be opened with
+ * the same user function (or none for the old default one).
+ */
+#define FFDB_HASH_DEFAULT 0     /* library default for new databases   */
+#define FFDB_HASH_FNV     1     /* byte by byte FNV (default before 8) */
+#define FFDB_HASH_WY      2     /* 64 bit multiply-mix hash            */
+#define FFDB_HASH_USER    0xff  /* user supplied hash function         */
 
 /*
  * How do we store key and data on a page
  * 1) key and data try to be on the primary page
  * 2) key points to pageno and offset where data are
+ * Files of version 7 embed small data items (at most 1/8 of a page)
+ * next to their keys. Larger data and files of older versions are
+ * stored indirectly.
  */
 #define FFDB_STORE_EMBED    0x00ffddee
 #define FFDB_STORE_INDIRECT 0x00ff1100
  
+/*
+ * Ways to open an existing database. A lazy open reads the header only:
+ * user information and configuration pages are read on first use, and
+ * a writer looks for its free and data pages before its first update.
+ * A lazy open never moves pages, so a compacted file cannot be opened
+ * lazily for write.
+ */
+#define FFDB_OPEN_DEFAULT 0
+#define FFDB_OPEN_LAZY    1
+
+/*
+ * Bits of rearrangepages in FFDB_HASHINFO. Fields after cmp were added
+ * later and are used only when their bit is set, so callers filling in
+ * the structure field by field without them keep working. Pages are no
+ * longer moved when a database is opened or closed: FFDB_REARRANGE_PAGES
+ * only prints a warning, and ffdb_compact moves them instead.
+ */
+#define FFDB_REARRANGE_PAGES 0x1     /* no longer used                   */
+#define FFDB_INFO_HASHID     0x100   /* hashid is set                    */
+#define FFDB_INFO_OPENMODE   0x200   /* openmode is set                  */
+#define FFDB_INFO_DEXTSIZE   0x400   /* dextsize is set                  */
+
 /*
  * Structure used to pass parameters to the hashing routines. 
  */
@@ -217,14 +293,23 @@ typedef struct {
   unsigned int	bsize;		 /* bucket size */
   unsigned int	nbuckets;	 /* number of buckets */
   unsigned long	cachesize;	 /* bytes to cache */
-  int           rearrangepages;  /* to rearrange page on open/close to save
-				  * space
-				  */
+  int           rearrangepages;  /* FFDB_INFO_* bits of fields set below */
   unsigned int   userinfolen;    /* how many bytes for user information */
   unsigned int   numconfigs;     /* number of configurations */
   unsigned int  (*hash) (const void *, unsigned int); /* hash function */
                                 /* key compare func */
   int           (*cmp) (const FFDB_DBT *, const FFDB_DBT *); 
+  unsigned int   hashid;         /* built-in hash function (FFDB_HASH_*)
+				  * used when hash is not supplied, with
+				  * FFDB_INFO_HASHID
+				  */
+  unsigned int   openmode;       /* FFDB_OPEN_* for an existing file, with
+				  * FFDB_INFO_OPENMODE
+				  */
+  unsigned int   dextsize;       /* bytes of data pages in a row moved
+				  * by one read or write (0: default), with
+				  * FFDB_INFO_DEXTSIZE
+				  */
 } FFDB_HASHINFO;
 
 
@@ -316,6 +401,31 @@ typedef struct _all_config_info_
   ffdb_config_info_t *allconfigs;
 }ffdb_all_config_info_t;
 
+/**
+ * Statistics of an open database
+ */
+typedef struct _ffdb_stats_
+{
+  double        open_time;      /* seconds spent opening the database */
+  unsigned int  bsize;          /* page size                          */
+  unsigned int  nbuckets;       /* number of buckets                  */
+  unsigned int  nkeys;          /* number of keys                     */
+  int           lazy;           /* opened with FFDB_OPEN_LAZY         */
+}ffdb_stats_t;
+
+/**
+ * Where overflow pages of key chains of a level of buckets are. These
+ * are the overflow pages above the bucket pages of the level
+ */
+typedef struct _ffdb_level_pages_
+{
+  unsigned int  nbuckets;       /* buckets of the level               */
+  unsigned int  novfl;          /* overflow pages of the level        */
+  unsigned int  first;          /* first overflow page                */
+  unsigned int  last;           /* last overflow page                 */
+  unsigned int  ndata;          /* data pages from first to last      */
+}ffdb_level_pages_t;
+
 
 #ifdef __cplusplus
 extern "C"
@@ -435,6 +545,415 @@ extern unsigned int
 ffdb_max_user_info_len (const FFDB_DB* db);
 
 
+/**
+ * Get data for a batch of keys
+ *
+ * All keys are hashed first and looked up in bucket page order so that
+ * every bucket page is visited once. Data are then read in data page
+ * order. Each value follows the same rule as a get call: if
+ * values[i].data is null, memory is allocated and caller should free it.
+ *
+ * @param db pointer to underlying database
+ * @param keys array of n keys
+ * @param n number of keys
+ * @param values array of n values to hold retrieved data
+ * @param status optional array of n results: 0 the key is found,
+ * FFDB_NOT_FOUND the key is not in the database, -1 on failure
+ *
+ * @return 0 when all keys are found. FFDB_NOT_FOUND when some keys are not
+ * found. -1 on failure with a proper errno set
+ */
+extern int
+ffdb_mget (const FFDB_DB* db, FFDB_DBT keys[], unsigned int n,
+	   FFDB_DBT values[], int status[]);
+
+
+/**
+ * Put a batch of key and data pairs into the database
+ *
+ * Pairs are applied in bucket order under one lock acquisition. Any
+ * table expansion caused by the batch is done at the end of the batch.
+ * If the same key appears more than once, the last one wins unless
+ * flag is FFDB_NOOVERWRITE.
+ *
+ * @param db pointer to underlying database
+ * @param keys array of n keys
+ * @param data array of n data
+ * @param n number of pairs
+ * @param flag put flag applied to every pair: 0 or FFDB_NOOVERWRITE
+ * @param status optional array of n results: 0 on success, -1 on failure
+ *
+ * @return 0 when all pairs are stored. -1 on failure with a proper 
+ * errno set
+ */
+extern int
+ffdb_mput (FFDB_DB* db, FFDB_DBT keys[], const FFDB_DBT data[],
+	   unsigned int n, unsigned int flag, int status[]);
+
+
+/**
+ * Get a read only view of data associated with a key
+ *
+ * On a database opened read only, a data item residing on a single page
+ * is returned in place: the page stays pinned until the view is released
+ * and no memory is copied or allocated. Otherwise the data item is copied
+ * into a private buffer owned by the view.
+ *
+ * @param db pointer to underlying database
+ * @param key the key to look up
+ * @param view the view of the data item
+ *
+ * @return 0 on success. FFDB_NOT_FOUND if the key is not found. 
+ * -1 on failure with a proper errno set
+ */
+extern int
+ffdb_get_view (const FFDB_DB* db, const FFDB_DBT* key, ffdb_view_t* view);
+
+/**
+ * Release a view obtained by ffdb_get_view
+ *
+ * @param db pointer to underlying database
+ * @param view the view to release
+ *
+ * @return 0 on success. -1 on failure with a proper errno set
+ */
+extern int
+ffdb_release_view (const FFDB_DB* db, ffdb_view_t* view);
+
+
+/**
+ * Get a byte range of data associated with a key
+ *
+ * Only the data pages covering the range are copied, and pages past
+ * the range are never read. Since the checksum covers the whole data
+ * item, it is not verified on a partial read.
+ *
+ * @param db pointer to underlying database
+ * @param key the key to look up
+ * @param offset where the range starts in the data item
+ * @param len number of bytes to read: the range has to lie within
+ * the data item. With len = 0 only the data length is returned
+ * @param buf buffer of at least len bytes
+ * @param datalen total length of the data item if not null
+ *
+ * @return 0 on success. FFDB_NOT_FOUND if the key is not found. 
+ * -1 on failure with a proper errno set
+ */
+extern int
+ffdb_get_range (const FFDB_DB* db, const FFDB_DBT* key,
+		long offset, long len, void* buf, long* datalen);
+
+
+/**
+ * Overwrite a byte range of data associated with a key in place
+ *
+ * The data length does not change. Only the data pages covering the
+ * range are written, and the data checksum is updated from the old 
+ * and the new bytes of the range.
+ *
+ * @param db pointer to underlying database
+ * @param key the key to look up
+ * @param offset where the range starts in the data item
+ * @param buf new bytes of the range
+ * @param len number of bytes to write: the range has to lie within 
+ * the data item
+ *
+ * @return 0 on success. FFDB_NOT_FOUND if the key is not found. 
+ * -1 on failure with a proper errno set
+ */
+extern int
+ffdb_put_range (const FFDB_DB* db, const FFDB_DBT* key,
+		long offset, const void* buf, long len);
+
+
+/**
+ * Open a data item associated with a key for streaming read
+ *
+ * The data item is copied page by page through ffdb_value_read_next
+ * so that a huge data item can be consumed in bounded memory. The data
+ * item should not be modified while the handle is open.
+ *
+ * @param db pointer to underlying database
+ * @param key the key to look up
+ * @param value returned streaming handle
+ *
+ * @return 0 on success. FFDB_NOT_FOUND if the key is not found. 
+ * -1 on failure with a proper errno set
+ */
+extern int
+ffdb_value_open_read (const FFDB_DB* db, const FFDB_DBT* key,
+		      ffdb_value_t** value);
+
+/**
+ * Read the next chunk of a data item opened by ffdb_value_open_read
+ *
+ * The checksum of the whole data item is verified when the last 
+ * chunk is read.
+ *
+ * @param value streaming handle
+ * @param buf buffer of at least len bytes
+ * @param len maximum number of bytes to read
+ *
+ * @return number of bytes read, 0 at the end of the data item.
+ * -1 on failure with a proper errno set
+ */
+extern long
+ffdb_value_read_next (ffdb_value_t* value, void* buf, long len);
+
+/**
+ * Open a data item of a given size associated with a key for
+ * streaming write
+ *
+ * Space of the data item is reserved right away, and an existing
+ * data item of a key is replaced. The data is then written page by page
+ * through ffdb_value_write_chunk and becomes valid after 
+ * ffdb_value_commit.
+ *
+ * @param db pointer to underlying database
+ * @param key the key of the data item
+ * @param size the total size of the data item
+ * @param value returned streaming handle
+ *
+ * @return 0 on success. -1 on failure with a proper errno set
+ */
+extern int
+ffdb_value_open_write (const FFDB_DB* db, const FFDB_DBT* key,
+		       long size, ffdb_value_t** value);
+
+/**
+ * Write the next chunk of a data item opened by ffdb_value_open_write
+ *
+ * @param value streaming handle
+ * @param buf data to write
+ * @param len number of bytes to write
+ *
+ * @return 0 on success. -1 on failure with a proper errno set
+ */
+extern int
+ffdb_value_write_chunk (ffdb_value_t* value, const void* buf, long len);
+
+/**
+ * Finish writing a data item: the checksum of the data item is
+ * stored and the handle is closed
+ *
+ * @param value streaming handle. All bytes must have been written
+ *
+ * @return 0 on success. -1 on failure with a proper errno set
+ */
+extern int
+ffdb_value_commit (ffdb_value_t* value);
+
+/**
+ * Close a streaming handle. A data item opened for write and closed
+ * without ffdb_value_commit fails its checksum when it is read
+ *
+ * @param value streaming handle
+ *
+ * @return 0 on success. -1 on failure with a proper errno set
+ */
+extern int
+ffdb_value_close (ffdb_value_t* value);
+
+/**
+ * Split all buckets of a database into at most n ranges of
+ * nearly equal number of buckets
+ *
+ * The ranges are valid until the hash table grows
+ *
+ * @param db pointer to underlying database
+ * @param ranges application allocated space for n ranges
+ * @param n number of ranges wanted
+ *
+ * @return number of ranges filled, which is less than n when the
+ * database has fewer than n buckets. -1 on failure with a proper errno set
+ */
+extern int
+ffdb_bucket_ranges (const FFDB_DB* db, ffdb_bucket_range_t ranges[],
+		    unsigned int n);
+
+/**
+ * Limit a key cursor to a range of buckets
+ *
+ * The cursor is reset: FFDB_FIRST and FFDB_LAST move to the first and
+ * the last item in the range, FFDB_NEXT and FFDB_PREV stop at the range 
+ * boundaries. Cursors limited to different ranges can be used by 
+ * different threads at the same time.
+ *
+ * @param cursor a key cursor
+ * @param range range of buckets. Buckets past the last bucket of the
+ * database are ignored
+ *
+ * @return 0 on success. -1 on failure with a proper errno set
+ */
+extern int
+ffdb_cursor_set_range (ffdb_cursor_t* cursor, const ffdb_bucket_range_t* range);
+
+/**
+ * Get as many key and data pairs as fit in a buffer from a cursor
+ *
+ * Every pair is packed as an unsigned int key length, the key, an 
+ * unsigned int data length and the data, in native byte order and
+ * without padding. Pairs in the buffer are walked by ffdb_bulk_next.
+ * A pair that does not fit is returned first by the next call with
+ * FFDB_NEXT (or FFDB_PREV).
+ *
+ * @param cursor a cursor
+ * @param buf application buffer: buf->data and buf->size give the space.
+ * On return buf->size is the number of bytes filled
+ * @param flags FFDB_FIRST, FFDB_NEXT, or FFDB_LAST, FFDB_PREV on a key cursor,
+ * or'ed with FFDB_BULK_KEYS to leave data out
+ * @param count number of pairs filled
+ *
+ * @return 0 on success. FFDB_NOT_FOUND if there are no more pairs.
+ * -1 on failure with a proper errno set. If errno is ENOMEM the next 
+ * pair does not fit into the empty buffer and buf->size holds its size
+ */
+extern int
+ffdb_cursor_get_bulk (ffdb_cursor_t* cursor, FFDB_DBT* buf,
+		      unsigned int flags, unsigned int* count);
+
+/**
+ * Walk pairs packed by ffdb_cursor_get_bulk
+ *
+ * @param buf buffer filled by ffdb_cursor_get_bulk
+ * @param pos position of the next pair in the buffer, starting at 0
+ * @param key key pointing into the buffer
+ * @param data data pointing into the buffer
+ *
+ * @return 0 on success. FFDB_NOT_FOUND at the end of the buffer
+ */
+extern int
+ffdb_bulk_next (const FFDB_DBT* buf, unsigned long* pos, 
+		FFDB_DBT* key, FFDB_DBT* data);
+
+/**
+ * Build an in memory directory of all keys of a database opened read only.
+ * Every lookup afterwards reads the data page of a key directly without
+ * walking the bucket and its overflow pages.
+ * All buckets are scanned by nthreads threads. If fname is not null
+ * the directory is loaded from that side file when the file was saved
+ * for the same database, otherwise the directory is saved into it.
+ * The database must use the default key compare routine
+ *
+ * @param db database handle opened with O_RDONLY
+ * @param fname side file name or null
+ * @param nthreads number of threads scanning buckets
+ *
+ * @return 0 on success. -1 on failure with a proper errno set
+ */
+extern int
+ffdb_keydir_open (FFDB_DB* db, const char* fname, unsigned int nthreads);
+
+/**
+ * Keep a bloom filter of all keys of a database in memory. A get of a key
+ * not in the filter returns FFDB_NOT_FOUND without reading any bucket page.
+ * The filter is built by nthreads threads scanning all buckets and is
+ * updated by every insert. If fname is not null the filter is loaded from
+ * that side file when the file was saved for the same database, and it is
+ * saved into the file when the database is closed
+ *
+ * @param db database handle
+ * @param fname side file name or null
+ * @param nthreads number of threads scanning buckets
+ *
+ * @return 0 on success. -1 on failure with a proper errno set
+ */
+extern int
+ffdb_filter_open (FFDB_DB* db, const char* fname, unsigned int nthreads);
+
+/**
+ * Split buckets in a background thread. Afterwards an insert that fills
+ * up a bucket only chains an overflow page and queues the split of the
+ * next bucket, which the thread performs one bucket at a time. Queued
+ * splits are finished when the database is closed.
+ * A failed split is reported once, by the next insert queueing a split or
+ * by the close call, which returns -1 with errno set
+ *
+ * @param db database handle opened for writing
+ *
+ * @return 0 on success. -1 on failure with a proper errno set
+ */
+extern int
+ffdb_background_split (FFDB_DB* db);
+
+/**
+ * Compact a database that is not open anywhere else. Pages above the
+ * last level of buckets are moved into the bucket pages not used yet
+ * and the file is truncated. The first open for write afterwards moves
+ * the pages back. Opening and closing a database never moves pages
+ * otherwise, so both take the same time however large the file is
+ *
+ * @param fname database file name
+ * @param openinfo the FFDB_HASHINFO the database is opened with or null.
+ * A user supplied hash function must be given here
+ *
+ * @return 0 on success. -1 on failure with a proper errno set
+ */
+extern int
+ffdb_compact (const char* fname, const void* openinfo);
+
+/**
+ * Get statistics of an open database
+ *
+ * @param db database handle
+ * @param stats statistics returned
+ *
+ * @return 0 on success. -1 on failure with a proper errno set
+ */
+extern int
+ffdb_get_stats (const FFDB_DB* db, ffdb_stats_t* stats);
+
+/**
+ * Get where overflow pages of key chains of each level are. Every page
+ * above the bucket pages is read
+ *
+ * @param db database handle
+ * @param levels information of each level returned, starting at level 0
+ * @param nlevels number of elements of levels on input. Number of levels
+ * filled on return
+ *
+ * @return 0 on success. -1 on failure with a proper errno set
+ */
+extern int
+ffdb_get_level_pages (const FFDB_DB* db, ffdb_level_pages_t levels[],
+		      unsigned int* nlevels);
+
+/**
+ * Check whether a key may be in a database without reading any page
+ *
+ * @param db database handle
+ * @param key the key
+ *
+ * @return 0 if the key is surely not in the database. 1 if it may be,
+ * which is always the case without a filter. -1 on failure with a
+ * proper errno set
+ */
+extern int
+ffdb_key_may_exist (const FFDB_DB* db, const FFDB_DBT* key);
+
+/**
+ * Free the in memory key directory of a database. This routine must not
+ * be called while other threads are using the database
+ *
+ * @param db database handle
+ *
+ * @return 0 on success. -1 on failure with a proper errno set
+ */
+extern int
+ffdb_keydir_close (FFDB_DB* db);
+
+/**
+ * Get a built-in hash function from its identifier. This is the
+ * function used for buckets of databases created with this identifier
+ *
+ * @param hashid one of the FFDB_HASH_ identifiers
+ *
+ * @return the hash function. 0 if hashid is not a built-in function
+ */
+extern unsigned int
+(*ffdb_hash_function (unsigned int hashid)) (const void* key, unsigned int len);
+
+
 /*
  * A routine which reset the database handle under panic mode
  */
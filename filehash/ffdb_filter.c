@@ -0,0 +1,490 @@
+/**
+ * Copyright (C) <2008> Jefferson Science Associates, LLC
+ *                      Under U.S. DOE Contract No. DE-AC05-06OR23177
+ *
+ *                      Thomas Jefferson National Accelerator Facility
+ *
+ *                      Jefferson Lab
+ *                      Scientific Computing Group,
+ *                      12000 Jefferson Ave.,
+ *                      Newport News, VA 23606
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ----------------------------------------------------------------------------
+ * Description:
+ *     Blocked Bloom filter of all keys of a hash table
+ *
+ *     Every key sets FFDB_FILTER_NHASH bits inside one 512 bit block,
+ *     so a test touches a single cache line. A lookup of a key whose
+ *     bits are not all set returns without reading any bucket page.
+ *     The filter is built by scanning all buckets, updated on every
+ *     insert and saved into a side file on close. The side file is
+ *     loaded on open as long as the table file has not been changed.
+ *
+ * Author:
+ *     Jie Chen
+ *     Scientific Computing Group
+ *     Jefferson Lab
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "ffdb_db.h"
+#include "ffdb_pagepool.h"
+#include "ffdb_page.h"
+#include "ffdb_hash_func.h"
+#include "ffdb_hash.h"
+
+/**
+ * Side file magic number and version
+ */
+#define FFDB_FILTER_MAGIC   0xcece6161
+#define FFDB_FILTER_VERSION 1
+
+/**
+ * Filter geometry: bits per key, bits set per key and
+ * number of 64 bit words in a block
+ */
+#define FFDB_FILTER_BITS_PER_KEY 16
+#define FFDB_FILTER_NHASH        8
+#define FFDB_FILTER_BLOCK_WORDS  8
+#define FFDB_FILTER_MIN_KEYS     512
+
+struct _ffdb_filter_
+{
+  unsigned long nblocks;        /* number of blocks: power of 2      */
+  unsigned long long* bits;     /* nblocks blocks                    */
+  unsigned long capacity;       /* number of keys the filter is for  */
+  unsigned long nkeys;          /* number of keys added              */
+  unsigned int nthreads;        /* threads scanning buckets          */
+  int dirty;                    /* not the same as the side file     */
+  char* fname;                  /* side file name or null            */
+};
+
+/**
+ * Header of a side file followed by all blocks
+ */
+typedef struct _ffdb_filter_hdr_
+{
+  unsigned int magic;
+  unsigned int version;
+  unsigned int hdr_nkeys;       /* number of keys of the table       */
+  unsigned int pad;
+  unsigned long long fsize;     /* size of the table file            */
+  long long mtime;              /* modification time of the table    */
+  long long mtime_nsec;
+  unsigned long long ino;       /* inode of the table file           */
+  unsigned long long nblocks;
+  unsigned long long capacity;
+  unsigned long long nkeys;
+}ffdb_filter_hdr_t;
+
+/**
+ * Bucket range scanned by one thread
+ */
+typedef struct _ffdb_filter_part_
+{
+  ffdb_htab_t* hashp;
+  ffdb_filter_t* filter;
+  unsigned int first, last;
+  int status;
+}ffdb_filter_part_t;
+
+/**
+ * Block and bit positions of a key. The block comes from the low bits
+ * of the hash, bit positions from a remix of the whole hash
+ */
+#define FFDB_FILTER_PROBE(filter,key,blk,a,b) do {                     \
+    unsigned long long _h = __ffdb_hash64((key)->data, (key)->size);  \
+    (blk) = (filter)->bits +                                           \
+      ((unsigned long)_h & ((filter)->nblocks - 1)) *                  \
+      FFDB_FILTER_BLOCK_WORDS;                                         \
+    _h ^= _h >> 33;                                                    \
+    _h *= 0xff51afd7ed558ccdULL;                                       \
+    _h ^= _h >> 33;                                                    \
+    (a) = (unsigned int)_h;                                            \
+    (b) = (unsigned int)(_h >> 32) | 1;                                \
+  } while (0)
+
+/**
+ * Allocate an empty filter for capacity keys
+ */
+static int
+_ffdb_filter_alloc (ffdb_filter_t* filter, unsigned long capacity)
+{
+  unsigned long nblocks, nbits;
+
+  if (capacity < FFDB_FILTER_MIN_KEYS)
+    capacity = FFDB_FILTER_MIN_KEYS;
+  nbits = capacity * FFDB_FILTER_BITS_PER_KEY;
+  for (nblocks = 1; nblocks * 64 * FFDB_FILTER_BLOCK_WORDS < nbits; )
+    nblocks *= 2;
+
+  filter->bits = (unsigned long long *)calloc (nblocks * FFDB_FILTER_BLOCK_WORDS,
+					       sizeof (unsigned long long));
+  if (!filter->bits)
+    return -1;
+  filter->nblocks = nblocks;
+  filter->capacity = capacity;
+  filter->nkeys = 0;
+  return 0;
+}
+
+/**
+ * Add a key found by a bucket scan
+ */
+static int
+_ffdb_filter_scan_add (void* arg, const FFDB_DBT* key, pgno_t pgno,
+		       unsigned int idx, const ffdb_datap_t* datap)
+{
+  (void)pgno;
+  (void)idx;
+  (void)datap;
+  ffdb_filter_add (((ffdb_filter_part_t *)arg)->filter, key);
+  return 0;
+}
+
+/**
+ * Scanning thread walking a range of buckets
+ */
+static void*
+_ffdb_filter_scan (void* arg)
+{
+  ffdb_filter_part_t* part = (ffdb_filter_part_t *)arg;
+  unsigned int bucket;
+
+  for (bucket = part->first; bucket <= part->last && part->status == 0;
+       bucket++) {
+    if (ffdb_scan_bucket (part->hashp, bucket, _ffdb_filter_scan_add,
+			  part) != 0)
+      part->status = -1;
+  }
+  return 0;
+}
+
+/**
+ * Add all keys of the table into an empty filter
+ */
+static int
+_ffdb_filter_scan_all (ffdb_htab_t* hashp, ffdb_filter_t* filter)
+{
+  ffdb_filter_part_t* parts;
+  pthread_t* tids;
+  unsigned long long nb;
+  unsigned int i, nthreads;
+  int status;
+
+  nb = (unsigned long long)hashp->hdr.max_bucket + 1;
+  nthreads = (filter->nthreads == 0) ? 1 : filter->nthreads;
+  if (nthreads > nb)
+    nthreads = (unsigned int)nb;
+
+  parts = (ffdb_filter_part_t *)calloc (nthreads, sizeof (ffdb_filter_part_t));
+  tids = (pthread_t *)calloc (nthreads, sizeof (pthread_t));
+  if (!parts || !tids) {
+    free (parts);
+    free (tids);
+    return -1;
+  }
+
+  for (i = 0; i < nthreads; i++) {
+    parts[i].hashp = hashp;
+    parts[i].filter = filter;
+    parts[i].first = (unsigned int)(i * nb / nthreads);
+    parts[i].last = (unsigned int)((i + 1) * nb / nthreads - 1);
+    if (pthread_create (&tids[i], 0, _ffdb_filter_scan, &parts[i]) != 0) {
+      /* scan this range here instead */
+      _ffdb_filter_scan (&parts[i]);
+      tids[i] = pthread_self ();
+    }
+  }
+
+  status = 0;
+  for (i = 0; i < nthreads; i++) {
+    if (!pthread_equal (tids[i], pthread_self ()))
+      pthread_join (tids[i], 0);
+    if (parts[i].status != 0)
+      status = -1;
+  }
+  free (parts);
+  free (tids);
+  return status;
+}
+
+/**
+ * Fill in what identifies the table a side file belongs to
+ */
+static int
+_ffdb_filter_ident (ffdb_htab_t* hashp, ffdb_filter_hdr_t* hdr)
+{
+  struct stat st;
+
+  memset (hdr, 0, sizeof (ffdb_filter_hdr_t));
+  if (stat (hashp->fname, &st) != 0)
+    return -1;
+  hdr->magic = FFDB_FILTER_MAGIC;
+  hdr->version = FFDB_FILTER_VERSION;
+  hdr->hdr_nkeys = hashp->hdr.nkeys;
+  hdr->fsize = (unsigned long long)st.st_size;
+  hdr->mtime = (long long)st.st_mtim.tv_sec;
+  hdr->mtime_nsec = (long long)st.st_mtim.tv_nsec;
+  hdr->ino = (unsigned long long)st.st_ino;
+  return 0;
+}
+
+/**
+ * Load the filter from its side file if the file matches the table
+ */
+static int
+_ffdb_filter_load (ffdb_htab_t* hashp, ffdb_filter_t* filter)
+{
+  ffdb_filter_hdr_t hdr, ident;
+  unsigned long len;
+  int fd, status;
+
+  if (_ffdb_filter_ident (hashp, &ident) != 0)
+    return -1;
+
+  fd = open (filter->fname, O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  status = -1;
+  if (read (fd, &hdr, sizeof (hdr)) == sizeof (hdr) &&
+      hdr.magic == ident.magic && hdr.version == ident.version &&
+      hdr.hdr_nkeys == ident.hdr_nkeys && hdr.fsize == ident.fsize &&
+      hdr.mtime == ident.mtime && hdr.mtime_nsec == ident.mtime_nsec &&
+      hdr.ino == ident.ino && hdr.nblocks > 0 &&
+      (hdr.nblocks & (hdr.nblocks - 1)) == 0) {
+    len = hdr.nblocks * FFDB_FILTER_BLOCK_WORDS * sizeof (unsigned long long);
+    filter->bits = (unsigned long long *)malloc (len);
+    if (filter->bits && read (fd, filter->bits, len) == (ssize_t)len) {
+      filter->nblocks = hdr.nblocks;
+      filter->capacity = hdr.capacity;
+      filter->nkeys = hdr.nkeys;
+      status = 0;
+    }
+    else {
+      free (filter->bits);
+      filter->bits = 0;
+    }
+  }
+  close (fd);
+  return status;
+}
+
+/**
+ * Save the filter into its side file. The table file must be closed
+ * so that its size and modification time are final
+ */
+static int
+_ffdb_filter_save (ffdb_htab_t* hashp, ffdb_filter_t* filter)
+{
+  ffdb_filter_hdr_t hdr;
+  char* tmpname;
+  unsigned long len;
+  int fd, status;
+
+  if (_ffdb_filter_ident (hashp, &hdr) != 0)
+    return -1;
+  hdr.nblocks = filter->nblocks;
+  hdr.capacity = filter->capacity;
+  hdr.nkeys = filter->nkeys;
+  len = filter->nblocks * FFDB_FILTER_BLOCK_WORDS * sizeof (unsigned long long);
+
+  tmpname = (char *)malloc (strlen (filter->fname) + 32);
+  if (!tmpname)
+    return -1;
+  sprintf (tmpname, "%s.%d", filter->fname, (int)getpid ());
+  fd = open (tmpname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    fprintf (stderr, "Cannot create key filter file %s\n", tmpname);
+    free (tmpname);
+    return -1;
+  }
+
+  status = 0;
+  if (write (fd, &hdr, sizeof (hdr)) != sizeof (hdr) ||
+      write (fd, filter->bits, len) != (ssize_t)len)
+    status = -1;
+  if (close (fd) != 0)
+    status = -1;
+  if (status == 0 && rename (tmpname, filter->fname) != 0)
+    status = -1;
+  if (status != 0) {
+    fprintf (stderr, "Cannot write key filter file %s\n", filter->fname);
+    unlink (tmpname);
+  }
+  free (tmpname);
+  return status;
+}
+
+/**
+ * Build the key filter of a table
+ */
+int
+ffdb_filter_build (ffdb_htab_t* hashp, const char* fname,
+		   unsigned int nthreads)
+{
+  ffdb_filter_t* filter;
+  unsigned long capacity;
+
+  filter = (ffdb_filter_t *)calloc (1, sizeof (ffdb_filter_t));
+  if (!filter) {
+    errno = ENOMEM;
+    return -1;
+  }
+  filter->nthreads = nthreads;
+  if (fname) {
+    filter->fname = strdup (fname);
+    if (!filter->fname) {
+      free (filter);
+      errno = ENOMEM;
+      return -1;
+    }
+  }
+
+  if (!filter->fname || _ffdb_filter_load (hashp, filter) != 0) {
+    /* leave room for new keys of a writable table */
+    capacity = hashp->hdr.nkeys;
+    if ((hashp->flags & O_ACCMODE) != O_RDONLY)
+      capacity *= 2;
+    if (_ffdb_filter_alloc (filter, capacity) != 0 ||
+	_ffdb_filter_scan_all (hashp, filter) != 0) {
+      fprintf (stderr, "Cannot build key filter\n");
+      ffdb_filter_free (filter);
+      errno = ENOMEM;
+      return -1;
+    }
+    filter->dirty = 1;
+  }
+
+  hashp->filter = filter;
+  return 0;
+}
+
+/**
+ * Rebuild a filter holding more keys than it was sized for
+ */
+int
+ffdb_filter_grow (ffdb_htab_t* hashp)
+{
+  ffdb_filter_t* filter = hashp->filter;
+  unsigned long long* bits;
+  unsigned long nblocks, capacity;
+
+  if (!filter || filter->nkeys <= filter->capacity)
+    return 0;
+
+  bits = filter->bits;
+  nblocks = filter->nblocks;
+  capacity = filter->capacity;
+  if (_ffdb_filter_alloc (filter, 2 * hashp->hdr.nkeys) != 0 ||
+      _ffdb_filter_scan_all (hashp, filter) != 0) {
+    /* keep the old filter: it still holds every key */
+    free (filter->bits);
+    filter->bits = bits;
+    filter->nblocks = nblocks;
+    filter->capacity = 2 * capacity;
+    return -1;
+  }
+  free (bits);
+  filter->dirty = 1;
+  return 0;
+}
+
+/**
+ * Add a key into the filter. Bits are set atomically so that
+ * inserts into different buckets may run in parallel
+ */
+void
+ffdb_filter_add (ffdb_filter_t* filter, const FFDB_DBT* key)
+{
+  unsigned long long* blk;
+  unsigned int a, b, i, bit;
+
+  FFDB_FILTER_PROBE(filter, key, blk, a, b);
+  for (i = 0; i < FFDB_FILTER_NHASH; i++) {
+    bit = (a + i * b) & (FFDB_FILTER_BLOCK_WORDS * 64 - 1);
+    __sync_fetch_and_or (&blk[bit >> 6], 1ULL << (bit & 63));
+  }
+  __sync_fetch_and_add (&filter->nkeys, 1);
+  filter->dirty = 1;
+}
+
+/**
+ * Check whether a key may be in the table
+ */
+int
+ffdb_filter_test (ffdb_filter_t* filter, const FFDB_DBT* key)
+{
+  unsigned long long* blk;
+  unsigned int a, b, i, bit;
+
+  FFDB_FILTER_PROBE(filter, key, blk, a, b);
+  for (i = 0; i < FFDB_FILTER_NHASH; i++) {
+    bit = (a + i * b) & (FFDB_FILTER_BLOCK_WORDS * 64 - 1);
+    if (!(blk[bit >> 6] & (1ULL << (bit & 63))))
+      return 0;
+  }
+  return 1;
+}
+
+/**
+ * Check whether the filter holds more keys than it was sized for
+ */
+int
+ffdb_filter_full (ffdb_filter_t* filter)
+{
+  return filter->nkeys > filter->capacity;
+}
+
+/**
+ * Save the filter into its side file if it has changed
+ */
+int
+ffdb_filter_sync (ffdb_htab_t* hashp)
+{
+  ffdb_filter_t* filter = hashp->filter;
+
+  if (!filter || !filter->fname || !filter->dirty)
+    return 0;
+  if (_ffdb_filter_save (hashp, filter) != 0)
+    return -1;
+  filter->dirty = 0;
+  return 0;
+}
+
+/**
+ * Free the memory of a filter
+ */
+void
+ffdb_filter_free (ffdb_filter_t* filter)
+{
+  if (!filter)
+    return;
+  free (filter->bits);
+  free (filter->fname);
+  free (filter);
+}
@@ -67,6 +67,7 @@
  *
  */
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
 #include <fcntl.h>
@@ -74,6 +75,7 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 
 #ifdef _FFDB_DEBUG
 #include <assert.h>
@@ -91,6 +93,9 @@ unsigned int hash_accesses, hash_collisions, hash_expansions, hash_overflows, ha
 #endif
 
 
+/* rearrangepages asking to move pages has been warned about */
+static int _ffdb_rearrange_warned = 0;
+
 /**
  * Forward decleration of various routines needed for DB
  */
@@ -107,6 +112,7 @@ static int _ffdb_hash_cursor (const FFDB_DB *, ffdb_cursor_t**, unsigned int);
 static int _ffdb_cursor_get  (ffdb_cursor_t* cursor, FFDB_DBT* key,
 			      FFDB_DBT* data, unsigned int flags);
 static int _ffdb_cursor_close (ffdb_cursor_t* cursor);
+static void _ffdb_split_thread_stop (ffdb_htab_t* hashp);
 
 /**
  * Test big endian or little endian
@@ -161,6 +167,7 @@ _ffdb_swap_header (ffdb_htab_t* hashp)
     M_32_SWAP(hdrp->spares[i]);
   for (i = 0; i < NCACHED; i++) 
     M_32_SWAP(hdrp->free_pages[i]);
+  M_32_SWAP(hdrp->hash_id);
   M_32_SWAP(hdrp->chksum);
 }
 
@@ -197,6 +204,7 @@ _ffdb_swap_header_copy(ffdb_hashhdr_t* srcp, ffdb_hashhdr_t* destp)
     P_32_COPY(srcp->spares[i], destp->spares[i]);
   for (i = 0; i < NCACHED; i++) 
     P_32_COPY(srcp->free_pages[i], destp->free_pages[i]);
+  P_32_COPY(srcp->hash_id, destp->hash_id);
   P_32_COPY(srcp->chksum, destp->chksum);
 }
 
@@ -210,6 +218,7 @@ _ffdb_hput_header (ffdb_htab_t* hashp)
   ffdb_hashhdr_t whdr;
   unsigned int num_copied = 0;
   unsigned int chksum = 0;
+  size_t pos;
 
   whdrp = &hashp->hdr;
 
@@ -219,12 +228,12 @@ _ffdb_hput_header (ffdb_htab_t* hashp)
   }
 
   /* calculate checksum value */
-  chksum = __ffdb_crc32_checksum (chksum, (const unsigned char *)whdrp,
-				  sizeof(ffdb_hashhdr_t) - sizeof(unsigned int));
+  pos = HDR_CHKSUM_POS(hashp->hdr.version);
+  chksum = __ffdb_crc32_checksum (chksum, (const unsigned char *)whdrp, pos);
   /* hashp->hdr.chksum = chksum; */
   if (hashp->mborder == LITTLE_ENDIAN) 
     M_32_SWAP(chksum);
-  whdrp->chksum = chksum;
+  memcpy ((unsigned char *)whdrp + pos, &chksum, sizeof(unsigned int));
 
 
   /* write the header */
@@ -249,6 +258,10 @@ _ffdb_flush_meta (ffdb_htab_t* hashp)
   if (!hashp->save_file)
     return 0;
 
+  /* free map pages are written before the header referring to them */
+  if (ffdb_freemap_sync (hashp) != 0)
+    return -1;
+
   /* flush out all the header page */
   hashp->hdr.h_charkey = hashp->hash(CHARKEY, sizeof(CHARKEY));
 
@@ -265,6 +278,14 @@ _ffdb_hdestroy (ffdb_htab_t* hashp)
 {
   int save_errno = 0;
 
+  /* overflow pages reserved but not used are given back first */
+  if (hashp->save_file)
+    ffdb_release_ovfl_run (hashp);
+
+  /* free map pages may be moved below */
+  if (ffdb_freemap_sync (hashp) != 0)
+    save_errno = errno;
+
   if (hashp->rearrange_pages && hashp->save_file)
     ffdb_rearrage_pages_on_close (hashp);
 
@@ -316,10 +337,20 @@ _ffdb_hdestroy (ffdb_htab_t* hashp)
   if (hashp->fp != -1)
     close (hashp->fp);
 
+  ffdb_freemap_free (hashp->freemap);
+
+  /* the filter side file records the final state of the closed file */
+  if (hashp->filter) {
+    (void)ffdb_filter_sync (hashp);
+    ffdb_filter_free (hashp->filter);
+  }
+
   if (hashp->fname)
     free (hashp->fname);
 
   /* free allocated memory */
+  if (hashp->keydir)
+    ffdb_keydir_free (hashp->keydir);
   if (hashp->split_buf)
     free(hashp->split_buf);
   if (hashp->bigdata_buf)
@@ -359,7 +390,8 @@ _ffdb_init_hash(ffdb_htab_t* hashp, const char* file,
   hashp->hdr.bsize = DEF_BUCKET_SIZE;
   hashp->hdr.bshift = DEF_BUCKET_SHIFT;
   hashp->hdr.ffactor = DEF_FFACTOR;
-  hashp->hash = __ffdb_default_hash;
+  hashp->hdr.hash_id = DEF_HASH_ID;
+  hashp->hash = __ffdb_builtin_hash (DEF_HASH_ID);
   hashp->h_compare = __ffdb_default_cmp;
   memset(hashp->hdr.spares, 0, sizeof(hashp->hdr.spares));
 
@@ -387,11 +419,19 @@ _ffdb_init_hash(ffdb_htab_t* hashp, const char* file,
       }
     }
 
-    /* Set rearrange page flag */
-    hashp->rearrange_pages = info->rearrangepages;
-    
-    if (info->hash)
+    if (info->hash) {
       hashp->hash = info->hash;
+      hashp->hdr.hash_id = FFDB_HASH_USER;
+    }
+    else if (INFO_IS_SET(info, FFDB_INFO_HASHID) &&
+	     info->hashid != FFDB_HASH_DEFAULT) {
+      if (!(hashp->hash = __ffdb_builtin_hash (info->hashid))) {
+	fprintf (stderr, "Unknown hash function %u.\n", info->hashid);
+	errno = EINVAL;
+	return errno;
+      }
+      hashp->hdr.hash_id = info->hashid;
+    }
     if (info->cmp)
       hashp->h_compare = info->cmp;
   }
@@ -409,6 +449,7 @@ _ffdb_hget_header(ffdb_htab_t *hashp, unsigned int page_size)
   (void)page_size;
   unsigned num_copied, newchksum;
   unsigned char *hdr_dest;
+  int version;
 
   num_copied = 0;
 
@@ -426,13 +467,22 @@ _ffdb_hget_header(ffdb_htab_t *hashp, unsigned int page_size)
   }
 
   /* Now I need compare checksum value */
+  version = hashp->hdr.version;
+  if (hashp->mborder == LITTLE_ENDIAN)
+    M_32_SWAP(version);
   newchksum = 0;
   newchksum = __ffdb_crc32_checksum (newchksum, hdr_dest,
-				     sizeof(ffdb_hashhdr_t) - sizeof(unsigned int));
+				     HDR_CHKSUM_POS(version));
 
   if (hashp->mborder == LITTLE_ENDIAN)
     _ffdb_swap_header(hashp);
 
+  /* older files are hashed by the user or the old default function */
+  if (version < FFDB_VERSION_8) {
+    hashp->hdr.chksum = hashp->hdr.hash_id;
+    hashp->hdr.hash_id = FFDB_HASH_USER;
+  }
+
   if (newchksum != hashp->hdr.chksum) {
     fprintf (stderr, "Hash Meta Data Checksum error!!!!!! 0x%x != 0x%x (retrieved)\n", newchksum, hashp->hdr.chksum);
     exit (1);
@@ -625,6 +675,34 @@ _ffdb_init_htab (ffdb_htab_t* hashp, int nb, FFDB_HASHINFO* info)
 
 
 
+/**
+ * Find reusable free pages and the current data page so that new data
+ * of a writer go to the right place. Called by open, or before the first
+ * update of a lazy open
+ */
+static void
+_ffdb_open_writer (ffdb_htab_t* hashp)
+{
+  /* Pages freed anywhere in the file are reused by a writer */
+  if (hashp->save_file && hashp->hdr.version > FFDB_VERSION_8 &&
+      ffdb_freemap_open (hashp) != 0)
+    fprintf (stderr, "Free pages of %s will not be reused\n", hashp->fname);
+
+  /* Find out current data page which is the last data page we are using */
+  /* Otherwise the datapage assigned to new insert will start at wrong place */
+  if (hashp->hdr.spares[hashp->hdr.ovfl_point + 1] > 0) {
+    hashp->curr_dpage = ffdb_last_data_page (hashp, hashp->hdr.spares[hashp->hdr.ovfl_point + 1] - 1);
+    /* what is left on the last data page goes to small data */
+    ffdb_reopen_data_page (hashp, SMALL_DATA_CLASS, hashp->curr_dpage);
+
+#if 0
+    fprintf (stderr, "Info: datapage will start at %d for level %d\n",
+	     hashp->curr_dpage, hashp->hdr.ovfl_point);
+#endif
+  }
+  hashp->writer_ready = 1;
+}
+
 /**
  * Interface to outside DB calls
  */
@@ -632,11 +710,12 @@ FFDB_DB *
 __ffdb_hash_open (const char* fname, int flags, int mode, const void* arg)
 {
   struct stat statbuf;
+  struct timeval start, end;
   FFDB_DB *dbp;
   ffdb_htab_t *hashp;
   unsigned int csize;
   unsigned long tcsize;
-  int ret, new_table, version_correct;
+  int ret, new_table, version_correct, i;
   FFDB_HASHINFO *info = (FFDB_HASHINFO *)arg;
 
   /**
@@ -656,6 +735,8 @@ __ffdb_hash_open (const char* fname, int flags, int mode, const void* arg)
     return 0;
   }
 
+  gettimeofday (&start, 0);
+
   /* initialize crc32 check sum */
   __ffdb_crc32_init ();
 
@@ -670,7 +751,13 @@ __ffdb_hash_open (const char* fname, int flags, int mode, const void* arg)
   memset (hashp, 0, sizeof(ffdb_htab_t));
   hashp->fp = -1;
   hashp->curr_dpage = INVALID_PGNO;
-  hashp->rearrange_pages = 1;
+  for (i = 0; i < FFDB_DATA_CLASSES * FFDB_DATA_PAGES; i++)
+    hashp->dpages[i / FFDB_DATA_PAGES][i % FFDB_DATA_PAGES].page = INVALID_PGNO;
+  /* pages are only moved by ffdb_compact */
+  hashp->rearrange_pages = 0;
+  if (INFO_IS_SET(info, FFDB_REARRANGE_PAGES) &&
+      __sync_lock_test_and_set (&_ffdb_rearrange_warned, 1) == 0)
+    fprintf (stderr, "Pages are no longer moved on open and close: call ffdb_compact to save space\n");
 
   /* check this machine byte order */
   hashp->mborder = _ffdb_test_endian();
@@ -715,19 +802,11 @@ __ffdb_hash_open (const char* fname, int flags, int mode, const void* arg)
   } 
   else {
     /* Table already exists */
-    if (info && info->hash)
-      hashp->hash = info->hash;
-    else
-      hashp->hash = __ffdb_default_hash;
-
     if (info && info->cmp)
       hashp->h_compare = info->cmp;
     else
       hashp->h_compare = __ffdb_default_cmp;
 
-    if (info)
-      hashp->rearrange_pages = info->rearrangepages;
-
     /* copy metadata from page into header */
     if (_ffdb_hget_header(hashp,(info && info->bsize ? info->bsize : DEF_BUCKET_SIZE)) != sizeof(ffdb_hashhdr_t)) {
       close (hashp->fp);
@@ -758,6 +837,18 @@ __ffdb_hash_open (const char* fname, int flags, int mode, const void* arg)
           hashp->data_valid_flag = DATA_VALID_5;
           hashp->data_invalid_flag = DATA_INVALID_5;
         }
+        else if (hashp->hdr.version == FFDB_VERSION_6) {
+          /* no embedded data: every data item is on data pages */
+        }
+        else if (hashp->hdr.version == FFDB_VERSION_7) {
+          /* no hash function recorded in the header */
+        }
+        else if (hashp->hdr.version == FFDB_VERSION_8) {
+          /* free pages are kept for each level */
+        }
+        else if (hashp->hdr.version == FFDB_VERSION_9) {
+          /* data headers point back to the key page */
+        }
         else {
           fprintf (stderr, "Cannot open file %s that has an unsupport hash version %d \n",
                    fname, hashp->hdr.version);
@@ -778,13 +869,43 @@ __ffdb_hash_open (const char* fname, int flags, int mode, const void* arg)
       return 0;
     }
 
+    /* a user function cannot replace the recorded built-in one */
+    if (hashp->hdr.hash_id != FFDB_HASH_USER && info && info->hash) {
+      fprintf (stderr, "%s uses built-in hash function %u, not a user one\n",
+	       fname, hashp->hdr.hash_id);
+      close (hashp->fp);
+      free (hashp);
+      errno = EINVAL;
+      return 0;
+    }
+
+    /* use the recorded hash function unless the user supplied one */
+    if (hashp->hdr.hash_id != FFDB_HASH_USER)
+      hashp->hash = __ffdb_builtin_hash (hashp->hdr.hash_id);
+    else if (info && info->hash)
+      hashp->hash = info->hash;
+    else
+      hashp->hash = __ffdb_default_hash;
+
     /* compare the calculated hash value and stored hash value */
-    if (hashp->hash(CHARKEY, sizeof(CHARKEY)) != hashp->hdr.h_charkey) {
+    if (!hashp->hash || hashp->hash(CHARKEY, sizeof(CHARKEY)) != hashp->hdr.h_charkey) {
       close (hashp->fp);
       free (hashp);
       errno = EFTYPE;
       return 0;
     }
+
+    /* only the header is read by a lazy open */
+    hashp->lazy_open = (INFO_IS_SET(info, FFDB_INFO_OPENMODE) &&
+			(info->openmode & FFDB_OPEN_LAZY));
+    if (hashp->lazy_open && hashp->save_file && hashp->hdr.num_moved_pages > 0) {
+      fprintf (stderr, "Cannot open compacted file %s lazily for write\n",
+	       fname);
+      close (hashp->fp);
+      free (hashp);
+      errno = EINVAL;
+      return 0;
+    }
   }
 
   /**
@@ -834,6 +955,11 @@ __ffdb_hash_open (const char* fname, int flags, int mode, const void* arg)
    */
   ffdb_pagepool_filter(hashp->mp, ffdb_pgin_routine, ffdb_pgout_routine, hashp);
 
+  /* Data pages of an extent are read and written in units of dextsize */
+  ffdb_pagepool_runsize (hashp->mp, 
+			 (INFO_IS_SET(info, FFDB_INFO_DEXTSIZE) && info->dextsize ?
+			  info->dextsize : DEF_DEXTSIZE) / hashp->hdr.bsize);
+
   /*
    * For a new table, set up the appropriate hashtable information
    */
@@ -862,6 +988,9 @@ __ffdb_hash_open (const char* fname, int flags, int mode, const void* arg)
   /* initialize the cursor queue */
   FFDB_TAILQ_INIT(&hashp->curs_queue);
   hashp->seq_cursor = NULL;
+  hashp->keydir = NULL;
+  hashp->filter = NULL;
+  hashp->freemap = NULL;
 
 
   /* get a chunk of memory for our split buffer */
@@ -877,9 +1006,13 @@ __ffdb_hash_open (const char* fname, int flags, int mode, const void* arg)
   hashp->new_file = new_table;
 
 
-  /* always read in user information page and configuration page */
-  _ffdb_read_user_info (hashp);
-  _ffdb_read_config_info (hashp);
+  /* read in user information page and configuration page unless
+   * they are left to their first use
+   */
+  if (!hashp->lazy_open) {
+    _ffdb_read_user_info (hashp);
+    _ffdb_read_config_info (hashp);
+  }
 
   if (!(dbp = (FFDB_DB *)malloc(sizeof(FFDB_DB)))) {
     ffdb_pagepool_close (hashp->mp);
@@ -942,20 +1075,13 @@ __ffdb_hash_open (const char* fname, int flags, int mode, const void* arg)
   /* Check whether I need to move data pages back to original places if
    * new insert is expected or some pages was moved previously
    */
-  if (!new_table && hashp->save_file && (hashp->rearrange_pages || hashp->hdr.num_moved_pages > 0)) 
+  if (!new_table && hashp->save_file && !hashp->lazy_open &&
+      (hashp->rearrange_pages || hashp->hdr.num_moved_pages > 0)) 
     ffdb_rearrage_pages_on_open (hashp);
 
-
-  /* Find out current data page which is the last data page we are using */
-  /* Otherwise the datapage assigned to new insert will start at wrong place */
-  if (hashp->hdr.spares[hashp->hdr.ovfl_point + 1] > 0) {
-    hashp->curr_dpage = ffdb_last_data_page (hashp, hashp->hdr.spares[hashp->hdr.ovfl_point + 1] - 1);
-
-#if 0
-    fprintf (stderr, "Info: datapage will start at %d for level %d\n",
-	     hashp->curr_dpage, hashp->hdr.ovfl_point);
-#endif
-  }
+  /* A lazy open finds free and data pages on the first update */
+  if (!hashp->lazy_open)
+    _ffdb_open_writer (hashp);
 
 
 #if 0
@@ -999,8 +1125,19 @@ __ffdb_hash_open (const char* fname, int flags, int mode, const void* arg)
   }
 #endif
 
-  /* finally intialize lock */
+  /* finally intialize locks */
   FFDB_LOCK_INIT (hashp->lock);
+  FFDB_LOCK_INIT (hashp->alloc_lock);
+  FFDB_RWLOCK_INIT (hashp->table_lock);
+  FFDB_LOCK_INIT (hashp->expand_lock);
+  for (i = 0; i < FFDB_NUM_BUCKET_LOCKS; i++)
+    FFDB_LOCK_INIT (hashp->bucket_locks[i]);
+  FFDB_COND_INIT (hashp->split_cond);
+  FFDB_COND_INIT (hashp->split_done);
+
+  gettimeofday (&end, 0);
+  hashp->open_time = (end.tv_sec - start.tv_sec) + 
+    (end.tv_usec - start.tv_usec) * 1.0e-6;
   return dbp;
 }
 
@@ -1009,6 +1146,52 @@ __ffdb_hash_open (const char* fname, int flags, int mode, const void* arg)
  * The following are routines handling i/o operations of database            *
  *****************************************************************************/
 
+/**
+ * Take the table latch exclusive. A split holds the expansion lock from
+ * publishing its new bucket until the keys are moved, so an exclusive
+ * latch never sees a half split bucket
+ */
+static void
+_ffdb_table_wrlock (ffdb_htab_t* hashp)
+{
+  FFDB_LOCK(hashp->expand_lock);
+  FFDB_WRLOCK(hashp->table_lock);
+}
+
+static void
+_ffdb_table_wrunlock (ffdb_htab_t* hashp)
+{
+  FFDB_RWUNLOCK(hashp->table_lock);
+  FFDB_UNLOCK(hashp->expand_lock);
+}
+
+/**
+ * Wait until a split of this bucket is done. The splitter holds the
+ * bucket locks of both buckets of a split while keys are moved
+ * Caller holds the table latch shared, so no new split starts
+ */
+static void
+_ffdb_bucket_wait (ffdb_htab_t* hashp, unsigned int bucket)
+{
+  if (!__sync_fetch_and_add (&hashp->splitting, 0))
+    return;
+  if (bucket == hashp->split_old || bucket == hashp->split_new) {
+    FFDB_LOCK(FFDB_BUCKET_LOCK(hashp, bucket));
+    FFDB_UNLOCK(FFDB_BUCKET_LOCK(hashp, bucket));
+  }
+}
+
+/**
+ * Wait until a running split is done before walking buckets
+ * Caller holds the table latch shared
+ */
+static void
+_ffdb_table_wait (ffdb_htab_t* hashp)
+{
+  if (__sync_fetch_and_add (&hashp->splitting, 0))
+    _ffdb_bucket_wait (hashp, hashp->split_old);
+}
+
 /**
  * Close the database
  */
@@ -1016,18 +1199,36 @@ static int
 _ffdb_hash_close (FFDB_DB* dbp)
 {
   ffdb_htab_t* hashp;
-  int retval;
+  int retval, i;
   
   if (!dbp) 
     return -1;
   hashp = (ffdb_htab_t *)dbp->internal;
 
+  /* queued bucket splits are done before the table is written out */
+  _ffdb_split_thread_stop (hashp);
+
+  _ffdb_table_wrlock (hashp);
   FFDB_LOCK(hashp->lock);
 
   retval = _ffdb_hdestroy (hashp);
 
-  /* free lock */
+  /* a background split failure not reported to any insert yet */
+  if (hashp->split_failed) {
+    errno = hashp->db_errno;
+    retval = -1;
+  }
+
+  /* free locks */
+  FFDB_COND_FINI(hashp->split_cond);
+  FFDB_COND_FINI(hashp->split_done);
   FFDB_LOCK_FINI(hashp->lock);
+  FFDB_LOCK_FINI(hashp->alloc_lock);
+  for (i = 0; i < FFDB_NUM_BUCKET_LOCKS; i++)
+    FFDB_LOCK_FINI(hashp->bucket_locks[i]);
+  _ffdb_table_wrunlock (hashp);
+  FFDB_RWLOCK_FINI(hashp->table_lock);
+  FFDB_LOCK_FINI(hashp->expand_lock);
 
   /* finally free hashp itself */
   free (hashp);
@@ -1045,9 +1246,17 @@ _ffdb_hash_close (FFDB_DB* dbp)
 unsigned int
 _ffdb_call_hash (ffdb_htab_t* hashp, const void* k, unsigned int len)
 {
-  unsigned int n, bucket;
+  return _ffdb_hash_bucket (hashp, hashp->hash (k, len));
+}
+
+/**
+ * Bucket number of a hash value
+ */
+unsigned int
+_ffdb_hash_bucket (ffdb_htab_t* hashp, unsigned int n)
+{
+  unsigned int bucket;
 
-  n = hashp->hash (k, len);
   bucket = (n & hashp->hdr.high_mask); /* n mod 2^(i + 1) */
 
   if (bucket > hashp->hdr.max_bucket) {
@@ -1058,34 +1267,33 @@ _ffdb_call_hash (ffdb_htab_t* hashp, const void* k, unsigned int len)
 }
 
 /**
- * Expand hash table
- * this happens when a bucket cannot hold any more keys
- *
- * We are not checking fill factor because we are trying to save
- * disk space instead of trying to speed up the access
+ * Add one bucket to the table: max_bucket and masks change and the
+ * page of the new bucket is allocated. The bucket to split is returned
+ * in old_bucket
+ * Caller holds the exclusive table latch
  */
 static int
-_ffdb_expand_table (ffdb_htab_t* hashp)
+_ffdb_grow_table (ffdb_htab_t* hashp, unsigned int* old_bucket,
+		  unsigned int* new_bucket, int* isdoubling)
 {
-  unsigned int old_bucket, new_bucket;
-  int spare_indx, isdoubling, ret;
+  int spare_indx;
   pgno_t p;
 
 #ifdef _FFDB_STATISTICS
   hash_expansions++;
 #endif
-  isdoubling = 0;
+  *isdoubling = 0;
 
   /* The number of buckets is increased by one, obviously */
-  new_bucket = ++hashp->hdr.max_bucket;
+  *new_bucket = ++hashp->hdr.max_bucket;
   
   /* which bucket to split */
-  old_bucket = (hashp->hdr.max_bucket & hashp->hdr.low_mask);
+  *old_bucket = (hashp->hdr.max_bucket & hashp->hdr.low_mask);
 
   /* If new bucket is greater than high mask, we do doubling again */
-  if (new_bucket > hashp->hdr.high_mask) {
+  if (*new_bucket > hashp->hdr.high_mask) {
     hashp->hdr.low_mask = hashp->hdr.high_mask;
-    hashp->hdr.high_mask = new_bucket | hashp->hdr.low_mask;
+    hashp->hdr.high_mask = *new_bucket | hashp->hdr.low_mask;
   }
 
   /*
@@ -1099,11 +1307,11 @@ _ffdb_expand_table (ffdb_htab_t* hashp)
     /* update current data page value */
     hashp->curr_dpage = INVALID_PGNO;
     hashp->hdr.ovfl_point = spare_indx;
-    isdoubling = 1;
+    *isdoubling = 1;
   }
 
 
-  BUCKET_TO_PAGE(new_bucket, p);
+  BUCKET_TO_PAGE(*new_bucket, p);
   if (p == MAX_PAGES(hashp)) {
     fprintf (stderr, "Reach maximum number of pages %d\n",
 	     MAX_PAGES(hashp));
@@ -1111,23 +1319,195 @@ _ffdb_expand_table (ffdb_htab_t* hashp)
   }
   
   /* Get a new bucket */
-  if (ffdb_new_page (hashp, new_bucket, HASH_BUCKET_PAGE) != 0)
+  if (ffdb_new_page (hashp, *new_bucket, HASH_BUCKET_PAGE) != 0)
     return -1;
 
 #ifdef _FFDB_DEBUG
-  fprintf (stderr, "Get a new expanded page at bucket %d split old bucket %d\n", new_bucket, old_bucket);
+  fprintf (stderr, "Get a new expanded page at bucket %d split old bucket %d\n", *new_bucket, *old_bucket);
 #endif
 
-  if (isdoubling) {
-    /* Write out meta header here */
-    _ffdb_flush_meta (hashp);
-    ffdb_pagepool_sync (hashp->mp); 
+  if (*isdoubling && hashp->save_file) {
+    /* Write out meta header here. Only the pages the header refers to,
+     * the free map and the first bucket page of the new level, go out
+     * ahead of it. Other dirty pages are written when they are evicted.
+     * If one of them cannot be written now, e.g. the bucket page is held
+     * by a cursor, the header waits for the next sync or close
+     */
+    if (ffdb_freemap_flush (hashp) == 0 &&
+	ffdb_pagepool_sync_page (hashp->mp, p) == 0)
+      _ffdb_flush_meta (hashp);
   }
-  
+  return 0;
+}
+
+/**
+ * Expand hash table
+ * this happens when a bucket cannot hold any more keys
+ *
+ * We are not checking fill factor because we are trying to save
+ * disk space instead of trying to speed up the access
+ *
+ * Caller holds the exclusive table latch
+ */
+static int
+_ffdb_expand_table (ffdb_htab_t* hashp)
+{
+  unsigned int old_bucket, new_bucket;
+  int isdoubling;
+
+  if (_ffdb_grow_table (hashp, &old_bucket, &new_bucket, &isdoubling) != 0)
+    return -1;
+  return ffdb_split_bucket (hashp, old_bucket, new_bucket, isdoubling);
+}
+
+/**
+ * Expand hash table while other threads use it. Only the change of
+ * max_bucket and masks is done under the exclusive table latch. Keys
+ * are moved with the latch shared and the bucket locks of the old and
+ * the new bucket held: inserts and lookups of other buckets go on,
+ * those of the two buckets wait for the split
+ *
+ * Caller holds no table latch
+ */
+static int
+_ffdb_expand_table_shared (ffdb_htab_t* hashp)
+{
+  unsigned int old_bucket, new_bucket;
+  pthread_mutex_t *olock, *nlock;
+  int isdoubling, ret;
+
+  _ffdb_table_wrlock (hashp);
+  if (_ffdb_grow_table (hashp, &old_bucket, &new_bucket, &isdoubling) != 0) {
+    _ffdb_table_wrunlock (hashp);
+    return -1;
+  }
+
+  /* no bucket lock is held by anyone under the exclusive latch */
+  olock = &FFDB_BUCKET_LOCK(hashp, old_bucket);
+  nlock = &FFDB_BUCKET_LOCK(hashp, new_bucket);
+  FFDB_LOCK(*olock);
+  if (nlock != olock)
+    FFDB_LOCK(*nlock);
+  hashp->split_old = old_bucket;
+  hashp->split_new = new_bucket;
+  hashp->splitting = 1;
+  FFDB_RWUNLOCK(hashp->table_lock);
+
+  /* the expansion lock keeps exclusive latches out until keys are moved */
+  FFDB_RDLOCK(hashp->table_lock);
   ret = ffdb_split_bucket (hashp, old_bucket, new_bucket, isdoubling);
+  __sync_lock_release (&hashp->splitting);
+  if (nlock != olock)
+    FFDB_UNLOCK(*nlock);
+  FFDB_UNLOCK(*olock);
+  FFDB_RWUNLOCK(hashp->table_lock);
+  FFDB_UNLOCK(hashp->expand_lock);
+
+  return ret;
+}
+
+
+/**
+ * Background splitter: queued bucket splits are done one at a time.
+ * Each holds the exclusive table latch only to add the new bucket and
+ * moves keys with the latch shared, so inserts wait only when they
+ * go into one of the two buckets being split.
+ * A failed split is kept in db_errno for the inserts waiting on splits
+ */
+static void*
+_ffdb_split_thread (void* arg)
+{
+  ffdb_htab_t* hashp = (ffdb_htab_t *)arg;
+  int err;
+
+  FFDB_LOCK (hashp->lock);
+  while (1) {
+    while (hashp->split_pending == 0 && !hashp->split_stop)
+      FFDB_COND_WAIT (hashp->split_cond, hashp->lock);
+    if (hashp->split_pending == 0)
+      break;
+    hashp->split_pending--;
+    FFDB_UNLOCK (hashp->lock);
+
+    err = errno = 0;
+    if (_ffdb_expand_table_shared (hashp) != 0) {
+      err = errno ? errno : EIO;
+      fprintf (stderr, "Background bucket split failed\n");
+    }
+
+    FFDB_LOCK (hashp->lock);
+    if (err) {
+      hashp->db_errno = err;
+      hashp->split_failed = 1;
+    }
+    FFDB_COND_BROADCAST (hashp->split_done);
+  }
+  FFDB_UNLOCK (hashp->lock);
+  return 0;
+}
+
+/**
+ * Queue n bucket splits for the background splitter
+ * Caller holds the table latch
+ *
+ * returns 1 when the splits are queued, 0 when there is no splitter
+ */
+static int
+_ffdb_queue_splits (ffdb_htab_t* hashp, unsigned int n)
+{
+  if (!hashp->split_running)
+    return 0;
+
+  FFDB_LOCK (hashp->lock);
+  hashp->split_pending += n;
+  FFDB_COND_SIGNAL (hashp->split_cond);
+  FFDB_UNLOCK (hashp->lock);
+  return 1;
+}
+
+/**
+ * Wait while the splitter is far behind. Inserts keep the table latch
+ * shared, so without waiting the splitter may never get it while buckets
+ * grow long overflow chains
+ * Caller holds no table latch
+ *
+ * returns -1 with errno set once after a background split failed
+ */
+static int
+_ffdb_split_wait (ffdb_htab_t* hashp)
+{
+  int ret = 0;
+
+  FFDB_LOCK (hashp->lock);
+  while (hashp->split_pending > FFDB_SPLIT_QUEUE)
+    FFDB_COND_WAIT (hashp->split_done, hashp->lock);
+  if (hashp->split_failed) {
+    hashp->split_failed = 0;
+    errno = hashp->db_errno;
+    ret = -1;
+  }
+  FFDB_UNLOCK (hashp->lock);
   return ret;
 }
 
+/**
+ * Stop the background splitter after all queued splits are done
+ */
+static void
+_ffdb_split_thread_stop (ffdb_htab_t* hashp)
+{
+  if (!hashp->split_running)
+    return;
+
+  FFDB_LOCK (hashp->lock);
+  hashp->split_stop = 1;
+  FFDB_COND_SIGNAL (hashp->split_cond);
+  FFDB_UNLOCK (hashp->lock);
+
+  pthread_join (hashp->split_thread, 0);
+  hashp->split_running = 0;
+  hashp->split_stop = 0;
+}
 
 /**
  * Get key from the database
@@ -1144,7 +1524,7 @@ _ffdb_hash_get (const FFDB_DB* dbp, const FFDB_DBT* key,
   ffdb_htab_t* hashp;
   ffdb_hent_t item;
   unsigned int bucket;
-  int status;
+  int status, rdonly;
 
 #ifdef _FFDB_DEBUG
   fprintf (stderr, "ffdb_hash_get key %s\n", (char *)key->data);
@@ -1160,12 +1540,38 @@ _ffdb_hash_get (const FFDB_DB* dbp, const FFDB_DBT* key,
 
   /* initialize item */
   memset (&item, 0, sizeof (ffdb_hent_t));
+
+  /* a read only table with a key directory goes to the data directly */
+  if (hashp->keydir) {
+    ffdb_datap_t datap;
+
+    status = ffdb_keydir_find (hashp->keydir, key, &item, &datap);
+    if (status != 0)
+      return status;
+    return ffdb_get_item_data (hashp, &item, &datap, data);
+  }
+
   /* Calculate the hash item size */
   item.seek_size = PAIRSIZE(key, data);
 
+  /* bucket layout must not change while looking up the key. 
+   * A read only table never changes
+   */
+  rdonly = ((hashp->flags & O_ACCMODE) == O_RDONLY);
+  if (!rdonly)
+    FFDB_RDLOCK(hashp->table_lock);
+
+  /* a key not in the filter is not in the table */
+  if (hashp->filter && !ffdb_filter_test (hashp->filter, key)) {
+    if (!rdonly)
+      FFDB_RWUNLOCK(hashp->table_lock);
+    return FFDB_NOT_FOUND;
+  }
+
   /* calculate hash value for this key */
   bucket = _ffdb_call_hash (hashp, key->data, key->size);
   item.bucket = bucket;
+  _ffdb_bucket_wait (hashp, bucket);
   
 #ifdef _FFDB_DEBUG
   fprintf (stderr, "Hash get Key %s hash bucket = %d\n", (char *)key->data, bucket);
@@ -1174,42 +1580,35 @@ _ffdb_hash_get (const FFDB_DB* dbp, const FFDB_DBT* key,
   /* Now I need find a page on which this key may reside */
   status = ffdb_find_item (hashp, (FFDB_DBT *)key, 0, &item);
   if (status != 0){ /* Something is really wrong */
+    if (!rdonly)
+      FFDB_RWUNLOCK(hashp->table_lock);
     return -1;
   }
 
   if (item.status == ITEM_NO_MORE) {
     ffdb_release_item (hashp, &item);
+    if (!rdonly)
+      FFDB_RWUNLOCK(hashp->table_lock);
     return FFDB_NOT_FOUND;
   }
 
   /* Now the item is found, item contains page information */
   /* page os released after the call */
   status = ffdb_get_item (hashp, key, data, &item, 1);
+  if (!rdonly)
+    FFDB_RWUNLOCK(hashp->table_lock);
 
   return status;
 }
 
 
 /**
- * Put a key and data pair into the database
+ * Check whether a key and data pair can be put into the database
  */
 static int
-_ffdb_hash_put (const FFDB_DB* dbp, FFDB_DBT* key, const FFDB_DBT* data,
-		unsigned int flag)
+_ffdb_check_put (ffdb_htab_t* hashp, const FFDB_DBT* key, const FFDB_DBT* data,
+		 unsigned int flag)
 {
-  ffdb_htab_t* hashp;
-  ffdb_hent_t item;
-  unsigned int bucket;
-  int status, newkey;
-
-  hashp = (ffdb_htab_t *)dbp->internal;
-
-#ifdef _FFDB_STATISTICS
-  FFDB_LOCK (hashp->lock);
-  hash_accesses++;
-  FFDB_UNLOCK (hashp->lock);
-#endif
-
   if (hashp->hdr.version > FFDB_VERSION_5) {
     /* check data size */
     if (data->size > FFDB_MAX_DATASIZE) {
@@ -1235,10 +1634,6 @@ _ffdb_hash_put (const FFDB_DB* dbp, FFDB_DBT* key, const FFDB_DBT* data,
     return -1;
   }
 
-  
-  /* This is a new key */
-  newkey = 1;
-
   /* check flags: if there is a flag it must be FFDB_NOOVERWRITE */
   if (flag && flag != FFDB_NOOVERWRITE) {
     FFDB_LOCK (hashp->lock);
@@ -1254,40 +1649,62 @@ _ffdb_hash_put (const FFDB_DB* dbp, FFDB_DBT* key, const FFDB_DBT* data,
     FFDB_UNLOCK (hashp->lock);
     return -1;
   }
+  return 0;
+}
+
+/**
+ * Finish a lazy open of a writer before its first update
+ */
+static void
+_ffdb_check_writer (ffdb_htab_t* hashp)
+{
+  if (hashp->writer_ready)
+    return;
+
+  _ffdb_table_wrlock (hashp);
+  if (!hashp->writer_ready)
+    _ffdb_open_writer (hashp);
+  _ffdb_table_wrunlock (hashp);
+}
+
+/**
+ * Put a key and data pair into a bucket
+ *
+ * Caller holds the table latch and the insert lock of this bucket.
+ * On return newkey tells whether the key is a new one and expand tells
+ * whether an overflow page was added so the table should be expanded
+ */
+static int
+_ffdb_put_in_bucket (ffdb_htab_t* hashp, unsigned int bucket,
+		     FFDB_DBT* key, const FFDB_DBT* data, unsigned int flag,
+		     int* newkey, int* expand)
+{
+  ffdb_hent_t item;
+  int status;
+
+  *newkey = 1;
+  *expand = 0;
 
   /* initialize item */
   memset (&item, 0, sizeof (ffdb_hent_t));
   /* Calculate the hash item size */
   item.seek_size = PAIRSIZE(key, data);
-
-  /* calculate hash value for this key */
-  bucket = _ffdb_call_hash (hashp, key->data, (unsigned int)key->size);
   item.bucket = bucket;
 
-#ifdef _FFDB_DEBUG
-  fprintf (stderr, "Key %s hash bucket = %d\n", (char *)key->data, bucket);
-#endif
-
   /* Now I need find a page on which this key may reside */
-  /* Find item is thread safe */
   status = ffdb_find_item (hashp, key, (FFDB_DBT *)data, &item);
   if (status != 0)  /* Something is really wrong */
     return status;
 
-
-  FFDB_LOCK(hashp->lock);
   if (item.status == ITEM_NO_MORE) {
     /* There is no item found, we need to insert this item */
     /* Find out whether there is space on this page to fit this pair */
-    if (PAIRFITS(item.pagep, key, data)) {
+    if (HASH_PAIRFITS(hashp, item.pagep, key, data)) {
 #ifdef _FFDB_DEBUG
       fprintf (stderr, "This data item bucket %d fit with page %d\n", bucket, item.pgno);
       fprintf (stderr, "data and key fits on the page data length = %ld \n", data->size);
 #endif
-      if ((status = ffdb_add_pair (hashp, key, data, &item, 0)) != 0) {
-	FFDB_UNLOCK (hashp->lock);  
-	return status;
-      }
+      status = ffdb_add_pair (hashp, key, data, &item, 0);
     }
     else {
       /* Data will not fit on the page */
@@ -1296,44 +1713,212 @@ _ffdb_hash_put (const FFDB_DB* dbp, FFDB_DBT* key, const FFDB_DBT* data,
 #endif
 
       /* First chain an overflow page */
-      if ((status = ffdb_add_ovflpage (hashp, key, data, &item)) != 0) {
-	FFDB_UNLOCK (hashp->lock);  
-	return status;
-      }
+      status = ffdb_add_ovflpage (hashp, key, data, &item);
 
       /* Now I need to expand the table even though the current bucket
-       * may not be splited at this moment
+       * may not be splited at this moment. This is done by the caller
+       * after the bucket lock is released since expansion touches 
+       * other buckets
        */
-      if ((status = _ffdb_expand_table (hashp)) != 0) {
-	hashp->hdr.nkeys++;
-	FFDB_UNLOCK (hashp->lock);
-	return status;
-      }
+      if (status == 0)
+	*expand = 1;
     }
     /* Now I should have the data on the page */
   }
   else if (item.status == ITEM_OK) {
-    newkey = 0;
+    *newkey = 0;
     /* This item already exists. Check flag to make sure it is 
      * a replace flag
      */
     if (flag && flag == FFDB_NOOVERWRITE) {
-      FFDB_UNLOCK (hashp->lock);  
-      return -1;
-    }
-
-    if ((status = ffdb_add_pair (hashp, key, data, &item, 1)) != 0) {
-      FFDB_UNLOCK (hashp->lock);  
-      return -1;
+      ffdb_release_item (hashp, &item);
+      status = -1;
     }
+    else if ((status = ffdb_add_pair (hashp, key, data, &item, 1)) != 0) 
+      status = -1;
   }      	
 
-  /* update number key information */
-  if (newkey)
-    hashp->hdr.nkeys++;
-
+  if (status == 0 && *newkey && hashp->filter)
+    ffdb_filter_add (hashp->filter, key);
+  return status;
+}
+
+/**
+ * Put a key and data pair into the database
+ */
+static int
+_ffdb_hash_put (const FFDB_DB* dbp, FFDB_DBT* key, const FFDB_DBT* data,
+		unsigned int flag)
+{
+  ffdb_htab_t* hashp;
+  unsigned int bucket;
+  int status, newkey, expand, queued;
+
+  hashp = (ffdb_htab_t *)dbp->internal;
+
+#ifdef _FFDB_STATISTICS
+  FFDB_LOCK (hashp->lock);
+  hash_accesses++;
+  FFDB_UNLOCK (hashp->lock);
+#endif
+
+  if (_ffdb_check_put (hashp, key, data, flag) != 0)
+    return -1;
+
+  _ffdb_check_writer (hashp);
+
+  /* Table latch is shared among inserts: max_bucket and masks are stable */
+  FFDB_RDLOCK(hashp->table_lock);
+
+  /* calculate hash value for this key */
+  bucket = _ffdb_call_hash (hashp, key->data, (unsigned int)key->size);
+
+#ifdef _FFDB_DEBUG
+  fprintf (stderr, "Key %s hash bucket = %d\n", (char *)key->data, bucket);
+#endif
+
+  /* Inserts into the same bucket are serialized, others run in parallel */
+  FFDB_LOCK(FFDB_BUCKET_LOCK(hashp, bucket));
+  status = _ffdb_put_in_bucket (hashp, bucket, key, data, flag, 
+				&newkey, &expand);
+  FFDB_UNLOCK(FFDB_BUCKET_LOCK(hashp, bucket));
+
+  /* update number key information */
+  if (status == 0 && newkey) {
+    FFDB_LOCK (hashp->lock);  
+    hashp->hdr.nkeys++;
+    FFDB_UNLOCK (hashp->lock);  
+  }
+
+  /* A background splitter takes the split off this insert */
+  queued = (expand && _ffdb_queue_splits (hashp, 1));
+  FFDB_RWUNLOCK(hashp->table_lock);
+
+  if (queued)
+    status = _ffdb_split_wait (hashp);
+  /* Expansion changes max_bucket and masks under the exclusive latch */
+  else if (expand) 
+    status = _ffdb_expand_table_shared (hashp);
+
+  /* A full key filter is rebuilt with no insert running */
+  if (status == 0 && hashp->filter && ffdb_filter_full (hashp->filter)) {
+    _ffdb_table_wrlock (hashp);
+    if (ffdb_filter_grow (hashp) != 0)
+      fprintf (stderr, "Cannot grow key filter: false positives increase\n");
+    _ffdb_table_wrunlock (hashp);
+  }
+
+  return status;
+}
+
+
+/**
+ * One pair of a batched put
+ */
+typedef struct _ffdb_mput_ent_
+{
+  unsigned int idx;        /* index into user supplied arrays */
+  unsigned int bucket;     /* bucket of this key */
+}ffdb_mput_ent_t;
+
+static int
+_ffdb_mput_cmp (const void* a, const void* b)
+{
+  const ffdb_mput_ent_t* e1 = (const ffdb_mput_ent_t *)a;
+  const ffdb_mput_ent_t* e2 = (const ffdb_mput_ent_t *)b;
+
+  if (e1->bucket != e2->bucket)
+    return (e1->bucket < e2->bucket) ? -1 : 1;
+  /* keep user order for the same bucket: a later put of a key wins */
+  return (e1->idx < e2->idx) ? -1 : (e1->idx > e2->idx);
+}
+
+int
+ffdb_mput (FFDB_DB* db, FFDB_DBT keys[], const FFDB_DBT data[],
+	   unsigned int n, unsigned int flag, int status[])
+{
+  ffdb_htab_t* hashp;
+  ffdb_mput_ent_t* ents;
+  unsigned int i, k, nexpand, nnew;
+  int ret, newkey, expand, queued, *rets;
+
+  if (!db || (n > 0 && (!keys || !data))) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (n == 0)
+    return 0;
+
+  hashp = (ffdb_htab_t *)db->internal;
+
+  ents = (ffdb_mput_ent_t *)calloc (n, sizeof (ffdb_mput_ent_t));
+  rets = status ? status : (int *)calloc (n, sizeof (int));
+  if (!ents || !rets) {
+    fprintf (stderr, "Cannot allocate space for %d pairs in a batch put\n", n);
+    free (ents);
+    if (rets != status)
+      free (rets);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  /* The whole batch is applied under the exclusive table latch:
+   * no bucket or allocator lock is contended inside
+   */
+  _ffdb_table_wrlock (hashp);
+  if (!hashp->writer_ready)
+    _ffdb_open_writer (hashp);
+
+  for (i = 0; i < n; i++) {
+    ents[i].idx = i;
+    ents[i].bucket = _ffdb_call_hash (hashp, keys[i].data, 
+				      (unsigned int)keys[i].size);
+  }
+  qsort (ents, n, sizeof (ffdb_mput_ent_t), _ffdb_mput_cmp);
+
+  ret = 0;
+  nexpand = nnew = 0;
+  for (i = 0; i < n; i++) {
+    k = ents[i].idx;
+    rets[k] = _ffdb_check_put (hashp, &keys[k], &data[k], flag);
+    if (rets[k] == 0) 
+      rets[k] = _ffdb_put_in_bucket (hashp, ents[i].bucket, &keys[k], &data[k],
+				     flag, &newkey, &expand);
+    if (rets[k] != 0) {
+      ret = -1;
+      continue;
+    }
+    nnew += newkey;
+    nexpand += expand;
+  }
+
+  FFDB_LOCK (hashp->lock);  
+  hashp->hdr.nkeys += nnew;
   FFDB_UNLOCK (hashp->lock);  
-  return 0;
+
+  /* Table expansion is deferred to the end of the batch */
+  queued = (nexpand > 0 && _ffdb_queue_splits (hashp, nexpand));
+  if (queued)
+    nexpand = 0;
+  for (i = 0; i < nexpand; i++) {
+    if (_ffdb_expand_table (hashp) != 0) {
+      ret = -1;
+      break;
+    }
+  }
+  if (hashp->filter && ffdb_filter_full (hashp->filter) &&
+      ffdb_filter_grow (hashp) != 0)
+    fprintf (stderr, "Cannot grow key filter: false positives increase\n");
+  _ffdb_table_wrunlock (hashp);
+
+  if (queued && _ffdb_split_wait (hashp) != 0)
+    ret = -1;
+
+  free (ents);
+  if (rets != status)
+    free (rets);
+
+  return ret;
 }
 
 
@@ -1383,17 +1968,20 @@ _ffdb_hash_sync (const FFDB_DB *dbp, unsigned int flags)
     return -1;
   hashp = (ffdb_htab_t *)dbp->internal;
 
+  _ffdb_table_wrlock (hashp);
   FFDB_LOCK(hashp->lock);
 
   /* flush meta information header to disk */
   if (_ffdb_flush_meta (hashp) != 0) {
     FFDB_UNLOCK(hashp->lock);
+    _ffdb_table_wrunlock (hashp);
     return -1;
   }
 
   ffdb_pagepool_sync (hashp->mp);
 
   FFDB_UNLOCK(hashp->lock);
+  _ffdb_table_wrunlock (hashp);
   return 0;
 }
 
@@ -1429,7 +2017,16 @@ _ffdb_hash_cursor (const FFDB_DB* dbp, ffdb_cursor_t** c, unsigned int type)
   inc->pcursor = nc;
   memset (&inc->item, 0, sizeof(ffdb_hent_t));  
   inc->item.status = ITEM_CLEAN;
+  inc->dpage = INVALID_PGNO;
+  inc->doff = inc->dndx = 0;
+  inc->first_bucket = 0;
+  inc->last_bucket = INVALID_PGNO;
+  inc->bulk_pending = 0;
+
+  /* cursors may be created by different threads */
+  FFDB_LOCK(inc->hashp->lock);
   FFDB_TAILQ_INSERT_TAIL(&(inc->hashp->curs_queue), inc, queue);
+  FFDB_UNLOCK(inc->hashp->lock);
 
   /* Set internal pointer */
   nc->internal = inc;
@@ -1580,52 +2177,1094 @@ ffdb_max_user_info_len (const FFDB_DB* db)
 }
 
 
-/************************************************************************
- * Cursor related routines                                              *
- ************************************************************************/
-static int
-_ffdb_cursor_get  (ffdb_cursor_t* cursor, FFDB_DBT* key,
-		   FFDB_DBT* data, unsigned int flags)
+int
+ffdb_get_view (const FFDB_DB* db, const FFDB_DBT* key, ffdb_view_t* view)
+{
+  ffdb_htab_t* hashp;
+  ffdb_hent_t item;
+  int status, rdonly;
+
+  if (!db || !key || !view) {
+    errno = EINVAL;
+    return -1;
+  }
+  hashp = (ffdb_htab_t *)db->internal;
+
+  view->data = 0;
+  view->size = 0;
+  view->page = 0;
+  view->buffer = 0;
+
+  /* initialize item */
+  memset (&item, 0, sizeof (ffdb_hent_t));
+
+  rdonly = ((hashp->flags & O_ACCMODE) == O_RDONLY);
+  if (!rdonly)
+    FFDB_RDLOCK(hashp->table_lock);
+
+  item.bucket = _ffdb_call_hash (hashp, key->data, key->size);
+  _ffdb_bucket_wait (hashp, item.bucket);
+  status = ffdb_find_item (hashp, (FFDB_DBT *)key, 0, &item);
+  if (status != 0) 
+    status = -1;
+  else if (item.status == ITEM_NO_MORE) {
+    ffdb_release_item (hashp, &item);
+    status = FFDB_NOT_FOUND;
+  }
+  else 
+    status = ffdb_get_item_view (hashp, &item, view);
+
+  if (!rdonly)
+    FFDB_RWUNLOCK(hashp->table_lock);
+
+  return status;
+}
+
+int
+ffdb_get_range (const FFDB_DB* db, const FFDB_DBT* key,
+		long offset, long len, void* buf, long* datalen)
+{
+  ffdb_htab_t* hashp;
+  ffdb_hent_t item;
+  int status, rdonly;
+
+  if (!db || !key || (len > 0 && !buf)) {
+    errno = EINVAL;
+    return -1;
+  }
+  hashp = (ffdb_htab_t *)db->internal;
+
+  /* initialize item */
+  memset (&item, 0, sizeof (ffdb_hent_t));
+
+  rdonly = ((hashp->flags & O_ACCMODE) == O_RDONLY);
+  if (!rdonly)
+    FFDB_RDLOCK(hashp->table_lock);
+
+  item.bucket = _ffdb_call_hash (hashp, key->data, key->size);
+  _ffdb_bucket_wait (hashp, item.bucket);
+  status = ffdb_find_item (hashp, (FFDB_DBT *)key, 0, &item);
+  if (status != 0) 
+    status = -1;
+  else if (item.status == ITEM_NO_MORE) {
+    ffdb_release_item (hashp, &item);
+    status = FFDB_NOT_FOUND;
+  }
+  else 
+    status = ffdb_get_item_range (hashp, &item, offset, len, buf, datalen);
+
+  if (!rdonly)
+    FFDB_RWUNLOCK(hashp->table_lock);
+
+  return status;
+}
+
+int
+ffdb_put_range (const FFDB_DB* db, const FFDB_DBT* key,
+		long offset, const void* buf, long len)
 {
+  ffdb_htab_t* hashp;
+  ffdb_hent_t item;
   int status;
-  ffdb_crs_t*  icrs = (ffdb_crs_t *)cursor->internal;
-  ffdb_htab_t* hashp = icrs->hashp;
-  unsigned int realflags;
 
-  /* Check flag to see whether it is valid */
-  if (flags != FFDB_FIRST && flags != FFDB_LAST &&
-      flags != FFDB_NEXT && flags != FFDB_PREV) {
-    fprintf (stderr, "Unsupported cursor get flag %d\n", flags);
+  if (!db || !key || (len > 0 && !buf)) {
+    errno = EINVAL;
     return -1;
   }
-    
-  realflags = flags;
-  if (cursor->type == FFDB_KEY_CURSOR) {
-    /* If the cursor has not been initialized */
-    if (flags == FFDB_NEXT && icrs->item.status == ITEM_CLEAN)
-      realflags = FFDB_FIRST;
-    
-    if (flags == FFDB_PREV && icrs->item.status == ITEM_CLEAN)
-      realflags = FFDB_LAST;
+  hashp = (ffdb_htab_t *)db->internal;
 
-    FFDB_LOCK(icrs->lock);
-    status = ffdb_cursor_find_by_key (hashp, icrs, key, data, realflags);
-    FFDB_UNLOCK(icrs->lock);
+  /* check file permission, if this is a read only file, cannot do it */
+  if ((hashp->flags & O_ACCMODE) == O_RDONLY) {
+    FFDB_LOCK (hashp->lock);
+    hashp->db_errno = errno = EPERM;
+    FFDB_UNLOCK (hashp->lock);
+    return -1;
   }
-  else {
-    status = 0;
+
+  /* initialize item */
+  memset (&item, 0, sizeof (ffdb_hent_t));
+
+  FFDB_RDLOCK(hashp->table_lock);
+
+  item.bucket = _ffdb_call_hash (hashp, key->data, key->size);
+
+  /* Writers to the same bucket are serialized */
+  FFDB_LOCK(FFDB_BUCKET_LOCK(hashp, item.bucket));
+  status = ffdb_find_item (hashp, (FFDB_DBT *)key, 0, &item);
+  if (status != 0) 
+    status = -1;
+  else if (item.status == ITEM_NO_MORE) {
+    ffdb_release_item (hashp, &item);
+    status = FFDB_NOT_FOUND;
   }
+  else 
+    status = ffdb_put_item_range (hashp, &item, offset, buf, len);
+  FFDB_UNLOCK(FFDB_BUCKET_LOCK(hashp, item.bucket));
+
+  FFDB_RWUNLOCK(hashp->table_lock);
+
   return status;
 }
 
+int
+ffdb_release_view (const FFDB_DB* db, ffdb_view_t* view)
+{
+  if (!db || !view) {
+    errno = EINVAL;
+    return -1;
+  }
+  return ffdb_release_item_view ((ffdb_htab_t *)db->internal, view);
+}
+
+
+/************************************************************************
+ * Batched lookup routines                                              *
+ ************************************************************************/
+
+/**
+ * One key of a batched lookup
+ */
+typedef struct _ffdb_mget_ent_
+{
+  unsigned int idx;        /* index into user supplied arrays */
+  unsigned int bucket;     /* bucket of this key */
+  unsigned int doff;       /* data offset on the first data page */
+  ffdb_hent_t  item;       /* hash entry found */
+  ffdb_datap_t datap;      /* data pointer of this key */
+}ffdb_mget_ent_t;
 
 static int
-_ffdb_cursor_close (ffdb_cursor_t* cursor)
+_ffdb_mget_bucket_cmp (const void* a, const void* b)
 {
-  ffdb_crs_t* inc = (ffdb_crs_t *)cursor->internal;
-  ffdb_htab_t* hashp = inc->hashp;
+  const ffdb_mget_ent_t* e1 = (const ffdb_mget_ent_t *)a;
+  const ffdb_mget_ent_t* e2 = (const ffdb_mget_ent_t *)b;
 
-  FFDB_TAILQ_REMOVE(&(hashp->curs_queue), inc, queue);
+  if (e1->bucket != e2->bucket)
+    return (e1->bucket < e2->bucket) ? -1 : 1;
+  return (e1->idx < e2->idx) ? -1 : (e1->idx > e2->idx);
+}
+
+static int
+_ffdb_mget_data_cmp (const void* a, const void* b)
+{
+  const ffdb_mget_ent_t* e1 = *(const ffdb_mget_ent_t **)a;
+  const ffdb_mget_ent_t* e2 = *(const ffdb_mget_ent_t **)b;
+
+  if (e1->datap.first != e2->datap.first)
+    return (e1->datap.first < e2->datap.first) ? -1 : 1;
+  return (e1->doff < e2->doff) ? -1 : (e1->doff > e2->doff);
+}
+
+/**
+ * Tell the kernel we are going to read a run of pages
+ */
+static void
+_ffdb_readahead (ffdb_htab_t* hashp, pgno_t first, pgno_t npages)
+{
+#ifdef POSIX_FADV_WILLNEED
+  (void)posix_fadvise (hashp->fp, (off_t)first * hashp->hdr.bsize,
+		       (off_t)npages * hashp->hdr.bsize, POSIX_FADV_WILLNEED);
+#else
+  (void)hashp;
+  (void)first;
+  (void)npages;
+#endif
+}
+
+int
+ffdb_mget (const FFDB_DB* db, FFDB_DBT keys[], unsigned int n,
+	   FFDB_DBT values[], int status[])
+{
+  ffdb_htab_t* hashp;
+  ffdb_mget_ent_t *ents, **found;
+  FFDB_DBT** gkeys;
+  ffdb_hent_t* gitems;
+  ffdb_datap_t* gdatap;
+  unsigned int i, k, g, nfound, dlen;
+  pgno_t page, rstart, rlen, last;
+  int ret, rdonly, *rets;
+  char stripes[FFDB_NUM_BUCKET_LOCKS];
+
+  if (!db || (n > 0 && (!keys || !values))) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (n == 0)
+    return 0;
+
+  hashp = (ffdb_htab_t *)db->internal;
+
+  ents = (ffdb_mget_ent_t *)calloc (n, sizeof (ffdb_mget_ent_t));
+  found = (ffdb_mget_ent_t **)calloc (n, sizeof (ffdb_mget_ent_t *));
+  gkeys = (FFDB_DBT **)calloc (n, sizeof (FFDB_DBT *));
+  gitems = (ffdb_hent_t *)calloc (n, sizeof (ffdb_hent_t));
+  gdatap = (ffdb_datap_t *)calloc (n, sizeof (ffdb_datap_t));
+  rets = status ? status : (int *)calloc (n, sizeof (int));
+  if (!ents || !found || !gkeys || !gitems || !gdatap || !rets) {
+    fprintf (stderr, "Cannot allocate space for %d keys in a batch get\n", n);
+    ret = -1;
+    errno = ENOMEM;
+    goto mget_done;
+  }
+
+  /* bucket layout must not change during this batch */
+  rdonly = ((hashp->flags & O_ACCMODE) == O_RDONLY);
+  if (!rdonly)
+    FFDB_RDLOCK(hashp->table_lock);
+
+  /* hash every key first and sort keys by bucket (hence by bucket page) */
+  for (i = 0; i < n; i++) {
+    ents[i].idx = i;
+    ents[i].bucket = _ffdb_call_hash (hashp, keys[i].data, keys[i].size);
+    rets[i] = FFDB_NOT_FOUND;
+  }
+  qsort (ents, n, sizeof (ffdb_mget_ent_t), _ffdb_mget_bucket_cmp);
+
+  /* Data pointers are copied off the bucket pages before the data are
+   * read. Writers of these buckets are held off until the data are read,
+   * taking the bucket locks in ascending order as every writer holds one
+   */
+  memset (stripes, 0, sizeof (stripes));
+  if (!rdonly) {
+    for (i = 0; i < n; i++)
+      stripes[ents[i].bucket & (FFDB_NUM_BUCKET_LOCKS - 1)] = 1;
+    for (i = 0; i < FFDB_NUM_BUCKET_LOCKS; i++)
+      if (stripes[i])
+	FFDB_LOCK(hashp->bucket_locks[i]);
+  }
+
+  /* read ahead all primary bucket pages, coalescing adjacent pages */
+  rlen = 0;
+  rstart = last = 0;
+  for (i = 0; i < n; i++) {
+    if (i > 0 && ents[i].bucket == ents[i - 1].bucket)
+      continue;
+    BUCKET_TO_PAGE(ents[i].bucket, page);
+    if (rlen > 0 && page == last + 1)
+      rlen++;
+    else {
+      if (rlen > 0)
+	_ffdb_readahead (hashp, rstart, rlen);
+      rstart = page;
+      rlen = 1;
+    }
+    last = page;
+  }
+  if (rlen > 0)
+    _ffdb_readahead (hashp, rstart, rlen);
+
+  /* visit each bucket chain once for all keys in the bucket */
+  ret = 0;
+  nfound = 0;
+  for (i = 0; i < n; i = k) {
+    for (k = i; k < n && ents[k].bucket == ents[i].bucket; k++)
+      gkeys[k - i] = &keys[ents[k].idx];
+
+    if (ffdb_find_items (hashp, ents[i].bucket, gkeys, k - i,
+			 gitems, gdatap) != 0) {
+      for (g = i; g < k; g++)
+	rets[ents[g].idx] = -1;
+      ret = -1;
+      continue;
+    }
+
+    for (g = i; g < k; g++) {
+      if (gitems[g - i].status != ITEM_OK)
+	continue;
+      ents[g].item = gitems[g - i];
+      ents[g].datap = gdatap[g - i];
+      if (hashp->hdr.version > FFDB_VERSION_5) 
+	ents[g].doff = GET_PGOFFSET(ents[g].datap.offset);
+      else
+	ents[g].doff = ents[g].datap.offset;
+      found[nfound++] = &ents[g];
+    }
+  }
+
+  /* now read data in data page order */
+  qsort (found, nfound, sizeof (ffdb_mget_ent_t *), _ffdb_mget_data_cmp);
+
+  rlen = 0;
+  rstart = last = 0;
+  for (i = 0; i < nfound; i++) {
+    /* embedded data are on the hash pages read already */
+    if (IS_EMBEDDED(&found[i]->datap))
+      continue;
+    page = found[i]->datap.first;
+    if (hashp->hdr.version > FFDB_VERSION_5)
+      dlen = (unsigned int)((found[i]->doff +
+			     REAL_DATA_LEN(found[i]->datap.len, found[i]->datap.offset))/hashp->hdr.bsize);
+    else
+      dlen = (found[i]->doff + found[i]->datap.len)/hashp->hdr.bsize;
+    if (rlen > 0 && page <= last + 1) {
+      if (page + dlen > last) {
+	rlen += page + dlen - last;
+	last = page + dlen;
+      }
+    }
+    else {
+      if (rlen > 0)
+	_ffdb_readahead (hashp, rstart, rlen);
+      rstart = page;
+      rlen = dlen + 1;
+      last = page + dlen;
+    }
+  }
+  if (rlen > 0)
+    _ffdb_readahead (hashp, rstart, rlen);
+
+  for (i = 0; i < nfound; i++) {
+    k = found[i]->idx;
+    if (ffdb_get_item_data (hashp, &found[i]->item, &found[i]->datap,
+			    &values[k]) != 0) {
+      rets[k] = -1;
+      ret = -1;
+    }
+    else
+      rets[k] = 0;
+  }
+
+  if (!rdonly) {
+    for (i = FFDB_NUM_BUCKET_LOCKS; i > 0; i--)
+      if (stripes[i - 1])
+	FFDB_UNLOCK(hashp->bucket_locks[i - 1]);
+    FFDB_RWUNLOCK(hashp->table_lock);
+  }
+
+  if (ret == 0 && nfound < n)
+    ret = FFDB_NOT_FOUND;
+
+ mget_done:
+  free (ents);
+  free (found);
+  free (gkeys);
+  free (gitems);
+  free (gdatap);
+  if (rets != status)
+    free (rets);
+
+  return ret;
+}
+
+
+/************************************************************************
+ * Streaming value routines                                             *
+ ************************************************************************/
+
+/**
+ * Find the data item of a key and point a streaming handle at its
+ * beginning. Caller holds the table latch
+ */
+static int
+_ffdb_value_find (ffdb_htab_t* hashp, ffdb_value_t* value)
+{
+  ffdb_hent_t item;
+  int status;
+
+  /* initialize item */
+  memset (&item, 0, sizeof (ffdb_hent_t));
+
+  item.bucket = _ffdb_call_hash (hashp, value->key.data, value->key.size);
+  _ffdb_bucket_wait (hashp, item.bucket);
+  status = ffdb_find_item (hashp, &value->key, 0, &item);
+  if (status != 0) 
+    return -1;
+  if (item.status == ITEM_NO_MORE) {
+    ffdb_release_item (hashp, &item);
+    return FFDB_NOT_FOUND;
+  }
+  return ffdb_value_start (hashp, &item, value);
+}
+
+/**
+ * Allocate a streaming handle with a private copy of a key
+ */
+static ffdb_value_t*
+_ffdb_value_alloc (ffdb_htab_t* hashp, const FFDB_DBT* key, int write)
+{
+  ffdb_value_t* value;
+
+  value = (ffdb_value_t *)calloc (1, sizeof (ffdb_value_t));
+  if (!value) {
+    errno = ENOMEM;
+    return 0;
+  }
+  value->key.data = malloc (key->size);
+  if (!value->key.data) {
+    free (value);
+    errno = ENOMEM;
+    return 0;
+  }
+  memcpy (value->key.data, key->data, key->size);
+  value->key.size = key->size;
+  value->hashp = hashp;
+  value->write = write;
+  return value;
+}
+
+int
+ffdb_value_open_read (const FFDB_DB* db, const FFDB_DBT* key,
+		      ffdb_value_t** value)
+{
+  ffdb_htab_t* hashp;
+  ffdb_value_t* v;
+  int status, rdonly;
+
+  if (!db || !key || !value) {
+    errno = EINVAL;
+    return -1;
+  }
+  hashp = (ffdb_htab_t *)db->internal;
+  *value = 0;
+
+  if (!(v = _ffdb_value_alloc (hashp, key, 0)))
+    return -1;
+
+  rdonly = ((hashp->flags & O_ACCMODE) == O_RDONLY);
+  if (!rdonly)
+    FFDB_RDLOCK(hashp->table_lock);
+  status = _ffdb_value_find (hashp, v);
+  if (!rdonly)
+    FFDB_RWUNLOCK(hashp->table_lock);
+
+  if (status != 0) {
+    ffdb_value_close (v);
+    return status;
+  }
+  *value = v;
+  return 0;
+}
+
+long
+ffdb_value_read_next (ffdb_value_t* value, void* buf, long len)
+{
+  ffdb_htab_t* hashp;
+  int status, rdonly;
+
+  if (!value || value->write || len < 0 || (len > 0 && !buf)) {
+    errno = EINVAL;
+    return -1;
+  }
+  hashp = value->hashp;
+
+  if (len > value->size - value->pos)
+    len = value->size - value->pos;
+  if (len == 0)
+    return 0;
+
+  rdonly = ((hashp->flags & O_ACCMODE) == O_RDONLY);
+  if (!rdonly)
+    FFDB_RDLOCK(hashp->table_lock);
+  status = ffdb_value_copy (hashp, value, buf, len);
+  if (!rdonly)
+    FFDB_RWUNLOCK(hashp->table_lock);
+
+  if (status != 0)
+    return -1;
+
+  /* The whole data item is read: check the checksum */
+  if (value->pos == value->size && value->chksum != value->stored_chksum) {
+    fprintf (stderr, "Get data checksum mismatch 0x%x (calculated) != 0x%x (stored)\n", value->chksum, value->stored_chksum);
+    errno = EIO;
+    return -1;
+  }
+  return len;
+}
+
+int
+ffdb_value_open_write (const FFDB_DB* db, const FFDB_DBT* key,
+		       long size, ffdb_value_t** value)
+{
+  ffdb_htab_t* hashp;
+  ffdb_value_t* v;
+  FFDB_DBT reserve;
+  int status;
+
+  if (!db || !key || !value || size < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  hashp = (ffdb_htab_t *)db->internal;
+  *value = 0;
+
+  if (!(v = _ffdb_value_alloc (hashp, key, 1)))
+    return -1;
+
+  /* A put without data only reserves space on data pages */
+  reserve.data = 0;
+  reserve.size = size;
+  if (_ffdb_hash_put (db, &v->key, &reserve, 0) != 0) {
+    ffdb_value_close (v);
+    return -1;
+  }
+
+  FFDB_RDLOCK(hashp->table_lock);
+  status = _ffdb_value_find (hashp, v);
+  FFDB_RWUNLOCK(hashp->table_lock);
+
+  if (status != 0) {
+    ffdb_value_close (v);
+    return -1;
+  }
+  *value = v;
+  return 0;
+}
+
+int
+ffdb_value_write_chunk (ffdb_value_t* value, const void* buf, long len)
+{
+  ffdb_htab_t* hashp;
+  int status;
+
+  if (!value || !value->write || len < 0 || (len > 0 && !buf) ||
+      len > value->size - value->pos) {
+    errno = EINVAL;
+    return -1;
+  }
+  hashp = value->hashp;
+  if (len == 0)
+    return 0;
+
+  FFDB_RDLOCK(hashp->table_lock);
+  status = ffdb_value_copy (hashp, value, (void *)buf, len);
+  FFDB_RWUNLOCK(hashp->table_lock);
+
+  return status;
+}
+
+int
+ffdb_value_commit (ffdb_value_t* value)
+{
+  ffdb_htab_t* hashp;
+  ffdb_hent_t item;
+  ffdb_datap_t* datap;
+  int status;
+
+  if (!value || !value->write || value->pos != value->size) {
+    errno = EINVAL;
+    return -1;
+  }
+  hashp = value->hashp;
+
+  /* initialize item */
+  memset (&item, 0, sizeof (ffdb_hent_t));
+
+  FFDB_RDLOCK(hashp->table_lock);
+  item.bucket = _ffdb_call_hash (hashp, value->key.data, value->key.size);
+
+  /* Now store the checksum of the data written */
+  FFDB_LOCK(FFDB_BUCKET_LOCK(hashp, item.bucket));
+  status = ffdb_find_item (hashp, &value->key, 0, &item);
+  if (status != 0) 
+    status = -1;
+  else if (item.status == ITEM_NO_MORE) {
+    ffdb_release_item (hashp, &item);
+    errno = ENOENT;
+    status = -1;
+  }
+  else {
+    datap = DATAP(item.pagep, item.pgndx);
+    datap->chksum = value->chksum;
+    ffdb_put_page (hashp, item.pagep, HASH_BUCKET_PAGE, 1);
+  }
+  FFDB_UNLOCK(FFDB_BUCKET_LOCK(hashp, item.bucket));
+  FFDB_RWUNLOCK(hashp->table_lock);
+
+  if (status == 0)
+    ffdb_value_close (value);
+  return status;
+}
+
+int
+ffdb_value_close (ffdb_value_t* value)
+{
+  if (!value) {
+    errno = EINVAL;
+    return -1;
+  }
+  free (value->key.data);
+  if (value->buffer)
+    free (value->buffer);
+  free (value);
+  return 0;
+}
+
+
+/************************************************************************
+ * Cursor related routines                                              *
+ ************************************************************************/
+static int
+_ffdb_cursor_get  (ffdb_cursor_t* cursor, FFDB_DBT* key,
+		   FFDB_DBT* data, unsigned int flags)
+{
+  int status;
+  ffdb_crs_t*  icrs = (ffdb_crs_t *)cursor->internal;
+  ffdb_htab_t* hashp = icrs->hashp;
+  unsigned int realflags;
+
+  /* Check flag to see whether it is valid */
+  if (flags != FFDB_FIRST && flags != FFDB_LAST &&
+      flags != FFDB_NEXT && flags != FFDB_PREV) {
+    fprintf (stderr, "Unsupported cursor get flag %d\n", flags);
+    return -1;
+  }
+    
+  realflags = flags;
+  icrs->bulk_pending = 0;
+  if (cursor->type == FFDB_KEY_CURSOR) {
+    /* If the cursor has not been initialized */
+    if (flags == FFDB_NEXT && icrs->item.status == ITEM_CLEAN)
+      realflags = FFDB_FIRST;
+    
+    if (flags == FFDB_PREV && icrs->item.status == ITEM_CLEAN)
+      realflags = FFDB_LAST;
+
+    FFDB_LOCK(icrs->lock);
+    FFDB_RDLOCK(hashp->table_lock);
+    _ffdb_table_wait (hashp);
+    status = ffdb_cursor_find_by_key (hashp, icrs, key, data, realflags);
+    FFDB_RWUNLOCK(hashp->table_lock);
+    FFDB_UNLOCK(icrs->lock);
+  }
+  else {
+    /* Data pages are only scanned forward */
+    if (flags == FFDB_LAST || flags == FFDB_PREV) {
+      fprintf (stderr, "Unsupported data cursor get flag %d\n", flags);
+      errno = EINVAL;
+      return -1;
+    }
+    if (flags == FFDB_NEXT && icrs->item.status == ITEM_CLEAN)
+      realflags = FFDB_FIRST;
+
+    FFDB_LOCK(icrs->lock);
+    FFDB_RDLOCK(hashp->table_lock);
+    _ffdb_table_wait (hashp);
+    status = ffdb_cursor_find_by_data (hashp, icrs, key, data, realflags);
+    FFDB_RWUNLOCK(hashp->table_lock);
+    FFDB_UNLOCK(icrs->lock);
+  }
+  return status;
+}
+
+
+/**
+ * Get many pairs packed into a buffer from a cursor
+ */
+int
+ffdb_cursor_get_bulk (ffdb_cursor_t* cursor, FFDB_DBT* buf,
+		      unsigned int flags, unsigned int* count)
+{
+  ffdb_crs_t* icrs;
+  ffdb_htab_t* hashp;
+  unsigned int realflags, step, n;
+  unsigned long used, size;
+  int status, keysonly;
+
+  if (!cursor || !buf || !buf->data || buf->size <= 0 || !count) {
+    errno = EINVAL;
+    return -1;
+  }
+  keysonly = (flags & FFDB_BULK_KEYS) != 0;
+  flags &= ~FFDB_BULK_KEYS;
+  if ((flags != FFDB_FIRST && flags != FFDB_NEXT &&
+       flags != FFDB_LAST && flags != FFDB_PREV) ||
+      (cursor->type != FFDB_KEY_CURSOR && 
+       (flags == FFDB_LAST || flags == FFDB_PREV))) {
+    fprintf (stderr, "Unsupported bulk cursor get flag %d\n", flags);
+    errno = EINVAL;
+    return -1;
+  }
+  icrs = (ffdb_crs_t *)cursor->internal;
+  hashp = icrs->hashp;
+
+  step = (flags == FFDB_LAST || flags == FFDB_PREV) ? FFDB_PREV : FFDB_NEXT;
+  realflags = flags;
+  if (icrs->item.status == ITEM_CLEAN && flags == FFDB_NEXT)
+    realflags = FFDB_FIRST;
+  if (icrs->item.status == ITEM_CLEAN && flags == FFDB_PREV)
+    realflags = FFDB_LAST;
+
+  n = 0;
+  used = size = 0;
+  FFDB_LOCK(icrs->lock);
+  FFDB_RDLOCK(hashp->table_lock);
+  _ffdb_table_wait (hashp);
+  if (realflags == FFDB_FIRST || realflags == FFDB_LAST)
+    icrs->bulk_pending = 0;
+  while (1) {
+    if (!icrs->bulk_pending) {
+      /* move the cursor without copying anything */
+      if (cursor->type == FFDB_KEY_CURSOR)
+	status = ffdb_cursor_find_by_key (hashp, icrs, 0, 0, realflags);
+      else
+	status = ffdb_cursor_find_by_data (hashp, icrs, 0, 0, realflags);
+      if (status != 0)
+	break;
+      icrs->bulk_pending = 1;
+    }
+    realflags = step;
+
+    status = ffdb_cursor_copy_item (hashp, icrs, keysonly,
+				    (unsigned char *)buf->data + used,
+				    buf->size - used, &size);
+    if (status != 0 || size > buf->size - used)
+      break;
+    icrs->bulk_pending = 0;
+    used += size;
+    n++;
+  }
+  FFDB_RWUNLOCK(hashp->table_lock);
+  FFDB_UNLOCK(icrs->lock);
+
+  if (status == 0) {
+    /* the buffer is full */
+    if (n == 0) {
+      buf->size = size;
+      errno = ENOMEM;
+      return -1;
+    }
+  }
+  else if (status == FFDB_NOT_FOUND && n > 0)
+    status = 0;
+
+  buf->size = used;
+  *count = n;
+  return status;
+}
+
+/**
+ * Walk pairs packed by ffdb_cursor_get_bulk
+ */
+int
+ffdb_bulk_next (const FFDB_DBT* buf, unsigned long* pos,
+		FFDB_DBT* key, FFDB_DBT* data)
+{
+  unsigned char* p;
+  unsigned int len;
+
+  if (*pos + 2 * sizeof (unsigned int) > (unsigned long)buf->size)
+    return FFDB_NOT_FOUND;
+
+  p = (unsigned char *)buf->data + *pos;
+  memcpy (&len, p, sizeof (unsigned int));
+  key->data = p + sizeof (unsigned int);
+  key->size = len;
+  p += sizeof (unsigned int) + len;
+
+  memcpy (&len, p, sizeof (unsigned int));
+  data->data = p + sizeof (unsigned int);
+  data->size = len;
+  p += sizeof (unsigned int) + len;
+
+  *pos = p - (unsigned char *)buf->data;
+  return 0;
+}
+
+/**
+ * Build an in memory key directory for a read only database
+ */
+int
+ffdb_keydir_open (FFDB_DB* db, const char* fname, unsigned int nthreads)
+{
+  ffdb_htab_t* hashp;
+
+  if (!db) {
+    errno = EINVAL;
+    return -1;
+  }
+  hashp = (ffdb_htab_t *)db->internal;
+  if ((hashp->flags & O_ACCMODE) != O_RDONLY) {
+    fprintf (stderr, "Key directory is only for read only databases\n");
+    errno = EINVAL;
+    return -1;
+  }
+  if (hashp->h_compare != __ffdb_default_cmp) {
+    fprintf (stderr, "Key directory needs the default key compare routine\n");
+    errno = EINVAL;
+    return -1;
+  }
+  if (hashp->keydir)
+    return 0;
+
+  return ffdb_keydir_build (hashp, fname, nthreads);
+}
+
+/**
+ * Keep a bloom filter of all keys of a database
+ */
+int
+ffdb_filter_open (FFDB_DB* db, const char* fname, unsigned int nthreads)
+{
+  ffdb_htab_t* hashp;
+  int rdonly, status;
+
+  if (!db) {
+    errno = EINVAL;
+    return -1;
+  }
+  hashp = (ffdb_htab_t *)db->internal;
+  rdonly = ((hashp->flags & O_ACCMODE) == O_RDONLY);
+
+  /* no insert may run while all keys are added */
+  if (!rdonly)
+    _ffdb_table_wrlock (hashp);
+  status = 0;
+  if (!hashp->filter)
+    status = ffdb_filter_build (hashp, fname, nthreads);
+  if (!rdonly)
+    _ffdb_table_wrunlock (hashp);
+
+  return status;
+}
+
+/**
+ * Split buckets in a background thread
+ */
+int
+ffdb_background_split (FFDB_DB* db)
+{
+  ffdb_htab_t* hashp;
+  int status;
+
+  if (!db) {
+    errno = EINVAL;
+    return -1;
+  }
+  hashp = (ffdb_htab_t *)db->internal;
+  if ((hashp->flags & O_ACCMODE) == O_RDONLY) {
+    fprintf (stderr, "Background split is only for databases open for write\n");
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* no insert may run while the splitter is started */
+  _ffdb_table_wrlock (hashp);
+  status = 0;
+  if (!hashp->split_running) {
+    hashp->split_pending = 0;
+    hashp->split_stop = 0;
+    if ((status = pthread_create (&hashp->split_thread, 0,
+				  _ffdb_split_thread, hashp)) != 0) {
+      fprintf (stderr, "Cannot start background split thread\n");
+      errno = status;
+      status = -1;
+    }
+    else
+      hashp->split_running = 1;
+  }
+  _ffdb_table_wrunlock (hashp);
+
+  return status;
+}
+
+/**
+ * Move pages of a database into its unused bucket pages
+ */
+int
+ffdb_compact (const char* fname, const void* openinfo)
+{
+  FFDB_DB* db;
+  FFDB_HASHINFO info;
+
+  if (!fname) {
+    errno = EINVAL;
+    return -1;
+  }
+  /* pages are moved on a full open */
+  if (openinfo) {
+    info = *(const FFDB_HASHINFO *)openinfo;
+    info.rearrangepages &= ~(FFDB_REARRANGE_PAGES | FFDB_INFO_OPENMODE);
+  }
+  if (!(db = ffdb_dbopen (fname, O_RDWR, 0, openinfo ? &info : 0))) {
+    fprintf (stderr, "Cannot open %s to compact\n", fname);
+    return -1;
+  }
+
+  /* pages are moved and the file is truncated on close */
+  ((ffdb_htab_t *)db->internal)->rearrange_pages = 1;
+  return (db->close) (db);
+}
+
+/**
+ * Statistics of an open database
+ */
+int
+ffdb_get_stats (const FFDB_DB* db, ffdb_stats_t* stats)
+{
+  ffdb_htab_t* hashp;
+  int rdonly;
+
+  if (!db || !stats) {
+    errno = EINVAL;
+    return -1;
+  }
+  hashp = (ffdb_htab_t *)db->internal;
+  rdonly = ((hashp->flags & O_ACCMODE) == O_RDONLY);
+
+  if (!rdonly)
+    FFDB_RDLOCK(hashp->table_lock);
+  stats->open_time = hashp->open_time;
+  stats->bsize = hashp->hdr.bsize;
+  stats->nbuckets = hashp->hdr.max_bucket + 1;
+  stats->nkeys = hashp->hdr.nkeys;
+  stats->lazy = hashp->lazy_open;
+  if (!rdonly)
+    FFDB_RWUNLOCK(hashp->table_lock);
+  return 0;
+}
+
+/**
+ * Where overflow pages of each level are
+ */
+int
+ffdb_get_level_pages (const FFDB_DB* db, ffdb_level_pages_t levels[],
+		      unsigned int* nlevels)
+{
+  ffdb_htab_t* hashp;
+  int rdonly, ret;
+
+  if (!db || !levels || !nlevels) {
+    errno = EINVAL;
+    return -1;
+  }
+  hashp = (ffdb_htab_t *)db->internal;
+  rdonly = ((hashp->flags & O_ACCMODE) == O_RDONLY);
+
+  if (!rdonly)
+    FFDB_RDLOCK(hashp->table_lock);
+  ret = ffdb_level_pages (hashp, levels, nlevels);
+  if (!rdonly)
+    FFDB_RWUNLOCK(hashp->table_lock);
+  return ret;
+}
+
+/**
+ * Check whether a key may be in a database
+ */
+int
+ffdb_key_may_exist (const FFDB_DB* db, const FFDB_DBT* key)
+{
+  ffdb_htab_t* hashp;
+  int rdonly, ret;
+
+  if (!db || !key) {
+    errno = EINVAL;
+    return -1;
+  }
+  hashp = (ffdb_htab_t *)db->internal;
+  rdonly = ((hashp->flags & O_ACCMODE) == O_RDONLY);
+
+  if (!rdonly)
+    FFDB_RDLOCK(hashp->table_lock);
+  ret = hashp->filter ? ffdb_filter_test (hashp->filter, key) : 1;
+  if (!rdonly)
+    FFDB_RWUNLOCK(hashp->table_lock);
+  return ret;
+}
+
+/**
+ * Get a built-in hash function
+ */
+unsigned int
+(*ffdb_hash_function (unsigned int hashid)) (const void* key, unsigned int len)
+{
+  if (hashid == FFDB_HASH_DEFAULT)
+    hashid = DEF_HASH_ID;
+  return __ffdb_builtin_hash (hashid);
+}
+
+/**
+ * Drop the in memory key directory
+ */
+int
+ffdb_keydir_close (FFDB_DB* db)
+{
+  ffdb_htab_t* hashp;
+
+  if (!db) {
+    errno = EINVAL;
+    return -1;
+  }
+  hashp = (ffdb_htab_t *)db->internal;
+  if (hashp->keydir) {
+    ffdb_keydir_free (hashp->keydir);
+    hashp->keydir = NULL;
+  }
+  return 0;
+}
+
+/**
+ * Split buckets into ranges for cursors
+ */
+int
+ffdb_bucket_ranges (const FFDB_DB* db, ffdb_bucket_range_t ranges[],
+		    unsigned int n)
+{
+  ffdb_htab_t* hashp;
+  unsigned long long nb;
+  unsigned int i, k;
+  int rdonly;
+
+  if (!db || !ranges || n == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  hashp = (ffdb_htab_t *)db->internal;
+  rdonly = ((hashp->flags & O_ACCMODE) == O_RDONLY);
+
+  if (!rdonly)
+    FFDB_RDLOCK(hashp->table_lock);
+  nb = (unsigned long long)hashp->hdr.max_bucket + 1;
+  if (!rdonly)
+    FFDB_RWUNLOCK(hashp->table_lock);
+
+  k = (nb < n) ? (unsigned int)nb : n;
+  for (i = 0; i < k; i++) {
+    ranges[i].first = (unsigned int)(i * nb / k);
+    ranges[i].last = (unsigned int)((i + 1) * nb / k - 1);
+  }
+  return (int)k;
+}
+
+/**
+ * Limit a key cursor to a range of buckets
+ */
+int
+ffdb_cursor_set_range (ffdb_cursor_t* cursor, const ffdb_bucket_range_t* range)
+{
+  ffdb_crs_t* icrs;
+
+  if (!cursor || !range || cursor->type != FFDB_KEY_CURSOR ||
+      range->first > range->last) {
+    fprintf (stderr, "Invalid bucket range or cursor type for a bucket range.\n");
+    errno = EINVAL;
+    return -1;
+  }
+  icrs = (ffdb_crs_t *)cursor->internal;
+
+  FFDB_LOCK(icrs->lock);
+  if (icrs->item.pagep) {
+    ffdb_put_page (icrs->hashp, icrs->item.pagep, TYPE(icrs->item.pagep), 0);
+    icrs->item.pagep = 0;
+  }
+  icrs->item.status = ITEM_CLEAN;
+  icrs->bulk_pending = 0;
+  icrs->first_bucket = range->first;
+  icrs->last_bucket = range->last;
+  FFDB_UNLOCK(icrs->lock);
+
+  return 0;
+}
+
+static int
+_ffdb_cursor_close (ffdb_cursor_t* cursor)
+{
+  ffdb_crs_t* inc = (ffdb_crs_t *)cursor->internal;
+  ffdb_htab_t* hashp = inc->hashp;
+
+  FFDB_LOCK(hashp->lock);
+  FFDB_TAILQ_REMOVE(&(hashp->curs_queue), inc, queue);
+  FFDB_UNLOCK(hashp->lock);
 
   /* Check whether there is a page need to be released */
   if (inc->item.pagep) {
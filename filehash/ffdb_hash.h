@@ -62,6 +62,23 @@ typedef enum {
 struct _ffdb_crs_;
 typedef struct _ffdb_crs_ ffdb_crs_t;
 
+struct _ffdb_keydir_;
+typedef struct _ffdb_keydir_ ffdb_keydir_t;
+
+struct _ffdb_filter_;
+typedef struct _ffdb_filter_ ffdb_filter_t;
+
+struct _ffdb_freemap_;
+typedef struct _ffdb_freemap_ ffdb_freemap_t;
+
+/**
+ * A data page open for new data items of a size class
+ */
+typedef struct ffdb_dpage {
+  pgno_t page;                  /* page number or INVALID_PGNO */
+  unsigned int start;           /* first free byte, 0 when full */
+} ffdb_dpage_t;
+
 /**
  * Hash Table Information 
  * This is stored in the first page of a hash based file
@@ -92,10 +109,22 @@ typedef struct hashhdr {	/* Disk resident portion */
   pgno_t spares[NCACHED];       /* indicating starting page number at this 
 				 * spliting stage
 				 */
-  pgno_t free_pages[NCACHED];   /* pages containing free pages information */
+  pgno_t free_pages[NCACHED];   /* pages containing free pages information
+				 * of each level. From version 9 on
+				 * free_pages[0] is the first free map page
+				 */
+  unsigned int hash_id;         /* built-in hash function (since version 8) */
   unsigned int chksum;          /* header crc checksum value */
 } ffdb_hashhdr_t;
 
+/**
+ * Headers before version 8 have no hash_id: their checksum is stored
+ * where hash_id is now
+ */
+#define HDR_CHKSUM_POS(version)						\
+  ((version) < FFDB_VERSION_8 ? offsetof(ffdb_hashhdr_t, hash_id) :	\
+   offsetof(ffdb_hashhdr_t, chksum))
+
 
 /**
  * Hash table definition
@@ -120,12 +149,39 @@ typedef struct htab {		/* Memory resident data structure */
   int	save_file;	        /* Indicates whether we need to flush file at
 				 * exit */
   pgno_t curr_dpage;            /* current data page number */
-  int   rearrange_pages;        /* rearrange pages to save disk space */
+  pgno_t ovfl_next;             /* next overflow page kept, not used  */
+  pgno_t ovfl_end;              /* page after overflow pages kept     */
+#define FFDB_DATA_CLASSES 3             /* small, medium and large data */
+#define FFDB_DATA_PAGES 4               /* open data pages of each class */
+  ffdb_dpage_t dpages[FFDB_DATA_CLASSES][FFDB_DATA_PAGES];
+  int   rearrange_pages;        /* rearrange pages on close (compact) */
   ffdb_pagepool_t *mp;		/* mpool for buffer management */
   pthread_mutex_t lock;		/* lock */
+  pthread_mutex_t alloc_lock;   /* lock for data pages, spares and free pages */
+  pthread_rwlock_t table_lock;  /* shared by get/put, exclusive to add buckets */
+#define FFDB_NUM_BUCKET_LOCKS 64        /* power of 2 */
+  pthread_mutex_t bucket_locks[FFDB_NUM_BUCKET_LOCKS]; /* insert locks */
+  pthread_mutex_t expand_lock;  /* held by a split and exclusive latch */
+  unsigned int split_old;       /* bucket being split                  */
+  unsigned int split_new;       /* bucket receiving keys of split_old  */
+  int splitting;                /* split_old and split_new are in use  */
+  pthread_t split_thread;       /* background bucket splitter          */
+  pthread_cond_t split_cond;    /* wakes the splitter, used with lock  */
+  pthread_cond_t split_done;    /* wakes inserts waiting on the queue  */
+#define FFDB_SPLIT_QUEUE 64             /* splits queued before inserts wait */
+  unsigned int split_pending;   /* bucket splits queued for splitter   */
+  int split_running;            /* splitter thread is running          */
+  int split_stop;               /* splitter finishes queue and exits   */
+  int split_failed;             /* a background split failed: db_errno */
                                 /* we changed the valid and invalid flag from version 5 to 6 */
   int data_valid_flag;          /* data valid flag used */
   int data_invalid_flag;        /* data invalid flag used */
+  ffdb_keydir_t *keydir;        /* in memory key directory (read only) */
+  ffdb_filter_t *filter;        /* bloom filter of all keys            */
+  ffdb_freemap_t *freemap;      /* free page bitmap (version 9 writer) */
+  int lazy_open;                /* opened with FFDB_OPEN_LAZY          */
+  int writer_ready;             /* free and data pages are found       */
+  double open_time;             /* seconds spent in open               */
 } ffdb_htab_t;
 
 
@@ -145,6 +201,24 @@ typedef struct hash_ent_ {
 } ffdb_hent_t;
 
 
+/**
+ * Streaming handle of a data item
+ */
+struct _ffdb_value_ {
+  ffdb_htab_t*          hashp;                 /* hash table       */
+  FFDB_DBT              key;                   /* private key copy */
+  int                   write;                 /* opened for write */
+  long                  size;                  /* data length      */
+  long                  pos;                   /* bytes done so far */
+  pgno_t                page;                  /* current data page */
+  unsigned int          start;                 /* data start on the page */
+  unsigned int          chksum;                /* checksum of bytes done */
+  unsigned int          stored_chksum;         /* checksum in data pointer */
+  unsigned char*        buffer;                /* copy of embedded data */
+  int                   extent;                /* pages after the first
+						* are in a row */
+};
+
 #define	ITEM_ERROR	-1
 #define ITEM_CLEAN      0
 #define	ITEM_OK		1
@@ -167,6 +241,17 @@ struct _ffdb_crs_
   ffdb_cursor_t *pcursor;
   /* Current key or data depending type of the cursor */
   ffdb_hent_t item;
+  /* Physical scan position of a data cursor: page, offset and index 
+   * of the next data header on the page 
+   */
+  pgno_t dpage;
+  unsigned int doff;
+  unsigned int dndx;
+  /* Buckets a key cursor is limited to */
+  pgno_t first_bucket;
+  pgno_t last_bucket;
+  /* The item the cursor is on has not been returned by a bulk get */
+  int bulk_pending;
   /* internal lock for the cursor */
   pthread_mutex_t lock;	
 };
@@ -183,6 +268,8 @@ struct _ffdb_crs_
 #define MIN_BUFFERS		6
 #define MINHDRSIZE		512
 #define DEF_CACHESIZE	        134217728       /* 2^27 default cache */
+#define DEF_DEXTSIZE	        262144          /* 2^18 data I/O unit */
+#define OVFL_RUN_PAGES		16		/* least overflow pages kept at once */
 #define DEF_BUCKET_SIZE		4096
 #define DEF_BUCKET_SHIFT	12		/* log2(BUCKET) */
 #define DEF_SEGSIZE		256
@@ -190,6 +277,8 @@ struct _ffdb_crs_
 #define DEF_DIRSIZE		256
 #define DEF_FFACTOR		65536
 #define MIN_FFACTOR		4
+#define DEF_HASH_ID		FFDB_HASH_WY	/* hash of new databases */
+#define INFO_IS_SET(I,B)	((I) && ((I)->rearrangepages & (B))) /* later field set */
 #define SPLTMAX			8
 #define CHARKEY			"%$sniglet^&"
 #define NUMKEY			1038583
@@ -251,6 +340,12 @@ struct _ffdb_crs_
 
 #define MAX_PAGES(H) (0xFFFFFFFF)
 
+/**
+ * Insert lock protecting a bucket and its overflow chain.
+ * Buckets are striped over a fixed number of locks
+ */
+#define FFDB_BUCKET_LOCK(H,B) ((H)->bucket_locks[(B) & (FFDB_NUM_BUCKET_LOCKS - 1)])
+
 /* Shorthands for accessing structure */
 #define METADATA_PGNO 0
 #define SPLIT_PGNO 0xFFFF
@@ -262,6 +357,11 @@ struct _ffdb_crs_
 extern unsigned int _ffdb_call_hash (ffdb_htab_t* hashp, const void* k, 
 				     unsigned int len);
 
+/**
+ * Bucket number of a hash value of a key
+ */
+extern unsigned int _ffdb_hash_bucket (ffdb_htab_t* hashp, unsigned int n);
+
 /**
  * Get a new page
  * This routine is always called before get_page
@@ -335,6 +435,248 @@ extern int ffdb_find_item (ffdb_htab_t* hashp,
 			   ffdb_hent_t* item);
 
 
+/**
+ * Find a set of keys all of which are hashed into the same bucket.
+ * Each page on the bucket chain is visited once.
+ *
+ * @param hashp the hash table pointer
+ * @param bucket the bucket all keys hashed into
+ * @param keys  array of n keys
+ * @param n     number of keys
+ * @param items hash entry information for each key. items[i].status is
+ * ITEM_OK if the key is found. No page is held on return
+ * @param datap copy of the data pointer for each key found
+ *
+ * @return 0 on success. -1 on failure
+ */
+extern int ffdb_find_items (ffdb_htab_t* hashp, unsigned int bucket,
+			    FFDB_DBT* keys[], unsigned int n,
+			    ffdb_hent_t* items, struct _ffdb_datap_* datap);
+
+/**
+ * Get data of an item found by ffdb_find_items
+ *
+ * @param hashp the hash table pointer
+ * @param item  hash entry found
+ * @param datap data pointer of this item
+ * @param val   returned data. Memory is allocated if val->data is null
+ *
+ * @return 0 on success. -1 on failure
+ */
+extern int ffdb_get_item_data (ffdb_htab_t* hashp, ffdb_hent_t* item,
+			       struct _ffdb_datap_* datap, FFDB_DBT* val);
+
+/**
+ * Get a view of the data item of an item found by ffdb_find_item.
+ * The page held by the item is released.
+ *
+ * @param hashp the hash table pointer
+ * @param item  hash entry found
+ * @param view  view of the data item
+ *
+ * @return 0 on success. -1 on failure
+ */
+extern int ffdb_get_item_view (ffdb_htab_t* hashp, ffdb_hent_t* item,
+			       ffdb_view_t* view);
+
+/**
+ * Release a view obtained from ffdb_get_item_view
+ *
+ * @param hashp the hash table pointer
+ * @param view  view of the data item
+ *
+ * @return 0 on success. -1 on failure
+ */
+extern int ffdb_release_item_view (ffdb_htab_t* hashp, ffdb_view_t* view);
+
+
+/**
+ * Copy a byte range of a data item into a buffer
+ *
+ * @param hashp the hash table pointer
+ * @param item  hash entry found
+ * @param offset where the range starts in the data item
+ * @param len   number of bytes to copy
+ * @param buf   buffer of at least len bytes
+ * @param datalen total length of the data item if not null
+ *
+ * @return 0 on success. -1 on failure
+ */
+extern int ffdb_get_item_range (ffdb_htab_t* hashp, ffdb_hent_t* item,
+				long offset, long len, void* buf,
+				long* datalen);
+
+
+/**
+ * Overwrite a byte range of a data item in place
+ *
+ * @param hashp the hash table pointer
+ * @param item  hash entry found
+ * @param offset where the range starts in the data item
+ * @param buf   new bytes of the range
+ * @param len   number of bytes to overwrite
+ *
+ * @return 0 on success. -1 on failure
+ */
+extern int ffdb_put_item_range (ffdb_htab_t* hashp, ffdb_hent_t* item,
+				long offset, const void* buf, long len);
+
+
+/**
+ * Start a streaming handle at the beginning of the data item found
+ * on the page held by item. Data embedded on the hash page are copied
+ * into the handle. The hash page held by item is released
+ *
+ * @param hashp the hash table pointer
+ * @param item  hash entry found
+ * @param value streaming handle
+ *
+ * @return 0 on success. -1 on failure
+ */
+extern int ffdb_value_start (ffdb_htab_t* hashp, ffdb_hent_t* item,
+			     ffdb_value_t* value);
+
+/**
+ * Copy the next len bytes of a streaming handle from or to the data
+ * pages depending on the direction of the handle
+ *
+ * @param hashp the hash table pointer
+ * @param value streaming handle
+ * @param buf   user buffer
+ * @param len   number of bytes to copy
+ *
+ * @return 0 on success. -1 on failure
+ */
+extern int ffdb_value_copy (ffdb_htab_t* hashp, ffdb_value_t* value,
+			    void* buf, long len);
+
+
+/**
+ * Routine called for every key visited by ffdb_scan_bucket
+ * with the key, the page and the index of the key and its data pointer.
+ * Returning non zero stops the scan
+ */
+typedef int (*ffdb_scan_func_t) (void* arg, const FFDB_DBT* key,
+				 pgno_t pgno, unsigned int idx,
+				 const struct _ffdb_datap_* datap);
+
+/**
+ * Visit all keys of a bucket on its bucket page and overflow pages
+ *
+ * @param hashp the hash table pointer
+ * @param bucket the bucket
+ * @param func routine called for every key
+ * @param arg argument passed to func
+ *
+ * @return 0 on success. -1 on failure
+ */
+extern int ffdb_scan_bucket (ffdb_htab_t* hashp, unsigned int bucket,
+			     ffdb_scan_func_t func, void* arg);
+
+/**
+ * Build the key directory of a read only table, loading it from
+ * a side file when the file matches the table
+ *
+ * @param hashp the hash table pointer
+ * @param fname side file name, or null
+ * @param nthreads number of threads scanning buckets
+ *
+ * @return 0 on success. -1 on failure
+ */
+extern int ffdb_keydir_build (ffdb_htab_t* hashp, const char* fname,
+			      unsigned int nthreads);
+
+/**
+ * Look up a key in the key directory. On success item holds the page
+ * and the index of the key, and datap its data pointer
+ *
+ * @return 0 on success. FFDB_NOT_FOUND if the key is not in the table
+ */
+extern int ffdb_keydir_find (ffdb_keydir_t* keydir, const FFDB_DBT* key,
+			     ffdb_hent_t* item, struct _ffdb_datap_* datap);
+
+/**
+ * Free the memory of a key directory
+ */
+extern void ffdb_keydir_free (ffdb_keydir_t* keydir);
+
+/**
+ * Build the key filter of a table, loading it from a side file when
+ * the file matches the table. The filter is saved by ffdb_filter_sync
+ *
+ * @param hashp the hash table pointer
+ * @param fname side file name, or null
+ * @param nthreads number of threads scanning buckets
+ *
+ * @return 0 on success. -1 on failure
+ */
+extern int ffdb_filter_build (ffdb_htab_t* hashp, const char* fname,
+			      unsigned int nthreads);
+
+/**
+ * Add a key into the key filter
+ */
+extern void ffdb_filter_add (ffdb_filter_t* filter, const FFDB_DBT* key);
+
+/**
+ * Check a key against the key filter
+ *
+ * @return 1 if the key may be in the table, 0 if it is not
+ */
+extern int ffdb_filter_test (ffdb_filter_t* filter, const FFDB_DBT* key);
+
+/**
+ * Check whether the key filter holds more keys than it was sized for
+ */
+extern int ffdb_filter_full (ffdb_filter_t* filter);
+
+/**
+ * Rebuild a full key filter twice as large. Caller holds the
+ * exclusive table latch
+ *
+ * @return 0 on success. -1 on failure
+ */
+extern int ffdb_filter_grow (ffdb_htab_t* hashp);
+
+/**
+ * Save the key filter into its side file if it has changed.
+ * The table file must be closed already
+ *
+ * @return 0 on success. -1 on failure
+ */
+extern int ffdb_filter_sync (ffdb_htab_t* hashp);
+
+/**
+ * Free the memory of a key filter
+ */
+extern void ffdb_filter_free (ffdb_filter_t* filter);
+
+/**
+ * Load the free page bitmap of a table opened for write
+ *
+ * @return 0 on success. -1 on failure
+ */
+extern int ffdb_freemap_open (ffdb_htab_t* hashp);
+
+/**
+ * Write changed parts of the free page bitmap onto free map pages
+ *
+ * @return 0 on success. -1 on failure
+ */
+extern int ffdb_freemap_sync (ffdb_htab_t* hashp);
+
+/**
+ * Write changed parts of the free page bitmap out to the file
+ *
+ * @return 0 on success. -1 on failure
+ */
+extern int ffdb_freemap_flush (ffdb_htab_t* hashp);
+
+/**
+ * Free the memory of a free page bitmap
+ */
+extern void ffdb_freemap_free (ffdb_freemap_t* freemap);
+
 /**
  * Get item from database. The item contains page and index 
  * information obtained from ffdb_find_item call
@@ -441,10 +783,40 @@ extern void ffdb_reduce_filesize (ffdb_htab_t* hashp);
  * @param hashp the usual hash table pointer
  * @param start we are looking for the data page from start backward
  *
- * @return last data page number
+ * @return last data page number or INVALID_PGNO if this level has none
  */
 extern pgno_t ffdb_last_data_page (ffdb_htab_t* hashp, pgno_t start);
 
+/**
+ * Open a data page found in the file for data items of a size class
+ *
+ * @param hashp the usual hash table pointer
+ * @param dclass size class of data going onto this page
+ * @param page data page number
+ */
+extern void ffdb_reopen_data_page (ffdb_htab_t* hashp, unsigned int dclass,
+				   pgno_t page);
+
+/**
+ * Give back overflow pages kept but not used by this writer
+ *
+ * @param hashp the usual hash table pointer
+ */
+extern void ffdb_release_ovfl_run (ffdb_htab_t* hashp);
+
+/**
+ * Find where overflow pages of each level are
+ *
+ * @param hashp the usual hash table pointer
+ * @param levels information of each level returned
+ * @param nlevels number of elements of levels on input. Number of levels
+ * filled on return
+ *
+ * @return 0 on success. -1 on failure with a proper errno set
+ */
+extern int ffdb_level_pages (ffdb_htab_t* hashp, ffdb_level_pages_t levels[],
+			     unsigned int* nlevels);
+
 
 /**
  * Set configuration information
@@ -519,6 +891,21 @@ extern int ffdb_cursor_find_by_key (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
 				    FFDB_DBT* key, FFDB_DBT* data,
 				    unsigned int flags);
 
+/**
+ * Cursor Get routine visiting data pages in physical order
+ */
+extern int ffdb_cursor_find_by_data (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
+				     FFDB_DBT* key, FFDB_DBT* data,
+				     unsigned int flags);
+
+/**
+ * Pack key and data of the item a cursor is positioned on into a buffer
+ * Both cursor find routines only position the cursor if key is null
+ */
+extern int ffdb_cursor_copy_item (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
+				  int keysonly, unsigned char* buf, 
+				  unsigned long space, unsigned long* size);
+
 
 
 /**
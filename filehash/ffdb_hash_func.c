@@ -265,6 +265,137 @@ __ham_func5(
   return (h);
 }
 
+/**
+ * 64 bit Fowler/Noll/Vo FNV-1a hash used by in memory key tables
+ */
+unsigned long long
+__ffdb_hash64 (const void* key, unsigned int len)
+{
+  const unsigned char *k, *e;
+  unsigned long long h;
+
+  k = key;
+  e = k + len;
+  for (h = 0xcbf29ce484222325ULL; k < e; ++k) {
+    h ^= *k;
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+/**
+ * Constants of the multiply-mix hash below. They are the same as
+ * the ones used by wyhash
+ */
+#define WY_P0 0xa0761d6478bd642fULL
+#define WY_P1 0xe7037ed1a0b428dbULL
+#define WY_P2 0x8ebc6af09c88c6e3ULL
+#define WY_P3 0x589965cc75374cc3ULL
+
+/**
+ * Multiply two 64 bit numbers and fold the 128 bit product
+ */
+static inline unsigned long long
+_ffdb_wymix (unsigned long long a, unsigned long long b)
+{
+#ifdef __SIZEOF_INT128__
+  __uint128_t r = (__uint128_t)a * b;
+  return (unsigned long long)r ^ (unsigned long long)(r >> 64);
+#else
+  unsigned long long ha, hb, la, lb, rh, rm0, rm1, rl, t, lo, c;
+
+  ha = a >> 32; hb = b >> 32; la = (unsigned int)a; lb = (unsigned int)b;
+  rh = ha * hb; rm0 = ha * lb; rm1 = hb * la; rl = la * lb;
+  t = rl + (rm0 << 32); c = t < rl;
+  lo = t + (rm1 << 32); c += lo < t;
+  return lo ^ (rh + (rm0 >> 32) + (rm1 >> 32) + c);
+#endif
+}
+
+/**
+ * Read little endian numbers so that the hash values do not depend on
+ * the byte order of the machine. Compilers turn these into single loads
+ */
+static inline unsigned long long
+_ffdb_wyr8 (const unsigned char* p)
+{
+  return (unsigned long long)p[0] | ((unsigned long long)p[1] << 8) |
+    ((unsigned long long)p[2] << 16) | ((unsigned long long)p[3] << 24) |
+    ((unsigned long long)p[4] << 32) | ((unsigned long long)p[5] << 40) |
+    ((unsigned long long)p[6] << 48) | ((unsigned long long)p[7] << 56);
+}
+
+static inline unsigned long long
+_ffdb_wyr4 (const unsigned char* p)
+{
+  return (unsigned long long)p[0] | ((unsigned long long)p[1] << 8) |
+    ((unsigned long long)p[2] << 16) | ((unsigned long long)p[3] << 24);
+}
+
+/**
+ * 64 bit multiply-mix hash in the style of wyhash. Keys are consumed
+ * 8 bytes at a time. Keys longer than 48 bytes are hashed by three
+ * independent lanes which the processor runs in parallel
+ */
+unsigned long long
+__ffdb_wyhash64 (const void* key, unsigned int len, unsigned long long seed)
+{
+  const unsigned char *p;
+  unsigned long long a, b, s1, s2;
+  unsigned int i;
+
+  p = key;
+  seed ^= WY_P0;
+  if (len <= 16) {
+    if (len >= 4) {
+      a = (_ffdb_wyr4 (p) << 32) | _ffdb_wyr4 (p + ((len >> 3) << 2));
+      b = (_ffdb_wyr4 (p + len - 4) << 32) |
+	_ffdb_wyr4 (p + len - 4 - ((len >> 3) << 2));
+    }
+    else if (len > 0) {
+      a = ((unsigned long long)p[0] << 16) |
+	((unsigned long long)p[len >> 1] << 8) | p[len - 1];
+      b = 0;
+    }
+    else
+      a = b = 0;
+  }
+  else {
+    i = len;
+    if (i > 48) {
+      s1 = s2 = seed;
+      do {
+	seed = _ffdb_wymix (_ffdb_wyr8 (p) ^ WY_P1, _ffdb_wyr8 (p + 8) ^ seed);
+	s1 = _ffdb_wymix (_ffdb_wyr8 (p + 16) ^ WY_P2, _ffdb_wyr8 (p + 24) ^ s1);
+	s2 = _ffdb_wymix (_ffdb_wyr8 (p + 32) ^ WY_P3, _ffdb_wyr8 (p + 40) ^ s2);
+	p += 48;
+	i -= 48;
+      } while (i > 48);
+      seed ^= s1 ^ s2;
+    }
+    while (i > 16) {
+      seed = _ffdb_wymix (_ffdb_wyr8 (p) ^ WY_P1, _ffdb_wyr8 (p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+    a = _ffdb_wyr8 (p + i - 16);
+    b = _ffdb_wyr8 (p + i - 8);
+  }
+  return _ffdb_wymix (WY_P1 ^ len, _ffdb_wymix (a ^ WY_P1, b ^ seed));
+}
+
+/**
+ * 32 bit version of the above hash used to find buckets
+ */
+unsigned int
+__ffdb_wyhash (const void* key, unsigned int len)
+{
+  unsigned long long h;
+
+  h = __ffdb_wyhash64 (key, len, 0);
+  return (unsigned int)(h ^ (h >> 32));
+}
+
 /*
  * __ham_test --
  *
@@ -332,6 +463,22 @@ unsigned int (*__ffdb_default_hash)(const void* key, unsigned int len) = __ham_f
  */
 int (*__ffdb_default_cmp)(const FFDB_DBT *a, const FFDB_DBT *b)= __ham_defcmp;
 
+/**
+ * Find a built-in hash function from its identifier
+ */
+unsigned int
+(*__ffdb_builtin_hash (unsigned int hashid)) (const void* key, unsigned int len)
+{
+  switch (hashid) {
+  case FFDB_HASH_FNV:
+    return __ham_func5;
+  case FFDB_HASH_WY:
+    return __ffdb_wyhash;
+  default:
+    return 0;
+  }
+}
+
 
 
 
@@ -347,6 +494,51 @@ static int _ffdb_crc32_inited = 0;
 
 #define _CRC32POLY (unsigned int)0xedb88320
 
+/**
+ * x^(2^k) modulo the crc polynomial for k = 0, ..., 31
+ */
+static unsigned int _ffdb_crc_x2n_table[32];
+
+/**
+ * Multiply two polynomials modulo the crc polynomial (reflected)
+ */
+static unsigned int
+_ffdb_crc32_multmodp (unsigned int a, unsigned int b)
+{
+  unsigned int m, p;
+
+  m = (unsigned int)1 << 31;
+  p = 0;
+  for (;;) {
+    if (a & m) {
+      p ^= b;
+      if ((a & (m - 1)) == 0)
+	break;
+    }
+    m >>= 1;
+    b = (b & 1) ? (b >> 1) ^ _CRC32POLY : b >> 1;
+  }
+  return p;
+}
+
+/**
+ * x^(n * 2^k) modulo the crc polynomial
+ */
+static unsigned int
+_ffdb_crc32_x2nmodp (long n, unsigned int k)
+{
+  unsigned int p;
+
+  p = (unsigned int)1 << 31;           /* x^0 == 1 */
+  while (n) {
+    if (n & 1)
+      p = _ffdb_crc32_multmodp (_ffdb_crc_x2n_table[k & 31], p);
+    n >>= 1;
+    k++;
+  }
+  return p;
+}
+
 /**
  * This routine initialize the CRC table above
  */
@@ -362,6 +554,11 @@ void __ffdb_crc32_init (void)
       for (j = 0; j < 256; j += 2 * i)
 	_ffdb_crc_table[i + j] = _ffdb_crc_table[j] ^ h;
     }
+
+    h = (unsigned int)1 << 30;         /* x^1 */
+    _ffdb_crc_x2n_table[0] = h;
+    for (i = 1; i < 32; i++)
+      _ffdb_crc_x2n_table[i] = h = _ffdb_crc32_multmodp (h, h);
     _ffdb_crc32_inited = 1;
   }
 }
@@ -380,6 +577,28 @@ __ffdb_crc32_checksum (unsigned int crc, const unsigned char* buf,
   return crc ^ 0xffffffff;
 }
 
+/**
+ * Update crc32 checksum of a buffer when len bytes followed by tail 
+ * bytes are changed from oldbuf to newbuf. Only the changed bytes
+ * are visited.
+ */
+unsigned int 
+__ffdb_crc32_update (unsigned int crc, const unsigned char* oldbuf,
+		     const unsigned char* newbuf, long len, long tail)
+{
+  unsigned int delta = 0;
+
+  /* crc is linear: crc(a) ^ crc(b) = crc0(a ^ b) for equal lengths */
+  while (len--)
+    delta = (delta >> 8) ^ _ffdb_crc_table[(delta ^ *oldbuf++ ^ *newbuf++) & 0xff];
+
+  /* shift the difference over the unchanged tail bytes */
+  if (delta && tail > 0)
+    delta = _ffdb_crc32_multmodp (_ffdb_crc32_x2nmodp (tail, 3), delta);
+
+  return crc ^ delta;
+}
+
 
 
 
@@ -49,11 +49,17 @@ extern unsigned int __ham_func2(const void* key, unsigned int len);
 extern unsigned int __ham_func3(const void* key, unsigned int len);
 extern unsigned int __ham_func4(const void* key, unsigned int len);
 extern unsigned int __ham_func5(const void* key, unsigned int len);
+extern unsigned long long __ffdb_hash64(const void* key, unsigned int len);
+extern unsigned long long __ffdb_wyhash64(const void* key, unsigned int len,
+					  unsigned long long seed);
+extern unsigned int __ffdb_wyhash(const void* key, unsigned int len);
 extern unsigned int __ffdb_log2(unsigned int num);
 extern int          __ham_defcmp(const FFDB_DBT* a, const FFDB_DBT* b);
 
 extern unsigned int (*__ffdb_default_hash)(const void* key, unsigned int len);
 extern int (*__ffdb_default_cmp)(const FFDB_DBT *a, const FFDB_DBT *b);
+extern unsigned int (*__ffdb_builtin_hash (unsigned int hashid))
+  (const void* key, unsigned int len);
 
 extern void __ffdb_crc32_init (void);
 
@@ -61,4 +67,9 @@ extern unsigned int  __ffdb_crc32_checksum (unsigned int crc,
 					    const unsigned char* buffer,
 					    long len);
 
+extern unsigned int  __ffdb_crc32_update (unsigned int crc,
+					  const unsigned char* oldbuf,
+					  const unsigned char* newbuf,
+					  long len, long tail);
+
 #endif
@@ -0,0 +1,517 @@
+/**
+ * Copyright (C) <2008> Jefferson Science Associates, LLC
+ *                      Under U.S. DOE Contract No. DE-AC05-06OR23177
+ *
+ *                      Thomas Jefferson National Accelerator Facility
+ *
+ *                      Jefferson Lab
+ *                      Scientific Computing Group,
+ *                      12000 Jefferson Ave.,
+ *                      Newport News, VA 23606
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ----------------------------------------------------------------------------
+ * Description:
+ *     In memory key directory of a read only hash table
+ *
+ *     Every key is mapped to the page and index where the key lives
+ *     and to its data pointer, so that a lookup goes straight to the
+ *     data page without walking the bucket and its overflow pages.
+ *     The directory is built by scanning all buckets with several
+ *     threads, and can be saved into a side file which is loaded
+ *     as long as the table file has not been changed.
+ *
+ * Author:
+ *     Jie Chen
+ *     Scientific Computing Group
+ *     Jefferson Lab
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "ffdb_db.h"
+#include "ffdb_pagepool.h"
+#include "ffdb_page.h"
+#include "ffdb_hash_func.h"
+#include "ffdb_hash.h"
+
+/**
+ * Side file magic number and version
+ */
+#define FFDB_KEYDIR_MAGIC   0xcece5151
+#define FFDB_KEYDIR_VERSION 1
+
+/**
+ * One slot of the directory
+ */
+typedef struct _ffdb_kdent_
+{
+  unsigned long long hash;      /* 64 bit hash of the key            */
+  unsigned long koff;           /* offset of the key in key space    */
+  unsigned int ksize;           /* key size                          */
+  pgno_t key_page;              /* page of the key, INVALID_PGNO for
+				   an empty slot                     */
+  unsigned int key_idx;         /* index of the key on the page      */
+  ffdb_datap_t datap;           /* data pointer of the key           */
+}ffdb_kdent_t;
+
+struct _ffdb_keydir_
+{
+  unsigned long nslots;         /* number of slots: power of 2       */
+  unsigned long nkeys;          /* number of keys                    */
+  ffdb_kdent_t* slots;          /* open addressing slots             */
+  unsigned char* keys;          /* all keys one after another        */
+  unsigned long keylen;         /* bytes of all keys                 */
+};
+
+/**
+ * Header of a side file followed by all slots and all keys
+ */
+typedef struct _ffdb_keydir_hdr_
+{
+  unsigned int magic;
+  unsigned int version;
+  unsigned int hdr_chksum;      /* header checksum of the table      */
+  unsigned int hdr_nkeys;       /* number of keys of the table       */
+  unsigned long long fsize;     /* size of the table file            */
+  long long mtime;              /* modification time of the table    */
+  long long mtime_nsec;
+  unsigned long long ino;       /* inode of the table file           */
+  unsigned long long nslots;
+  unsigned long long nkeys;
+  unsigned long long keylen;
+}ffdb_keydir_hdr_t;
+
+/**
+ * Keys and slots collected by one scanning thread
+ */
+typedef struct _ffdb_keydir_part_
+{
+  ffdb_htab_t* hashp;
+  unsigned int first, last;     /* bucket range                      */
+  ffdb_kdent_t* ents;
+  unsigned long nents, maxents;
+  unsigned char* keys;
+  unsigned long keylen, maxkeylen;
+  int status;
+}ffdb_keydir_part_t;
+
+/**
+ * Add a key found by a bucket scan to a part of the directory
+ */
+static int
+_ffdb_keydir_add (void* arg, const FFDB_DBT* key, pgno_t pgno,
+		  unsigned int idx, const ffdb_datap_t* datap)
+{
+  ffdb_keydir_part_t* part = (ffdb_keydir_part_t *)arg;
+  ffdb_kdent_t* ent;
+
+  if (part->nents == part->maxents) {
+    part->maxents = (part->maxents == 0) ? 1024 : 2 * part->maxents;
+    ent = (ffdb_kdent_t *)realloc (part->ents,
+				   part->maxents * sizeof (ffdb_kdent_t));
+    if (!ent) {
+      part->status = -1;
+      return 1;
+    }
+    part->ents = ent;
+  }
+  if (part->keylen + key->size > part->maxkeylen) {
+    unsigned char* keys;
+    unsigned long newlen = (part->maxkeylen == 0) ? 65536 : 2 * part->maxkeylen;
+
+    while (newlen < part->keylen + key->size)
+      newlen *= 2;
+    keys = (unsigned char *)realloc (part->keys, newlen);
+    if (!keys) {
+      part->status = -1;
+      return 1;
+    }
+    part->keys = keys;
+    part->maxkeylen = newlen;
+  }
+
+  ent = &part->ents[part->nents++];
+  memset (ent, 0, sizeof (ffdb_kdent_t));
+  ent->hash = __ffdb_hash64 (key->data, key->size);
+  ent->koff = part->keylen;
+  ent->ksize = key->size;
+  ent->key_page = pgno;
+  ent->key_idx = idx;
+  memcpy (&ent->datap, datap, sizeof (ffdb_datap_t));
+
+  memcpy (part->keys + part->keylen, key->data, key->size);
+  part->keylen += key->size;
+  return 0;
+}
+
+/**
+ * Scanning thread walking a range of buckets
+ */
+static void*
+_ffdb_keydir_scan (void* arg)
+{
+  ffdb_keydir_part_t* part = (ffdb_keydir_part_t *)arg;
+  unsigned int bucket;
+
+  for (bucket = part->first; bucket <= part->last && part->status == 0;
+       bucket++) {
+    if (ffdb_scan_bucket (part->hashp, bucket, _ffdb_keydir_add, part) != 0)
+      part->status = -1;
+  }
+  return 0;
+}
+
+/**
+ * Put a slot into the open addressing table
+ */
+static void
+_ffdb_keydir_insert (ffdb_keydir_t* keydir, const ffdb_kdent_t* ent)
+{
+  unsigned long i, mask;
+
+  mask = keydir->nslots - 1;
+  i = (unsigned long)ent->hash & mask;
+  while (keydir->slots[i].key_page != INVALID_PGNO)
+    i = (i + 1) & mask;
+  memcpy (&keydir->slots[i], ent, sizeof (ffdb_kdent_t));
+}
+
+/**
+ * Allocate an empty directory for nkeys keys of keylen bytes
+ */
+static ffdb_keydir_t*
+_ffdb_keydir_alloc (unsigned long nslots, unsigned long keylen)
+{
+  ffdb_keydir_t* keydir;
+  unsigned long i;
+
+  keydir = (ffdb_keydir_t *)calloc (1, sizeof (ffdb_keydir_t));
+  if (!keydir)
+    return 0;
+  keydir->nslots = nslots;
+  keydir->slots = (ffdb_kdent_t *)calloc (nslots, sizeof (ffdb_kdent_t));
+  keydir->keys = (unsigned char *)malloc (keylen > 0 ? keylen : 1);
+  if (!keydir->slots || !keydir->keys) {
+    ffdb_keydir_free (keydir);
+    return 0;
+  }
+  for (i = 0; i < nslots; i++)
+    keydir->slots[i].key_page = INVALID_PGNO;
+  keydir->keylen = keylen;
+  return keydir;
+}
+
+/**
+ * Fill in what identifies the table a side file belongs to
+ */
+static int
+_ffdb_keydir_ident (ffdb_htab_t* hashp, ffdb_keydir_hdr_t* hdr)
+{
+  struct stat st;
+
+  memset (hdr, 0, sizeof (ffdb_keydir_hdr_t));
+  if (fstat (hashp->fp, &st) != 0)
+    return -1;
+  hdr->magic = FFDB_KEYDIR_MAGIC;
+  hdr->version = FFDB_KEYDIR_VERSION;
+  hdr->hdr_chksum = hashp->hdr.chksum;
+  hdr->hdr_nkeys = hashp->hdr.nkeys;
+  hdr->fsize = (unsigned long long)st.st_size;
+  hdr->mtime = (long long)st.st_mtim.tv_sec;
+  hdr->mtime_nsec = (long long)st.st_mtim.tv_nsec;
+  hdr->ino = (unsigned long long)st.st_ino;
+  return 0;
+}
+
+/**
+ * Read or write exactly len bytes
+ */
+static int
+_ffdb_keydir_io (int fd, void* buf, unsigned long len, int write_it)
+{
+  unsigned char* p = (unsigned char *)buf;
+  ssize_t ret;
+
+  while (len > 0) {
+    if (write_it)
+      ret = write (fd, p, len);
+    else
+      ret = read (fd, p, len);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret <= 0)
+      return -1;
+    p += ret;
+    len -= ret;
+  }
+  return 0;
+}
+
+/**
+ * Load a directory from a side file matching the table
+ */
+static ffdb_keydir_t*
+_ffdb_keydir_load (ffdb_htab_t* hashp, const char* fname)
+{
+  ffdb_keydir_hdr_t hdr, ident;
+  ffdb_keydir_t* keydir;
+  int fd;
+
+  if (_ffdb_keydir_ident (hashp, &ident) != 0)
+    return 0;
+
+  fd = open (fname, O_RDONLY);
+  if (fd < 0)
+    return 0;
+
+  if (_ffdb_keydir_io (fd, &hdr, sizeof (hdr), 0) != 0 ||
+      hdr.magic != ident.magic || hdr.version != ident.version ||
+      hdr.hdr_chksum != ident.hdr_chksum || hdr.hdr_nkeys != ident.hdr_nkeys ||
+      hdr.fsize != ident.fsize || hdr.mtime != ident.mtime ||
+      hdr.mtime_nsec != ident.mtime_nsec || hdr.ino != ident.ino ||
+      hdr.nslots == 0 || (hdr.nslots & (hdr.nslots - 1)) != 0) {
+    /* out of date or not a side file */
+    close (fd);
+    return 0;
+  }
+
+  keydir = _ffdb_keydir_alloc (hdr.nslots, hdr.keylen);
+  if (!keydir) {
+    close (fd);
+    return 0;
+  }
+  keydir->nkeys = hdr.nkeys;
+  if (_ffdb_keydir_io (fd, keydir->slots,
+		       keydir->nslots * sizeof (ffdb_kdent_t), 0) != 0 ||
+      _ffdb_keydir_io (fd, keydir->keys, keydir->keylen, 0) != 0) {
+    fprintf (stderr, "Cannot read key directory file %s\n", fname);
+    ffdb_keydir_free (keydir);
+    keydir = 0;
+  }
+  close (fd);
+  return keydir;
+}
+
+/**
+ * Save a directory into a side file. The file is replaced atomically
+ */
+static int
+_ffdb_keydir_save (ffdb_htab_t* hashp, ffdb_keydir_t* keydir,
+		   const char* fname)
+{
+  ffdb_keydir_hdr_t hdr;
+  char* tmpname;
+  int fd, status;
+
+  if (_ffdb_keydir_ident (hashp, &hdr) != 0)
+    return -1;
+  hdr.nslots = keydir->nslots;
+  hdr.nkeys = keydir->nkeys;
+  hdr.keylen = keydir->keylen;
+
+  tmpname = (char *)malloc (strlen (fname) + 32);
+  if (!tmpname)
+    return -1;
+  sprintf (tmpname, "%s.%d", fname, (int)getpid ());
+  fd = open (tmpname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    fprintf (stderr, "Cannot create key directory file %s\n", tmpname);
+    free (tmpname);
+    return -1;
+  }
+
+  status = 0;
+  if (_ffdb_keydir_io (fd, &hdr, sizeof (hdr), 1) != 0 ||
+      _ffdb_keydir_io (fd, keydir->slots,
+		       keydir->nslots * sizeof (ffdb_kdent_t), 1) != 0 ||
+      _ffdb_keydir_io (fd, keydir->keys, keydir->keylen, 1) != 0)
+    status = -1;
+  if (close (fd) != 0)
+    status = -1;
+  if (status == 0 && rename (tmpname, fname) != 0)
+    status = -1;
+  if (status != 0) {
+    fprintf (stderr, "Cannot write key directory file %s\n", fname);
+    unlink (tmpname);
+  }
+  free (tmpname);
+  return status;
+}
+
+/**
+ * Build a directory by scanning all buckets with several threads
+ */
+static ffdb_keydir_t*
+_ffdb_keydir_scan_all (ffdb_htab_t* hashp, unsigned int nthreads)
+{
+  ffdb_keydir_part_t* parts;
+  pthread_t* tids;
+  ffdb_keydir_t* keydir;
+  unsigned long long nb;
+  unsigned long nkeys, keylen, nslots, base, k;
+  unsigned int i;
+  int status;
+
+  nb = (unsigned long long)hashp->hdr.max_bucket + 1;
+  if (nthreads == 0)
+    nthreads = 1;
+  if (nthreads > nb)
+    nthreads = (unsigned int)nb;
+
+  parts = (ffdb_keydir_part_t *)calloc (nthreads, sizeof (ffdb_keydir_part_t));
+  tids = (pthread_t *)calloc (nthreads, sizeof (pthread_t));
+  if (!parts || !tids) {
+    free (parts);
+    free (tids);
+    return 0;
+  }
+
+  for (i = 0; i < nthreads; i++) {
+    parts[i].hashp = hashp;
+    parts[i].first = (unsigned int)(i * nb / nthreads);
+    parts[i].last = (unsigned int)((i + 1) * nb / nthreads - 1);
+    if (pthread_create (&tids[i], 0, _ffdb_keydir_scan, &parts[i]) != 0) {
+      /* scan this range here instead */
+      _ffdb_keydir_scan (&parts[i]);
+      tids[i] = pthread_self ();
+    }
+  }
+  for (i = 0; i < nthreads; i++) {
+    if (!pthread_equal (tids[i], pthread_self ()))
+      pthread_join (tids[i], 0);
+  }
+
+  status = 0;
+  nkeys = keylen = 0;
+  for (i = 0; i < nthreads; i++) {
+    if (parts[i].status != 0)
+      status = -1;
+    nkeys += parts[i].nents;
+    keylen += parts[i].keylen;
+  }
+
+  keydir = 0;
+  if (status == 0) {
+    /* keep the table at most half full */
+    nslots = 16;
+    while (nslots < 2 * nkeys)
+      nslots *= 2;
+    keydir = _ffdb_keydir_alloc (nslots, keylen);
+  }
+  if (keydir) {
+    base = 0;
+    for (i = 0; i < nthreads; i++) {
+      memcpy (keydir->keys + base, parts[i].keys, parts[i].keylen);
+      for (k = 0; k < parts[i].nents; k++) {
+	parts[i].ents[k].koff += base;
+	_ffdb_keydir_insert (keydir, &parts[i].ents[k]);
+      }
+      base += parts[i].keylen;
+    }
+    keydir->nkeys = nkeys;
+  }
+
+  for (i = 0; i < nthreads; i++) {
+    free (parts[i].ents);
+    free (parts[i].keys);
+  }
+  free (parts);
+  free (tids);
+  return keydir;
+}
+
+/**
+ * Build the key directory of a read only table
+ */
+int
+ffdb_keydir_build (ffdb_htab_t* hashp, const char* fname,
+		   unsigned int nthreads)
+{
+  ffdb_keydir_t* keydir;
+
+  keydir = 0;
+  if (fname)
+    keydir = _ffdb_keydir_load (hashp, fname);
+
+  if (!keydir) {
+    keydir = _ffdb_keydir_scan_all (hashp, nthreads);
+    if (!keydir) {
+      fprintf (stderr, "Cannot build key directory\n");
+      errno = ENOMEM;
+      return -1;
+    }
+    /* a directory that cannot be saved is still usable */
+    if (fname)
+      (void)_ffdb_keydir_save (hashp, keydir, fname);
+  }
+
+  if (hashp->keydir)
+    ffdb_keydir_free (hashp->keydir);
+  hashp->keydir = keydir;
+  return 0;
+}
+
+/**
+ * Look up a key in the key directory
+ */
+int
+ffdb_keydir_find (ffdb_keydir_t* keydir, const FFDB_DBT* key,
+		  ffdb_hent_t* item, ffdb_datap_t* datap)
+{
+  unsigned long long h;
+  unsigned long i, mask;
+  ffdb_kdent_t* ent;
+
+  h = __ffdb_hash64 (key->data, key->size);
+  mask = keydir->nslots - 1;
+  i = (unsigned long)h & mask;
+  while (keydir->slots[i].key_page != INVALID_PGNO) {
+    ent = &keydir->slots[i];
+    if (ent->hash == h && ent->ksize == (unsigned int)key->size &&
+	memcmp (keydir->keys + ent->koff, key->data, key->size) == 0) {
+      memset (item, 0, sizeof (ffdb_hent_t));
+      item->pgno = ent->key_page;
+      item->pgndx = ent->key_idx;
+      item->status = ITEM_OK;
+      memcpy (datap, &ent->datap, sizeof (ffdb_datap_t));
+      return 0;
+    }
+    i = (i + 1) & mask;
+  }
+  return FFDB_NOT_FOUND;
+}
+
+/**
+ * Free the memory of a key directory
+ */
+void
+ffdb_keydir_free (ffdb_keydir_t* keydir)
+{
+  if (!keydir)
+    return;
+  free (keydir->slots);
+  free (keydir->keys);
+  free (keydir);
+}
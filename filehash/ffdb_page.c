@@ -65,6 +65,8 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
 #include <assert.h>
 #include "ffdb_db.h"
 #include "ffdb_page.h"
@@ -75,6 +77,10 @@
  * get next data page number either a new or reuse from a free page
  */
 static pgno_t _ffdb_data_page (ffdb_htab_t* hashp, int new_page, int* reuse);
+/* new_page value asking for the page right after the last allocated one */
+#define FFDB_EXTENT_PAGE 2
+/* data page to be opened by a size class of data */
+static pgno_t _ffdb_open_data_page (ffdb_htab_t* hashp, int* reuse);
 static pgno_t _ffdb_ovfl_page (ffdb_htab_t* hashp, int* reuse);
 
 #ifdef _FFDB_STATISTICS
@@ -238,6 +244,7 @@ _ffdb_init_page (ffdb_htab_t* hashp, void* p, pgno_t page,
     OFFSET(p) = BIG_PAGE_OVERHEAD;
     break;
   case HASH_FREE_PAGE:
+  case HASH_FREEMAP_PAGE:
     OFFSET(p) = 0;
     /* Not using offset: actually just pad */
     break;
@@ -400,6 +407,170 @@ ffdb_pgout_routine (void* arg, pgno_t pgno, void* page)
 }
 
 
+/**
+ * Maximum number of pages read by a single preadv of an extent
+ */
+#define FFDB_EXTENT_IOV_PAGES 512
+
+/**
+ * Whether pages after the first page of a data item can be read 
+ * directly from the file as one extent
+ *
+ * Pages in the cache of a read only database are never dirty, and
+ * page headers can be checked without byte swapping
+ */
+#define FFDB_DIRECT_EXTENT(hashp, offset)				\
+  ((hashp)->hdr.version > FFDB_VERSION_5 && IS_EXTENT(offset) &&	\
+   ((hashp)->flags & O_ACCMODE) == O_RDONLY &&				\
+   (hashp)->hdr.lorder == (hashp)->mborder)
+
+/**
+ * Read rlen bytes of data held by an extent of pages starting at page
+ * first straight from the file with preadv: page headers go to a 
+ * scratch buffer and data goes to dst. 
+ *
+ * The page headers are checked so that an extent broken by page 
+ * rearrangement is detected, in which case the caller walks the page
+ * chain instead.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+static int
+_ffdb_read_extent (ffdb_htab_t* hashp, pgno_t first, pgno_t prev,
+		   unsigned char* dst, long rlen)
+{
+  struct iovec iov[2 * FFDB_EXTENT_IOV_PAGES];
+  unsigned char* hdrs;
+  pgno_t page;
+  long cap, len, total;
+  ssize_t nread;
+  int i, n, status = 0;
+
+  hdrs = (unsigned char *)malloc (FFDB_EXTENT_IOV_PAGES * BIG_PAGE_OVERHEAD);
+  if (!hdrs)
+    return -1;
+
+  cap = hashp->hdr.bsize - BIG_PAGE_OVERHEAD;
+  page = first;
+  while (rlen > 0 && status == 0) {
+    /* set up one batch of pages */
+    total = 0;
+    for (n = 0; n < FFDB_EXTENT_IOV_PAGES && rlen > 0; n++) {
+      len = (rlen < cap) ? rlen : cap;
+      iov[2 * n].iov_base = hdrs + n * BIG_PAGE_OVERHEAD;
+      iov[2 * n].iov_len = BIG_PAGE_OVERHEAD;
+      iov[2 * n + 1].iov_base = dst;
+      iov[2 * n + 1].iov_len = len;
+      total += BIG_PAGE_OVERHEAD + len;
+      dst += len;
+      rlen -= len;
+    }
+
+    nread = preadv (hashp->fp, iov, 2 * n, 
+		    (off_t)page * hashp->hdr.bsize);
+    if (nread != total) {
+      status = -1;
+      break;
+    }
+
+    /* check every page header of this batch */
+    for (i = 0; i < n; i++, page++) {
+      void* p = hdrs + i * BIG_PAGE_OVERHEAD;
+      if (CURR_PGNO(p) != page || PAGE_SIGN(p) != FFDB_PAGE_MAGIC ||
+	  TYPE(p) != HASH_DATA_PAGE || 
+	  PREV_PGNO(p) != ((page == first) ? prev : page - 1)) {
+	status = -1;
+	break;
+      }
+    }
+  }
+  free (hdrs);
+  return status;
+}
+
+/**
+ * Load pages of an extent from page on in a row when page is not in
+ * the cache yet: rlen bytes of the data item are left from page on
+ */
+static void
+_ffdb_extent_load (ffdb_htab_t* hashp, pgno_t page, long rlen)
+{
+  long cap = hashp->hdr.bsize - BIG_PAGE_OVERHEAD;
+  long npages = (rlen + cap - 1) / cap;
+
+  if (npages > FFDB_MAX_RUN_PAGES)
+    npages = FFDB_MAX_RUN_PAGES;
+  (void)ffdb_pagepool_load_pages (hashp->mp, page, (unsigned int)npages);
+}
+
+/**
+ * Get a data item embedded on its key page
+ *
+ * Same as _ffdb_get_data below for small data items living right below
+ * their data pointers on the key page item->pgno, which may be held by
+ * item already
+ */
+static int
+_ffdb_get_embedded_data (ffdb_htab_t* hashp, ffdb_hent_t* item,
+			 FFDB_DBT* val, ffdb_datap_t* datap)
+{
+  void* pagep;
+  pgno_t tp;
+  unsigned int newchksum;
+  long datalen;
+  int needfree = 0;
+
+  pagep = item->pagep;
+  if (!pagep) {
+    pagep = ffdb_get_page (hashp, item->pgno, HASH_RAW_PAGE, 0, &tp);
+    if (!pagep) {
+      fprintf (stderr, "Cannot get key page at %d \n", item->pgno);
+      return -1;
+    }
+  }
+  datalen = datap->len;
+  assert (datap->offset + datalen <= hashp->hdr.bsize);
+
+  if (val->data && val->size > 0) {
+    if (val->size < datalen) {
+      fprintf (stderr, "Warning: application allocated space %ld < data size %ld\n",
+	       (long)val->size, datalen);
+      if (pagep != item->pagep)
+	ffdb_put_page (hashp, pagep, HASH_RAW_PAGE, 0);
+      return -1;
+    }
+    else
+      val->size = datalen;
+  }
+  else {
+    val->data = (char *)malloc(datalen > 0 ? datalen : 1);
+    if (!val->data) {
+      fprintf (stderr, "Cannot allocate space to get data back for size of %ld bytes. \n",
+	       datalen);
+      if (pagep != item->pagep)
+	ffdb_put_page (hashp, pagep, HASH_RAW_PAGE, 0);
+      return -1;
+    }
+    val->size = datalen;
+    needfree = 1;
+  }
+  memcpy (val->data, (unsigned char *)pagep + datap->offset, datalen);
+  if (pagep != item->pagep)
+    ffdb_put_page (hashp, pagep, HASH_RAW_PAGE, 0);
+
+  newchksum = __ffdb_crc32_checksum (0, val->data, val->size);
+  if (newchksum != datap->chksum) {
+    fprintf (stderr, "Get data checksum mismatch 0x%x (calculated) != 0x%x (stored)\n", newchksum, datap->chksum);
+    if (needfree) {
+      free (val->data);
+      val->data = 0;
+    }
+    val->size = 0;
+    return -1;
+  }
+  return 0;
+}
+
 /**
  * Get a real data item from data pages pointed by the data pointer
  * 
@@ -423,6 +594,9 @@ _ffdb_get_data (ffdb_htab_t* hashp, ffdb_hent_t* item,
   long rlen, copylen, datalen, hdatalen, idx;
   int needfree = 0;
 
+  if (IS_EMBEDDED(datap))
+    return _ffdb_get_embedded_data (hashp, item, val, datap);
+
   /* Get first page where the data item resides */
   pagep = ffdb_get_page (hashp, datap->first, HASH_DATA_PAGE, 0, &tp);
   if (!pagep) {
@@ -462,14 +636,15 @@ _ffdb_get_data (ffdb_htab_t* hashp, ffdb_hent_t* item,
   }
 
 
-  assert (header->key_page == item->pgno);
-  assert (header->key_idx == item->pgndx);
+  assert (KEY_BY_HASH(hashp) || header->key_page == item->pgno);
+  assert (KEY_BY_HASH(hashp) || header->key_idx == item->pgndx);
 
   /* Now check whether I have allocated space to data */
   if (val->data && val->size > 0) {
     if (val->size < datalen) {
       fprintf (stderr, "Warning: application allocated space %ld < data size %ld\n",
 	       (long)val->size, datalen);
+      ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 0);
       return -1;
     }
     else
@@ -480,6 +655,7 @@ _ffdb_get_data (ffdb_htab_t* hashp, ffdb_hent_t* item,
     if (!val->data) {
       fprintf (stderr, "Cannot allocate space to get data back for size of %ld bytes. \n",
 	       datalen);
+      ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 0);
       return -1;
     }
     val->size = datalen;
@@ -490,6 +666,9 @@ _ffdb_get_data (ffdb_htab_t* hashp, ffdb_hent_t* item,
   rlen = val->size;
   start = roff + sizeof(ffdb_data_header_t);
   next = NEXT_PGNO(pagep);
+  if (rlen == 0)
+    /* nothing to copy from an empty data item */
+    ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 0);
   while (rlen > 0) {
     /* where copy starts in val->data */
     idx = val->size - rlen;
@@ -504,7 +683,19 @@ _ffdb_get_data (ffdb_htab_t* hashp, ffdb_hent_t* item,
     ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 0);
 
     rlen -= copylen;
+    if (rlen > 0 && start != BIG_PAGE_OVERHEAD &&
+	FFDB_DIRECT_EXTENT(hashp, datap->offset) &&
+	_ffdb_read_extent (hashp, next, datap->first, 
+			   (unsigned char *)val->data + val->size - rlen,
+			   rlen) == 0) 
+      /* everything after the first page is read in one go */
+      rlen = 0;
+
     if (rlen > 0) { /* multiple pages */
+      /* pages of an extent come in by runs */
+      if (hashp->hdr.version > FFDB_VERSION_5 && IS_EXTENT(datap->offset))
+	_ffdb_extent_load (hashp, next, rlen);
+
       /* get next page */
       pagep = ffdb_get_page (hashp, next, HASH_DATA_PAGE, 0, &tp);
       if (!pagep) {
@@ -540,6 +731,30 @@ _ffdb_get_data (ffdb_htab_t* hashp, ffdb_hent_t* item,
   return 0;
 }
 
+/**
+ * Check whether a datum of a size class should start on a new data page
+ * instead of at start of the open page of its class
+ *
+ * A large datum stays on the open page only if it does not need more
+ * pages from there than from the beginning of a new page
+ */
+static int
+_ffdb_data_needs_page (ffdb_htab_t* hashp, unsigned int dclass,
+		       const FFDB_DBT* val, unsigned int start)
+{
+  size_t total, fspace, cap;
+
+  total = BIG_DATA_TOTAL_SIZE(val);
+  fspace = hashp->hdr.bsize - start;
+  if (dclass != LARGE_DATA_CLASS)
+    return total > fspace;
+
+  cap = hashp->hdr.bsize - BIG_PAGE_OVERHEAD;
+  if (total <= fspace)
+    return 0;
+  return 1 + (total - fspace + cap - 1) / cap > (total + cap - 1) / cap;
+}
+
 /**
  * Add a datum into a data page
  *
@@ -549,6 +764,8 @@ _ffdb_get_data (ffdb_htab_t* hashp, ffdb_hent_t* item,
  * @param val   the pointer to the datum
  * @param pagep memory pointer of the beginning of the data page
  * @param dpage data page number
+ * @param dclass size class of the open data page dp
+ * @param dp open data page of dclass the data page is taken from
  * @datap datap regular hash data pointer residing on hash page
  *
  * @return returns 0 on success, -1 system failure
@@ -556,7 +773,7 @@ _ffdb_get_data (ffdb_htab_t* hashp, ffdb_hent_t* item,
 static int
 _ffdb_add_data (ffdb_htab_t *hashp, pgno_t key_page, pgno_t key_index,
 		const FFDB_DBT* val, void* mem, pgno_t pnum,
-		ffdb_datap_t* datap)
+		unsigned int dclass, ffdb_dpage_t* dp, ffdb_datap_t* datap)
 {
   unsigned int start, fspace;
   ffdb_data_header_t header;
@@ -574,13 +791,15 @@ _ffdb_add_data (ffdb_htab_t *hashp, pgno_t key_page, pgno_t key_index,
    * When data is put on a page, unless there are space at least for
    * a data header, this page is marked full
    * 
+   * Small and medium data go to a new page instead of straddling
+   * two pages, large data when a new page saves them a page
    */
   reuse = 0;
   start = HIGHEST_FREE(mem);
-  if (start == 0) {
+  if (start == 0 || _ffdb_data_needs_page (hashp, dclass, val, start)) {
     /* I need to allocate another page */
     reuse = 0;
-    cpage = _ffdb_data_page (hashp, 1, &reuse);
+    cpage = _ffdb_open_data_page (hashp, &reuse);
     cpagep = ffdb_get_page (hashp, cpage, HASH_DATA_PAGE, FFDB_CREATE, &tp);
     if (!cpagep) {
       fprintf (stderr, "Cannot allocate next page at %d\n", cpage);
@@ -591,15 +810,20 @@ _ffdb_add_data (ffdb_htab_t *hashp, pgno_t key_page, pgno_t key_index,
     /* this has to be success */
     assert (cpagep != 0);
 
-    /* this page could be reuse page from overflow pages */
-    if (reuse) 
+    /* this page could be reuse page from overflow pages, or the first
+     * page of a level which reads back as a deleted page when an overflow
+     * page after it has been written first
+     */
+    if (reuse || TYPE(cpagep) == HASH_DELETED_PAGE) 
       _ffdb_init_page (hashp, cpagep, cpage, HASH_DATA_PAGE);      
 
     NEXT_PGNO(mem) = cpage;
     PREV_PGNO(cpagep) = pnum;
 
-    /* Now free the old data page */
-    ffdb_put_page (hashp, mem, HASH_DATA_PAGE, 0);
+    /* Now free the old data page: the old page may have been written
+     * out since it was filled, so its new link makes it dirty
+     */
+    ffdb_put_page (hashp, mem, HASH_DATA_PAGE, 1);
 
     /* update start value */
     start = HIGHEST_FREE(cpagep);
@@ -661,13 +885,16 @@ _ffdb_add_data (ffdb_htab_t *hashp, pgno_t key_page, pgno_t key_index,
 
     /* now copy header on to memory */
     memcpy (cpagep + start, &header, BIG_DATA_OVERHEAD);
-    /* Now copy data on to memory */
-    memmove (cpagep + start + BIG_DATA_OVERHEAD, val->data, val->size);
+    /* Now copy data on to memory: no data when space is only reserved */
+    if (val->data)
+      memmove (cpagep + start + BIG_DATA_OVERHEAD, val->data, val->size);
 
     
     /* Update the page header */
     HIGHEST_FREE(cpagep) = header.next;
     NUM_ENT(cpagep)++;
+    dp->page = cpage;
+    dp->start = header.next;
 
     /* Put this page back */
     ffdb_put_page (hashp, cpagep, HASH_DATA_PAGE, 1);
@@ -681,8 +908,9 @@ _ffdb_add_data (ffdb_htab_t *hashp, pgno_t key_page, pgno_t key_index,
 
     if (fspace - BIG_DATA_OVERHEAD > 0) {
     /* copy part of data onto this page */
-      memmove (cpagep + start + BIG_DATA_OVERHEAD, val->data, 
-	       fspace - BIG_DATA_OVERHEAD);
+      if (val->data)
+	memmove (cpagep + start + BIG_DATA_OVERHEAD, val->data, 
+		 fspace - BIG_DATA_OVERHEAD);
       rlen = val->size - (fspace - BIG_DATA_OVERHEAD); 
     }
     /* Now copy data to each page */
@@ -690,7 +918,10 @@ _ffdb_add_data (ffdb_htab_t *hashp, pgno_t key_page, pgno_t key_index,
     /* get a free page or a new page */
     /* fp is the first page of the chain */
     reuse = 0;
-    fp = currp = _ffdb_data_page (hashp, 1, &reuse);
+    /* pages of the chain are taken in a row so that they form an 
+     * extent: free pages are never reused here 
+     */
+    fp = currp = _ffdb_data_page (hashp, FFDB_EXTENT_PAGE, &reuse);
     prevp = cpage;
     
     while (rlen > 0) {
@@ -728,19 +959,24 @@ _ffdb_add_data (ffdb_htab_t *hashp, pgno_t key_page, pgno_t key_index,
 
       /* where to start copy the data */
       idx = val->size - rlen;
-      memmove (currpagep + BIG_PAGE_OVERHEAD, ((unsigned char *)val->data + idx),
-	       copylen);
+      if (val->data)
+	memmove (currpagep + BIG_PAGE_OVERHEAD, 
+		 ((unsigned char *)val->data + idx), copylen);
       
       /* reduce number of bytes */
       rlen -= copylen;
 
+      /* what is left on the last page stays open */
+      dp->page = currp;
+      dp->start = HIGHEST_FREE(currpagep);
+
       if (rlen > 0) {
 	/* remember the previous page number */
 	prevp = currp;
 
 	/* get next page number */
 	reuse = 0;
-	currp = _ffdb_data_page (hashp, 1, &reuse);
+	currp = _ffdb_data_page (hashp, FFDB_EXTENT_PAGE, &reuse);
 
 	/* update next page number */
 	NEXT_PGNO(currpagep) = currp;
@@ -773,6 +1009,8 @@ _ffdb_add_data (ffdb_htab_t *hashp, pgno_t key_page, pgno_t key_index,
   if (hashp->hdr.version > FFDB_VERSION_5) {
     datap->offset = start;      
     INSERT_LEN_TO_PGOFFSET(val->size, datap->offset);
+    if (!fit_on_page)
+      SET_EXTENT(datap->offset);
   }
   else
     datap->offset = start;      
@@ -825,8 +1063,9 @@ _ffdb_replace_data (ffdb_htab_t* hashp, const FFDB_DBT* val,
   /* Data can fit in the page */
   if (BIG_DATA_TOTAL_SIZE(val) <= fspace) {
     /* Copy data onto the page, header is changed already in memory */
-    memmove (mem + roffset + BIG_DATA_OVERHEAD, val->data,
-	     val->size);
+    if (val->data)
+      memmove (mem + roffset + BIG_DATA_OVERHEAD, val->data,
+	       val->size);
 
     /* Put data page away */
     ffdb_put_page (hashp, mem, TYPE(mem), 1);
@@ -838,8 +1077,9 @@ _ffdb_replace_data (ffdb_htab_t* hashp, const FFDB_DBT* val,
     /* Copy part of data to this page */
     if (fspace - BIG_DATA_OVERHEAD > 0) {
     /* copy part of data onto this page */
-      memmove (mem + roffset + BIG_DATA_OVERHEAD, val->data, 
-	       fspace - BIG_DATA_OVERHEAD);
+      if (val->data)
+	memmove (mem + roffset + BIG_DATA_OVERHEAD, val->data, 
+		 fspace - BIG_DATA_OVERHEAD);
       rlen = val->size - (fspace - BIG_DATA_OVERHEAD); 
     }
     
@@ -863,8 +1103,9 @@ _ffdb_replace_data (ffdb_htab_t* hashp, const FFDB_DBT* val,
 
       /* where to start copy the data */
       idx = val->size - rlen;
-      memmove (currpagep + BIG_PAGE_OVERHEAD, 
-	       ((unsigned char *)val->data + idx), copylen);
+      if (val->data)
+	memmove (currpagep + BIG_PAGE_OVERHEAD, 
+		 ((unsigned char *)val->data + idx), copylen);
       
       /* reduce number of remaining bytes */
       rlen -= copylen;
@@ -923,684 +1164,1994 @@ _ffdb_update_data_info (ffdb_htab_t* hashp, ffdb_datap_t* datap,
 }
 
 /**
- * Get a free page from free map page if there is one
- * Return 0 when there is no free page
+ * In memory copy of the free map of version 9 and later files: one bit
+ * for each page, set when the page is free. Every page freed anywhere
+ * in the file can be reused
  */
-static pgno_t
-_ffdb_reuse_free_ovflpage (ffdb_htab_t* hashp)
+struct _ffdb_freemap_
 {
-  pgno_t fpage, tp, num, np, nextp;
-  void *fpagep;
-  unsigned int clevel = hashp->hdr.ovfl_point;
+  unsigned long long* bits;     /* one bit per page                  */
+  pgno_t npages;                /* number of pages covered by bits   */
+  pgno_t nfree;                 /* number of bits set                */
+  pgno_t hint;                  /* where the next search starts      */
+  int nodata;                   /* no free page for data was found   */
+  unsigned int chunkbits;       /* pages covered by a free map page  */
+  unsigned int nchunks;         /* number of chunks                  */
+  pgno_t* mpages;               /* free map page of each chunk       */
+  unsigned char* dirty;         /* chunk changed since the last sync */
+};
 
-  /* check current free page number at this level */
-  num = 0;
-  if ((fpage = hashp->hdr.free_pages[clevel]) != INVALID_PGNO) {
-    fpagep = ffdb_get_page (hashp, fpage, HASH_FREE_PAGE, 0, &tp);
-    if (!fpagep) {
-      fprintf (stderr, "Fatal error: free map page at %d could not be found\n",
-	       fpage);
-      abort ();
-    }
+/**
+ * Make the free map cover a page
+ */
+static int
+_ffdb_freemap_grow (ffdb_freemap_t* fmap, pgno_t page)
+{
+  unsigned int nchunks, i;
+  unsigned long long* bits;
+  pgno_t* mpages;
+  unsigned char* dirty;
+  size_t nwords, owords;
 
-    if ((np = NUM_FREE_PAGES(fpagep)) > 0) {
-      num = FREE_PAGE(fpagep, np - 1);
-      /* reduce number of free pages by one */
-      NUM_FREE_PAGES(fpagep)--;
-      ffdb_put_page (hashp, fpagep, HASH_FREE_PAGE, 1);
-    }
-    else {
-      nextp = NEXT_PGNO(fpagep);
+  if (page < fmap->npages)
+    return 0;
 
-      /* There is no page free anymore, so I can free this 
-       * page for a normal use
-       *
-       * No need to clean this page, we will reset this page upon reloading
-       */
-      ffdb_put_page (hashp, fpagep, HASH_OVFL_PAGE, 1);
-#ifdef _FFDB_DEBUG
-      fprintf (stderr, "Free page %d is not longer needed, put it back\n",
-	       fpage);
-#endif
-      num = fpage;
-      /* nextp could be INVALID_PGNO */
-      hashp->hdr.free_pages[clevel] = nextp;
-#ifdef _FFDB_DEBUG
-      fprintf (stderr, "Free map page %d contains no free pages, reuse it\n",
-	       fpage);
-#endif
-    }
+  nchunks = page / fmap->chunkbits + 1;
+  owords = (size_t)fmap->nchunks * (fmap->chunkbits / 64);
+  nwords = (size_t)nchunks * (fmap->chunkbits / 64);
+  bits = (unsigned long long *)realloc (fmap->bits, 
+					nwords * sizeof(unsigned long long));
+  if (!bits)
+    return -1;
+  fmap->bits = bits;
+  memset (bits + owords, 0, (nwords - owords) * sizeof(unsigned long long));
+
+  mpages = (pgno_t *)realloc (fmap->mpages, nchunks * sizeof(pgno_t));
+  if (!mpages)
+    return -1;
+  fmap->mpages = mpages;
+  dirty = (unsigned char *)realloc (fmap->dirty, nchunks);
+  if (!dirty)
+    return -1;
+  fmap->dirty = dirty;
+  for (i = fmap->nchunks; i < nchunks; i++) {
+    mpages[i] = INVALID_PGNO;
+    dirty[i] = 0;
   }
-  return num;
+  fmap->nchunks = nchunks;
+  fmap->npages = (pgno_t)nchunks * fmap->chunkbits;
+  return 0;
 }
 
-
-
 /**
- * Find out what is next data page number given current page number
- * We need first to check freed overflow pages
- *
- * If there are somthing really wrong, the page released by this call
- * cannot be reclaimed. (We will live with the consequence)
+ * Load the free map from the chain of free map pages
  */
-static pgno_t
-_ffdb_data_page (ffdb_htab_t* hashp, int new_page, int* reuse)
+int
+ffdb_freemap_open (ffdb_htab_t* hashp)
 {
-  pgno_t num = 0;
-  pgno_t maxp = 0;
-  /* get next level of overflow point */
-  unsigned int level = hashp->hdr.ovfl_point + 1;
-
-  *reuse = 0;
-  if (hashp->curr_dpage == INVALID_PGNO) {
-    /* The data page and overflow page starts at the following page number */
-    BUCKET_TO_PAGE(hashp->hdr.high_mask, hashp->curr_dpage);
-    hashp->curr_dpage++;
-
-    BUCKET_TO_PAGE(hashp->hdr.max_bucket, maxp);
-    fprintf (stderr, "Doubling at level %d max_bucket at %d data page starts at %d\n", hashp->hdr.ovfl_point, maxp, hashp->curr_dpage);
+  ffdb_freemap_t* fmap;
+  pgno_t page, next, tp, chunk;
+  unsigned char *pagep, b;
+  unsigned long long* words;
+  unsigned int i;
 
-#ifdef _FFDB_DEBUG
-    fprintf (stderr, "data page starts at %d for level %d\n",
-	     hashp->curr_dpage, hashp->hdr.ovfl_point);
-#endif
+  fmap = (ffdb_freemap_t *)calloc (1, sizeof (ffdb_freemap_t));
+  if (!fmap) {
+    errno = ENOMEM;
+    return -1;
   }
+  fmap->chunkbits = FREEMAP_BITS(hashp);
 
-  if (hashp->hdr.spares[level] == 0) 
-    hashp->hdr.spares[level] = hashp->curr_dpage + 1;
-
-  if (!new_page) 
-    num = hashp->curr_dpage;
-  else {
-    num = _ffdb_reuse_free_ovflpage (hashp);
-    if (num > 0) {
-#ifdef _FFDB_DEBUG
-      fprintf (stderr, "Reuse previously freed overflow page %u\n", num);
-#endif
-      *reuse = 1;
+  page = hashp->hdr.free_pages[0];
+  while (page != INVALID_PGNO) {
+    pagep = ffdb_get_page (hashp, page, HASH_FREEMAP_PAGE, 0, &tp);
+    if (!pagep) {
+      fprintf (stderr, "Cannot get free map page %d\n", page);
+      ffdb_freemap_free (fmap);
+      return -1;
     }
-    else {
-      num = hashp->hdr.spares[level];
-      hashp->hdr.spares[level]++;
+    chunk = FREEMAP_CHUNK(pagep);
+    if (TYPE(pagep) != HASH_FREEMAP_PAGE ||
+	_ffdb_freemap_grow (fmap, (chunk + 1) * fmap->chunkbits - 1) != 0) {
+      fprintf (stderr, "Cannot load free map page %d\n", page);
+      ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
+      ffdb_freemap_free (fmap);
+      errno = EFTYPE;
+      return -1;
     }
-    hashp->curr_dpage = num;
+    fmap->mpages[chunk] = page;
+    words = fmap->bits + (size_t)chunk * (fmap->chunkbits / 64);
+    for (i = 0; i < FREEMAP_BYTES(hashp); i++) {
+      if ((b = pagep[FREEMAP_START + i]) != 0) {
+	words[i / 8] |= (unsigned long long)b << ((i % 8) * 8);
+	fmap->nfree += __builtin_popcount (b);
+      }
+    }
+    next = NEXT_PGNO(pagep);
+    ffdb_put_page (hashp, pagep, HASH_FREEMAP_PAGE, 0);
+    page = next;
   }
-  return num;
+  hashp->freemap = fmap;
+  return 0;
 }
 
 /**
- * Find out what is next overflow page number given current page number
- * We need first to check freed overflow pages
- *
- * If there are somthing really wrong, the page released by this call
- * cannot be reclaimed. (We will live with the consequence)
+ * Write changed chunks of the free map onto their free map pages
  */
-static pgno_t
-_ffdb_ovfl_page (ffdb_htab_t* hashp, int* reuse)
+int
+ffdb_freemap_sync (ffdb_htab_t* hashp)
 {
-  pgno_t num = 0;
-  pgno_t maxp = 0;
-  /* get next level of overflow point */
-  unsigned int level = hashp->hdr.ovfl_point + 1;
+  ffdb_freemap_t* fmap = hashp->freemap;
+  unsigned char* pagep;
+  unsigned long long* words;
+  unsigned int chunk, i;
+  pgno_t tp;
 
-  *reuse = 0;
-  if (hashp->curr_dpage == INVALID_PGNO) {
-    /* The data page and overflow page starts at the following page number */
-    BUCKET_TO_PAGE(hashp->hdr.high_mask, hashp->curr_dpage);
-    hashp->curr_dpage++;
+  if (!fmap)
+    return 0;
 
-    BUCKET_TO_PAGE(hashp->hdr.max_bucket, maxp);
-    fprintf (stderr, "Doubling at level %d max_bucket at %d over flow page starts at %d\n", hashp->hdr.ovfl_point, maxp, hashp->curr_dpage);
-#ifdef _FFDB_DEBUG
-    fprintf (stderr, "overflow page starts at %d for level %d\n",
-	     hashp->curr_dpage, hashp->hdr.ovfl_point);
-#endif
+  for (chunk = 0; chunk < fmap->nchunks; chunk++) {
+    if (!fmap->dirty[chunk] || fmap->mpages[chunk] == INVALID_PGNO)
+      continue;
+    pagep = ffdb_get_page (hashp, fmap->mpages[chunk], HASH_FREEMAP_PAGE,
+			   0, &tp);
+    if (!pagep) {
+      fprintf (stderr, "Cannot get free map page %d\n", fmap->mpages[chunk]);
+      return -1;
+    }
+    words = fmap->bits + (size_t)chunk * (fmap->chunkbits / 64);
+    for (i = 0; i < FREEMAP_BYTES(hashp); i++)
+      pagep[FREEMAP_START + i] = (unsigned char)(words[i / 8] >> ((i % 8) * 8));
+    ffdb_put_page (hashp, pagep, HASH_FREEMAP_PAGE, 1);
+    fmap->dirty[chunk] = 0;
   }
+  return 0;
+}
 
-  if (hashp->hdr.spares[level] == 0) 
-    hashp->hdr.spares[level] = hashp->curr_dpage + 1;
+/**
+ * Write changed chunks of the free map onto their free map pages and
+ * the free map pages out to the file
+ */
+int
+ffdb_freemap_flush (ffdb_htab_t* hashp)
+{
+  ffdb_freemap_t* fmap = hashp->freemap;
+  unsigned int chunk;
 
-  num = _ffdb_reuse_free_ovflpage (hashp);
-  if (num > 0) {
-#ifdef _FFDB_DEBUG
-    fprintf (stderr, "Overflow reuse previously freed overflow page %d\n", num);
-#endif
-    *reuse = 1;
-  }
-  else {
-    num = hashp->hdr.spares[level];
-    hashp->hdr.spares[level]++;
+  if (ffdb_freemap_sync (hashp) != 0)
+    return -1;
+  if (!fmap)
+    return 0;
+
+  for (chunk = 0; chunk < fmap->nchunks; chunk++) {
+    if (fmap->mpages[chunk] != INVALID_PGNO &&
+	ffdb_pagepool_sync_page (hashp->mp, fmap->mpages[chunk]) != 0)
+      return -1;
   }
-  return num;
+  return 0;
 }
 
-
 /**
- * Search for the last data page on this level starting from the last
- * going backward to search
- *
- * This routine has to success since there is at least one data page
- * at any level
+ * Free memory of the free map
  */
-pgno_t
-ffdb_last_data_page (ffdb_htab_t* hashp, pgno_t start)
+void
+ffdb_freemap_free (ffdb_freemap_t* fmap)
 {
-  pgno_t page, ret, tp;
-  void* pagep;
-  int  done = 0;
-
-  /* We start from the first page above reguler hash pages */
-  ret = INVALID_PGNO;
-  page = start;
-  while (!done) {
-    pagep = ffdb_get_page (hashp, page, HASH_RAW_PAGE, 0, &tp);
-    if (!pagep) {
-      fprintf (stderr, "Cannot get page %d while looking for the last data page.\n",
-	       page);
-      abort ();
-    }
-    if (TYPE(pagep) == HASH_DATA_PAGE && NEXT_PGNO(pagep) == INVALID_PGNO) {
-      done = 1;
-      ret = page;
-    }
-    ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
-    page--;
-  }
-
-  return ret;
-}
+  if (!fmap)
+    return;
+  free (fmap->bits);
+  free (fmap->mpages);
+  free (fmap->dirty);
+  free (fmap);
+}
 
 /**
- * Put a page back into pagepool
+ * Number of overflow pages kept at once for key pages of a level: as
+ * many as the level has buckets, at least OVFL_RUN_PAGES
  */
-int
-ffdb_put_page (ffdb_htab_t* hashp, void* mem,
-	       unsigned int addrtype, int dirty)
+static pgno_t
+_ffdb_ovfl_region_pages (unsigned int point)
 {
-  (void)addrtype;
-  unsigned int flags = 0;
+  pgno_t npages = (point > 0) ? POW2(point - 1) : 1;
 
-  if (dirty) {
-    flags |= FFDB_PAGE_DIRTY;
-  }
-  return ffdb_pagepool_put_page (hashp->mp, mem, flags);
+  return (npages < OVFL_RUN_PAGES) ? OVFL_RUN_PAGES : npages;
 }
 
 /**
- * get a brand new page
+ * Overflow pages kept for key pages of a level: a level of version 9
+ * and later files keeps them right after its first data page. Pages
+ * in [first, end) are returned
+ *
+ * Return 0 when the level has such pages
  */
-int
-ffdb_new_page (ffdb_htab_t* hashp, pgno_t addr, 
-	       unsigned int addrtype)
+static int
+_ffdb_ovfl_region (ffdb_htab_t* hashp, unsigned int point,
+		   pgno_t* first, pgno_t* end)
 {
-  pgno_t page;
-  void* mem;
-  int   status;
-
-  switch (addrtype) {
-  case HASH_BUCKET_PAGE:
-    BUCKET_TO_PAGE(addr,page);
-#ifdef _FFDB_DEBUG
-    fprintf (stderr, "New: Bucket %d mapped to page %d\n", addr, page);
-#endif
-    break;
-  default:
-    page = addr;
-    break;
-  }
-  status = ffdb_pagepool_new_page (hashp->mp, &page,
-				   FFDB_PAGE_REQUEST, &mem);
-  if (status != 0)
-    return status;
-  
-  /* We have to initialize the page */
-  _ffdb_init_page (hashp, mem, page, addrtype);
+  if (hashp->hdr.version <= FFDB_VERSION_8 || point + 1 >= NCACHED)
+    return -1;
 
-  /* Flush back the page so a get page will have the correct content */
-  ffdb_put_page (hashp, mem, addrtype, 1);
+  BUCKET_TO_PAGE(POW2(point) - 1, *first);
+  *first += 2;
+  *end = *first + _ffdb_ovfl_region_pages (point);
 
+  /* levels laid out before the table grew keep no overflow pages */
+  if (hashp->hdr.spares[point + 1] < *end)
+    return -1;
   return 0;
 }
 
 /**
- * Add a free overflow page the the free information page
+ * Overflow pages kept for key pages which hold a page
  *
- * free page is opage
- * fpagep is page pointer for the first page of the free information page
+ * Return 0 when the page is one of them
  */
-static void
-_ffdb_update_free_page (ffdb_htab_t* hashp, void* fpagep, pgno_t opage)
+static int
+_ffdb_ovfl_region_of (ffdb_htab_t* hashp, pgno_t page,
+		      pgno_t* first, pgno_t* end)
 {
-  (void)hashp;
-  unsigned int nf = NUM_FREE_PAGES(fpagep);
+  unsigned int point;
 
-  FREE_PAGE(fpagep, nf) = opage;
-  
-  NUM_FREE_PAGES(fpagep)++;
+  for (point = 0; point <= hashp->hdr.ovfl_point; point++) {
+    if (_ffdb_ovfl_region (hashp, point, first, end) == 0 &&
+	page >= *first && page < *end)
+      return 0;
+  }
+  return -1;
 }
 
 /**
- * Free an overflow page: this happens when a bucket is split. 
- * We need to update free page in the previous level
- *
- * Return whether this page should be deleted
- *
- * The freed overflow page is represented by 'memp'
+ * First free page in [first, end) of the free map
+ * Return 0 when there is no free page
  */
-static void
-_ffdb_free_ovflpage (ffdb_htab_t* hashp, void* memp, int isdoubling,
-		     int* deleteit)
+static pgno_t
+_ffdb_freemap_find (ffdb_freemap_t* fmap, pgno_t first, pgno_t end)
 {
-  (void)isdoubling;
-  unsigned int level, nf;
-  pgno_t fpage, tp, opage, nextpage, xpage;
-  void *fpagep, *fnext, *xpagep;
-  int xtra_page, reuse;
-
-  /* Set delete flag to true */
-  *deleteit = 1;
+  size_t w;
+  unsigned long long word;
+  pgno_t page;
 
-  /* get overflow page number */
-  opage = CURR_PGNO(memp);
+  if (end > fmap->npages)
+    end = fmap->npages;
+  if (first >= end)
+    return 0;
 
-  /* check what level this page belongs to */
-  for (level = 0; level <= hashp->hdr.ovfl_point; level++) {
-    if (opage < hashp->hdr.spares[level]) {
-      break;
+  for (w = first / 64; w <= (end - 1) / 64; w++) {
+    word = fmap->bits[w];
+    if (w == first / 64)
+      word &= ~0ULL << (first % 64);
+    if (word) {
+      page = (pgno_t)(w * 64 + __builtin_ctzll (word));
+      return (page < end) ? page : 0;
     }
   }
-  /* level is one level down */
-  level--;
-
-#ifdef _FFDB_DEBUG
-  fprintf (stderr, "Free overflow page %d for level %d isdoubling = %d\n",
-	   opage, level, isdoubling);
-#endif
+  return 0;
+}
 
-  reuse = 0;
-  if (hashp->hdr.free_pages[level] == INVALID_PGNO) {
-    /* I just use this page to keep track free pages */
-    fpage = opage;
-    hashp->hdr.free_pages[level] = fpage;
-    *deleteit = 0;
+/**
+ * Take a page found free out of the free map
+ */
+static void
+_ffdb_freemap_take (ffdb_freemap_t* fmap, pgno_t page)
+{
+  fmap->bits[page / 64] &= ~(1ULL << (page % 64));
+  fmap->nfree--;
+  fmap->dirty[page / fmap->chunkbits] = 1;
+}
 
-    fnext = fpagep = memp;
+/**
+ * Take a free page for data out of the free map. Free pages kept for
+ * key pages are left alone. The search starts right after the page
+ * taken last so that pages taken in a row tend to be adjacent
+ * Return 0 when there is no free page
+ */
+static pgno_t
+_ffdb_freemap_alloc (ffdb_htab_t* hashp)
+{
+  ffdb_freemap_t* fmap = hashp->freemap;
+  pgno_t page, first, end;
+  int pass;
 
-    /* Clean this page out into a free page */
-    _ffdb_init_page (hashp, fpagep, fpage, HASH_FREE_PAGE);
-#ifdef _FFDB_DEBUG
-    fprintf (stderr, "Reuse %d to be free page \n", fpage);
-#endif
-  }
-  else {
-    fpage = hashp->hdr.free_pages[level];
+  if (!fmap || fmap->nfree == 0 || fmap->nodata)
+    return 0;
 
-    /* get this page */
-    fnext = fpagep = ffdb_get_page (hashp, fpage, HASH_FREE_PAGE, 
-				    FFDB_CREATE, &tp);
-    if (!fpagep) {
-      fprintf (stderr, "cannot allocate %d for free overflow pages\n", fpage);
-      abort ();
+  for (pass = 0; pass < 2; pass++) {
+    page = _ffdb_freemap_find (fmap, pass ? 0 : fmap->hint, fmap->npages);
+    while (page > 0 && _ffdb_ovfl_region_of (hashp, page, &first, &end) == 0)
+      page = _ffdb_freemap_find (fmap, end, fmap->npages);
+    if (page > 0) {
+      _ffdb_freemap_take (fmap, page);
+      fmap->hint = page + 1;
+      return page;
     }
-    if (reuse)
-      _ffdb_init_page (hashp, fpagep, fpage, HASH_FREE_PAGE);
+  }
+  /* searched again once a page for data is freed */
+  fmap->nodata = 1;
+  return 0;
+}
 
-#ifdef _FFDB_DEBUG
-    fprintf (stderr, "Get a page %d keeping free page at level %d\n",
-	     tp, level);
-#endif
+/**
+ * Take a free page kept for key pages out of the free map, looking at
+ * levels from top down to bottom
+ * Return 0 when there is no free page
+ */
+static pgno_t
+_ffdb_freemap_alloc_ovfl (ffdb_htab_t* hashp, unsigned int top,
+			  unsigned int bottom)
+{
+  ffdb_freemap_t* fmap = hashp->freemap;
+  pgno_t page, first, end;
+  unsigned int point;
 
-    xtra_page = 1;
-    /* I have to check chain of pages */
-    while (fnext) {
-      /* get current number of free pages contained inside this page */
-      nf = NUM_FREE_PAGES(fpagep);
-      if (nf < MAX_NUM_FREE_PAGES - 1){ /* There is space on this page */
-	/* Now write this page number to the free page */
-	_ffdb_update_free_page (hashp, fpagep, opage);
-	xtra_page = 0;
-	/* put this page out */
-	ffdb_put_page (hashp, fpagep, TYPE(fpagep), 1);
-	/* We are done */
-	fnext = 0;
-	xtra_page = 0;
-      }
-      else {
-	nextpage = NEXT_PGNO(fpagep);
-	if (nextpage == INVALID_PGNO)
-	  fnext = 0;
-	else {
-	  fnext = ffdb_get_page (hashp, nextpage, HASH_FREE_PAGE, 0, &tp);
-	  if (!fnext) {
-	    fprintf (stderr, "Cannot get free bitmap page %d\n",
-		     nextpage);
-	    /* release the previous page */
-	    ffdb_put_page (hashp, fpagep, TYPE(fpagep), 0);
-	    return;
-	  }
-	  /* release the previous page */
-	  ffdb_put_page (hashp, fpagep, TYPE(fpagep), 0);
+  if (!fmap || fmap->nfree == 0)
+    return 0;
 
-	  /* assign new pointers */
-	  fpagep = fnext;
-	  fpage = nextpage;
-	}
-      }
+  for (point = top + 1; point-- > bottom; ) {
+    if (_ffdb_ovfl_region (hashp, point, &first, &end) == 0 &&
+	(page = _ffdb_freemap_find (fmap, first, end)) > 0) {
+      _ffdb_freemap_take (fmap, page);
+      return page;
     }
-  
-    /* If we need extra page */
-    reuse = 0;
-    if (xtra_page) {
-      /* We need an extra page to store free page. We just use this page */
-      xpage = opage;
-#ifdef _FFDB_DEBUG
-      fprintf (stderr, "reuse overflow page %d as chained free page %d\n",
-	       xpage, fpage);
-#endif
-      *deleteit = 0;
-
-      /* initialize this page */
-      xpagep = memp;
-      _ffdb_init_page (hashp, xpagep, xpage, HASH_FREE_PAGE);
+  }
+  return 0;
+}
 
-#ifdef _FFDB_STATISTICS
-      hash_overflows++;
-#endif
+/**
+ * Put a page into the free map. The first free page of a chunk becomes
+ * the free map page of the chunk and is not deleted
+ */
+static void
+_ffdb_freemap_add (ffdb_htab_t* hashp, void* memp, int* deleteit)
+{
+  ffdb_freemap_t* fmap = hashp->freemap;
+  pgno_t page, chunk, tp, first, end;
+  void* headp;
 
-      /* set up correct link */
-      NEXT_PGNO (fpagep) = xpage;
-      PREV_PGNO (xpagep) = fpage;
+  page = CURR_PGNO(memp);
+  *deleteit = 1;
+  if (!fmap || _ffdb_freemap_grow (fmap, page) != 0) {
+    fprintf (stderr, "Free page %d cannot be reused\n", page);
+    return;
+  }
 
-      /* release the previous page */
-      ffdb_put_page (hashp, fpagep, TYPE(fpagep), 0); 
+  chunk = page / fmap->chunkbits;
+  if (fmap->mpages[chunk] == INVALID_PGNO) {
+    _ffdb_init_page (hashp, memp, page, HASH_FREEMAP_PAGE);
+    FREEMAP_CHUNK(memp) = chunk;
+    NEXT_PGNO(memp) = hashp->hdr.free_pages[0];
+    if (hashp->hdr.free_pages[0] != INVALID_PGNO) {
+      headp = ffdb_get_page (hashp, hashp->hdr.free_pages[0],
+			     HASH_FREEMAP_PAGE, 0, &tp);
+      if (headp) {
+	PREV_PGNO(headp) = page;
+	ffdb_put_page (hashp, headp, HASH_FREEMAP_PAGE, 1);
+      }
     }
+    hashp->hdr.free_pages[0] = page;
+    fmap->mpages[chunk] = page;
+    *deleteit = 0;
+  }
+  else {
+    fmap->bits[page / 64] |= 1ULL << (page % 64);
+    fmap->nfree++;
+    if (_ffdb_ovfl_region_of (hashp, page, &first, &end) != 0)
+      fmap->nodata = 0;
   }
+  fmap->dirty[chunk] = 1;
 }
 
 /**
- * Delete a page: usually an overflow page
+ * Put pages in [first, end) never written into the free map. Only a
+ * page becoming the free map page of its chunk is read
  */
-static int
-ffdb_delete_page (ffdb_htab_t* hashp, void* pagep, 
-		  unsigned int addrtype, int isdoubling)
+static void
+_ffdb_freemap_add_range (ffdb_htab_t* hashp, pgno_t first, pgno_t end)
 {
-  int deleteit = 0;
-  if (addrtype == HASH_OVFL_PAGE) {
-    _ffdb_free_ovflpage (hashp, pagep, isdoubling, &deleteit);
+  ffdb_freemap_t* fmap = hashp->freemap;
+  pgno_t page, chunk, tp;
+  void* pagep;
+  int deleteit;
+
+  for (page = first; page < end; page++) {
+    if (fmap && _ffdb_freemap_grow (fmap, page) == 0 &&
+	fmap->mpages[(chunk = page / fmap->chunkbits)] != INVALID_PGNO) {
+      fmap->bits[page / 64] |= 1ULL << (page % 64);
+      fmap->nfree++;
+      fmap->nodata = 0;
+      fmap->dirty[chunk] = 1;
+      continue;
+    }
+    pagep = ffdb_get_page (hashp, page, HASH_OVFL_PAGE, FFDB_CREATE, &tp);
+    if (!pagep) {
+      fprintf (stderr, "Reserved overflow page %d cannot be reused\n", page);
+      continue;
+    }
+    _ffdb_freemap_add (hashp, pagep, &deleteit);
     if (deleteit) {
-      /* if this page need to be deleted */
-      _ffdb_init_page (hashp, pagep, CURR_PGNO(pagep), HASH_DELETED_PAGE);
-      return ffdb_pagepool_delete (hashp->mp, pagep); 
+      _ffdb_init_page (hashp, pagep, page, HASH_DELETED_PAGE);
+      ffdb_pagepool_delete (hashp->mp, pagep);
     }
-    else 
-      return ffdb_put_page (hashp, pagep, TYPE(pagep), 1);
+    else
+      ffdb_put_page (hashp, pagep, HASH_FREEMAP_PAGE, 1);
   }
-  else 
-    return ffdb_pagepool_delete (hashp->mp, pagep);
 }
 
 /**
- * Get a page
+ * Get a free page from free map page if there is one
+ * Return 0 when there is no free page
+ */
+static pgno_t
+_ffdb_reuse_free_ovflpage (ffdb_htab_t* hashp)
+{
+  pgno_t fpage, tp, num, np, nextp;
+  void *fpagep;
+  unsigned int clevel = hashp->hdr.ovfl_point;
+
+  /* free pages other than those kept for key pages are taken */
+  if (hashp->hdr.version > FFDB_VERSION_8)
+    return _ffdb_freemap_alloc (hashp);
+
+  /* check current free page number at this level */
+  num = 0;
+  if ((fpage = hashp->hdr.free_pages[clevel]) != INVALID_PGNO) {
+    fpagep = ffdb_get_page (hashp, fpage, HASH_FREE_PAGE, 0, &tp);
+    if (!fpagep) {
+      fprintf (stderr, "Fatal error: free map page at %d could not be found\n",
+	       fpage);
+      abort ();
+    }
+
+    if ((np = NUM_FREE_PAGES(fpagep)) > 0) {
+      num = FREE_PAGE(fpagep, np - 1);
+      /* reduce number of free pages by one */
+      NUM_FREE_PAGES(fpagep)--;
+      ffdb_put_page (hashp, fpagep, HASH_FREE_PAGE, 1);
+    }
+    else {
+      nextp = NEXT_PGNO(fpagep);
+
+      /* There is no page free anymore, so I can free this 
+       * page for a normal use
+       *
+       * No need to clean this page, we will reset this page upon reloading
+       */
+      ffdb_put_page (hashp, fpagep, HASH_OVFL_PAGE, 1);
+#ifdef _FFDB_DEBUG
+      fprintf (stderr, "Free page %d is not longer needed, put it back\n",
+	       fpage);
+#endif
+      num = fpage;
+      /* nextp could be INVALID_PGNO */
+      hashp->hdr.free_pages[clevel] = nextp;
+#ifdef _FFDB_DEBUG
+      fprintf (stderr, "Free map page %d contains no free pages, reuse it\n",
+	       fpage);
+#endif
+    }
+  }
+  return num;
+}
+
+
+
+/**
+ * Start pages of the current level once a data or overflow page is
+ * needed after the table doubles. The first page after the bucket pages
+ * is kept for data. From version 9 on the overflow pages kept for key
+ * pages of the level follow, and the overflow pages of the run left
+ * open at the level below are given back
+ */
+static void
+_ffdb_level_start (ffdb_htab_t* hashp)
+{
+  pgno_t maxp = 0;
+  pgno_t first, end;
+  /* get next level of overflow point */
+  unsigned int level = hashp->hdr.ovfl_point + 1;
+
+  if (hashp->curr_dpage == INVALID_PGNO) {
+    /* The data page and overflow page starts at the following page number */
+    BUCKET_TO_PAGE(hashp->hdr.high_mask, hashp->curr_dpage);
+    hashp->curr_dpage++;
+
+    BUCKET_TO_PAGE(hashp->hdr.max_bucket, maxp);
+    fprintf (stderr, "Doubling at level %d max_bucket at %d data page starts at %d\n", hashp->hdr.ovfl_point, maxp, hashp->curr_dpage);
+
+#ifdef _FFDB_DEBUG
+    fprintf (stderr, "data page starts at %d for level %d\n",
+	     hashp->curr_dpage, hashp->hdr.ovfl_point);
+#endif
+  }
+
+  if (hashp->hdr.spares[level] != 0)
+    return;
+
+  hashp->hdr.spares[level] = hashp->curr_dpage + 1;
+  if (hashp->hdr.version > FFDB_VERSION_8) {
+    ffdb_release_ovfl_run (hashp);
+
+    first = hashp->hdr.spares[level];
+    end = first + _ffdb_ovfl_region_pages (hashp->hdr.ovfl_point);
+    hashp->hdr.spares[level] = end;
+    hashp->ovfl_next = first;
+    hashp->ovfl_end = end;
+#ifdef _FFDB_DEBUG
+    fprintf (stderr, "Keep overflow pages %d to %d for level %d\n",
+	     first, end - 1, hashp->hdr.ovfl_point);
+#endif
+  }
+}
+
+/**
+ * Find out what is next data page number given current page number
+ * We need first to check freed overflow pages, unless new_page is
+ * FFDB_EXTENT_PAGE, in which case consecutive calls return 
+ * consecutive pages
+ *
+ * If there are somthing really wrong, the page released by this call
+ * cannot be reclaimed. (We will live with the consequence)
+ */
+static pgno_t
+_ffdb_data_page (ffdb_htab_t* hashp, int new_page, int* reuse)
+{
+  pgno_t num = 0;
+  /* get next level of overflow point */
+  unsigned int level = hashp->hdr.ovfl_point + 1;
+
+  *reuse = 0;
+  _ffdb_level_start (hashp);
+
+  if (!new_page) 
+    num = hashp->curr_dpage;
+  else {
+    num = 0;
+    if (new_page != FFDB_EXTENT_PAGE)
+      num = _ffdb_reuse_free_ovflpage (hashp);
+    if (num > 0) {
+#ifdef _FFDB_DEBUG
+      fprintf (stderr, "Reuse previously freed overflow page %u\n", num);
+#endif
+      *reuse = 1;
+    }
+    else {
+      num = hashp->hdr.spares[level];
+      hashp->hdr.spares[level]++;
+    }
+    hashp->curr_dpage = num;
+  }
+  return num;
+}
+
+/**
+ * Get a data page to be opened by a size class of data
+ *
+ * The current data page goes to the first class asking for a page
+ * if it is not open yet, which is how the first data page of a
+ * level is handed out. Otherwise a new or freed page is taken.
+ * Open pages of the classes are kept over doublings.
+ */
+static pgno_t
+_ffdb_open_data_page (ffdb_htab_t* hashp, int* reuse)
+{
+  pgno_t num;
+  unsigned int c, i;
+
+  num = _ffdb_data_page (hashp, 0, reuse);
+  for (c = 0; c < FFDB_DATA_CLASSES; c++) {
+    for (i = 0; i < FFDB_DATA_PAGES; i++) {
+      if (hashp->dpages[c][i].page == num)
+	return _ffdb_data_page (hashp, 1, reuse);
+    }
+  }
+  return num;
+}
+
+/**
+ * Open a data page found in the file for data items of a size class
+ */
+void
+ffdb_reopen_data_page (ffdb_htab_t* hashp, unsigned int dclass, pgno_t page)
+{
+  void* pagep;
+  pgno_t tp;
+
+  if (page == INVALID_PGNO)
+    return;
+  pagep = ffdb_get_page (hashp, page, HASH_DATA_PAGE, 0, &tp);
+  if (!pagep) {
+    fprintf (stderr, "Cannot get data page %d to reopen\n", page);
+    return;
+  }
+  hashp->dpages[dclass][0].page = page;
+  hashp->dpages[dclass][0].start = HIGHEST_FREE(pagep);
+  ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 0);
+}
+
+/**
+ * Find out what is next overflow page number given current page number
+ * We need first to check freed overflow pages
+ *
+ * From version 9 on overflow pages are taken from the pages kept for
+ * key pages of the current level: freed ones first, then those not
+ * used yet. Freed pages kept by the levels below come next. Once all
+ * of them are used, as many pages again are kept above the data pages
+ * so far. Key pages of a level therefore sit together instead of
+ * between data pages. A page not used yet may read back as a deleted
+ * page when later pages were written first
+ *
+ * If there are somthing really wrong, the page released by this call
+ * cannot be reclaimed. (We will live with the consequence)
+ */
+static pgno_t
+_ffdb_ovfl_page (ffdb_htab_t* hashp, int* reuse)
+{
+  pgno_t num = 0;
+  unsigned int point = hashp->hdr.ovfl_point;
+  /* get next level of overflow point */
+  unsigned int level = point + 1;
+
+  *reuse = 0;
+  _ffdb_level_start (hashp);
+
+  if (hashp->hdr.version > FFDB_VERSION_8) {
+    num = _ffdb_freemap_alloc_ovfl (hashp, point, point);
+    if (num == 0 && hashp->ovfl_next < hashp->ovfl_end)
+      return hashp->ovfl_next++;
+    if (num == 0 && point > 0)
+      num = _ffdb_freemap_alloc_ovfl (hashp, point - 1, 0);
+    if (num > 0) {
+#ifdef _FFDB_DEBUG
+      fprintf (stderr, "Overflow reuse previously freed overflow page %d\n", num);
+#endif
+      *reuse = 1;
+      return num;
+    }
+
+    num = hashp->hdr.spares[level];
+    hashp->hdr.spares[level] += _ffdb_ovfl_region_pages (point);
+    hashp->ovfl_next = num + 1;
+    hashp->ovfl_end = hashp->hdr.spares[level];
+#ifdef _FFDB_DEBUG
+    fprintf (stderr, "Keep overflow pages %d to %d\n", num,
+	     hashp->ovfl_end - 1);
+#endif
+    return num;
+  }
+
+  num = _ffdb_reuse_free_ovflpage (hashp);
+  if (num > 0) {
+#ifdef _FFDB_DEBUG
+    fprintf (stderr, "Overflow reuse previously freed overflow page %d\n", num);
+#endif
+    *reuse = 1;
+  }
+  else {
+    num = hashp->hdr.spares[level];
+    hashp->hdr.spares[level]++;
+  }
+  return num;
+}
+
+/**
+ * Give back overflow pages of the run left open by this writer. Pages
+ * kept for key pages of a level go to the free map, where only overflow
+ * pages are taken from. Other pages at the end of the level are taken
+ * off the level
+ */
+void
+ffdb_release_ovfl_run (ffdb_htab_t* hashp)
+{
+  unsigned int level = hashp->hdr.ovfl_point + 1;
+  pgno_t first, end, trim;
+
+  if (hashp->ovfl_next >= hashp->ovfl_end)
+    return;
+
+  trim = hashp->ovfl_end;
+  if (hashp->hdr.spares[level] == hashp->ovfl_end) {
+    trim = hashp->ovfl_next;
+    if (_ffdb_ovfl_region (hashp, level - 1, &first, &end) == 0 && end > trim)
+      trim = end;
+    hashp->hdr.spares[level] = trim;
+  }
+  _ffdb_freemap_add_range (hashp, hashp->ovfl_next, trim);
+  hashp->ovfl_next = hashp->ovfl_end = 0;
+}
+
+
+/**
+ * Find where overflow pages of each level are by reading every page
+ * above the bucket pages of the level. Both bucket and overflow page
+ * types mark an overflow page there
+ */
+int
+ffdb_level_pages (ffdb_htab_t* hashp, ffdb_level_pages_t levels[],
+		  unsigned int* nlevels)
+{
+  unsigned int point, n, ndata, type;
+  pgno_t page, end, tp;
+  ffdb_level_pages_t* lp;
+  void* pagep;
+
+  n = hashp->hdr.ovfl_point + 1;
+  if (n > *nlevels)
+    n = *nlevels;
+
+  for (point = 0; point < n; point++) {
+    lp = &levels[point];
+    memset (lp, 0, sizeof (ffdb_level_pages_t));
+    lp->nbuckets = (point > 0) ? POW2(point - 1) : 1;
+
+    BUCKET_TO_PAGE(POW2(point) - 1, page);
+    page++;
+    end = hashp->hdr.spares[point + 1];
+    /* pages moved into unused bucket pages when the file was closed */
+    if (point == hashp->hdr.ovfl_point && end > hashp->hdr.num_moved_pages)
+      end -= hashp->hdr.num_moved_pages;
+
+    for (ndata = 0; page < end; page++) {
+      pagep = ffdb_get_page (hashp, page, HASH_RAW_PAGE, 0, &tp);
+      if (!pagep) {
+	fprintf (stderr, "Cannot get page %d to find overflow pages\n", page);
+	errno = EIO;
+	return -1;
+      }
+      type = (CURR_PGNO(pagep) == page) ? TYPE(pagep) : 0;
+      ffdb_put_page (hashp, pagep, HASH_RAW_PAGE, 0);
+
+      if (type == HASH_BUCKET_PAGE || type == HASH_OVFL_PAGE) {
+	if (lp->novfl++ == 0)
+	  lp->first = page;
+	lp->last = page;
+	lp->ndata += ndata;
+	ndata = 0;
+      }
+      else if (type == HASH_DATA_PAGE && lp->novfl > 0)
+	ndata++;
+    }
+  }
+  *nlevels = n;
+  return 0;
+}
+
+/**
+ * Search for the last data page on this level starting from the last
+ * going backward to search
+ *
+ * A level holding only overflow pages has no data page when all data
+ * items are embedded on key pages. INVALID_PGNO is returned and the
+ * first page of the level is used once a data page is needed
+ */
+pgno_t
+ffdb_last_data_page (ffdb_htab_t* hashp, pgno_t start)
+{
+  pgno_t page, ret, tp, low;
+  void* pagep;
+  int  done = 0;
+
+  /* the first page of this level is kept for data */
+  BUCKET_TO_PAGE(hashp->hdr.high_mask, low);
+  low++;
+
+  /* We start from the first page above reguler hash pages */
+  ret = INVALID_PGNO;
+  page = start;
+  while (!done && page >= low) {
+    pagep = ffdb_get_page (hashp, page, HASH_RAW_PAGE, 0, &tp);
+    if (!pagep) {
+      fprintf (stderr, "Cannot get page %d while looking for the last data page.\n",
+	       page);
+      abort ();
+    }
+    if (TYPE(pagep) == HASH_DATA_PAGE && NEXT_PGNO(pagep) == INVALID_PGNO) {
+      done = 1;
+      ret = page;
+    }
+    ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
+    page--;
+  }
+
+  return ret;
+}
+
+/**
+ * Put a page back into pagepool
+ */
+int
+ffdb_put_page (ffdb_htab_t* hashp, void* mem,
+	       unsigned int addrtype, int dirty)
+{
+  (void)addrtype;
+  unsigned int flags = 0;
+
+  if (dirty) {
+    flags |= FFDB_PAGE_DIRTY;
+  }
+  return ffdb_pagepool_put_page (hashp->mp, mem, flags);
+}
+
+/**
+ * get a brand new page
+ */
+int
+ffdb_new_page (ffdb_htab_t* hashp, pgno_t addr, 
+	       unsigned int addrtype)
+{
+  pgno_t page;
+  void* mem;
+  int   status;
+
+  switch (addrtype) {
+  case HASH_BUCKET_PAGE:
+    BUCKET_TO_PAGE(addr,page);
+#ifdef _FFDB_DEBUG
+    fprintf (stderr, "New: Bucket %d mapped to page %d\n", addr, page);
+#endif
+    break;
+  default:
+    page = addr;
+    break;
+  }
+  status = ffdb_pagepool_new_page (hashp->mp, &page,
+				   FFDB_PAGE_REQUEST, &mem);
+  if (status != 0)
+    return status;
+  
+  /* We have to initialize the page */
+  _ffdb_init_page (hashp, mem, page, addrtype);
+
+  /* Flush back the page so a get page will have the correct content */
+  ffdb_put_page (hashp, mem, addrtype, 1);
+
+  return 0;
+}
+
+/**
+ * Add a free overflow page the the free information page
+ *
+ * free page is opage
+ * fpagep is page pointer for the first page of the free information page
+ */
+static void
+_ffdb_update_free_page (ffdb_htab_t* hashp, void* fpagep, pgno_t opage)
+{
+  (void)hashp;
+  unsigned int nf = NUM_FREE_PAGES(fpagep);
+
+  FREE_PAGE(fpagep, nf) = opage;
+  
+  NUM_FREE_PAGES(fpagep)++;
+}
+
+/**
+ * Free an overflow page: this happens when a bucket is split. 
+ * We need to update free page in the previous level
+ *
+ * Return whether this page should be deleted
+ *
+ * The freed overflow page is represented by 'memp'
+ */
+static void
+_ffdb_free_ovflpage (ffdb_htab_t* hashp, void* memp, int isdoubling,
+		     int* deleteit)
+{
+  (void)isdoubling;
+  unsigned int level, nf;
+  pgno_t fpage, tp, opage, nextpage, xpage;
+  void *fpagep, *fnext, *xpagep;
+  int xtra_page, reuse;
+
+  if (hashp->hdr.version > FFDB_VERSION_8) {
+    _ffdb_freemap_add (hashp, memp, deleteit);
+    return;
+  }
+
+  /* Set delete flag to true */
+  *deleteit = 1;
+
+  /* get overflow page number */
+  opage = CURR_PGNO(memp);
+
+  /* check what level this page belongs to */
+  for (level = 0; level <= hashp->hdr.ovfl_point; level++) {
+    if (opage < hashp->hdr.spares[level]) {
+      break;
+    }
+  }
+  /* level is one level down */
+  level--;
+
+#ifdef _FFDB_DEBUG
+  fprintf (stderr, "Free overflow page %d for level %d isdoubling = %d\n",
+	   opage, level, isdoubling);
+#endif
+
+  reuse = 0;
+  if (hashp->hdr.free_pages[level] == INVALID_PGNO) {
+    /* I just use this page to keep track free pages */
+    fpage = opage;
+    hashp->hdr.free_pages[level] = fpage;
+    *deleteit = 0;
+
+    fnext = fpagep = memp;
+
+    /* Clean this page out into a free page */
+    _ffdb_init_page (hashp, fpagep, fpage, HASH_FREE_PAGE);
+#ifdef _FFDB_DEBUG
+    fprintf (stderr, "Reuse %d to be free page \n", fpage);
+#endif
+  }
+  else {
+    fpage = hashp->hdr.free_pages[level];
+
+    /* get this page */
+    fnext = fpagep = ffdb_get_page (hashp, fpage, HASH_FREE_PAGE, 
+				    FFDB_CREATE, &tp);
+    if (!fpagep) {
+      fprintf (stderr, "cannot allocate %d for free overflow pages\n", fpage);
+      abort ();
+    }
+    if (reuse)
+      _ffdb_init_page (hashp, fpagep, fpage, HASH_FREE_PAGE);
+
+#ifdef _FFDB_DEBUG
+    fprintf (stderr, "Get a page %d keeping free page at level %d\n",
+	     tp, level);
+#endif
+
+    xtra_page = 1;
+    /* I have to check chain of pages */
+    while (fnext) {
+      /* get current number of free pages contained inside this page */
+      nf = NUM_FREE_PAGES(fpagep);
+      if (nf < MAX_NUM_FREE_PAGES - 1){ /* There is space on this page */
+	/* Now write this page number to the free page */
+	_ffdb_update_free_page (hashp, fpagep, opage);
+	xtra_page = 0;
+	/* put this page out */
+	ffdb_put_page (hashp, fpagep, TYPE(fpagep), 1);
+	/* We are done */
+	fnext = 0;
+	xtra_page = 0;
+      }
+      else {
+	nextpage = NEXT_PGNO(fpagep);
+	if (nextpage == INVALID_PGNO)
+	  fnext = 0;
+	else {
+	  fnext = ffdb_get_page (hashp, nextpage, HASH_FREE_PAGE, 0, &tp);
+	  if (!fnext) {
+	    fprintf (stderr, "Cannot get free bitmap page %d\n",
+		     nextpage);
+	    /* release the previous page */
+	    ffdb_put_page (hashp, fpagep, TYPE(fpagep), 0);
+	    return;
+	  }
+	  /* release the previous page */
+	  ffdb_put_page (hashp, fpagep, TYPE(fpagep), 0);
+
+	  /* assign new pointers */
+	  fpagep = fnext;
+	  fpage = nextpage;
+	}
+      }
+    }
+  
+    /* If we need extra page */
+    reuse = 0;
+    if (xtra_page) {
+      /* We need an extra page to store free page. We just use this page */
+      xpage = opage;
+#ifdef _FFDB_DEBUG
+      fprintf (stderr, "reuse overflow page %d as chained free page %d\n",
+	       xpage, fpage);
+#endif
+      *deleteit = 0;
+
+      /* initialize this page */
+      xpagep = memp;
+      _ffdb_init_page (hashp, xpagep, xpage, HASH_FREE_PAGE);
+
+#ifdef _FFDB_STATISTICS
+      hash_overflows++;
+#endif
+
+      /* set up correct link */
+      NEXT_PGNO (fpagep) = xpage;
+      PREV_PGNO (xpagep) = fpage;
+
+      /* release the previous page */
+      ffdb_put_page (hashp, fpagep, TYPE(fpagep), 0); 
+    }
+  }
+}
+
+/**
+ * Delete a page: usually an overflow page
+ */
+static int
+ffdb_delete_page (ffdb_htab_t* hashp, void* pagep, 
+		  unsigned int addrtype, int isdoubling)
+{
+  int deleteit = 0;
+  if (addrtype == HASH_OVFL_PAGE) {
+    _ffdb_free_ovflpage (hashp, pagep, isdoubling, &deleteit);
+    if (deleteit) {
+      /* if this page need to be deleted */
+      _ffdb_init_page (hashp, pagep, CURR_PGNO(pagep), HASH_DELETED_PAGE);
+      return ffdb_pagepool_delete (hashp->mp, pagep); 
+    }
+    else 
+      return ffdb_put_page (hashp, pagep, TYPE(pagep), 1);
+  }
+  else 
+    return ffdb_pagepool_delete (hashp->mp, pagep);
+}
+
+/**
+ * Get a page
  */
 void *
 ffdb_get_page (ffdb_htab_t* hashp, pgno_t addr, 
 	       unsigned int addrtype, unsigned flags, pgno_t* page)
 {
-  int   status;
-  void* mem = 0;
+  int   status;
+  void* mem = 0;
+
+  switch (addrtype) {
+  case HASH_BUCKET_PAGE:
+    BUCKET_TO_PAGE(addr, *page);
+#ifdef _FFDB_DEBUG
+    fprintf (stderr, "Get: Bucket %d mapped to page %d\n", addr, *page);
+#endif
+    break;
+  default:
+    *page = addr;
+    break;
+  }
+  status = ffdb_pagepool_get_page (hashp->mp, page, flags, &mem);
+
+  if (status != 0)
+    return 0;
+
+  /* If this page is a new page, we need to initialize it.
+   * A new page is a page with page number 0 since zero page number
+   * will never occur
+   */
+  if (FFDB_FLAG_ISSET(flags, FFDB_CREATE) && CURR_PGNO(mem) == 0) 
+    _ffdb_init_page (hashp, mem, *page, addrtype);
+
+  return mem;
+}
+
+/**
+ * Release item and the related page associated with this item
+ *
+ * This routine is used when the item is no longer needed, which
+ * usually happened when hash_get did not get anything
+ */
+int ffdb_release_item (ffdb_htab_t* hashp,
+		       ffdb_hent_t* item)
+{
+  int status;
+  /* Now I do not need this page */
+  status = ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
+
+  item->pagep = 0;
+  item->pgno = INVALID_PGNO;
+  item->bucket = INVALID_PGNO;
+  item->status = ITEM_ERROR;
+
+  return status;
+}
+
+
+/**
+ * Routines to find a page for key and data pair
+ */
+int ffdb_find_item (ffdb_htab_t* hashp,
+		    FFDB_DBT* key, FFDB_DBT* val,
+		    ffdb_hent_t* item)
+{
+  unsigned int i, found, done;
+  pgno_t nextp;
+  unsigned int chksum = 0;
+  FFDB_DBT ekey;
+  unsigned char *ekdata = 0;
+
+  /* first get page for this bucket */
+  item->pagep = ffdb_get_page (hashp, item->bucket, HASH_BUCKET_PAGE,
+			       FFDB_PAGE_CREATE, &item->pgno);
+  if (item->pagep == 0) {
+    fprintf (stderr, "Cannot get page for bucket %d\n", item->bucket);
+    item->status = ITEM_ERROR;
+    return -1;
+  }
+#ifdef _FFDB_DEBUG
+  fprintf (stderr, "Allocate page %d for bucket %d num entry %d\n", item->pgno, 
+	   item->bucket, NUM_ENT(item->pagep));
+#endif
+
+  /* do a quick checksum on data */
+  if (val && val->data) {
+    chksum = 0;
+    chksum = __ffdb_crc32_checksum (chksum, val->data, val->size);
+    item->data_chksum = chksum;
+  }
+  else
+    item->data_chksum = 0;
+
+  if (NUM_ENT(item->pagep) == 0) { /* new page or nothing on it */
+    item->pgndx = 0;
+    item->status = ITEM_NO_MORE;
+    _ffdb_init_page (hashp, item->pagep, item->pgno, HASH_BUCKET_PAGE);
+    return 0;
+  }
+
+#ifdef _FFDB_STATISTICS
+  FFDB_LOCK (hashp->lock);
+  hash_collisions++;
+  FFDB_UNLOCK (hashp->lock);
+#endif
+
+  /* set item page number information */
+  item->pgno = CURR_PGNO (item->pagep);
+  item->status = ITEM_NO_MORE;
+  found = 0;
+  done = 0;
+  while (!done) {
+    for (i = 0; i < NUM_ENT(item->pagep); i++) {
+      /* get key for this index */
+      ekdata = KEY(item->pagep, i);
+      ekey.data = ekdata;
+      ekey.size = KEY_LEN(item->pagep, i);
+
+      /* We do not allow duplicated keys */
+      if (hashp->h_compare(key, &ekey) == 0) {
+	found = 1;
+	break;
+      }
+    }
+    if (found) /* We have found an item */
+      done = 1;
+    else {
+      /* This is the page */
+      if (NEXT_PGNO(item->pagep) == INVALID_PGNO)
+	done = 1;
+      else {
+	nextp = NEXT_PGNO(item->pagep);
+
+	/* Put this page back */
+	ffdb_put_page (hashp, item->pagep, HASH_BUCKET_PAGE, 0);
+
+	/* get the next page */
+	item->pagep = ffdb_get_page (hashp, nextp, HASH_OVFL_PAGE,
+				     0, &item->pgno);
+	if (item->pagep == 0) {
+	  fprintf (stderr, "Cannot get next page for bucket %d at page %d\n", 
+		   item->bucket, item->pgno);
+	  item->status = ITEM_ERROR;
+	  return -1;
+	}
+#ifdef _FFDB_DEBUG
+	fprintf (stderr, "Could not find item on primary page, check next page at %d\n", nextp);
+#endif
+      }
+    }
+  }
+  /* no matter whether we found the item or not, the index = i */
+  item->pgndx = i;
+
+  if (found) {
+    /* We found the key */
+    item->status = ITEM_OK;
+    item->key_off = KEY_OFF(item->pagep, i);
+    item->key_len = KEY_LEN(item->pagep, i);
+    item->data_off = DATAP_OFF(item->pagep, i);
+  }
+  return 0;
+}
+
+
+int ffdb_get_item (ffdb_htab_t* hashp,
+		   const FFDB_DBT* key, FFDB_DBT* val,
+		   ffdb_hent_t* item, int freepage)
+{
+  (void)key;
+  (void)val;
+  int status;
+  ffdb_datap_t* datap;
+  unsigned int roff;
+  long rlen;
+
+  /* first get data pointer */
+  datap = DATAP(item->pagep, item->pgndx);
+  if (hashp->hdr.version > FFDB_VERSION_5) {
+    rlen = REAL_DATA_LEN(datap->len, datap->offset);
+    roff = GET_PGOFFSET (datap->offset);
+  }
+#ifdef _FFDB_DEBUG
+  if (hashp->hdr.version > FFDB_VERSION_5) {
+    rlen = REAL_DATA_LEN(datap->len, datap->offset);
+    roff = GET_PGOFFSET (datap->offset);
+    fprintf (stderr, "Found Key %s information: \n", (char *)key->data);
+    fprintf (stderr, "At first page %d\n", datap->first);
+    fprintf (stderr, "At offset %u and datap->offset %u \n", roff, datap->offset);
+    fprintf (stderr, "Length of data %ld with datap->len = %u \n", rlen, datap->len);
+    fprintf (stderr, "Checksum of data is 0x%x\n", datap->chksum);
+    fprintf (stderr, "freepage is = %d\n", freepage);
+  }
+  else {
+    fprintf (stderr, "Found Key %s information: \n", (char *)key->data);
+    fprintf (stderr, "At first page %d\n", datap->first);
+    fprintf (stderr, "At offset %d\n", datap->offset);
+    fprintf (stderr, "Length of data %d\n", datap->len);
+    fprintf (stderr, "Checksum of data is 0x%x\n", datap->chksum);
+    fprintf (stderr, "freepage is = %d\n", freepage);
+  }
+#else
+  (void)roff;
+  (void)rlen;
+#endif
+
+  /* Now I have to hop to data page to get this data item */
+  status = _ffdb_get_data (hashp, item, val, datap);
+  if (status != 0) {
+    fprintf (stderr, "Cannot get data on page %d at offset %d\n",
+	     datap->first, datap->offset);
+    return status;
+  }
+
+ /* Now I do not need this page */
+  if (freepage)
+    ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
+
+  return 0;
+}
+
+/**
+ * Find a set of keys hashed into the same bucket
+ *
+ * Every page on the bucket chain is pinned only once no matter how many
+ * keys are looked up. The bucket page is released before returning.
+ */
+int ffdb_find_items (ffdb_htab_t* hashp, unsigned int bucket,
+		     FFDB_DBT* keys[], unsigned int n,
+		     ffdb_hent_t* items, ffdb_datap_t* datap)
+{
+  unsigned int i, k, left;
+  pgno_t nextp, pgno;
+  void* pagep;
+  FFDB_DBT ekey;
+
+  for (i = 0; i < n; i++) {
+    items[i].bucket = bucket;
+    items[i].pagep = 0;
+    items[i].status = ITEM_NO_MORE;
+  }
+
+  /* first get page for this bucket */
+  pagep = ffdb_get_page (hashp, bucket, HASH_BUCKET_PAGE,
+			 FFDB_PAGE_CREATE, &pgno);
+  if (pagep == 0) {
+    fprintf (stderr, "Cannot get page for bucket %d\n", bucket);
+    return -1;
+  }
+
+  left = n;
+  while (1) {
+    for (i = 0; i < n; i++) {
+      if (items[i].status == ITEM_OK)
+	continue;
+      for (k = 0; k < NUM_ENT(pagep); k++) {
+	ekey.data = KEY(pagep, k);
+	ekey.size = KEY_LEN(pagep, k);
+
+	if (hashp->h_compare(keys[i], &ekey) == 0) {
+	  items[i].status = ITEM_OK;
+	  items[i].pgno = CURR_PGNO(pagep);
+	  items[i].pgndx = k;
+	  items[i].key_off = KEY_OFF(pagep, k);
+	  items[i].key_len = KEY_LEN(pagep, k);
+	  items[i].data_off = DATAP_OFF(pagep, k);
+	  memcpy (&datap[i], DATAP(pagep, k), sizeof (ffdb_datap_t));
+	  left--;
+	  break;
+	}
+      }
+    }
+    nextp = (NUM_ENT(pagep) == 0) ? INVALID_PGNO : NEXT_PGNO(pagep);
+    ffdb_put_page (hashp, pagep, HASH_BUCKET_PAGE, 0);
+
+    if (left == 0 || nextp == INVALID_PGNO)
+      break;
+
+    pagep = ffdb_get_page (hashp, nextp, HASH_OVFL_PAGE, 0, &pgno);
+    if (pagep == 0) {
+      fprintf (stderr, "Cannot get next page for bucket %d at page %d\n", 
+	       bucket, nextp);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Visit all keys of a bucket
+ */
+int ffdb_scan_bucket (ffdb_htab_t* hashp, unsigned int bucket,
+		      ffdb_scan_func_t func, void* arg)
+{
+  unsigned int k;
+  pgno_t nextp, pgno;
+  void* pagep;
+  FFDB_DBT ekey;
+  int stop;
+
+  pagep = ffdb_get_page (hashp, bucket, HASH_BUCKET_PAGE, 0, &pgno);
+  if (pagep == 0) {
+    fprintf (stderr, "Cannot get page for bucket %d\n", bucket);
+    return -1;
+  }
+
+  while (1) {
+    stop = 0;
+    for (k = 0; k < NUM_ENT(pagep) && !stop; k++) {
+      ekey.data = KEY(pagep, k);
+      ekey.size = KEY_LEN(pagep, k);
+      stop = func (arg, &ekey, pgno, k, DATAP(pagep, k));
+    }
+    nextp = (NUM_ENT(pagep) == 0) ? INVALID_PGNO : NEXT_PGNO(pagep);
+    ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
+
+    if (stop || nextp == INVALID_PGNO)
+      break;
+
+    pagep = ffdb_get_page (hashp, nextp, HASH_OVFL_PAGE, 0, &pgno);
+    if (pagep == 0) {
+      fprintf (stderr, "Cannot get next page for bucket %d at page %d\n", 
+	       bucket, nextp);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Find the key of a data item through the key hash in its data header
+ * (version 10 and later). doff is where the header is on data page dpage
+ *
+ * On success the key page is held in item with the index of the key
+ * and 0 is returned. -1 is returned if no key points to this data item
+ */
+static int
+_ffdb_find_data_key (ffdb_htab_t* hashp, ffdb_data_header_t* header,
+		     pgno_t dpage, unsigned int doff, ffdb_hent_t* item)
+{
+  unsigned int k, bucket;
+  pgno_t nextp, pgno;
+  ffdb_datap_t* datap;
+  void* pagep;
+
+  bucket = _ffdb_hash_bucket (hashp, header->key_page);
+  pagep = ffdb_get_page (hashp, bucket, HASH_BUCKET_PAGE, 0, &pgno);
+  if (pagep == 0) {
+    fprintf (stderr, "Cannot get page for bucket %d\n", bucket);
+    return -1;
+  }
+
+  while (1) {
+    for (k = 0; k < NUM_ENT(pagep); k++) {
+      datap = DATAP(pagep, k);
+      if (!IS_EMBEDDED(datap) && datap->first == dpage &&
+	  GET_PGOFFSET(datap->offset) == doff) {
+	item->pgno = pgno;
+	item->pgndx = k;
+	item->pagep = pagep;
+	return 0;
+      }
+    }
+    nextp = (NUM_ENT(pagep) == 0) ? INVALID_PGNO : NEXT_PGNO(pagep);
+    ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
+
+    if (nextp == INVALID_PGNO)
+      break;
+
+    pagep = ffdb_get_page (hashp, nextp, HASH_OVFL_PAGE, 0, &pgno);
+    if (pagep == 0) {
+      fprintf (stderr, "Cannot get next page for bucket %d at page %d\n", 
+	       bucket, nextp);
+      return -1;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Get data for an item found by ffdb_find_items
+ */
+int ffdb_get_item_data (ffdb_htab_t* hashp, ffdb_hent_t* item,
+			ffdb_datap_t* datap, FFDB_DBT* val)
+{
+  return _ffdb_get_data (hashp, item, val, datap);
+}
+
+/**
+ * Get a view of the data item found on the page held by item
+ * 
+ * The data page is kept pinned in the view if the file is read only and
+ * the item fits on that page. Otherwise the item is copied. Embedded
+ * data keep the hash page held by item pinned instead. Otherwise the
+ * hash page held by item is released
+ */
+int ffdb_get_item_view (ffdb_htab_t* hashp, ffdb_hent_t* item,
+			ffdb_view_t* view)
+{
+  ffdb_datap_t* datap;
+  ffdb_data_header_t* header;
+  FFDB_DBT val;
+  void* pagep;
+  pgno_t tp;
+  unsigned int roff, start, chksum;
+  long datalen;
+  int status;
+
+  view->data = 0;
+  view->size = 0;
+  view->page = 0;
+  view->buffer = 0;
+
+  datap = DATAP(item->pagep, item->pgndx);
+  if (IS_EMBEDDED(datap) && (hashp->flags & O_ACCMODE) == O_RDONLY) {
+    chksum = __ffdb_crc32_checksum (0, item->pagep + datap->offset, 
+				    datap->len);
+    if (chksum != datap->chksum) {
+      fprintf (stderr, "Get data checksum mismatch 0x%x (calculated) != 0x%x (stored)\n", chksum, datap->chksum);
+      ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
+      item->pagep = 0;
+      return -1;
+    }
+    /* the view takes over the hash page */
+    view->data = (unsigned char *)item->pagep + datap->offset;
+    view->size = datap->len;
+    view->page = item->pagep;
+    item->pagep = 0;
+    return 0;
+  }
 
-  switch (addrtype) {
-  case HASH_BUCKET_PAGE:
-    BUCKET_TO_PAGE(addr, *page);
-#ifdef _FFDB_DEBUG
-    fprintf (stderr, "Get: Bucket %d mapped to page %d\n", addr, *page);
-#endif
-    break;
-  default:
-    *page = addr;
-    break;
+  if (IS_EMBEDDED(datap)) {
+    datalen = datap->len;
+    roff = datap->offset;
   }
-  status = ffdb_pagepool_get_page (hashp->mp, page, flags, &mem);
+  else if (hashp->hdr.version > FFDB_VERSION_5) {
+    datalen = REAL_DATA_LEN(datap->len, datap->offset);
+    roff = GET_PGOFFSET (datap->offset);
+  }
+  else {
+    datalen = datap->len;
+    roff = datap->offset;
+  }
+  start = roff + sizeof(ffdb_data_header_t);
 
-  if (status != 0)
+  if ((hashp->flags & O_ACCMODE) != O_RDONLY || IS_EMBEDDED(datap) ||
+      start + datalen > hashp->hdr.bsize) {
+    /* Pages may change or data crosses pages: make a copy */
+    val.data = 0;
+    val.size = 0;
+    status = _ffdb_get_data (hashp, item, &val, datap);
+    ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
+    item->pagep = 0;
+    if (status != 0)
+      return status;
+    view->data = view->buffer = val.data;
+    view->size = val.size;
     return 0;
+  }
 
-  /* If this page is a new page, we need to initialize it.
-   * A new page is a page with page number 0 since zero page number
-   * will never occur
-   */
-  if (FFDB_FLAG_ISSET(flags, FFDB_CREATE) && CURR_PGNO(mem) == 0) 
-    _ffdb_init_page (hashp, mem, *page, addrtype);
+  pagep = ffdb_get_page (hashp, datap->first, HASH_DATA_PAGE, 0, &tp);
+  if (!pagep) {
+    fprintf (stderr, "Cannot get data page at %d \n", datap->first);
+    ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
+    item->pagep = 0;
+    return -1;
+  }
 
-  return mem;
+  /* now do a quick sanity check */
+  assert (datap->first == CURR_PGNO(pagep));
+  header = BIG_DATA_HEADER(pagep, roff);
+  if (hashp->hdr.version > FFDB_VERSION_5) 
+    assert (REAL_DATA_LEN(header->len, header->status) == datalen);
+  else
+    assert (header->len == datap->len);
+  assert (KEY_BY_HASH(hashp) || header->key_page == item->pgno);
+  assert (KEY_BY_HASH(hashp) || header->key_idx == item->pgndx);
+
+  chksum = 0;
+  chksum = __ffdb_crc32_checksum (chksum, (unsigned char *)pagep + start,
+				  datalen);
+  if (chksum != datap->chksum) {
+    fprintf (stderr, "Get data checksum mismatch 0x%x (calculated) != 0x%x (stored)\n", chksum, datap->chksum);
+    ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 0);
+    ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
+    item->pagep = 0;
+    return -1;
+  }
+
+  view->data = (unsigned char *)pagep + start;
+  view->size = datalen;
+  view->page = pagep;
+
+  ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
+  item->pagep = 0;
+  return 0;
 }
 
 /**
- * Release item and the related page associated with this item
- *
- * This routine is used when the item is no longer needed, which
- * usually happened when hash_get did not get anything
+ * Release a view obtained from ffdb_get_item_view
  */
-int ffdb_release_item (ffdb_htab_t* hashp,
-		       ffdb_hent_t* item)
+int ffdb_release_item_view (ffdb_htab_t* hashp, ffdb_view_t* view)
 {
-  int status;
-  /* Now I do not need this page */
-  status = ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
+  int status = 0;
 
-  item->pagep = 0;
-  item->pgno = INVALID_PGNO;
-  item->bucket = INVALID_PGNO;
-  item->status = ITEM_ERROR;
+  if (view->page) 
+    status = ffdb_put_page (hashp, view->page, HASH_DATA_PAGE, 0);
+  if (view->buffer)
+    free (view->buffer);
 
+  view->data = 0;
+  view->size = 0;
+  view->page = 0;
+  view->buffer = 0;
   return status;
 }
 
+/**
+ * Move to the page of an extent holding byte offset of a data item
+ *
+ * next is the first page of the extent and pos + flen is where the 
+ * extent starts in the data item. The target page is checked against 
+ * its previous page number so that an extent broken by page 
+ * rearrangement is never trusted. On success next becomes the target
+ * page and pos is moved forward by the pages skipped.
+ */
+static void
+_ffdb_extent_seek (ffdb_htab_t* hashp, pgno_t* next, long* pos, 
+		   long flen, long offset)
+{
+  void* pagep;
+  pgno_t page, tp;
+  long cap, k;
+
+  cap = hashp->hdr.bsize - BIG_PAGE_OVERHEAD;
+  if (offset < *pos + flen + cap)
+    return;
+
+  /* number of whole pages of the extent in front of offset */
+  k = (offset - *pos - flen) / cap;
+  page = *next + k;
+  pagep = ffdb_get_page (hashp, page, HASH_DATA_PAGE, 0, &tp);
+  if (!pagep)
+    return;
+  if (CURR_PGNO(pagep) == page && TYPE(pagep) == HASH_DATA_PAGE &&
+      PREV_PGNO(pagep) == page - 1) {
+    *next = page;
+    *pos += k * cap;
+  }
+  ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 0);
+}
 
 /**
- * Routines to find a page for key and data pair
+ * Copy a byte range of the data item found on the page held by item
+ *
+ * Pages of the data chain in front of the range are only visited for
+ * their next page link, and the chain is not followed past the range.
+ * The checksum covers the whole data item and is not verified here.
+ * The hash page held by item is released
  */
-int ffdb_find_item (ffdb_htab_t* hashp,
-		    FFDB_DBT* key, FFDB_DBT* val,
-		    ffdb_hent_t* item)
+int ffdb_get_item_range (ffdb_htab_t* hashp, ffdb_hent_t* item,
+			 long offset, long len, void* buf, long* datalen)
 {
-  unsigned int i, found, done;
-  pgno_t nextp;
-  unsigned int chksum = 0;
-  FFDB_DBT ekey;
-  unsigned char *ekdata = 0;
+  ffdb_datap_t datap;
+  ffdb_data_header_t* header;
+  void* pagep;
+  pgno_t next, tp;
+  unsigned int roff, start;
+  long dlen, pos, skip, copylen, idx;
+
+  /* keep a copy of the data pointer since the hash page is released */
+  memcpy (&datap, DATAP(item->pagep, item->pgndx), sizeof (ffdb_datap_t));
+  if (IS_EMBEDDED(&datap)) {
+    dlen = datap.len;
+    if (datalen)
+      *datalen = dlen;
+    if (offset < 0 || len < 0 || offset + len > dlen) {
+      fprintf (stderr, "Data range [%ld, %ld) is outside data item of %ld bytes\n",
+	       offset, offset + len, dlen);
+      ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
+      item->pagep = 0;
+      errno = EINVAL;
+      return -1;
+    }
+    memcpy (buf, (unsigned char *)item->pagep + datap.offset + offset, len);
+    ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
+    item->pagep = 0;
+    return 0;
+  }
+  if (hashp->hdr.version > FFDB_VERSION_5) {
+    dlen = REAL_DATA_LEN(datap.len, datap.offset);
+    roff = GET_PGOFFSET (datap.offset);
+  }
+  else {
+    dlen = datap.len;
+    roff = datap.offset;
+  }
+  next = datap.first;
+  if (datalen)
+    *datalen = dlen;
 
-  /* first get page for this bucket */
-  item->pagep = ffdb_get_page (hashp, item->bucket, HASH_BUCKET_PAGE,
-			       FFDB_PAGE_CREATE, &item->pgno);
-  if (item->pagep == 0) {
-    fprintf (stderr, "Cannot get page for bucket %d\n", item->bucket);
-    item->status = ITEM_ERROR;
+  /* done with the hash page */
+  ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
+  item->pagep = 0;
+
+  if (offset < 0 || len < 0 || offset + len > dlen) {
+    fprintf (stderr, "Data range [%ld, %ld) is outside data item of %ld bytes\n",
+	     offset, offset + len, dlen);
+    errno = EINVAL;
     return -1;
   }
-#ifdef _FFDB_DEBUG
-  fprintf (stderr, "Allocate page %d for bucket %d num entry %d\n", item->pgno, 
-	   item->bucket, NUM_ENT(item->pagep));
-#endif
+  if (len == 0)
+    return 0;
 
-  /* do a quick checksum on data */
-  if (val) {
-    chksum = 0;
-    chksum = __ffdb_crc32_checksum (chksum, val->data, val->size);
-    item->data_chksum = chksum;
-  }
-  else
-    item->data_chksum = 0;
+  /* pos is the offset within the data item where page data starts */
+  pos = 0;
+  start = roff + sizeof(ffdb_data_header_t);
+  idx = 0;
+  while (idx < len) {
+    if (next != datap.first && hashp->hdr.version > FFDB_VERSION_5 && 
+	IS_EXTENT(datap.offset))
+      _ffdb_extent_load (hashp, next, len - idx);
+    pagep = ffdb_get_page (hashp, next, HASH_DATA_PAGE, 0, &tp);
+    if (!pagep) {
+      fprintf (stderr, "Cannot get data page at %d\n", next);
+      return -1;
+    }
+    if (next == datap.first) {
+      /* now do a quick sanity check */
+      assert (datap.first == CURR_PGNO(pagep));
+      header = BIG_DATA_HEADER(pagep, roff);
+      assert (KEY_BY_HASH(hashp) || header->key_page == item->pgno);
+      assert (KEY_BY_HASH(hashp) || header->key_idx == item->pgndx);
+    }
+    next = NEXT_PGNO(pagep);
+
+    /* pages of an extent are in a row: jump to the page of the range */
+    if (start != BIG_PAGE_OVERHEAD && next != INVALID_PGNO &&
+	hashp->hdr.version > FFDB_VERSION_5 && IS_EXTENT(datap.offset)) 
+      _ffdb_extent_seek (hashp, &next, &pos, hashp->hdr.bsize - start, 
+			 offset);
+
+    copylen = hashp->hdr.bsize - start;
+    if (pos + copylen > offset) {
+      skip = (offset > pos) ? offset - pos : 0;
+      copylen -= skip;
+      if (copylen > len - idx)
+	copylen = len - idx;
+      memcpy ((unsigned char *)buf + idx, 
+	      (unsigned char *)pagep + start + skip, copylen);
+      idx += copylen;
+    }
+    pos += hashp->hdr.bsize - start;
+    ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 0);
 
-  if (NUM_ENT(item->pagep) == 0) { /* new page or nothing on it */
-    item->pgndx = 0;
-    item->status = ITEM_NO_MORE;
-    _ffdb_init_page (hashp, item->pagep, item->pgno, HASH_BUCKET_PAGE);
-    return 0;
+    start = BIG_PAGE_OVERHEAD;
   }
+  return 0;
+}
 
-#ifdef _FFDB_STATISTICS
-  FFDB_LOCK (hashp->lock);
-  hash_collisions++;
-  FFDB_UNLOCK (hashp->lock);
-#endif
+/**
+ * Overwrite a byte range of the data item found on the page held by item
+ *
+ * Only data pages holding the range are modified. The checksum in the
+ * data pointer is updated from the old and new bytes of the range, and
+ * the hash page held by item is released
+ */
+int ffdb_put_item_range (ffdb_htab_t* hashp, ffdb_hent_t* item,
+			 long offset, const void* buf, long len)
+{
+  ffdb_datap_t* datap;
+  void* pagep;
+  pgno_t next, tp;
+  unsigned int roff, start, chksum;
+  long dlen, pos, skip, copylen, idx;
+  int status = 0;
 
-  /* set item page number information */
-  item->pgno = CURR_PGNO (item->pagep);
-  item->status = ITEM_NO_MORE;
-  found = 0;
-  done = 0;
-  while (!done) {
-    for (i = 0; i < NUM_ENT(item->pagep); i++) {
-      /* get key for this index */
-      ekdata = KEY(item->pagep, i);
-      ekey.data = ekdata;
-      ekey.size = KEY_LEN(item->pagep, i);
+  datap = DATAP(item->pagep, item->pgndx);
+  if (IS_EMBEDDED(datap)) {
+    dlen = datap->len;
+    roff = datap->offset;
+  }
+  else if (hashp->hdr.version > FFDB_VERSION_5) {
+    dlen = REAL_DATA_LEN(datap->len, datap->offset);
+    roff = GET_PGOFFSET (datap->offset);
+  }
+  else {
+    dlen = datap->len;
+    roff = datap->offset;
+  }
 
-      /* We do not allow duplicated keys */
-      if (hashp->h_compare(key, &ekey) == 0) {
-	found = 1;
-	break;
-      }
-    }
-    if (found) /* We have found an item */
-      done = 1;
-    else {
-      /* This is the page */
-      if (NEXT_PGNO(item->pagep) == INVALID_PGNO)
-	done = 1;
-      else {
-	nextp = NEXT_PGNO(item->pagep);
+  if (offset < 0 || len < 0 || offset + len > dlen) {
+    fprintf (stderr, "Data range [%ld, %ld) is outside data item of %ld bytes\n",
+	     offset, offset + len, dlen);
+    ffdb_put_page (hashp, item->pagep, HASH_BUCKET_PAGE, 0);
+    item->pagep = 0;
+    errno = EINVAL;
+    return -1;
+  }
 
-	/* Put this page back */
-	ffdb_put_page (hashp, item->pagep, HASH_BUCKET_PAGE, 0);
+  chksum = datap->chksum;
+  if (IS_EMBEDDED(datap)) {
+    /* embedded data are right on the hash page */
+    pagep = (unsigned char *)item->pagep + roff + offset;
+    datap->chksum = __ffdb_crc32_update (chksum, pagep, 
+					 (const unsigned char *)buf, len,
+					 dlen - (offset + len));
+    memcpy (pagep, buf, len);
+    ffdb_put_page (hashp, item->pagep, HASH_BUCKET_PAGE, 1);
+    item->pagep = 0;
+    return 0;
+  }
 
-	/* get the next page */
-	item->pagep = ffdb_get_page (hashp, nextp, HASH_OVFL_PAGE,
-				     0, &item->pgno);
-	if (item->pagep == 0) {
-	  fprintf (stderr, "Cannot get next page for bucket %d at page %d\n", 
-		   item->bucket, item->pgno);
-	  item->status = ITEM_ERROR;
-	  return -1;
-	}
-#ifdef _FFDB_DEBUG
-	fprintf (stderr, "Could not find item on primary page, check next page at %d\n", nextp);
-#endif
-      }
+  next = datap->first;
+  pos = 0;
+  start = roff + sizeof(ffdb_data_header_t);
+  idx = 0;
+  while (idx < len) {
+    pagep = ffdb_get_page (hashp, next, HASH_DATA_PAGE, 0, &tp);
+    if (!pagep) {
+      fprintf (stderr, "Cannot get data page at %d\n", next);
+      status = -1;
+      break;
     }
-  }
-  /* no matter whether we found the item or not, the index = i */
-  item->pgndx = i;
+    next = NEXT_PGNO(pagep);
+
+    copylen = hashp->hdr.bsize - start;
+    if (pos + copylen > offset) {
+      skip = (offset > pos) ? offset - pos : 0;
+      copylen -= skip;
+      if (copylen > len - idx)
+	copylen = len - idx;
+      chksum = __ffdb_crc32_update (chksum, 
+				    (unsigned char *)pagep + start + skip,
+				    (const unsigned char *)buf + idx, copylen,
+				    dlen - (offset + idx + copylen));
+      memcpy ((unsigned char *)pagep + start + skip,
+	      (const unsigned char *)buf + idx, copylen);
+      idx += copylen;
+      ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 1);
+    }
+    else
+      ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 0);
+    pos += hashp->hdr.bsize - start;
 
-  if (found) {
-    /* We found the key */
-    item->status = ITEM_OK;
-    item->key_off = KEY_OFF(item->pagep, i);
-    item->key_len = KEY_LEN(item->pagep, i);
-    item->data_off = DATAP_OFF(item->pagep, i);
+    start = BIG_PAGE_OVERHEAD;
   }
-  return 0;
-}
 
+  /* checksum always matches the bytes written so far */
+  datap->chksum = chksum;
+  ffdb_put_page (hashp, item->pagep, HASH_BUCKET_PAGE, 1);
+  item->pagep = 0;
 
-int ffdb_get_item (ffdb_htab_t* hashp,
-		   const FFDB_DBT* key, FFDB_DBT* val,
-		   ffdb_hent_t* item, int freepage)
+  return status;
+}
+
+/**
+ * Start a streaming handle at the beginning of the data item found
+ * on the page held by item
+ *
+ * Embedded data are copied since the hash page may be split under
+ * the handle
+ */
+int ffdb_value_start (ffdb_htab_t* hashp, ffdb_hent_t* item,
+		      ffdb_value_t* value)
 {
-  (void)key;
-  (void)val;
-  int status;
   ffdb_datap_t* datap;
   unsigned int roff;
-  long rlen;
 
-  /* first get data pointer */
   datap = DATAP(item->pagep, item->pgndx);
-  if (hashp->hdr.version > FFDB_VERSION_5) {
-    rlen = REAL_DATA_LEN(datap->len, datap->offset);
-    roff = GET_PGOFFSET (datap->offset);
+  if (IS_EMBEDDED(datap)) {
+    /* streaming writes always reserve space on data pages */
+    if (value->write) {
+      fprintf (stderr, "Data item replaced while opened for streaming write\n");
+      ffdb_put_page (hashp, item->pagep, HASH_BUCKET_PAGE, 0);
+      item->pagep = 0;
+      errno = EBUSY;
+      return -1;
+    }
+    value->buffer = (unsigned char *)malloc (datap->len > 0 ? datap->len : 1);
+    if (!value->buffer) {
+      ffdb_put_page (hashp, item->pagep, HASH_BUCKET_PAGE, 0);
+      item->pagep = 0;
+      errno = ENOMEM;
+      return -1;
+    }
+    memcpy (value->buffer, item->pagep + datap->offset, datap->len);
+    value->size = datap->len;
+    roff = 0;
   }
-#ifdef _FFDB_DEBUG
-  if (hashp->hdr.version > FFDB_VERSION_5) {
-    rlen = REAL_DATA_LEN(datap->len, datap->offset);
+  else if (hashp->hdr.version > FFDB_VERSION_5) {
+    value->size = REAL_DATA_LEN(datap->len, datap->offset);
     roff = GET_PGOFFSET (datap->offset);
-    fprintf (stderr, "Found Key %s information: \n", (char *)key->data);
-    fprintf (stderr, "At first page %d\n", datap->first);
-    fprintf (stderr, "At offset %u and datap->offset %u \n", roff, datap->offset);
-    fprintf (stderr, "Length of data %ld with datap->len = %u \n", rlen, datap->len);
-    fprintf (stderr, "Checksum of data is 0x%x\n", datap->chksum);
-    fprintf (stderr, "freepage is = %d\n", freepage);
   }
   else {
-    fprintf (stderr, "Found Key %s information: \n", (char *)key->data);
-    fprintf (stderr, "At first page %d\n", datap->first);
-    fprintf (stderr, "At offset %d\n", datap->offset);
-    fprintf (stderr, "Length of data %d\n", datap->len);
-    fprintf (stderr, "Checksum of data is 0x%x\n", datap->chksum);
-    fprintf (stderr, "freepage is = %d\n", freepage);
-  }
-#else
-  (void)roff;
-  (void)rlen;
-#endif
+    value->size = datap->len;
+    roff = datap->offset;
+  }
+  value->pos = 0;
+  value->page = datap->first;
+  value->start = roff + sizeof(ffdb_data_header_t);
+  value->extent = (!IS_EMBEDDED(datap) && 
+		   hashp->hdr.version > FFDB_VERSION_5 && IS_EXTENT(datap->offset));
+  value->chksum = 0;
+  value->stored_chksum = datap->chksum;
+
+  ffdb_put_page (hashp, item->pagep, HASH_BUCKET_PAGE, 0);
+  item->pagep = 0;
+  return 0;
+}
 
-  /* Now I have to hop to data page to get this data item */
-  status = _ffdb_get_data (hashp, item, val, datap);
-  if (status != 0) {
-    fprintf (stderr, "Cannot get data on page %d at offset %d\n",
-	     datap->first, datap->offset);
-    return status;
+/**
+ * Copy the next len bytes of a streaming handle
+ *
+ * Only one data page is held at a time and the handle moves to the 
+ * next page of the chain once a page is used up
+ */
+int ffdb_value_copy (ffdb_htab_t* hashp, ffdb_value_t* value,
+		     void* buf, long len)
+{
+  void* pagep;
+  pgno_t tp;
+  long copylen, idx;
+
+  if (value->buffer) {
+    memcpy (buf, value->buffer + value->pos, len);
+    value->chksum = __ffdb_crc32_checksum (value->chksum, buf, len);
+    value->pos += len;
+    return 0;
   }
 
- /* Now I do not need this page */
-  if (freepage)
-    ffdb_put_page (hashp, item->pagep, HASH_RAW_PAGE, 0);
+  idx = 0;
+  while (idx < len) {
+    if (value->extent && value->start == BIG_PAGE_OVERHEAD)
+      _ffdb_extent_load (hashp, value->page, value->size - value->pos);
+    pagep = ffdb_get_page (hashp, value->page, HASH_DATA_PAGE, 0, &tp);
+    if (!pagep) {
+      fprintf (stderr, "Cannot get data page at %d\n", value->page);
+      return -1;
+    }
 
+    copylen = hashp->hdr.bsize - value->start;
+    if (copylen > len - idx)
+      copylen = len - idx;
+    if (value->write)
+      memcpy ((unsigned char *)pagep + value->start, 
+	      (unsigned char *)buf + idx, copylen);
+    else
+      memcpy ((unsigned char *)buf + idx, 
+	      (unsigned char *)pagep + value->start, copylen);
+    value->chksum = __ffdb_crc32_checksum (value->chksum,
+					   (unsigned char *)buf + idx, 
+					   copylen);
+    idx += copylen;
+    value->pos += copylen;
+    value->start += copylen;
+
+    /* this page is used up: move on to the next page of the chain */
+    if ((long)value->start >= (long)hashp->hdr.bsize &&
+	value->pos < value->size) {
+      value->page = NEXT_PGNO(pagep);
+      value->start = BIG_PAGE_OVERHEAD;
+    }
+    ffdb_put_page (hashp, pagep, HASH_DATA_PAGE, 
+		   (value->write && copylen > 0));
+  }
   return 0;
 }
 
 /**
- * Add a pair of key and data onto a page (hash page) represented by
- * page address and page number
+ * Look for the fullest open data page of size class c with room for
+ * a datum and keep it in best if it is fuller than best
+ */
+static void
+_ffdb_data_fit (ffdb_htab_t* hashp, unsigned int c, const FFDB_DBT* val,
+		ffdb_dpage_t** best, unsigned int* bclass)
+{
+  ffdb_dpage_t* dp;
+  unsigned int i;
+
+  for (i = 0; i < FFDB_DATA_PAGES; i++) {
+    dp = &hashp->dpages[c][i];
+    if (dp->page == INVALID_PGNO || dp->start == 0 ||
+	_ffdb_data_needs_page (hashp, c, val, dp->start))
+      continue;
+    if (!*best || dp->start > (*best)->start) {
+      *best = dp;
+      *bclass = c;
+    }
+  }
+}
+
+/**
+ * Pick the open data page for a datum of size class dclass
  *
- * This page is hash page: all data pointers are on this type of page
+ * The fullest open page of the class with room for the datum is taken.
+ * Small and medium data then use up what is left on the open pages of
+ * the other classes. Without room anywhere an unused slot of the class
+ * is returned, or else its fullest page which makes way for a new page.
+ * dclass is changed to the class owning the page returned.
+ */
+static ffdb_dpage_t*
+_ffdb_data_slot (ffdb_htab_t* hashp, unsigned int* dclass,
+		 const FFDB_DBT* val)
+{
+  ffdb_dpage_t *dp, *best;
+  unsigned int c, i;
+
+  best = 0;
+  _ffdb_data_fit (hashp, *dclass, val, &best, dclass);
+  if (!best && *dclass != LARGE_DATA_CLASS) {
+    c = *dclass;
+    for (i = 0; i < FFDB_DATA_CLASSES; i++) {
+      if (i != c)
+	_ffdb_data_fit (hashp, i, val, &best, dclass);
+    }
+  }
+  if (best)
+    return best;
+
+  for (i = 0; i < FFDB_DATA_PAGES; i++) {
+    dp = &hashp->dpages[*dclass][i];
+    if (dp->page == INVALID_PGNO)
+      return dp;
+    if (!best || (best->start > 0 && (dp->start == 0 || 
+				      dp->start > best->start)))
+      best = dp;
+  }
+  return best;
+}
+
+/**
+ * Store a data item of the key at index n of a key page on data pages
+ * and fill in the data pointer of this data item
  */
 static int
-_ffdb_add_item_on_page (ffdb_htab_t* hashp, void* pagep, pgno_t page,
-			FFDB_DBT* key, const FFDB_DBT* val,
-			unsigned int data_chksum)
+_ffdb_store_data (ffdb_htab_t* hashp, pgno_t page, unsigned int n,
+		  const FFDB_DBT* key, const FFDB_DBT* val,
+		  unsigned int data_chksum, ffdb_datap_t* datap)
 {
-  unsigned int n, off, soff;
-  ffdb_datap_t datap;
   pgno_t dpage, fpage;
   void* memp;
   int status, reuse;
-  
-  n = NUM_ENT(pagep);
-  /* Find place to put the key */
-  off = OFFSET(pagep) - (unsigned int)key->size + 1;
-  memmove (pagep + off, key->data, (unsigned int)key->size);
-
-  /* Set Key Offset Value */
-  KEY_OFF(pagep, n) = off;
-  KEY_LEN(pagep, n) = (unsigned int)key->size;
-
-  /*  Find place to put data pointer value */
-  off -= sizeof(ffdb_datap_t);
-  soff = off;
-  /* I have to align this pointer to 4 byte boundary */
-  ALIGN_DATAP_OFFSET_VAL(off);
+  unsigned int dclass;
+  ffdb_dpage_t* dp;
 
-  /* I will fill 0 to the gap of data and key */
-  /* ------off---soff-----000key */
-  if (off != soff) 
-    memset (pagep + off + sizeof(ffdb_datap_t), 0, soff - off);
+  /* Here I have to figure out where to put the data.
+   * The open data pages of the size classes are shared by all 
+   * inserting threads
+   */
+  dclass = DATA_CLASS(hashp, val);
 
+  /* the data header refers to the key by its hash value */
+  if (KEY_BY_HASH(hashp)) {
+    page = hashp->hash (key->data, (unsigned int)key->size);
+    n = 0;
+  }
 
-  /* Here I have to figure out where to put the data */
+  FFDB_LOCK(hashp->alloc_lock);
+  dp = _ffdb_data_slot (hashp, &dclass, val);
   reuse = 0;
-  fpage = _ffdb_data_page(hashp, 0, &reuse);
+  if (dp->page == INVALID_PGNO)
+    dp->page = _ffdb_open_data_page (hashp, &reuse);
+  fpage = dp->page;
 
 #ifdef _FFDB_DEBUG
   fprintf (stderr, "Get data page %d to store data from hash page %d at level %d\n",
@@ -1613,24 +3164,32 @@ _ffdb_add_item_on_page (ffdb_htab_t* hashp, void* pagep, pgno_t page,
   if (!memp) {
     fprintf (stderr, "cannot get data page for at page number %d\n",
 	     dpage);
+    FFDB_UNLOCK(hashp->alloc_lock);
     return -1;
   }
-  
+  /* this page could be reuse page from overflow pages, or the unwritten
+   * first page of a level (see _ffdb_add_data)
+   */
+  if (reuse || TYPE(memp) == HASH_DELETED_PAGE)
+    _ffdb_init_page (hashp, memp, fpage, HASH_DATA_PAGE);
+  dp->start = HIGHEST_FREE(memp);
 
   /* Now Put data on this page: this data can expand multiple pages */
 
   /* the datap offset value will be changed inside the following add_data routine
    * to reflect the real length 
    */
-  datap.first = fpage;
-  datap.offset = 0;
-  datap.len = (unsigned int)val->size;
-  datap.chksum = data_chksum;
+  datap->first = fpage;
+  datap->offset = 0;
+  datap->len = (unsigned int)val->size;
+  datap->chksum = data_chksum;
 
   /* add data to data page provided key page and key index in the page
    * datap offset and first page is updated in the add_data call 
    */
-  status = _ffdb_add_data (hashp, page, n, val, memp, dpage, &datap);
+  status = _ffdb_add_data (hashp, page, n, val, memp, dpage, dclass, dp,
+			   datap);
+  FFDB_UNLOCK(hashp->alloc_lock);
   if (status != 0) {
     fprintf (stderr, "cannot put data into data page at page number %d\n",
 	     dpage);
@@ -1640,13 +3199,62 @@ _ffdb_add_item_on_page (ffdb_htab_t* hashp, void* pagep, pgno_t page,
 #ifdef _FFDB_DEBUG
   if (hashp->hdr.version > FFDB_VERSION_5) {
     fprintf (stderr, "Real Data len %ld and datap.len %u is stored at page %u offset %u datap.offset 0x%x checksum 0x%x\n",
-	     REAL_DATA_LEN(datap.len, datap.offset), datap.len, datap.first, GET_PGOFFSET(datap.offset), datap.offset,
-	     datap.chksum);
+	     REAL_DATA_LEN(datap->len, datap->offset), datap->len, datap->first, GET_PGOFFSET(datap->offset), datap->offset,
+	     datap->chksum);
   }
   else
     fprintf (stderr, "Data len %d is stored at page %d offset %d checksum 0x%x\n",
-	     datap.len, datap.first, datap.offset, datap.chksum);
+	     datap->len, datap->first, datap->offset, datap->chksum);
 #endif
+  return 0;
+}
+
+/**
+ * Add a pair of key and data onto a page (hash page) represented by
+ * page address and page number
+ *
+ * This page is hash page: all data pointers are on this type of page.
+ * Small data items are embedded right below their data pointers
+ */
+static int
+_ffdb_add_item_on_page (ffdb_htab_t* hashp, void* pagep, pgno_t page,
+			FFDB_DBT* key, const FFDB_DBT* val,
+			unsigned int data_chksum)
+{
+  unsigned int n, off, soff;
+  ffdb_datap_t datap;
+  
+  n = NUM_ENT(pagep);
+  /* Find place to put the key */
+  off = OFFSET(pagep) - (unsigned int)key->size + 1;
+  memmove (pagep + off, key->data, (unsigned int)key->size);
+
+  /* Set Key Offset Value */
+  KEY_OFF(pagep, n) = off;
+  KEY_LEN(pagep, n) = (unsigned int)key->size;
+
+  /*  Find place to put data pointer value */
+  off -= sizeof(ffdb_datap_t);
+  soff = off;
+  /* I have to align this pointer to 4 byte boundary */
+  ALIGN_DATAP_OFFSET_VAL(off);
+
+  /* I will fill 0 to the gap of data and key */
+  /* ------off---soff-----000key */
+  if (off != soff) 
+    memset (pagep + off + sizeof(ffdb_datap_t), 0, soff - off);
+
+  if (DATA_EMBEDS(hashp, key, val)) {
+    /* ---data---off---soff-----000key */
+    datap.first = EMBED_PGNO;
+    datap.offset = off - (unsigned int)val->size;
+    datap.len = (unsigned int)val->size;
+    datap.chksum = data_chksum;
+    memmove (pagep + datap.offset, val->data, val->size);
+  }
+  else if (_ffdb_store_data (hashp, page, n, key, val, data_chksum,
+			     &datap) != 0)
+    return -1;
 
   /* copy data pointer to hash page right location */
   memmove (pagep + off, &datap, sizeof(ffdb_datap_t));
@@ -1654,7 +3262,10 @@ _ffdb_add_item_on_page (ffdb_htab_t* hashp, void* pagep, pgno_t page,
 
   /* Update this page information */
   NUM_ENT(pagep) = n + 1;
-  OFFSET(pagep) = off - 1;
+  if (IS_EMBEDDED(&datap))
+    OFFSET(pagep) = datap.offset - 1;
+  else
+    OFFSET(pagep) = off - 1;
 
   return 0;
 }
@@ -1662,7 +3273,8 @@ _ffdb_add_item_on_page (ffdb_htab_t* hashp, void* pagep, pgno_t page,
 /**
  * Replace a hash item on the page identified by item structure
  * Data can be only replaced when the new data has size <= the existing
- * data size
+ * data size. Embedded data growing out of their space on the key page
+ * and reserved space of a streaming write are moved to data pages
  */
 static int
 _ffdb_replace_item_on_page (ffdb_htab_t* hashp,
@@ -1680,6 +3292,20 @@ _ffdb_replace_item_on_page (ffdb_htab_t* hashp,
 
   /* Get current data pointer information of this key */
   datap = DATAP (item->pagep, item->pgndx);
+
+  if (IS_EMBEDDED(datap)) {
+    if (val->data && 
+	(size_t)val->size <= DATAP_OFF(item->pagep, item->pgndx) - datap->offset) {
+      /* overwrite embedded data in place */
+      memmove (item->pagep + datap->offset, val->data, val->size);
+      datap->len = (unsigned int)val->size;
+      datap->chksum = item->data_chksum;
+      return 0;
+    }
+    /* the space on the key page is left for the next split to reclaim */
+    return _ffdb_store_data (hashp, item->pgno, item->pgndx, key, val,
+			     item->data_chksum, datap);
+  }
   
 #ifdef _FFDB_DEBUG
   fprintf (stderr, "Replace Key %s information: \n", (char *)key->data);
@@ -1782,7 +3408,9 @@ int ffdb_add_ovflpage (ffdb_htab_t* hashp,
 
   /* Find out next overflow page number */
   reuse = 0;
+  FFDB_LOCK(hashp->alloc_lock);
   ovflpage = _ffdb_ovfl_page (hashp, &reuse);
+  FFDB_UNLOCK(hashp->alloc_lock);
 #ifdef _FFDB_DEBUG
   fprintf (stderr, "Allocate an overflow page %d for primary page %d at level %d\n",
 	   ovflpage, item->pgno, hashp->hdr.ovfl_point);
@@ -1797,7 +3425,8 @@ int ffdb_add_ovflpage (ffdb_htab_t* hashp,
     ffdb_put_page (hashp, item->pagep, HASH_BUCKET_PAGE, 0);
     return -1; 
   }
-  if (reuse)
+  /* a reused page, or an unwritten page of an overflow run */
+  if (reuse || TYPE(opagep) == HASH_DELETED_PAGE)
     _ffdb_init_page (hashp, opagep, ovflpage, HASH_OVFL_PAGE);
 
 #ifdef _FFDB_STATISTICS
@@ -1830,11 +3459,11 @@ int ffdb_add_ovflpage (ffdb_htab_t* hashp,
  */
 static int
 _ffdb_write_key_datap_to_page (ffdb_htab_t* hashp, FFDB_DBT* key, 
-			       ffdb_datap_t *datap,
+			       ffdb_datap_t *datap, const void* edata,
 			       void* pagep, pgno_t page)
 {
   unsigned int n, off, soff;
-  int status;
+  int status = 0;
   
   n = NUM_ENT(pagep);
   /* Find place to put the key */
@@ -1863,9 +3492,16 @@ _ffdb_write_key_datap_to_page (ffdb_htab_t* hashp, FFDB_DBT* key,
   memmove (pagep + off, datap, sizeof(ffdb_datap_t));
   DATAP_OFF(pagep, n) = off;
 
-  /* Need update data item information about key page and key index */
-  /* The data items are on data pages, this could be slow           */
-  status = _ffdb_update_data_info (hashp, datap, page, n);
+  if (IS_EMBEDDED(datap)) {
+    /* embedded data move along with the key */
+    memmove (pagep + off - datap->len, edata, datap->len);
+    ((ffdb_datap_t *)(pagep + off))->offset = off - datap->len;
+    off -= datap->len;
+  }
+  else if (!KEY_BY_HASH(hashp))
+    /* Need update data item information about key page and key index */
+    /* The data items are on data pages, this could be slow           */
+    status = _ffdb_update_data_info (hashp, datap, page, n);
 
   /* Update this page information */
   NUM_ENT(pagep) = n + 1;
@@ -1881,16 +3517,19 @@ _ffdb_write_key_datap_to_page (ffdb_htab_t* hashp, FFDB_DBT* key,
  * which could be the first of a few overflow pages
  *
  * The data pointer points to data pages that could be allocated
- * in previous levels
+ * in previous levels, or to embedded data at edata
  */
 static int
 _ffdb_add_key_datap_to_bucket (ffdb_htab_t* hashp, FFDB_DBT* key, 
-			       ffdb_datap_t *datap, 
+			       ffdb_datap_t *datap, const void* edata,
 			       unsigned int bucket)
 {
   pgno_t page, ovflpage, nextpage, tp;
   void *pagep, *opagep, *npagep;
   int needovfl, reuse;
+  size_t elen;
+
+  elen = IS_EMBEDDED(datap) ? datap->len : 0;
 
   /* First grab a page related to this bucket */
   npagep = pagep = ffdb_get_page (hashp, bucket, HASH_BUCKET_PAGE, 
@@ -1905,8 +3544,8 @@ _ffdb_add_key_datap_to_bucket (ffdb_htab_t* hashp, FFDB_DBT* key,
   while (npagep) {
     /* check whether this pair should fit on this page */
     /* the following macro does not care the data part */
-    if (PAIRFITS (npagep, key, dumb)) {
-      _ffdb_write_key_datap_to_page (hashp, key, datap, pagep, page);
+    if (PAIRSIZE (key, dumb) + elen <= FREESPACE (npagep)) {
+      _ffdb_write_key_datap_to_page (hashp, key, datap, edata, pagep, page);
       needovfl = 0;
       /* release this page */
       ffdb_put_page (hashp, pagep, HASH_BUCKET_PAGE, 1);
@@ -1939,7 +3578,9 @@ _ffdb_add_key_datap_to_bucket (ffdb_htab_t* hashp, FFDB_DBT* key,
       
   if (needovfl) {
     reuse = 0;
+    FFDB_LOCK(hashp->alloc_lock);
     ovflpage = _ffdb_ovfl_page (hashp, &reuse);
+    FFDB_UNLOCK(hashp->alloc_lock);
 #ifdef _FFDB_DEBUG
     fprintf (stderr, "Get an overflow page (expanded) %d for page %d\n",
 	     ovflpage, page);
@@ -1954,7 +3595,7 @@ _ffdb_add_key_datap_to_bucket (ffdb_htab_t* hashp, FFDB_DBT* key,
       ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
       return -1;
     }
-    if (reuse) 
+    if (reuse || TYPE(opagep) == HASH_DELETED_PAGE)
       _ffdb_init_page (hashp, opagep, ovflpage, HASH_OVFL_PAGE);
 
 #ifdef _FFDB_STATISTICS
@@ -1971,7 +3612,8 @@ _ffdb_add_key_datap_to_bucket (ffdb_htab_t* hashp, FFDB_DBT* key,
     ffdb_put_page (hashp, pagep, TYPE(pagep), 1); 
 
     /* add key and data pointer to this page */
-    _ffdb_write_key_datap_to_page (hashp, key, datap, opagep, ovflpage);
+    _ffdb_write_key_datap_to_page (hashp, key, datap, edata, 
+				   opagep, ovflpage);
 
     /* release this page */
     ffdb_put_page (hashp, opagep, HASH_OVFL_PAGE, 1);
@@ -1983,6 +3625,9 @@ _ffdb_add_key_datap_to_bucket (ffdb_htab_t* hashp, FFDB_DBT* key,
  * Split a bucket: this happens when a bucket is full. This bucket may not be 
  * splitted right away (overflow pages needed), but it will eventually 
  * will be splitted
+ *
+ * Caller holds the exclusive table latch, or the table latch shared and
+ * the bucket locks of both buckets while other buckets take inserts
  */
 int 
 ffdb_split_bucket (ffdb_htab_t* hashp, unsigned int oldbucket,
@@ -1994,6 +3639,7 @@ ffdb_split_bucket (ffdb_htab_t* hashp, unsigned int oldbucket,
   pgno_t oldpage, nextpage, tp;
   unsigned char *kdata = 0;
   ffdb_datap_t* datap = 0;
+  void* edata = 0;
   int base_page = 1;
 
   /* This page may not be in memory or in use so FFDB_CREATE flag has to be 
@@ -2021,13 +3667,14 @@ ffdb_split_bucket (ffdb_htab_t* hashp, unsigned int oldbucket,
       key.data = kdata;
       key.size = KEY_LEN(temp_pagep, i);
       datap = DATAP(temp_pagep, i);
+      edata = IS_EMBEDDED(datap) ? temp_pagep + datap->offset : 0;
 
       /* Now we need to put this key and data pointer pair */
       if (_ffdb_call_hash (hashp, key.data, key.size) == oldbucket) 
 	/* this stays with old page without changing data pointer value */
-	_ffdb_add_key_datap_to_bucket (hashp, &key, datap, oldbucket);
+	_ffdb_add_key_datap_to_bucket (hashp, &key, datap, edata, oldbucket);
       else 
-	_ffdb_add_key_datap_to_bucket (hashp, &key, datap, newbucket);
+	_ffdb_add_key_datap_to_bucket (hashp, &key, datap, edata, newbucket);
     }
     
     /* get next page number */
@@ -2036,11 +3683,18 @@ ffdb_split_bucket (ffdb_htab_t* hashp, unsigned int oldbucket,
     /* if this is the base page (regular hash page) */
     if (base_page) 
       base_page = 0;
-    else  /* free overflow page */ 
+    else { /* free overflow page: inserts may be taking free pages */
+      FFDB_LOCK(hashp->alloc_lock);
       ffdb_delete_page (hashp, temp_pagep, HASH_OVFL_PAGE, isdoubling);
+      FFDB_UNLOCK(hashp->alloc_lock);
+    }
     
     if (nextpage != INVALID_PGNO) 
-      temp_pagep = ffdb_get_page (hashp, nextpage, HASH_OVFL_PAGE, 0, &tp);
+      /* freed overflow pages are written out so that a scan of the
+       * file never meets keys and embedded data left on them
+       */
+      temp_pagep = ffdb_get_page (hashp, nextpage, HASH_OVFL_PAGE, 
+				  FFDB_PAGE_DIRTY, &tp);
     else
       break;
   }
@@ -2072,6 +3726,10 @@ _ffdb_update_data_pages_content (ffdb_htab_t* hashp, void *pagep,
   for (i = 0; i < NUM_ENT(pagep); i++) {
     datap = DATAP(pagep, i);
 
+    /* Embedded data move with the key page */
+    if (IS_EMBEDDED(datap))
+      continue;
+
     /* First check whether this data page pointed by datap->first
      * is a page to be moved. If yes, we are doing nothing, since
      * its key_page content is already updated when the data page
@@ -2116,6 +3774,8 @@ _ffdb_update_data_pages_content (ffdb_htab_t* hashp, void *pagep,
  *
  * If the key_page is also among pages that are moved, the data header's 
  * key_page will be updated to its new location.
+ *
+ * From version 10 on the key is found through the key hash instead.
  */
 static int
 _ffdb_update_key_pages_content (ffdb_htab_t* hashp, void *pagep, 
@@ -2129,11 +3789,24 @@ _ffdb_update_key_pages_content (ffdb_htab_t* hashp, void *pagep,
   pgno_t kp, newkp;
   ffdb_data_header_t *header = 0;
   ffdb_datap_t* datap = 0;
+  ffdb_hent_t item;
 
   next = FIRST_DATA_POS(pagep);
   for (i = 0; i < NUM_ENT(pagep); i++) {
     header = BIG_DATA_HEADER(pagep, next);
 
+    if (KEY_BY_HASH(hashp)) {
+      /* the key is looked up through its bucket: data items whose
+       * keys are gone are left alone 
+       */
+      if (_ffdb_find_data_key (hashp, header, oldpage, next, &item) == 0) {
+	DATAP(item.pagep, item.pgndx)->first = newpage;
+	ffdb_put_page (hashp, item.pagep, TYPE(item.pagep), 1);
+      }
+      next = header->next;
+      continue;
+    }
+
     /* get key page pointed back by this header */
     kpagep = ffdb_get_page (hashp, header->key_page, HASH_RAW_PAGE, 0, &kp);
     if (!kpagep) {
@@ -2331,7 +4004,7 @@ _ffdb_move_pages (ffdb_htab_t* hashp, unsigned short type,
       fprintf (stderr, "Update primary page for data page %d %d page = %d page sign = 0x%x\n", page, rpage, CURR_PGNO(pagep), PAGE_SIGN(pagep));
 #endif
     }
-    else if (type == HASH_BUCKET_PAGE) {
+    else if (type == HASH_BUCKET_PAGE && !KEY_BY_HASH(hashp)) {
       /* Update the key page entry inside each data page pointed 
        * by the overflow page. The data pages that have been moved
        *will not be updated since they are updated by the above routine
@@ -2422,6 +4095,9 @@ ffdb_rearrage_pages_on_close (ffdb_htab_t* hashp)
   _ffdb_move_pages (hashp, HASH_FREE_PAGE, dfirst, dlast,
 		    funused, lunused);
 
+  _ffdb_move_pages (hashp, HASH_FREEMAP_PAGE, dfirst, dlast,
+		    funused, lunused);
+
   hashp->hdr.num_moved_pages = num_page_moved;
 
   return 0;
@@ -2478,6 +4154,9 @@ ffdb_rearrage_pages_on_open (ffdb_htab_t* hashp)
   _ffdb_move_pages (hashp, HASH_FREE_PAGE, oldfirst, oldlast,
 		    newfirst, newlast);
 
+  _ffdb_move_pages (hashp, HASH_FREEMAP_PAGE, oldfirst, oldlast,
+		    newfirst, newlast);
+
   /* If there are no data pages moved, unlikely but possible */
   if (lastdpage == INVALID_PGNO) 
     hashp->curr_dpage = ffdb_last_data_page (hashp, newfirst - 1);
@@ -2776,10 +4455,24 @@ ffdb_cursor_find_by_key (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
 			 FFDB_DBT* key, FFDB_DBT* data,
 			 unsigned int flags)
 {
-  pgno_t bucket, tp, nextp;
+  pgno_t bucket, tp, nextp, first, last;
   unsigned char* ekdata;
   unsigned int   eksize;
 
+  /* buckets this cursor is limited to */
+  first = cursor->first_bucket;
+  last = cursor->last_bucket;
+  if (last > hashp->hdr.max_bucket)
+    last = hashp->hdr.max_bucket;
+  if (first > last) {
+    if (cursor->item.pagep) {
+      ffdb_put_page (hashp, cursor->item.pagep, TYPE(cursor->item.pagep), 0);
+      cursor->item.pagep = 0;
+    }
+    cursor->item.status = ITEM_NO_MORE;
+    return FFDB_NOT_FOUND;
+  }
+
   if (flags == FFDB_FIRST) {
     if (cursor->item.pagep) {
       /* need to release the previous page */
@@ -2787,7 +4480,7 @@ ffdb_cursor_find_by_key (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
       cursor->item.pagep = 0;
     }
       
-    bucket = 0;
+    bucket = first;
     cursor->item.pagep = ffdb_get_page (hashp, bucket,
 					HASH_BUCKET_PAGE, 0, &tp);
     if (!(cursor->item.pagep)) {
@@ -2796,8 +4489,7 @@ ffdb_cursor_find_by_key (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
       return -1;
     }
     /* Skip empty buckets */
-    while (NUM_ENT(cursor->item.pagep) == 0 && 
-	   bucket <= hashp->hdr.max_bucket) {
+    while (NUM_ENT(cursor->item.pagep) == 0 && bucket < last) {
       ffdb_put_page (hashp, cursor->item.pagep, TYPE(cursor->item.pagep), 0);
       /* Get next bucket */
       cursor->item.pagep = 0;
@@ -2812,7 +4504,7 @@ ffdb_cursor_find_by_key (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
 	return -1;
       }
     }
-    if (bucket > hashp->hdr.max_bucket) {
+    if (NUM_ENT(cursor->item.pagep) == 0) {
       /* empty database */
       ffdb_put_page (hashp, cursor->item.pagep, TYPE(cursor->item.pagep), 0);
       cursor->item.status = ITEM_NO_MORE;
@@ -2829,7 +4521,7 @@ ffdb_cursor_find_by_key (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
       ffdb_put_page (hashp, cursor->item.pagep, TYPE(cursor->item.pagep), 0);
       cursor->item.pagep = 0;
     }
-    bucket = hashp->hdr.max_bucket;
+    bucket = last;
     
     cursor->item.pagep = ffdb_get_page (hashp, bucket,
 					HASH_BUCKET_PAGE, 0, &tp);
@@ -2843,6 +4535,11 @@ ffdb_cursor_find_by_key (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
       ffdb_put_page (hashp, cursor->item.pagep, TYPE(cursor->item.pagep), 0);
       /* Get next bucket */
       cursor->item.pagep = 0;
+      if (bucket == first) {
+	/* this is the last one and it is empty */
+	cursor->item.status = ITEM_NO_MORE;
+	return FFDB_NOT_FOUND;
+      }
       bucket--;
 
       cursor->item.pagep = ffdb_get_page (hashp, bucket, HASH_BUCKET_PAGE, 
@@ -2853,13 +4550,6 @@ ffdb_cursor_find_by_key (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
 	cursor->item.status = ITEM_ERROR;
 	return -1;
       }
-      if (bucket == 0 && NUM_ENT(cursor->item.pagep) == 0) {
-	/* this is the last one and it is empty */
-	ffdb_put_page (hashp, cursor->item.pagep, TYPE(cursor->item.pagep), 0);
-	cursor->item.status = ITEM_NO_MORE;
-	cursor->item.pagep = 0;
-	return FFDB_NOT_FOUND;
-      }
     }
 
     cursor->item.pgno = tp;
@@ -2867,6 +4557,10 @@ ffdb_cursor_find_by_key (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
     cursor->item.pgndx = NUM_ENT(cursor->item.pagep) - 1;
     cursor->item.status = ITEM_OK;
   }
+  else if (cursor->item.status != ITEM_OK) {
+    /* the cursor has walked past either end or failed before */
+    return (cursor->item.status == ITEM_NO_MORE) ? FFDB_NOT_FOUND : -1;
+  }
   else if (flags == FFDB_NEXT) {
     /* We have reached the last data on the key page */
     if (cursor->item.pgndx == NUM_ENT(cursor->item.pagep) - 1) {
@@ -2874,8 +4568,7 @@ ffdb_cursor_find_by_key (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
       nextp = NEXT_PGNO(cursor->item.pagep);
       /* put back this page */
       ffdb_put_page (hashp, cursor->item.pagep, TYPE(cursor->item.pagep), 0);
-      if (cursor->item.bucket >= hashp->hdr.max_bucket &&
-	  nextp == INVALID_PGNO) {
+      if (cursor->item.bucket >= last && nextp == INVALID_PGNO) {
 	/* We are done */
 	cursor->item.status = ITEM_NO_MORE;
 	cursor->item.pagep = 0;
@@ -2899,7 +4592,7 @@ ffdb_cursor_find_by_key (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
 	while (NUM_ENT(cursor->item.pagep) == 0) {
 	  ffdb_put_page (hashp, cursor->item.pagep, 
 			 TYPE(cursor->item.pagep), 0);
-	  if (cursor->item.bucket == hashp->hdr.max_bucket) {
+	  if (cursor->item.bucket >= last) {
 	    cursor->item.pagep = 0;
 	    /* End of buckets and we are done */
 	    cursor->item.status = ITEM_NO_MORE;
@@ -2946,7 +4639,7 @@ ffdb_cursor_find_by_key (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
       nextp = NEXT_PGNO(cursor->item.pagep);
       /* put this page out */
       ffdb_put_page (hashp, cursor->item.pagep, TYPE(cursor->item.pagep), 0);
-      if (cursor->item.bucket == 0 && nextp == INVALID_PGNO) {
+      if (cursor->item.bucket <= first && nextp == INVALID_PGNO) {
 	/* We are done */
 	cursor->item.status = ITEM_NO_MORE;
 	cursor->item.pagep = 0;
@@ -2964,7 +4657,7 @@ ffdb_cursor_find_by_key (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
 	while (NUM_ENT(cursor->item.pagep) == 0) {
 	  ffdb_put_page (hashp, cursor->item.pagep, 
 			 TYPE(cursor->item.pagep), 0);
-	  if (cursor->item.bucket == 0) {
+	  if (cursor->item.bucket <= first) {
 	    /* this is the last one and it is empty */
 	    cursor->item.status = ITEM_NO_MORE;
 	    cursor->item.pagep = 0;
@@ -3011,6 +4704,10 @@ ffdb_cursor_find_by_key (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
     return -1;
   }
 
+  /* Only position the cursor */
+  if (!key)
+    return 0;
+
   /* Get Key data and size */
   ekdata = KEY(cursor->item.pagep, cursor->item.pgndx);
   eksize = KEY_LEN(cursor->item.pagep, cursor->item.pgndx);
@@ -3048,6 +4745,252 @@ ffdb_cursor_find_by_key (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
   return 0;
 }
 
+/**
+ * Last page that may hold data in the file
+ */
+static pgno_t
+_ffdb_last_scan_page (ffdb_htab_t* hashp)
+{
+  pgno_t last, dlast;
+
+  BUCKET_TO_PAGE(hashp->hdr.max_bucket, last);
+  /* pages moved into unused bucket pages when the file was closed */
+  last += hashp->hdr.num_moved_pages;
+
+  dlast = hashp->hdr.spares[hashp->hdr.ovfl_point + 1];
+  if (dlast > 0) {
+    dlast = dlast - 1 - hashp->hdr.num_moved_pages;
+    if (dlast > last)
+      last = dlast;
+  }
+  return last;
+}
+
+/**
+ * Visit data items in the order of data pages in the file
+ *
+ * Every data header on a data page points back to the key page and 
+ * the key index of its item, from which the key and the data pointer
+ * are retrieved. A data item spanning multiple pages is read when 
+ * its header is met, and the following pages of the item hold no 
+ * header of their own except for items after it on the last page.
+ * Data embedded on a key page are visited when the key page is met.
+ *
+ * From version 10 on the data header holds the key hash instead, and
+ * only the chain of the bucket of that hash is walked for the key.
+ */
+int
+ffdb_cursor_find_by_data (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
+			  FFDB_DBT* key, FFDB_DBT* data,
+			  unsigned int flags)
+{
+  void *pagep, *kpagep;
+  pgno_t last, tp, kp;
+  ffdb_data_header_t* header;
+  ffdb_hent_t item;
+  ffdb_datap_t datap;
+  unsigned int eksize, doff;
+  int status, embedded;
+
+  if (flags == FFDB_FIRST) {
+    BUCKET_TO_PAGE(0, cursor->dpage);
+    cursor->doff = cursor->dndx = 0;
+    cursor->item.status = ITEM_OK;
+#ifdef POSIX_FADV_SEQUENTIAL
+    (void)posix_fadvise (hashp->fp, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  }
+  else if (flags != FFDB_NEXT) {
+    fprintf (stderr, "Unsupported cursor flag %d\n", flags);
+    return -1;
+  }
+  if (cursor->item.status != ITEM_OK)
+    return FFDB_NOT_FOUND;
+
+  /* find the next data header or embedded data item */
+  memset (&item, 0, sizeof (ffdb_hent_t));
+  last = _ffdb_last_scan_page (hashp);
+  header = 0;
+  pagep = 0;
+  embedded = 0;
+  while (cursor->dpage <= last) {
+    pagep = ffdb_get_page (hashp, cursor->dpage, HASH_RAW_PAGE, 0, &tp);
+    if (!pagep) {
+      fprintf (stderr, "Cannot get page %d for data cursor.\n", 
+	       cursor->dpage);
+      cursor->item.status = ITEM_ERROR;
+      return -1;
+    }
+    if (TYPE(pagep) == HASH_DATA_PAGE && cursor->dndx < NUM_ENT(pagep)) {
+      if (cursor->dndx == 0)
+	cursor->doff = FIRST_DATA_POS(pagep);
+      header = BIG_DATA_HEADER(pagep, cursor->doff);
+      doff = cursor->doff;
+      cursor->doff = header->next;
+      cursor->dndx++;
+      if (!KEY_BY_HASH(hashp))
+	break;
+      /* the key is looked up through its hash value: data items
+       * whose keys are gone are skipped
+       */
+      if (_ffdb_find_data_key (hashp, header, cursor->dpage, doff,
+			       &item) == 0) {
+	ffdb_put_page (hashp, item.pagep, TYPE(item.pagep), 0);
+	break;
+      }
+      header = 0;
+      ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
+      continue;
+    }
+    if (hashp->hdr.version > FFDB_VERSION_6 &&
+	(TYPE(pagep) == HASH_BUCKET_PAGE || TYPE(pagep) == HASH_OVFL_PAGE)) {
+      while (cursor->dndx < NUM_ENT(pagep) && 
+	     !IS_EMBEDDED(DATAP(pagep, cursor->dndx)))
+	cursor->dndx++;
+      if (cursor->dndx < NUM_ENT(pagep)) {
+	item.pgno = cursor->dpage;
+	item.pgndx = cursor->dndx;
+	cursor->dndx++;
+	embedded = 1;
+	break;
+      }
+    }
+    ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
+    cursor->dpage++;
+    cursor->dndx = 0;
+  }
+  if (!header && !embedded) {
+    cursor->item.status = ITEM_NO_MORE;
+    return FFDB_NOT_FOUND;
+  }
+
+  /* the key lives on the page pointed back by the data header */
+  if (header && !KEY_BY_HASH(hashp)) {
+    item.pgno = header->key_page;
+    item.pgndx = header->key_idx;
+  }
+  ffdb_put_page (hashp, pagep, TYPE(pagep), 0);
+
+  /* Only position the cursor at the key of this item */
+  if (!key) {
+    cursor->item.pgno = item.pgno;
+    cursor->item.pgndx = item.pgndx;
+    return 0;
+  }
+
+  kpagep = ffdb_get_page (hashp, item.pgno, HASH_RAW_PAGE, 0, &kp);
+  if (!kpagep) {
+    fprintf (stderr, "Cannot get key page %d for data cursor.\n", item.pgno);
+    cursor->item.status = ITEM_ERROR;
+    return -1;
+  }
+  eksize = KEY_LEN(kpagep, item.pgndx);
+  memcpy (&datap, DATAP(kpagep, item.pgndx), sizeof (ffdb_datap_t));
+
+  if (key->data && key->size > 0) {
+    /* User supplied space */
+    if (key->size < eksize) {
+      fprintf (stderr, "Warning: application provided key space %ld < key stored on disk with size %ld\n",
+	       (long)key->size, (long)eksize);
+      ffdb_put_page (hashp, kpagep, TYPE(kpagep), 0);
+      return -1;
+    }
+    else
+      key->size = eksize;
+  }
+  else {
+    key->data = (unsigned char *)malloc(eksize * sizeof(unsigned char));
+    if (!key->data) {
+      fprintf (stderr, "Cannot allocate space for cursor_get to retrieve key of size %u \n",
+	       eksize);
+      ffdb_put_page (hashp, kpagep, TYPE(kpagep), 0);
+      return -1;
+    }
+    key->size = eksize;
+  }
+  memcpy (key->data, KEY(kpagep, item.pgndx), eksize);
+  ffdb_put_page (hashp, kpagep, TYPE(kpagep), 0);
+
+  if (data) {
+    status = _ffdb_get_data (hashp, &item, data, &datap);
+    if (status != 0)
+      return status;
+  }
+  return 0;
+}
+
+/**
+ * Copy the key and data of the item a cursor is positioned on into
+ * a buffer as an unsigned int key length, the key, an unsigned int
+ * data length and the data. The data length is 0 if keysonly is set.
+ *
+ * @return 0 on success, -1 on failure. size holds the number of bytes
+ * of the item, which is not copied if it does not fit in space bytes.
+ */
+int
+ffdb_cursor_copy_item (ffdb_htab_t* hashp, ffdb_crs_t* cursor,
+		       int keysonly, unsigned char* buf, 
+		       unsigned long space, unsigned long* size)
+{
+  void* kpagep;
+  pgno_t kp;
+  ffdb_hent_t item;
+  ffdb_datap_t datap;
+  FFDB_DBT val;
+  unsigned int eksize, len;
+  long datalen;
+  int status;
+
+  memset (&item, 0, sizeof (ffdb_hent_t));
+  item.pgno = cursor->item.pgno;
+  item.pgndx = cursor->item.pgndx;
+
+  kpagep = ffdb_get_page (hashp, item.pgno, HASH_RAW_PAGE, 0, &kp);
+  if (!kpagep) {
+    fprintf (stderr, "Cannot get key page %d for cursor.\n", item.pgno);
+    return -1;
+  }
+  eksize = KEY_LEN(kpagep, item.pgndx);
+  memcpy (&datap, DATAP(kpagep, item.pgndx), sizeof (ffdb_datap_t));
+  if (keysonly)
+    datalen = 0;
+  else if (IS_EMBEDDED(&datap))
+    datalen = datap.len;
+  else if (hashp->hdr.version > FFDB_VERSION_5)
+    datalen = REAL_DATA_LEN(datap.len, datap.offset);
+  else
+    datalen = datap.len;
+
+  if (datalen > (long)UINT_MAX) {
+    fprintf (stderr, "Data size %ld is too large for a bulk record.\n",
+	     datalen);
+    ffdb_put_page (hashp, kpagep, TYPE(kpagep), 0);
+    errno = EFBIG;
+    return -1;
+  }
+  *size = 2 * sizeof (unsigned int) + eksize + datalen;
+  if (*size > space) {
+    ffdb_put_page (hashp, kpagep, TYPE(kpagep), 0);
+    return 0;
+  }
+
+  len = eksize;
+  memcpy (buf, &len, sizeof (unsigned int));
+  memcpy (buf + sizeof (unsigned int), KEY(kpagep, item.pgndx), eksize);
+  ffdb_put_page (hashp, kpagep, TYPE(kpagep), 0);
+
+  buf += sizeof (unsigned int) + eksize;
+  len = (unsigned int)datalen;
+  memcpy (buf, &len, sizeof (unsigned int));
+  if (datalen == 0)
+    return 0;
+
+  val.data = buf + sizeof (unsigned int);
+  val.size = datalen;
+  status = ffdb_get_item_data (hashp, &item, &datap, &val);
+  return (status == 0) ? 0 : -1;
+}
+
 /**
  * Dump out all page information for debug purpose
  */
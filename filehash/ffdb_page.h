@@ -85,7 +85,7 @@ typedef struct _ffdb_datap_
 /**
  * Set bit 20 - 27 of offset using 8 bit from data length field
  */
-#define INSERT_LEN_TO_PGOFFSET(l,o) ((o) = (((DLEN_HIGH_BITS(l)) << 20) | ((o) & 0xfffff) ) )
+#define INSERT_LEN_TO_PGOFFSET(l,o) ((o) = (((DLEN_HIGH_BITS(l)) << 20) | ((o) & 0xf00fffff) ) )
 
 /**
  * Retrieve bit 20 -27 from offset so we can combine it to form
@@ -108,6 +108,14 @@ typedef struct _ffdb_datap_
  */
 #define GET_PGOFFSET(o) ((o) & 0xfffff)
 
+/**
+ * Bit 28 of offset marks data whose pages after the first page
+ * were allocated as one run of contiguous pages (an extent)
+ */
+#define EXTENT_BIT        0x10000000
+#define IS_EXTENT(o)      ((o) & EXTENT_BIT)
+#define SET_EXTENT(o)     ((o) |= EXTENT_BIT)
+
 /**
  * Alignment for the data pointer value
  */
@@ -220,6 +228,25 @@ typedef struct _ffdb_datap_
  */
 #define PAIRSIZE(K,D) (PAIR_OVERHEAD + (K)->size + sizeof(ffdb_datap_t) + sizeof(int) - 1)
 
+/**
+ * Small data items are embedded on the key page right below their data
+ * pointer (version 7). The data pointer of an embedded item has the first
+ * page EMBED_PGNO and the offset of the data on the key page. 
+ * A put without data (streaming write) always goes to data pages
+ */
+#define EMBED_PGNO        0xfffffffe
+#define IS_EMBEDDED(dp)   ((dp)->first == EMBED_PGNO)
+#define EMBED_MAXSIZE(h)  ((h)->hdr.bsize >> 3)
+
+#define DATA_EMBEDS(h,K,D)                                        \
+  ((h)->hdr.version > FFDB_VERSION_6 && (D)->data &&              \
+   (size_t)(D)->size <= (size_t)EMBED_MAXSIZE(h) &&               \
+   PAIRSIZE(K,D) + (size_t)(D)->size <= (size_t)(h)->hdr.bsize - PAGE_OVERHEAD)
+
+/* space of a pair on the key page including embedded data */
+#define HASH_PAIRSIZE(h,K,D) \
+  (PAIRSIZE(K,D) + (DATA_EMBEDS(h,K,D) ? (size_t)(D)->size : 0))
+
 /*
  * Since these are all unsigned, we need to guarantee that we never go
  * negative.  Offset values are 0-based and overheads are one based (i.e.
@@ -234,6 +261,11 @@ typedef struct _ffdb_datap_
  */
 #define PAIRFITS(P,K,D)	((PAIRSIZE((K),(D))) <= FREESPACE((P)))
 
+/**
+ * Whether a pair with its data embedded when small enough would fit
+ */
+#define HASH_PAIRFITS(h,P,K,D) ((HASH_PAIRSIZE((h),(K),(D))) <= FREESPACE((P)))
+
 /**
  * Page allocation definition
  */
@@ -284,8 +316,8 @@ typedef struct _ffdb_datap_
  * free byte  data length       4       pgno_t
  *            data_status       4       deleted or not
  *            next              4       pgno_t
- *            key_page          4       pgno_t
- *            key_idx           4       pgno_t
+ *            key_page          4       pgno_t  (key hash from version 10)
+ *            key_idx           4       pgno_t  (0 from version 10)
  *      data
  *
  * When a page has been used, highest free byte = 0
@@ -319,6 +351,13 @@ typedef struct _ffdb_data_header_
   pgno_t  key_idx;            /* index within the key page to find key */
 }ffdb_data_header_t;
 
+/**
+ * From version 10 on key_page of a data header is the hash value of
+ * the key and key_idx is 0. The key is found through its bucket, so
+ * moving keys to other pages on a split leaves the data pages alone
+ */
+#define KEY_BY_HASH(H) ((H)->hdr.version > FFDB_VERSION_9)
+
 #define INSERT_LEN_TO_STATUS(l,s) (INSERT_LEN_TO_PGOFFSET(l,s))
 #define GET_LEN_FROM_STATUS(s)    (GET_LEN_FROM_PGOFFSET(s))
 #define GET_STATUS(s)             (GET_PGOFFSET(s))
@@ -342,6 +381,20 @@ typedef struct _ffdb_data_header_
  */
 #define BIG_DATA_TOTAL_SIZE(val) (BIG_DATA_OVERHEAD + (val)->size )
 
+/**
+ * Size classes of data items on data pages. Every class fills its own
+ * open data pages: small items are packed densely, medium items never
+ * straddle two pages and large items start on a new page
+ */
+#define SMALL_DATA_CLASS        0
+#define MEDIUM_DATA_CLASS       1
+#define LARGE_DATA_CLASS        2
+
+#define DATA_CLASS(H,val)						\
+  ((BIG_DATA_TOTAL_SIZE(val) <= (size_t)(H)->hdr.bsize / 8) ? SMALL_DATA_CLASS : \
+   ((BIG_DATA_TOTAL_SIZE(val) <= (size_t)(H)->hdr.bsize - BIG_PAGE_OVERHEAD) ?	\
+    MEDIUM_DATA_CLASS : LARGE_DATA_CLASS))
+
 /**
  * Get data header pointed by offset on a page
  */
@@ -383,6 +436,29 @@ typedef struct _ffdb_data_header_
 #define FREE_PAGE(P,IDX) (FIND_VALUE((P), pgno_t, FREE_PAGE_START + (IDX)*sizeof(pgno_t)))
 #define MAX_NUM_FREE_PAGES ((hashp->hdr.bsize - FREE_PAGE_START)/sizeof(pgno_t))
 
+/**
+ * Free Map Page of version 9 and later: one bit for every page of the
+ * file. A bit is set when its page is free. Each free map page holds
+ * the bits of a chunk of consecutive pages and is itself a page of
+ * that chunk. All free map pages are chained from free_pages[0] of
+ * the header. Bits are stored byte by byte and never swapped
+ *
+ * 0    current page number     4       pgno_t          CURR_PGNO(p)
+ * 4    previous page number    4       pgno_t          PREV_PGNO(P)
+ * 8    next page number        4       pgno_t          NEXT_PGNO(P)
+ * 12   page signature          4       pgno_t          PAGE_SIGN(P)
+ * 16   not used                2       indx_t          NUM_ENT(P)
+ * 18   page type               2       indx_t          TYPE(P)
+ * 20   crc checksum            4       pgno_t          CKSUM(P)
+ * 24   chunk number            4       pgno_t          FREEMAP_CHUNK(P)
+ * 28   pad                     4       pgno_t          not used
+ * 32   bits of pages chunk * FREEMAP_BITS to (chunk + 1) * FREEMAP_BITS - 1
+ */
+#define FREEMAP_START      32
+#define FREEMAP_CHUNK(P)   (OFFSET((P)))
+#define FREEMAP_BYTES(h)   ((unsigned int)((h)->hdr.bsize - FREEMAP_START) & ~7U)
+#define FREEMAP_BITS(h)    (FREEMAP_BYTES(h) * 8)
+
 /**
  * Page Type Definition
  */
@@ -393,6 +469,7 @@ typedef struct _ffdb_data_header_
 #define HASH_UINFO_PAGE      0x4001
 #define HASH_CONFIG_PAGE     0x5001
 #define HASH_FREE_PAGE       0x6001
+#define HASH_FREEMAP_PAGE    0x7001
 #define HASH_DELETED_PAGE    0x8001
 #define HASH_RAW_PAGE        0xffee
 
@@ -87,6 +87,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sys/uio.h>
 #include <ffdb_db.h>
 #include "ffdb_pagepool.h"
 
@@ -295,6 +296,46 @@ _ffdb_pagepool_write(ffdb_pagepool_t* pgp,
 }
 
 
+/*
+ * _ffdb_pagepool_write_run
+ *	Write dirty pages in a row to disk by a single write.
+ * This routine is called with pages being locked
+ */
+static int
+_ffdb_pagepool_write_run (ffdb_pagepool_t* pgp, ffdb_bkt_t** bps,
+			  unsigned int n)
+{
+  struct iovec iov[FFDB_MAX_RUN_PAGES];
+  unsigned int i;
+  ssize_t nbytes;
+
+  if (n == 1)
+    return _ffdb_pagepool_write (pgp, bps[0]);
+
+  for (i = 0; i < n; i++) {
+#ifdef _FFDB_STATISTICS
+    ++pgp->pagewrite;
+#endif
+    if (pgp->pgout)
+      (pgp->pgout)(pgp->pgcookie, bps[i]->pgno, bps[i]->page);
+    iov[i].iov_base = bps[i]->page;
+    iov[i].iov_len = pgp->pagesize;
+  }
+
+  nbytes = pwritev (pgp->fd, iov, n, (off_t)pgp->pagesize * bps[0]->pgno);
+  if (nbytes != (ssize_t)pgp->pagesize * n)
+    return -1;
+
+  for (i = 0; i < n; i++)
+    FFDB_FLAG_CLR(bps[i]->flags, FFDB_PAGE_DIRTY);
+
+  /* Update how many pages this file holds now */
+  if (bps[n - 1]->pgno >= pgp->npages) 
+    pgp->npages = bps[n - 1]->pgno + 1;
+
+  return 0;
+}
+
 /*
  * _ffdb_clean_page_ondisk
  *	Clean a page on disk
@@ -369,7 +410,23 @@ _ffdb_pagepool_reuse_bkt (ffdb_pagepool_t* pgp, ffdb_bkt_t** retbp)
 
     reusepage = 0;
       
-    if (!(FFDB_FLAG_ISSET(bp->flags, FFDB_PAGE_LOCKED)) && 
+    if (FFDB_FLAG_ISSET(pgp->fileflags, FFDB_RDONLY)) {
+      /* Read only pages are shared: only the reference count matters */
+      if (!(FFDB_FLAG_ISSET(bp->flags, FFDB_PAGE_LOCKED)) && bp->ref == 0) {
+	reusepage = 1;
+	head = &pgp->hqh[FFDB_HASHKEY(bp->pgno)];
+	FFDB_CIRCLEQ_REMOVE(head, bp, hq);
+	FFDB_CIRCLEQ_REMOVE(&pgp->lqh, bp, lq);
+	bp->waiters = 0;
+	bp->flags = FFDB_PAGE_VALID;
+#ifdef _FFDB_STATISTICS
+	++pgp->pagereuse;
+#endif
+	*retbp = bp;
+	break;
+      }
+    }
+    else if (!(FFDB_FLAG_ISSET(bp->flags, FFDB_PAGE_LOCKED)) && 
 	!(FFDB_FLAG_ISSET(bp->flags, FFDB_PAGE_PINNED)) &&
 	bp->waiters == 0) {
       /* This page is not locked and pinned, so it can be reused */
@@ -499,6 +556,7 @@ ffdb_pagepool_create (ffdb_pagepool_t** pgp, unsigned int flags)
    */
   memset (p, 0, sizeof(ffdb_pagepool_t));
   p->fd = -1;
+  p->runpages = 1;
 
   /**
    * Initialize LRU and hash table
@@ -514,6 +572,11 @@ ffdb_pagepool_create (ffdb_pagepool_t** pgp, unsigned int flags)
     free (p);
     return ret;
   }
+  if ((ret = FFDB_RWLOCK_INIT (p->rolock)) != 0) {
+    FFDB_LOCK_FINI (p->lock);
+    free (p);
+    return ret;
+  }
 
   *pgp = p;
   return 0;
@@ -964,6 +1027,64 @@ ffdb_pagepool_new_page (ffdb_pagepool_t* pgp, pgno_t* pageno,
   return status;
 }
 
+/**
+ * Get a page from a read only file
+ *
+ * Pages of a read only file never change once they are loaded. Any number
+ * of threads may hold the same page: there is no owner, no waiter and no
+ * LRU relinking. A cache hit only takes a shared lock and bumps the
+ * reference count. Loading a missing page takes the lock exclusively.
+ */
+static int
+_ffdb_pagepool_get_page_ro (ffdb_pagepool_t* pgp, pgno_t* pageno,
+			    unsigned int flags, void** mem)
+{
+  int ret;
+  ffdb_bkt_t* bp;
+  struct _ffdb_hqh *head;
+
+  if (FFDB_FLAG_ISSET(flags, FFDB_PAGE_DIRTY) ||
+      FFDB_FLAG_ISSET(flags, FFDB_PAGE_NEW)) {
+    fprintf (stderr, "ffdb_pagepool_get: DIRTY_PAGE or PAGE_NEW flag cannot be used on readonly file.\n");
+    errno = EINVAL;
+    return errno;
+  }
+
+  head = &pgp->hqh[FFDB_HASHKEY(*pageno)];
+
+  FFDB_RDLOCK (pgp->rolock);
+  FFDB_CIRCLEQ_FOREACH(bp, head, hq) {
+    if (bp->pgno == *pageno) {
+      __sync_fetch_and_add (&bp->ref, 1);
+      *mem = bp->page;
+      FFDB_RWUNLOCK (pgp->rolock);
+      return 0;
+    }
+  }
+  FFDB_RWUNLOCK (pgp->rolock);
+
+  FFDB_WRLOCK (pgp->rolock);
+#ifdef _FFDB_STATISTICS
+  pgp->pageget++;
+#endif
+  /* Some other thread may have loaded the page in the mean time */
+  FFDB_CIRCLEQ_FOREACH(bp, head, hq) {
+    if (bp->pgno == *pageno) {
+      __sync_fetch_and_add (&bp->ref, 1);
+      *mem = bp->page;
+      FFDB_RWUNLOCK (pgp->rolock);
+      return 0;
+    }
+  }
+#ifdef _FFDB_STATISTICS
+  pgp->cachemiss++;
+#endif
+  ret = _ffdb_pagepool_load_new_page (pgp, *pageno, flags, mem);
+  FFDB_RWUNLOCK (pgp->rolock);
+
+  return ret;
+}
+
 /**
  * Get a cached page from the page poll
  * There will be no difference of treatment on the thread getting
@@ -991,6 +1112,9 @@ ffdb_pagepool_get_page (ffdb_pagepool_t* pgp, pgno_t* pageno,
   /* Set memory pointer to NULL */
   *mem = 0;
 
+  if (FFDB_FLAG_ISSET(pgp->fileflags, FFDB_RDONLY))
+    return _ffdb_pagepool_get_page_ro (pgp, pageno, flags, mem);
+
   FFDB_LOCK (pgp->lock);
 #ifdef _FFDB_STATISTICS
   pgp->pageget++;
@@ -1210,6 +1334,13 @@ ffdb_pagepool_put_page (ffdb_pagepool_t* pgp, void* mem,
   ffdb_bkt_t* bp;
   ffdb_bkt_waiter_t* sleeper = 0;
 
+  /* A read only page is never modified: just drop the reference */
+  if (FFDB_FLAG_ISSET(pgp->fileflags, FFDB_RDONLY)) {
+    bp = (ffdb_bkt_t *)((char *)mem - sizeof (ffdb_bkt_t));
+    __sync_fetch_and_sub (&bp->ref, 1);
+    return 0;
+  }
+
   FFDB_LOCK(pgp->lock);
 #ifdef _FFDB_STATISTICS
   pgp->pageput++;
@@ -1390,8 +1521,10 @@ ffdb_pagepool_change_page (ffdb_pagepool_t* pgp, void* mem,
 static int
 _ffdb_pagepool_sync_i (ffdb_pagepool_t* pgp, unsigned int numpages)
 {
-  unsigned int num;
+  unsigned int num, nrun;
+  int ret;
   ffdb_bkt_t* bp;
+  ffdb_bkt_t* run[FFDB_MAX_RUN_PAGES];
   ffdb_sbkt_t* sbp;
   ffdb_sbkt_t* next;
   ffdb_slh_t slh;
@@ -1428,19 +1561,27 @@ _ffdb_pagepool_sync_i (ffdb_pagepool_t* pgp, unsigned int numpages)
   /* Do a merge sort on the list slh according to pageno */
   _ffdb_slist_merge_sort (&slh);
 
-  /* Now walk through the sorted list, and dump pages to the back end file */
+  /* Now walk through the sorted list, and dump pages to the back end file
+   * Dirty pages in a row go out by a single write
+   */
+  ret = 0;
+  nrun = 0;
   sbp = FFDB_SLIST_FIRST(&slh);
   next = 0;
   while (sbp) {
     next = FFDB_SLIST_NEXT(sbp, sl);
 
-    if (FFDB_FLAG_ISSET(sbp->bp->flags, FFDB_PAGE_DIRTY)) {
-
-      if (_ffdb_pagepool_write (pgp, sbp->bp) != 0) {
-	fprintf (stderr, "ffdb_pagepool_sync: writing page %d error.\n",
-		 sbp->bp->pgno);
-	return -1;
+    if (ret == 0 && FFDB_FLAG_ISSET(sbp->bp->flags, FFDB_PAGE_DIRTY)) {
+      if (nrun > 0 && (nrun == pgp->runpages ||
+		       sbp->bp->pgno != run[nrun - 1]->pgno + 1)) {
+	if (_ffdb_pagepool_write_run (pgp, run, nrun) != 0) {
+	  fprintf (stderr, "ffdb_pagepool_sync: writing page %d error.\n",
+		   run[0]->pgno);
+	  ret = -1;
+	}
+	nrun = 0;
       }
+      run[nrun++] = sbp->bp;
     }
 #ifdef _FFDB_STATISTICS
     ++pgp->pageflush;
@@ -1450,8 +1591,14 @@ _ffdb_pagepool_sync_i (ffdb_pagepool_t* pgp, unsigned int numpages)
     free (sbp);
     sbp = next;
   }
+  if (ret == 0 && nrun > 0 && 
+      _ffdb_pagepool_write_run (pgp, run, nrun) != 0) {
+    fprintf (stderr, "ffdb_pagepool_sync: writing page %d error.\n",
+	     run[0]->pgno);
+    ret = -1;
+  }
 
-  return 0;
+  return ret;
 }
 
 
@@ -1466,6 +1613,10 @@ ffdb_pagepool_sync (ffdb_pagepool_t* pgp)
 {
   int ret;
 
+  /* Nothing can be dirty on a read only file */
+  if (FFDB_FLAG_ISSET(pgp->fileflags, FFDB_RDONLY))
+    return 0;
+
   FFDB_LOCK (pgp->lock);
 
   ret = _ffdb_pagepool_sync_i (pgp, 0);
@@ -1477,6 +1628,189 @@ ffdb_pagepool_sync (ffdb_pagepool_t* pgp)
 
 
 
+/**
+ * Flush a single dirty page back to the back end file if it is in the
+ * cache and not in use by other threads
+ *
+ * @param pgp cache page pool pointer
+ * @param pageno page number
+ */
+int
+ffdb_pagepool_sync_page (ffdb_pagepool_t* pgp, pgno_t pageno)
+{
+  struct _ffdb_hqh *head;
+  ffdb_bkt_t* bp;
+  int ret = 0;
+
+  if (FFDB_FLAG_ISSET(pgp->fileflags, FFDB_RDONLY))
+    return 0;
+
+  FFDB_LOCK (pgp->lock);
+
+  head = &pgp->hqh[FFDB_HASHKEY(pageno)];
+  FFDB_CIRCLEQ_FOREACH(bp, head, hq) {
+    if (bp->pgno == pageno) {
+      if (!FFDB_FLAG_ISSET(bp->flags, FFDB_PAGE_DIRTY))
+	break;
+      /* a page in use may be changing: caller has to write it later */
+      if (FFDB_FLAG_ISSET(bp->flags, FFDB_PAGE_PINNED) || bp->waiters > 0) {
+	errno = EBUSY;
+	ret = -1;
+	break;
+      }
+      if (_ffdb_pagepool_write (pgp, bp) != 0) {
+	fprintf (stderr, "ffdb_pagepool_sync_page: writing page %d error.\n",
+		 pageno);
+	ret = -1;
+      }
+#ifdef _FFDB_STATISTICS
+      ++pgp->pageflush;
+#endif
+      break;
+    }
+  }
+
+  FFDB_UNLOCK (pgp->lock);
+
+  return ret;
+}
+
+
+/**
+ * Set the number of pages in a row read or written by a single I/O call
+ */
+void
+ffdb_pagepool_runsize (ffdb_pagepool_t* pgp, unsigned int npages)
+{
+  if (npages < 1)
+    npages = 1;
+  if (npages > FFDB_MAX_RUN_PAGES)
+    npages = FFDB_MAX_RUN_PAGES;
+  pgp->runpages = npages;
+}
+
+/**
+ * Find a page in the cache
+ *
+ * This routine is called when the pgp->lock or pgp->rolock is held
+ */
+static ffdb_bkt_t *
+_ffdb_pagepool_find_bkt (ffdb_pagepool_t* pgp, pgno_t pageno)
+{
+  ffdb_bkt_t* bp;
+
+  FFDB_CIRCLEQ_FOREACH(bp, &pgp->hqh[FFDB_HASHKEY(pageno)], hq) {
+    if (bp->pgno == pageno)
+      return bp;
+  }
+  return 0;
+}
+
+/**
+ * Load pages in a row which are not in the cache by a single read
+ *
+ * This routine is called when the pgp->lock or pgp->rolock is held
+ */
+static int
+_ffdb_pagepool_load_run (ffdb_pagepool_t* pgp, pgno_t first,
+			 unsigned int npages)
+{
+  struct iovec iov[FFDB_MAX_RUN_PAGES];
+  ffdb_bkt_t* bps[FFDB_MAX_RUN_PAGES];
+  struct _ffdb_hqh *head;
+  ffdb_bkt_t* bp;
+  unsigned int i, n;
+  ssize_t nbytes;
+
+  /* pages in use by other threads keep at least half of the cache */
+  if (npages > pgp->runpages)
+    npages = pgp->runpages;
+  if (npages > pgp->maxcache / 2)
+    npages = pgp->maxcache / 2;
+  if (first >= pgp->npages)
+    return 0;
+  if (npages > pgp->npages - first)
+    npages = pgp->npages - first;
+  if (npages <= 1 || _ffdb_pagepool_find_bkt (pgp, first))
+    return 0;
+
+  for (n = 0; n < npages; n++) {
+    if (n > 0 && _ffdb_pagepool_find_bkt (pgp, first + n))
+      break;
+    bp = 0;
+    if (pgp->curcache > pgp->maxcache &&
+	_ffdb_pagepool_reuse_bkt (pgp, &bp) == -1)
+      bp = 0;
+    if (!bp && !(bp = _ffdb_pagepool_new_bkt (pgp)))
+      break;
+    bps[n] = bp;
+    iov[n].iov_base = bp->page;
+    iov[n].iov_len = pgp->pagesize;
+  }
+
+  nbytes = n > 0 ? preadv (pgp->fd, iov, n, (off_t)pgp->pagesize * first) : 0;
+  if (nbytes != (ssize_t)pgp->pagesize * n) {
+    /* buckets not loaded go away: single pages are read on demand */
+    for (i = 0; i < n; i++) {
+      free (bps[i]);
+      --pgp->curcache;
+    }
+    return (nbytes < 0) ? errno : 0;
+  }
+
+#ifdef _FFDB_STATISTICS
+  pgp->pageread += n;
+#endif
+  for (i = 0; i < n; i++) {
+    bp = bps[i];
+    bp->pgno = first + i;
+    bp->ref = 0;
+    bp->waiters = 0;
+    bp->flags = FFDB_PAGE_VALID;
+    bp->owner = FFDB_THREAD_ID;
+
+    head = &pgp->hqh[FFDB_HASHKEY(bp->pgno)];
+    FFDB_CIRCLEQ_INSERT_HEAD(head, bp, hq);
+    FFDB_CIRCLEQ_INSERT_TAIL(&pgp->lqh, bp, lq);
+
+    if (pgp->pgin) 
+      (pgp->pgin)(pgp->pgcookie, bp->pgno, bp->page);
+  }
+  return 0;
+}
+
+/**
+ * Load pages in a row into the cache by a single read
+ */
+int
+ffdb_pagepool_load_pages (ffdb_pagepool_t* pgp, pgno_t first,
+			  unsigned int npages)
+{
+  int ret;
+
+  if (pgp->runpages <= 1 || npages <= 1)
+    return 0;
+
+  if (FFDB_FLAG_ISSET(pgp->fileflags, FFDB_RDONLY)) {
+    /* a cached first page only needs the shared lock */
+    FFDB_RDLOCK (pgp->rolock);
+    ret = (_ffdb_pagepool_find_bkt (pgp, first) != 0);
+    FFDB_RWUNLOCK (pgp->rolock);
+    if (ret)
+      return 0;
+
+    FFDB_WRLOCK (pgp->rolock);
+    ret = _ffdb_pagepool_load_run (pgp, first, npages);
+    FFDB_RWUNLOCK (pgp->rolock);
+    return ret;
+  }
+
+  FFDB_LOCK (pgp->lock);
+  ret = _ffdb_pagepool_load_run (pgp, first, npages);
+  FFDB_UNLOCK (pgp->lock);
+  return ret;
+}
+
 /**
  * Close the page poll pointer and any resource associated with this file
  * This implies all dirty pages are flushed out, 
@@ -1513,6 +1847,7 @@ ffdb_pagepool_close (ffdb_pagepool_t* pgp)
 
   /* destroy lock */
   FFDB_LOCK_FINI(pgp->lock);
+  FFDB_RWLOCK_FINI(pgp->rolock);
 
   free (pgp);
   return 0;
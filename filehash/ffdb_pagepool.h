@@ -69,6 +69,11 @@
 #define FFDB_LOCK_FINI(lock)      (pthread_mutex_destroy (&(lock)))
 #define FFDB_LOCK(lock)           (pthread_mutex_lock(&(lock)))
 #define FFDB_UNLOCK(lock)         (pthread_mutex_unlock(&(lock)))
+#define FFDB_RWLOCK_INIT(lock)    (pthread_rwlock_init (&(lock), 0))
+#define FFDB_RWLOCK_FINI(lock)    (pthread_rwlock_destroy (&(lock)))
+#define FFDB_RDLOCK(lock)         (pthread_rwlock_rdlock(&(lock)))
+#define FFDB_WRLOCK(lock)         (pthread_rwlock_wrlock(&(lock)))
+#define FFDB_RWUNLOCK(lock)       (pthread_rwlock_unlock(&(lock)))
 #define FFDB_COND_INIT(cond)      (pthread_cond_init(&(cond), 0))
 #define FFDB_COND_FINI(cond)      (pthread_cond_destroy(&(cond)))
 #define FFDB_COND_WAIT(cond,lock) (pthread_cond_wait(&(cond), &(lock)))
@@ -93,6 +98,11 @@
  */
 #define FFDB_WRITE_FRAC           5
 
+/**
+ * Maximum number of pages in a row read or written by a single I/O call
+ */
+#define FFDB_MAX_RUN_PAGES        256
+
 
 /*
  * Common flags --
@@ -216,6 +226,7 @@ typedef struct _ffdb_pagepool_
   pgno_t	npages;			/* number of pages in the file */
   pgno_t	maxpgno;		/* maximum pages number in use */
   unsigned int	pagesize;		/* file page size */
+  unsigned int  runpages;               /* pages in a row per I/O call */
   unsigned int  fileflags;              /* file creation flag */
   int	        fd;		        /* file descriptor */
   int           close_fd;   		/* do i close fd on exit */
@@ -240,6 +251,7 @@ typedef struct _ffdb_pagepool_
   unsigned int  pagewait;
 #endif  
   pthread_mutex_t lock;
+  pthread_rwlock_t rolock;              /* page table lock for read only file */
 }ffdb_pagepool_t;
 
 #ifdef _cplusplus
@@ -319,6 +331,9 @@ ffdb_pagepool_new_page (ffdb_pagepool_t* pgp, pgno_t* pageno,
  * will be allocated and eventually written back to the file. Once this
  * page is claimed by a thread, other threads cannot access this thread.
  *
+ * If the file is opened read only, pages are immutable once loaded:
+ * any number of threads share a page and only its reference count is kept.
+ *
  * @param pgp cache page pool pointer
  * @param pageno requested page number
  * @param flags this flag can be either 0, or by bitwise inclusively OR'ing
@@ -383,6 +398,43 @@ ffdb_pagepool_change_page (ffdb_pagepool_t* pgp, void* mem,
 extern int
 ffdb_pagepool_sync (ffdb_pagepool_t* pgp);
 
+/**
+ * Flush a single dirty page back to the back end file. The page is left
+ * alone if it is not in the cache or is in use by other threads
+ *
+ * @param  pgp cache page pool pointer
+ * @param  pageno page number
+ *
+ * @return 0 when the page is not dirty in the cache any more. -1 with
+ * errno EBUSY when the dirty page is in use, -1 on write errors
+ */
+extern int
+ffdb_pagepool_sync_page (ffdb_pagepool_t* pgp, pgno_t pageno);
+
+/**
+ * Set the number of pages in a row which are read or written by a 
+ * single I/O call. Dirty pages in a row are always written together
+ *
+ * @param  pgp cache page pool pointer
+ * @param  npages number of pages (at most FFDB_MAX_RUN_PAGES)
+ */
+extern void
+ffdb_pagepool_runsize (ffdb_pagepool_t* pgp, unsigned int npages);
+
+/**
+ * Load pages in a row into the cache by a single read when the first
+ * page is not in the cache. Loading stops at a page in the cache or at
+ * the end of the file. Loaded pages are left unpinned for later gets
+ *
+ * @param  pgp cache page pool pointer
+ * @param  first first page number
+ * @param  npages number of pages wanted
+ * @return 0 on success, otherwise errno
+ */
+extern int
+ffdb_pagepool_load_pages (ffdb_pagepool_t* pgp, pgno_t first, 
+			  unsigned int npages);
+
 /**
  * Close the page poll pointer and any resource associated with this file
  * This implies all dirty pages are flushed out, 
@@ -9,10 +9,15 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/file.h>
+#include <errno.h>
 #include <ffdb_db.h>
 
 #define INITIAL	500000
 #define MAXWORDS 500000	       /* # of elements in search table */
+#define NUM_RANGES 7
+#define BULK_SIZE 4096
+#define NUM_ABSENT 100000
+#define NUM_LEVELS 32
 
 
 static void
@@ -62,9 +67,18 @@ int main(int argc, char** argv)
   int	stat, i, numkey;
   char *dbase;
   ffdb_cursor_t* cur;
+  ffdb_bucket_range_t ranges[NUM_RANGES];
+  int nranges, r, nfwd, nbwd;
+  FFDB_DBT bulk;
+  void *bbuf;
+  unsigned long bsize, pos;
+  unsigned int count;
+  char *filterfile, kstr[64];
+  ffdb_level_pages_t levels[NUM_LEVELS];
+  unsigned int nlevels, l;
 
   if (argc < 3) {
-    fprintf (stderr, "Usage: %s cachesize dbase\n", argv[0]);
+    fprintf (stderr, "Usage: %s cachesize dbase [filterfile]\n", argv[0]);
     exit (1);
   }
 
@@ -78,6 +92,7 @@ int main(int argc, char** argv)
   ctl.cachesize = atoi(*argv++);
   ctl.rearrangepages = 0;
   dbase = *argv++;
+  filterfile = (argc > 3) ? *argv++ : 0;
   fprintf (stderr, "dbase = %s\n", dbase);
 #if 1
   if (!(dbp = ffdb_dbopen(dbase, O_RDONLY, 0400, &ctl))) {
@@ -141,8 +156,217 @@ int main(int argc, char** argv)
   }
 
   fprintf (stderr, "Number of keys = %d\n", numkey);
+  cur->close (cur);
+
+  /* Walk through all pairs again in the order of data pages */
+  stat = dbp->cursor (dbp, &cur, FFDB_DATA_CURSOR);
+  if (stat != 0) {
+    fprintf (stderr, "Cannot open a data cursor\n");
+    (dbp->close)(dbp);
+    return -1;
+  }
+
+  key.data = 0;
+  key.size = 0;
+  res.data = 0;
+  res.size = 0;
+
+  i = 0;
+  while ((stat = cur->get (cur, &key, &res, FFDB_NEXT)) == FFDB_SUCCESS) {
+    FFDB_DBT val;
+
+    /* the pair has to be the same as the one found by the key */
+    val.data = 0;
+    val.size = 0;
+    if ((dbp->get)(dbp, &key, &val, 0) != 0 || val.size != res.size ||
+	memcmp (val.data, res.data, res.size) != 0) {
+      fprintf (stderr, "Data cursor pair mismatch for key %s\n", 
+	       (char *)(key.data));
+      stat = -1;
+    }
+    i++;
+
+    free (val.data);
+    free (key.data);
+    free (res.data);
+
+    key.data = 0;
+    key.size = 0;
+    res.data = 0;
+    res.size = 0;
+    if (stat != FFDB_SUCCESS)
+      break;
+  }
+  cur->close (cur);
+
+  fprintf (stderr, "Number of keys in data page order = %d\n", i);
+  if (stat != FFDB_NOT_FOUND || i != numkey) {
+    (dbp->close)(dbp);
+    return 1;
+  }
+
+  /* Walk through all keys in bucket ranges, forward and backward */
+  nranges = ffdb_bucket_ranges (dbp, ranges, NUM_RANGES);
+  if (nranges <= 0 || dbp->cursor (dbp, &cur, FFDB_KEY_CURSOR) != 0) {
+    fprintf (stderr, "Cannot split buckets into ranges\n");
+    (dbp->close)(dbp);
+    return 1;
+  }
+  nfwd = nbwd = 0;
+  for (r = 0; r < nranges; r++) {
+    ffdb_cursor_set_range (cur, &ranges[r]);
+    key.data = 0;
+    key.size = 0;
+    while ((stat = cur->get (cur, &key, 0, FFDB_NEXT)) == FFDB_SUCCESS) {
+      nfwd++;
+      free (key.data);
+      key.data = 0;
+      key.size = 0;
+    }
+    ffdb_cursor_set_range (cur, &ranges[r]);
+    while ((stat = cur->get (cur, &key, 0, FFDB_PREV)) == FFDB_SUCCESS) {
+      nbwd++;
+      free (key.data);
+      key.data = 0;
+      key.size = 0;
+    }
+  }
+  cur->close (cur);
+
+  fprintf (stderr, "Number of keys in %d bucket ranges = %d forward %d backward\n",
+	   nranges, nfwd, nbwd);
+  if (nfwd != numkey || nbwd != numkey) {
+    (dbp->close)(dbp);
+    return 1;
+  }
+
+  /* Walk through all pairs and all keys in bulk with a small buffer */
+  bsize = BULK_SIZE;
+  bbuf = malloc (bsize);
+  nfwd = nbwd = 0;
+  for (r = 0; r < 2; r++) {
+    if (dbp->cursor (dbp, &cur, r == 0 ? FFDB_DATA_CURSOR : FFDB_KEY_CURSOR) != 0) {
+      fprintf (stderr, "Cannot open a cursor for bulk get\n");
+      break;
+    }
+    while (1) {
+      bulk.data = bbuf;
+      bulk.size = bsize;
+      stat = ffdb_cursor_get_bulk (cur, &bulk, 
+				   r == 0 ? FFDB_NEXT : FFDB_NEXT | FFDB_BULK_KEYS,
+				   &count);
+      if (stat == -1 && errno == ENOMEM) {
+	/* a pair larger than the buffer */
+	bsize = bulk.size;
+	bbuf = realloc (bbuf, bsize);
+	continue;
+      }
+      if (stat != FFDB_SUCCESS)
+	break;
+
+      pos = 0;
+      while (ffdb_bulk_next (&bulk, &pos, &key, &res) == FFDB_SUCCESS) {
+	FFDB_DBT val;
+
+	val.data = 0;
+	val.size = 0;
+	if ((dbp->get)(dbp, &key, &val, 0) != 0 || 
+	    (r == 0 && (val.size != res.size ||
+			memcmp (val.data, res.data, res.size) != 0)) ||
+	    (r == 1 && res.size != 0)) {
+	  fprintf (stderr, "Bulk pair mismatch for key %s\n", 
+		   (char *)(key.data));
+	  count = 0;
+	}
+	free (val.data);
+	if (r == 0)
+	  nfwd++;
+	else
+	  nbwd++;
+      }
+      if (count == 0)
+	break;
+    }
+    cur->close (cur);
+  }
+  free (bbuf);
+
+  fprintf (stderr, "Number of pairs in bulk = %d and keys in bulk = %d\n",
+	   nfwd, nbwd);
+  if (nfwd != numkey || nbwd != numkey) {
+    (dbp->close)(dbp);
+    return 1;
+  }
+
+  /* Overflow pages of a level sit together without data pages between */
+  nlevels = NUM_LEVELS;
+  if (ffdb_get_level_pages (dbp, levels, &nlevels) != 0) {
+    fprintf (stderr, "Cannot find overflow pages\n");
+    (dbp->close)(dbp);
+    return 1;
+  }
+  nfwd = 0;
+  for (l = 0; l < nlevels; l++) {
+    if (levels[l].novfl == 0)
+      continue;
+    fprintf (stderr, "Level %d with %d buckets has %d overflow pages from %d to %d with %d data pages\n",
+	     l, levels[l].nbuckets, levels[l].novfl, levels[l].first,
+	     levels[l].last, levels[l].ndata);
+    if (levels[l].ndata > 0)
+      nfwd++;
+  }
+  if (nfwd > 0) {
+    fprintf (stderr, "Data pages found between overflow pages of %d levels\n",
+	     nfwd);
+    (dbp->close)(dbp);
+    return 1;
+  }
+
+  /* Every key passes the key filter, absent keys mostly do not */
+  if (ffdb_filter_open (dbp, filterfile, 4) != 0 ||
+      dbp->cursor (dbp, &cur, FFDB_KEY_CURSOR) != 0) {
+    fprintf (stderr, "Cannot build key filter\n");
+    (dbp->close)(dbp);
+    return 1;
+  }
+  nfwd = nbwd = 0;
+  key.data = 0;
+  key.size = 0;
+  while ((stat = cur->get (cur, &key, 0, FFDB_NEXT)) == FFDB_SUCCESS) {
+    res.data = 0;
+    res.size = 0;
+    if (ffdb_key_may_exist (dbp, &key) == 1 &&
+	(dbp->get)(dbp, &key, &res, 0) == 0)
+      nfwd++;
+    else
+      fprintf (stderr, "Key %s is lost by key filter\n", (char *)(key.data));
+    free (res.data);
+    free (key.data);
+    key.data = 0;
+    key.size = 0;
+  }
+  cur->close (cur);
+
+  for (i = 0; i < NUM_ABSENT; i++) {
+    sprintf (kstr, "absent-key-%d", i);
+    key.data = kstr;
+    key.size = strlen (kstr) + 1;
+    res.data = 0;
+    res.size = 0;
+    if ((dbp->get)(dbp, &key, &res, 0) != FFDB_NOT_FOUND) {
+      fprintf (stderr, "Absent key %s is found\n", kstr);
+      nfwd = -1;
+    }
+    nbwd += (ffdb_key_may_exist (dbp, &key) == 1);
+  }
+
+  fprintf (stderr, "Number of keys through key filter = %d with %d false positives in %d\n",
+	   nfwd, nbwd, NUM_ABSENT);
 
   (dbp->close)(dbp);
 
+  if (nfwd != numkey)
+    return 1;
+
   return 0;
 }
@@ -60,10 +60,11 @@ int main(int argc, char** argv)
   FFDB_DBT item, key;
   FFDB_DB	*dbp;
   FFDB_HASHINFO ctl;
-  char *p1, *p2, *dbase;
+  int compact;
+  char *p1, *p2, *dbase, *filterfile;
 
   if (argc < 5) {
-    fprintf (stderr, "Usage: %s bucketsize nbuckets rearrange(0|1) dbasename\n", argv[0]);
+    fprintf (stderr, "Usage: %s bucketsize nbuckets rearrange(0|1) dbasename [filterfile]\n", argv[0]);
     exit(1);
   }
 
@@ -75,10 +76,12 @@ int main(int argc, char** argv)
   ctl.cachesize = 1 * 1024 * 1024;
   ctl.bsize = atoi(*argv++);
   ctl.nbuckets = atoi(*argv++);
-  ctl.rearrangepages = atoi(*argv++);
+  compact = atoi(*argv++);
+  ctl.rearrangepages = 0;
   ctl.numconfigs = 100;
   ctl.userinfolen = 100000;
   dbase = *argv++;
+  filterfile = (argc > 5) ? *argv++ : 0;
 
 #if 0
   if (!(dbp = ffdb_dbopen( dbase,
@@ -101,6 +104,12 @@ int main(int argc, char** argv)
   insert_user_info (dbp, USER_STRING);
   init_config_info (dbp, 100);
 
+  /* Keep the key filter up to date while inserting */
+  if (filterfile && ffdb_filter_open (dbp, filterfile, 1) != 0) {
+    fprintf (stderr, "cannot build key filter %s\n", filterfile);
+    exit(1);
+  }
+
   key.data = wp1;
   item.data = wp2;
   while ( fgets(wp1, MAX_LEN, stdin) &&
@@ -134,6 +143,12 @@ int main(int argc, char** argv)
   
   (dbp->close)(dbp);
 
+  /* moving pages to save space is a separate step after close */
+  if (compact && ffdb_compact (dbase, &ctl) != 0) {
+    fprintf (stderr, "cannot compact %s\n", dbase);
+    exit(1);
+  }
+
   fprintf (stderr, "We put %d item in the database %s\n", i, dbase);
 
   exit(0);
@@ -150,7 +150,6 @@ int main(int argc, char** argv)
     exit(1);
   }
 
-  ctl.rearrangepages = 1;
   if (!(dbp_m = ffdb_dbopen(dbase_m,
 			    O_CREAT|O_RDWR, 0600, &ctl))){
     /* create table */
@@ -199,6 +198,12 @@ int main(int argc, char** argv)
   (dbp_nm->close)(dbp_nm);  
   (dbp_m->close)(dbp_m);
 
+  /* the second database is compacted after close */
+  if (ffdb_compact (dbase_m, &ctl) != 0) {
+    fprintf (stderr, "cannot compact %s\n", dbase_m);
+    exit(1);
+  }
+
 
   fprintf (stderr, "We put %d item in the database %s\n", i, dbase_m);
   fprintf (stderr, "We put %d item in the database %s\n", i, dbase_nm);
@@ -126,7 +126,7 @@ int main(int argc, char** argv)
   FFDB_DB	*dbp;
   FFDB_HASHINFO ctl;
   int  i, numthread;
-  char *dbase, *strfile;
+  char *dbase, *strfile, *keydirfile;
   unsigned char userdata[4096];
   unsigned int len = 4096;
   ffdb_all_config_info_t acf;
@@ -135,7 +135,7 @@ int main(int argc, char** argv)
   void* status;
 
   if (argc < 5) {
-    fprintf (stderr, "Usage: %s cachesize numthreads dbase stringfile\n", argv[0]);
+    fprintf (stderr, "Usage: %s cachesize numthreads dbase stringfile [keydirfile]\n", argv[0]);
     exit (1);
   }
 
@@ -151,6 +151,7 @@ int main(int argc, char** argv)
   numthread = atoi(*argv++);
   dbase = *argv++;
   strfile = *argv++;
+  keydirfile = (argc > 5) ? *argv++ : 0;
   fprintf (stderr, "dbase = %s number thread = %d\n", dbase, numthread);
   if (!(dbp = ffdb_dbopen(dbase, O_RDONLY, 0600, &ctl))) {
     /* create table */
@@ -158,6 +159,12 @@ int main(int argc, char** argv)
     exit(1);
   }
 
+  /* Look keys up through an in memory key directory */
+  if (keydirfile && ffdb_keydir_open (dbp, keydirfile, numthread) != 0) {
+    fprintf (stderr, "cannot build key directory %s\n", keydirfile);
+    exit(1);
+  }
+
   /* Read user and configuration information */
   read_user_info (dbp, userdata, &len);
 
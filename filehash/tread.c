@@ -82,7 +82,9 @@ int main(int argc, char** argv)
   ctl.cmp = NULL;
   ctl.bsize = 64;
   ctl.cachesize = atoi(*argv++);
-  ctl.rearrangepages = atoi(*argv++);
+  /* pages are not moved by a reader: rearrange is ignored */
+  argv++;
+  ctl.rearrangepages = 0;
   
   dbase = *argv++;
   fprintf (stderr, "dbase = %s\n", dbase);
@@ -58,6 +58,7 @@ int main(int argc, char** argv)
   FFDB_DBT item, key;
   FFDB_DB	*dbp;
   FFDB_HASHINFO ctl;
+  int compact;
   char *p1, *p2, *dbase;
 
   if (argc < 4) {
@@ -73,7 +74,8 @@ int main(int argc, char** argv)
   ctl.cachesize = atoi(*argv++);
   ctl.bsize = 0;
   ctl.nbuckets = 0;
-  ctl.rearrangepages = atoi(*argv++);
+  compact = atoi(*argv++);
+  ctl.rearrangepages = 0;
   ctl.numconfigs = 100;
   dbase = *argv++;
 
@@ -122,6 +124,12 @@ int main(int argc, char** argv)
   
   (dbp->close)(dbp);
 
+  /* moving pages to save space is a separate step after close */
+  if (compact && ffdb_compact (dbase, &ctl) != 0) {
+    fprintf (stderr, "cannot compact %s\n", dbase);
+    exit(1);
+  }
+
   fprintf (stderr, "We put %d item in the database %s\n", i, dbase);
 
   exit(0);
@@ -77,6 +77,7 @@ int main(int argc, char** argv)
   FFDB_DBT item, key;
   FFDB_DB	*dbp;
   FFDB_HASHINFO ctl;
+  int compact;
   char *p1, *p2, *dbase;
   char *end;
   long datasize;
@@ -96,7 +97,8 @@ int main(int argc, char** argv)
   ctl.cachesize = atoi(*argv++);
   ctl.bsize = 0;
   ctl.nbuckets = 0;
-  ctl.rearrangepages = atoi(*argv++);
+  compact = atoi(*argv++);
+  ctl.rearrangepages = 0;
   ctl.numconfigs = 100;
   dbase = *argv++;
   datasize = strtol (*argv++, &end, 10);
@@ -135,5 +137,11 @@ int main(int argc, char** argv)
   
   (dbp->close)(dbp);
 
+  /* moving pages to save space is a separate step after close */
+  if (compact && ffdb_compact (dbase, &ctl) != 0) {
+    fprintf (stderr, "cannot compact %s\n", dbase);
+    exit(1);
+  }
+
   return 0;
 }
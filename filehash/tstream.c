@@ -0,0 +1,312 @@
+/**
+ * Simple code to test streaming read and write of data items
+ *
+ * Data items are written in chunks of varying sizes, read back
+ * with a regular get and then streamed back in chunks again
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <ffdb_db.h>
+
+#define MAX_CHUNK 10000
+
+/**
+ * Deterministic byte of a data item at a position
+ */
+static unsigned char
+data_byte (int i, long pos)
+{
+  return (unsigned char)((i * 131 + pos * 7 + pos / 1000) % 251);
+}
+
+/**
+ * Size of data item i
+ */
+static long
+data_size (int i, long maxdsize)
+{
+  return (i * 7919L) % maxdsize + 1;
+}
+
+static int
+write_item (FFDB_DB* dbp, FFDB_DBT* key, int i, long size)
+{
+  ffdb_value_t* value;
+  unsigned char buf[MAX_CHUNK];
+  long pos, len, k;
+
+  if (ffdb_value_open_write (dbp, key, size, &value) != 0) {
+    fprintf (stderr, "Cannot open key %s for write\n", (char *)key->data);
+    return -1;
+  }
+  for (pos = 0; pos < size; pos += len) {
+    len = (pos * 13 + i) % MAX_CHUNK + 1;
+    if (len > size - pos)
+      len = size - pos;
+    for (k = 0; k < len; k++)
+      buf[k] = data_byte (i, pos + k);
+    if (ffdb_value_write_chunk (value, buf, len) != 0) {
+      fprintf (stderr, "Cannot write chunk at %ld for key %s\n", pos,
+	       (char *)key->data);
+      ffdb_value_close (value);
+      return -1;
+    }
+  }
+  if (ffdb_value_commit (value) != 0) {
+    fprintf (stderr, "Cannot commit key %s\n", (char *)key->data);
+    ffdb_value_close (value);
+    return -1;
+  }
+  return 0;
+}
+
+static int
+put_item (FFDB_DB* dbp, FFDB_DBT* key, int i, long size)
+{
+  FFDB_DBT data;
+  unsigned char buf[MAX_CHUNK];
+  long k;
+
+  for (k = 0; k < size; k++)
+    buf[k] = data_byte (i, k);
+  data.data = buf;
+  data.size = size;
+  if ((dbp->put)(dbp, key, &data, 0) != 0) {
+    fprintf (stderr, "Cannot put key %s\n", (char *)key->data);
+    return -1;
+  }
+  return 0;
+}
+
+static int
+check_item (FFDB_DB* dbp, FFDB_DBT* key, int i, long size)
+{
+  ffdb_value_t* value;
+  FFDB_DBT res;
+  unsigned char buf[MAX_CHUNK];
+  long pos, len, k;
+
+  /* regular get verifies the checksum stored on commit */
+  res.data = 0;
+  res.size = 0;
+  if ((dbp->get)(dbp, key, &res, 0) != 0 || res.size != size) {
+    fprintf (stderr, "Cannot get key %s\n", (char *)key->data);
+    return -1;
+  }
+  for (k = 0; k < size; k++) {
+    if (((unsigned char *)res.data)[k] != data_byte (i, k)) {
+      fprintf (stderr, "Data mismatch at %ld for key %s\n", k,
+	       (char *)key->data);
+      free (res.data);
+      return -1;
+    }
+  }
+  free (res.data);
+
+  /* stream it back */
+  if (ffdb_value_open_read (dbp, key, &value) != 0) {
+    fprintf (stderr, "Cannot open key %s for read\n", (char *)key->data);
+    return -1;
+  }
+  pos = 0;
+  while ((len = ffdb_value_read_next (value, buf, (pos * 3 + i) % MAX_CHUNK + 1)) > 0) {
+    for (k = 0; k < len; k++) {
+      if (buf[k] != data_byte (i, pos + k)) {
+	fprintf (stderr, "Streamed data mismatch at %ld for key %s\n",
+		 pos + k, (char *)key->data);
+	ffdb_value_close (value);
+	return -1;
+      }
+    }
+    pos += len;
+  }
+  ffdb_value_close (value);
+  if (len < 0 || pos != size) {
+    fprintf (stderr, "Cannot stream key %s back\n", (char *)key->data);
+    return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  FFDB_DB	*dbp;
+  FFDB_HASHINFO ctl;
+  FFDB_DBT key;
+  ffdb_stats_t stats;
+  int  i, numkeys, errors;
+  long maxdsize;
+  char *dbase;
+  char kstr[128];
+
+  if (argc < 5) {
+    fprintf (stderr, "Usage: %s bucketsize dbasename numkeys maxdatasize [hashid] [dextsize]\n", argv[0]);
+    exit (1);
+  }
+
+  argv++;
+  ctl.hash = NULL;
+  ctl.cmp = NULL;
+  ctl.hashid = FFDB_HASH_DEFAULT;
+  ctl.openmode = FFDB_OPEN_DEFAULT;
+  ctl.dextsize = 0;
+  ctl.cachesize = 0;
+  ctl.bsize = atoi(*argv++);
+  ctl.nbuckets = 4;
+  ctl.rearrangepages = FFDB_INFO_HASHID | FFDB_INFO_OPENMODE | FFDB_INFO_DEXTSIZE;
+  ctl.numconfigs = 0;
+  ctl.userinfolen = 1000;
+  dbase = *argv++;
+  numkeys = atoi(*argv++);
+  maxdsize = atol(*argv++);
+  if (argc > 5)
+    ctl.hashid = atoi(*argv++);
+  if (argc > 6)
+    ctl.dextsize = atoi(*argv++);
+
+  if (maxdsize <= 0) {
+    fprintf (stderr, "Data size must be positive\n");
+    exit (1);
+  }
+
+  if (!(dbp = ffdb_dbopen(dbase, O_RDWR|O_CREAT|O_TRUNC, 0600, &ctl))) {
+    fprintf(stderr, "cannot create: hash table\n" );
+    exit(1);
+  }
+
+  errors = 0;
+  for (i = 0; i < numkeys; i++) {
+    sprintf (kstr, "stream-key-%d", i);
+    key.data = kstr;
+    key.size = strlen(kstr) + 1;
+    if (write_item (dbp, &key, i, data_size (i, maxdsize)) != 0)
+      errors++;
+  }
+
+  /* replace every other item with a smaller one */
+  for (i = 0; i < numkeys; i += 2) {
+    sprintf (kstr, "stream-key-%d", i);
+    key.data = kstr;
+    key.size = strlen(kstr) + 1;
+    if (write_item (dbp, &key, i + 1, data_size (i, maxdsize) / 2) != 0)
+      errors++;
+  }
+
+  for (i = 0; i < numkeys; i++) {
+    sprintf (kstr, "stream-key-%d", i);
+    key.data = kstr;
+    key.size = strlen(kstr) + 1;
+    if (i % 2 == 0) {
+      if (check_item (dbp, &key, i + 1, data_size (i, maxdsize) / 2) != 0)
+	errors++;
+    }
+    else if (check_item (dbp, &key, i, data_size (i, maxdsize)) != 0)
+      errors++;
+  }
+
+  /* small items put directly live on key pages until they grow out */
+  for (i = 0; i < numkeys; i += 3) {
+    sprintf (kstr, "small-key-%d", i);
+    key.data = kstr;
+    key.size = strlen(kstr) + 1;
+    if (put_item (dbp, &key, i + 2, data_size (i, 64)) != 0 ||
+	check_item (dbp, &key, i + 2, data_size (i, 64)) != 0 ||
+	put_item (dbp, &key, i + 3, data_size (i, 64) / 2) != 0 ||
+	check_item (dbp, &key, i + 3, data_size (i, 64) / 2) != 0)
+      errors++;
+    else if (i % 2 == 0) {
+      if (put_item (dbp, &key, i + 4, 64 + data_size (i, MAX_CHUNK - 64)) != 0 ||
+	  check_item (dbp, &key, i + 4, 64 + data_size (i, MAX_CHUNK - 64)) != 0)
+	errors++;
+    }
+    else if (write_item (dbp, &key, i + 4, data_size (i, 64)) != 0 ||
+	     check_item (dbp, &key, i + 4, data_size (i, 64)) != 0)
+      errors++;
+  }
+
+  dbp->close (dbp);
+
+  /* the hash function recorded in the file is picked up on reopen */
+  ctl.hashid = FFDB_HASH_DEFAULT;
+  if (!(dbp = ffdb_dbopen(dbase, O_RDONLY, 0400, &ctl))) {
+    fprintf(stderr, "cannot reopen: hash table\n" );
+    exit(1);
+  }
+  for (i = 1; i < numkeys; i += 2) {
+    sprintf (kstr, "stream-key-%d", i);
+    key.data = kstr;
+    key.size = strlen(kstr) + 1;
+    if (check_item (dbp, &key, i, data_size (i, maxdsize)) != 0)
+      errors++;
+  }
+  dbp->close (dbp);
+
+  /* a lazy open of a writer finds its free and data pages on first put */
+  ctl.openmode = FFDB_OPEN_LAZY;
+  if (!(dbp = ffdb_dbopen(dbase, O_RDWR, 0600, &ctl))) {
+    fprintf(stderr, "cannot reopen lazily: hash table\n" );
+    exit(1);
+  }
+  if (ffdb_get_stats (dbp, &stats) != 0 || !stats.lazy) {
+    fprintf (stderr, "Cannot get statistics of a lazy open\n");
+    errors++;
+  }
+  for (i = 0; i < numkeys; i += 4) {
+    sprintf (kstr, "lazy-key-%d", i);
+    key.data = kstr;
+    key.size = strlen(kstr) + 1;
+    if (write_item (dbp, &key, i, data_size (i, maxdsize)) != 0)
+      errors++;
+  }
+  for (i = 0; i < numkeys; i++) {
+    sprintf (kstr, "lazy-key-%d", i);
+    key.data = kstr;
+    key.size = strlen(kstr) + 1;
+    if (i % 4 == 0 && check_item (dbp, &key, i, data_size (i, maxdsize)) != 0)
+      errors++;
+    sprintf (kstr, "stream-key-%d", i);
+    key.data = kstr;
+    key.size = strlen(kstr) + 1;
+    if (i % 2 == 1 && check_item (dbp, &key, i, data_size (i, maxdsize)) != 0)
+      errors++;
+  }
+  dbp->close (dbp);
+
+  /* a user function does not replace the recorded built-in one */
+  ctl.hash = ffdb_hash_function (FFDB_HASH_FNV);
+  if ((dbp = ffdb_dbopen(dbase, O_RDONLY, 0400, &ctl)) != 0 || errno != EINVAL) {
+    fprintf (stderr, "Opened with a user hash function\n");
+    if (dbp)
+      dbp->close (dbp);
+    errors++;
+  }
+  ctl.hash = NULL;
+
+  /* later fields are ignored when their bits are not set */
+  ctl.rearrangepages = 0;
+  ctl.hashid = 0x7fffffff;
+  ctl.openmode = 0x7fffffff;
+  ctl.dextsize = 1;
+  if (!(dbp = ffdb_dbopen(dbase, O_RDWR, 0600, &ctl))) {
+    fprintf(stderr, "cannot reopen without later fields: hash table\n" );
+    exit(1);
+  }
+  if (ffdb_get_stats (dbp, &stats) != 0 || stats.lazy) {
+    fprintf (stderr, "Lazy open without asking for it\n");
+    errors++;
+  }
+  dbp->close (dbp);
+
+  if (errors) {
+    fprintf (stderr, "%d errors found\n", errors);
+    return 1;
+  }
+  return 0;
+}
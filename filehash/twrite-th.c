@@ -0,0 +1,249 @@
+/**
+ * Simple code to test threaded write database
+ *
+ * Each thread inserts its own set of keys concurrently, after which
+ * all keys are replaced while batch readers fetch them, and finally
+ * all keys are read back and checked
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <pthread.h>
+#include <ffdb_db.h>
+
+typedef struct _thread_info_
+{
+  FFDB_DB* dbp;
+  int      numkeys;
+  int      maxdsize;
+  int      tnum;
+  int      gen;
+  int      errors;
+}thread_info_t;
+
+#define MAX_LEN 32768
+
+#define MAX_THREADS 100
+
+#define MGET_BATCH 16
+
+/**
+ * Deterministic key and data for a thread, an index and a generation
+ */
+static void
+make_pair (int tnum, int i, int gen, int maxdsize, char* kstr, char* vstr)
+{
+  int k, len;
+
+  sprintf (kstr, "key-%d-%d", tnum, i);
+
+  /* a replacement is never larger than the data it replaces */
+  len = (tnum * 7919 + i * 31) % maxdsize;
+  len -= gen * (len / 4);
+  if (len < 5)
+    len = 5;
+  for (k = 0; k < len; k++)
+    vstr[k] = (char)('0' + (tnum + i + k + gen) % 75);
+  vstr[len] = '\0';
+}
+
+static void *writer_thread (void* arg)
+{
+  thread_info_t *tinfo = (thread_info_t *)arg;
+  char kstr[MAX_LEN], vstr[MAX_LEN];
+  FFDB_DBT key, item;
+  int i;
+
+  for (i = 0; i < tinfo->numkeys; i++) {
+    make_pair (tinfo->tnum, i, tinfo->gen, tinfo->maxdsize, kstr, vstr);
+    key.data = kstr;
+    key.size = strlen(kstr) + 1;
+    item.data = vstr;
+    item.size = strlen(vstr) + 1;
+
+    if ((tinfo->dbp->put)(tinfo->dbp, &key, &item, 
+			  tinfo->gen ? 0 : FFDB_NOOVERWRITE) != 0) {
+      fprintf (stderr, "thread %d cannot insert key %s\n", tinfo->tnum, kstr);
+      tinfo->errors++;
+    }
+  }
+  fprintf (stderr, "Done writer thread %d\n", tinfo->tnum);
+  return 0;
+}
+
+static void *reader_thread (void* arg)
+{
+  thread_info_t *tinfo = (thread_info_t *)arg;
+  char kstr[MAX_LEN], vstr[MAX_LEN], recv[MAX_LEN];
+  FFDB_DBT key, res;
+  int i, stat;
+
+  for (i = 0; i < tinfo->numkeys; i++) {
+    make_pair (tinfo->tnum, i, tinfo->gen, tinfo->maxdsize, kstr, vstr);
+    key.data = kstr;
+    key.size = strlen(kstr) + 1;
+    res.data = recv;
+    res.size = MAX_LEN;
+
+    stat = (tinfo->dbp->get)(tinfo->dbp, &key, &res, 0);
+    if (stat != 0) {
+      fprintf (stderr, "thread %d cannot find key %s\n", tinfo->tnum, kstr);
+      tinfo->errors++;
+    }
+    else if (strcmp (vstr, (char *)res.data) != 0) {
+      fprintf (stderr, "Retriving data mismatch for key %s\n", kstr);
+      tinfo->errors++;
+    }
+  }
+  fprintf (stderr, "Done reader thread %d\n", tinfo->tnum);
+  return 0;
+}
+
+/**
+ * Batch reader running while the keys are replaced: every value must be
+ * either the old or the new one, never a mix of the two
+ */
+static void *mget_thread (void* arg)
+{
+  thread_info_t *tinfo = (thread_info_t *)arg;
+  char kstr[MGET_BATCH][MAX_LEN], vstr[MAX_LEN], nstr[MAX_LEN];
+  char recv[MGET_BATCH][MAX_LEN];
+  FFDB_DBT keys[MGET_BATCH], res[MGET_BATCH];
+  int stat[MGET_BATCH];
+  int i, k, n;
+
+  for (i = 0; i < tinfo->numkeys; i += n) {
+    n = (tinfo->numkeys - i < MGET_BATCH) ? tinfo->numkeys - i : MGET_BATCH;
+    for (k = 0; k < n; k++) {
+      make_pair (tinfo->tnum, i + k, 0, tinfo->maxdsize, kstr[k], vstr);
+      keys[k].data = kstr[k];
+      keys[k].size = strlen(kstr[k]) + 1;
+      res[k].data = recv[k];
+      res[k].size = MAX_LEN;
+    }
+
+    if (ffdb_mget (tinfo->dbp, keys, n, res, stat) == -1) {
+      fprintf (stderr, "thread %d batch get failed at key %s\n", 
+	       tinfo->tnum, kstr[0]);
+      tinfo->errors++;
+    }
+
+    for (k = 0; k < n; k++) {
+      make_pair (tinfo->tnum, i + k, 0, tinfo->maxdsize, kstr[k], vstr);
+      make_pair (tinfo->tnum, i + k, 1, tinfo->maxdsize, kstr[k], nstr);
+      if (stat[k] != 0) {
+	fprintf (stderr, "thread %d cannot batch get key %s\n", 
+		 tinfo->tnum, kstr[k]);
+	tinfo->errors++;
+      }
+      else if (strcmp (vstr, (char *)res[k].data) != 0 &&
+	       strcmp (nstr, (char *)res[k].data) != 0) {
+	fprintf (stderr, "Batch retriving data mismatch for key %s\n", kstr[k]);
+	tinfo->errors++;
+      }
+    }
+  }
+  fprintf (stderr, "Done batch reader thread %d\n", tinfo->tnum);
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  FFDB_DB	*dbp;
+  FFDB_HASHINFO ctl;
+  int  i, numthread, numkeys, maxdsize, bgsplit, errors;
+  char *dbase;
+  thread_info_t tinfo[MAX_THREADS], minfo[MAX_THREADS];
+  pthread_t tid[MAX_THREADS], mid[MAX_THREADS];
+  void* status;
+
+  if (argc < 6) {
+    fprintf (stderr, "Usage: %s bucketsize numthreads dbasename numkeys(per thread) maxdatasize [bgsplit]\n", argv[0]);
+    exit (1);
+  }
+
+  argv++;
+  ctl.hash = NULL;
+  ctl.cmp = NULL;
+  ctl.cachesize = 0;
+  ctl.bsize = atoi(*argv++);
+  ctl.nbuckets = 4;
+  ctl.rearrangepages = 0;
+  ctl.numconfigs = 0;
+  ctl.userinfolen = 1000;
+  numthread = atoi(*argv++);
+  dbase = *argv++;
+  numkeys = atoi(*argv++);
+  maxdsize = atoi(*argv++);
+  bgsplit = (argc > 6) ? atoi(*argv++) : 0;
+
+  if (numthread <= 0 || numthread > MAX_THREADS) {
+    fprintf (stderr, "Number of threads must be between 1 and %d\n", MAX_THREADS);
+    exit (1);
+  }
+
+  if (maxdsize <= 0 || maxdsize >= MAX_LEN) {
+    fprintf (stderr, "Data string size must be between 1 and %d\n", MAX_LEN - 1);
+    exit (1);
+  }
+
+  fprintf (stderr, "dbase = %s number thread = %d\n", dbase, numthread);
+  if (!(dbp = ffdb_dbopen(dbase, O_RDWR|O_CREAT|O_TRUNC, 0600, &ctl))) {
+    fprintf(stderr, "cannot create: hash table\n" );
+    exit(1);
+  }
+
+  /* buckets are split by a background thread instead of the writers */
+  if (bgsplit && ffdb_background_split (dbp) != 0) {
+    fprintf(stderr, "cannot start background split\n" );
+    exit(1);
+  }
+
+  /* Fireup writers */
+  for (i = 0; i < numthread; i++) {
+    tinfo[i].dbp = dbp;
+    tinfo[i].numkeys = numkeys;
+    tinfo[i].maxdsize = maxdsize;
+    tinfo[i].tnum = i;
+    tinfo[i].gen = 0;
+    tinfo[i].errors = 0;
+    pthread_create (&tid[i], 0, writer_thread, (void *)&tinfo[i]);
+  }
+  for (i = 0; i < numthread; i++)
+    pthread_join (tid[i], &status);
+
+  /* Replace every key while batch readers fetch the same keys */
+  for (i = 0; i < numthread; i++) {
+    minfo[i] = tinfo[i];
+    tinfo[i].gen = 1;
+    pthread_create (&tid[i], 0, writer_thread, (void *)&tinfo[i]);
+    pthread_create (&mid[i], 0, mget_thread, (void *)&minfo[i]);
+  }
+  for (i = 0; i < numthread; i++) {
+    pthread_join (tid[i], &status);
+    pthread_join (mid[i], &status);
+  }
+
+  /* Read everything back using the same number of threads */
+  for (i = 0; i < numthread; i++)
+    pthread_create (&tid[i], 0, reader_thread, (void *)&tinfo[i]);
+  for (i = 0; i < numthread; i++)
+    pthread_join (tid[i], &status);
+
+  errors = 0;
+  for (i = 0; i < numthread; i++)
+    errors += tinfo[i].errors + minfo[i].errors;
+
+  dbp->close (dbp);
+
+  if (errors) {
+    fprintf (stderr, "%d errors found\n", errors);
+    return 1;
+  }
+  return 0;
+}
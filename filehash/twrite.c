@@ -95,6 +95,7 @@ int main(int argc, char** argv)
   FFDB_DBT item, key;
   FFDB_DB	*dbp;
   FFDB_HASHINFO ctl;
+  int compact;
   char *dbase;
   char kstr[MAX_LEN], vstr[MAX_LEN];
 
@@ -111,7 +112,8 @@ int main(int argc, char** argv)
   ctl.cachesize = 0;
   ctl.bsize = atoi(*argv++);
   ctl.nbuckets = atoi(*argv++);
-  ctl.rearrangepages = atoi(*argv++);
+  compact = atoi(*argv++);
+  ctl.rearrangepages = 0;
   ctl.numconfigs = 100;
   ctl.userinfolen = 100000;
   dbase = *argv++;
@@ -181,6 +183,12 @@ int main(int argc, char** argv)
   
   (dbp->close)(dbp);
 
+  /* moving pages to save space is a separate step after close */
+  if (compact && ffdb_compact (dbase, &ctl) != 0) {
+    fprintf (stderr, "cannot compact %s\n", dbase);
+    exit(1);
+  }
+
   fprintf (stderr, "We put %d item in the database %s\n", i, dbase);
 
   exit(0);
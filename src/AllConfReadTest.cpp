@@ -46,7 +46,7 @@ main (int argc, char** argv)
 {
   char keystr[80], datastr[128];
   if (argc < 5) {
-    cerr << "Usage: " << argv[0] << " cachesize numconfigs rearrange(0|1) dbasename " << endl;
+    cerr << "Usage: " << argv[0] << " cachesize numconfigs rearrange(0|1) dbasename [keydirfile]" << endl;
     return -1;
   }
   
@@ -61,6 +61,8 @@ main (int argc, char** argv)
   dbtest.setCacheSize (cachesize);
   if  (rearrange)
     dbtest.enablePageMove ();
+  if (argc > 5)
+    dbtest.enableKeyDirectory (argv[5]);
 
   if (dbtest.open (dbase, O_RDONLY, 0400) != 0) {
     cerr << "cannot open database " << dbase << endl;
@@ -111,6 +113,89 @@ main (int argc, char** argv)
     }
   }
 
+  // Read all keys back again in one batch
+  vector<StringKey> keys;
+  for (int i = 0; i < NUM_KEYS; i++) {
+    ::sprintf (keystr, "Key Test Loop %d", i);
+    keys.push_back (StringKey(keystr));
+  }
+  vector< vector<UserData> > batchv;
+  vector<bool> found;
+  if (dbtest.get (keys, batchv, found) != 0) {
+    cerr << "Cannot get vector data in a batch" << endl;
+    dbtest.close ();
+    return -1;
+  }
+  for (int i = 0; i < NUM_KEYS; i++) {
+    vector<UserData> rdatav;
+    if (!found[i] || dbtest.get (keys[i], rdatav) != 0 ||
+	rdatav.size() != batchv[i].size()) {
+      cerr << "Batch retrieved data is wrong at loop " << i << endl;
+      dbtest.close ();
+      return -1;
+    }
+    for (unsigned int k = 0; k < rdatav.size(); k++) {
+      if (rdatav[k] != batchv[i][k]) {
+	cerr << "Batch retrieved data is wrong at " << k << " element loop " << i << endl;
+	dbtest.close ();
+	return -1;
+      }
+    }
+
+    // Read single configurations by range
+    for (unsigned int k = 0; k < rdatav.size(); k += 7) {
+      UserData cdata;
+      if (dbtest.getConfig (keys[i], k, cdata) != 0 || rdatav[k] != cdata) {
+	cerr << "Configuration " << k << " retrieved by range is wrong at loop " << i << endl;
+	dbtest.close ();
+	return -1;
+      }
+    }
+  }
+
+  // Walk all keys by an iterator and get all keys at once
+  int nkeys = 0;
+  for (AllConfStoreDB<StringKey, UserData>::key_iterator it = dbtest.begin();
+       it != dbtest.end(); ++it)
+    nkeys++;
+  vector<StringKey> ikeys;
+  dbtest.keys (ikeys);
+  if (nkeys != NUM_KEYS || ikeys.size() != (std::size_t)NUM_KEYS) {
+    cerr << "Key iterator visited " << nkeys << " keys and " << ikeys.size() 
+	 << " keys retrieved instead of " << NUM_KEYS << endl;
+    dbtest.close ();
+    return -1;
+  }
+
+  // Dump all pairs in the order of data pages, then by parallel threads
+  for (unsigned int nthreads = 1; nthreads <= 4; nthreads += 3) {
+    vector<StringKey> allkeys;
+    vector< vector<UserData> > allvals;
+    dbtest.setScanThreads (nthreads);
+    dbtest.keysAndData (allkeys, allvals);
+    if (allkeys.size() != (std::size_t)NUM_KEYS || allvals.size() != allkeys.size()) {
+      cerr << "Dumped " << allkeys.size() << " pairs instead of " << NUM_KEYS 
+	   << " by " << nthreads << " threads" << endl;
+      dbtest.close ();
+      return -1;
+    }
+    for (std::size_t i = 0; i < allkeys.size(); i++) {
+      vector<UserData> rdatav;
+      if (dbtest.get (allkeys[i], rdatav) != 0 || rdatav.size() != allvals[i].size()) {
+	cerr << "Dumped pair is wrong at " << i << endl;
+	dbtest.close ();
+	return -1;
+      }
+      for (unsigned int k = 0; k < rdatav.size(); k++) {
+	if (rdatav[k] != allvals[i][k]) {
+	  cerr << "Dumped data is wrong at " << k << " element pair " << i << endl;
+	  dbtest.close ();
+	  return -1;
+	}
+      }
+    }
+  }
+
   dbtest.close ();
 
   return 0;
@@ -109,6 +109,81 @@ namespace FILEDB
       }
       return ret;
     }
+
+    /**
+     * Split a data blob of all configurations into a vector
+     */
+    template <typename D0>
+    int unpack (const std::string& cdata, std::vector< D0 >& vs)
+    {
+      // this the first time I am calling this get
+      if (cdata.size() % nbin_ != 0) {
+	std::cerr << "Retrieved data size " << cdata.size() << " is not multiple of number of configurations " << nbin_ << std::endl;
+	return -1;
+      }
+      if (bytesize_ == 0) 
+	bytesize_ = cdata.size()/nbin_;
+
+      if ((std::size_t)bytesize_ != cdata.size()/nbin_) {
+	std::cerr << "Previous byte size " << bytesize_ << " is not the same as the current one " << cdata.size()/nbin_ << std::endl;
+	return -1;
+      }
+
+      // now split this data blob into a vector
+      const char *rdata = cdata.data();
+      for (std::size_t i = 0; i < cdata.length(); i += bytesize_) {
+	D0 elem;
+	std::string tmp;
+	tmp.assign (&rdata[i], bytesize_);
+	try {
+	  elem.readObject(tmp);
+	}
+	catch (SerializeException& e) {
+	  std::cerr << "Serialize individual element error: " << e.what () << std::endl;
+	  return -1;
+	}
+	// add to array
+	vs.push_back (elem);
+      }
+
+      return 0;
+    }
+
+    /**
+     * Split a data blob of all configurations into a vector without
+     * changing any member, so that scanning threads can share it
+     */
+    template <typename D0>
+    void splitConfigs (const std::string& cdata, std::vector< D0 >& vs) const
+    {
+      if (cdata.length() % nbin_ != 0) {
+	std::cerr << "Data element size " << cdata.length() << " is not multiple of number of configuration " << nbin_ << std::endl;
+	abort ();
+      }
+
+      long bsize = cdata.length()/nbin_;
+      if (bytesize_ != 0 && bsize != bytesize_) {
+	std::cerr << "Individual element size " << bsize << " != expected " << bytesize_ << std::endl;
+	abort ();
+      }
+
+      const char *rdata = cdata.data();
+      vs.reserve (nbin_);
+      for (std::size_t k = 0; k < cdata.length(); k += bsize) {
+	D0 elem;
+	std::string tmp;
+	tmp.assign (&rdata[k], bsize);
+	try {
+	  elem.readObject(tmp);
+	}
+	catch (SerializeException &e) {
+	  std::cerr << "Serialize individual element error: " << e.what() << std::endl;
+	  abort ();
+	}
+	// insert into the individual vector
+	vs.push_back (elem);
+      }
+    }
    
   public:
 
@@ -251,39 +326,107 @@ namespace FILEDB
 	return ret;
       }
 
-      // this the first time I am calling this get
-      if (cdata.size() % nbin_ != 0) {
-	std::cerr << "Retrieved data size " << cdata.size() << " is not multiple of number of configurations " << nbin_ << std::endl;
+      return unpack<D0> (cdata, vs);
+    }
+
+
+   /**
+     * Return data of a single configuration corresponding to a key.
+     * Only the bytes of this configuration are read from the database
+     * @param key a key
+     * @param index index of the configuration
+     * @param data data of the configuration
+     * @return 0 when there are something for this key. 1 when there are no
+     */
+    template <typename K0 = K, typename D0 = D>
+    int getConfig (const K0& key, int index, D0& data)
+    {
+      int ret;
+      long datalen;
+      std::string cdata;
+
+      if (index < 0 || index >= nbin_) {
+	std::cerr << "Configuration index " << index << " is out of range [0, " << nbin_ << ")" << std::endl;
 	return -1;
       }
-      if (bytesize_ == 0) 
-	bytesize_ = cdata.size()/nbin_;
 
-      if ((std::size_t)bytesize_ != cdata.size()/nbin_) {
-	std::cerr << "Previous byte size " << bytesize_ << " is not the same as the current one " << cdata.size()/nbin_ << std::endl;
+      try {
+	// learn the element size from the data length first
+	if (bytesize_ == 0) {
+	  ret = getDataRange <K0> (this->db->dbh_, key, 0, 0, cdata, datalen);
+	  if (ret != 0)
+	    return ret;
+	  if (datalen % nbin_ != 0) {
+	    std::cerr << "Retrieved data size " << datalen << " is not multiple of number of configurations " << nbin_ << std::endl;
+	    return -1;
+	  }
+	  bytesize_ = datalen/nbin_;
+	}
+
+	ret = getDataRange <K0> (this->db->dbh_, key, index * bytesize_,
+				 bytesize_, cdata, datalen);
+      }
+      catch (SerializeException& e) {
+	std::cerr << "Retrieve record number information error : " << e.what () << std::endl;
 	return -1;
       }
 
-      // now split this data blob into a vector
-      char *rdata = (char *)&cdata[0];
-      for (std::size_t i = 0; i < cdata.length(); i += bytesize_) {
-	D0 elem;
-	std::string tmp;
-	tmp.assign (&rdata[i], bytesize_);
-	try {
-	  elem.readObject(tmp);
-	}
-	catch (SerializeException& e) {
-	  std::cerr << "Serialize individual element error: " << e.what () << std::endl;
-	  return -1;
-	}
-	// add to array
-	vs.push_back (elem);
+      if (ret != 0)
+	return ret;
+
+      if (datalen != bytesize_ * nbin_) {
+	std::cerr << "Previous byte size " << bytesize_ << " is not the same as the current one " << datalen/nbin_ << std::endl;
+	return -1;
       }
 
+      try {
+	data.readObject (cdata);
+      }
+      catch (SerializeException& e) {
+	std::cerr << "Serialize individual element error: " << e.what () << std::endl;
+	return -1;
+      }
       return 0;
     }
 
+   /**
+     * Return vectors of data corresponding to a batch of keys
+     * @param keys keys to look up
+     * @param vs after the call vs[i] holds the ensemble for keys[i]
+     * @param found after the call found[i] is true if keys[i] is found
+     * @return 0 when all keys are found. 1 when some keys are not found.
+     * Otherwise failure
+     */
+    template <typename K0 = K, typename D0 = D>
+    int get (const std::vector<K0>& keys, std::vector< std::vector< D0 > >& vs,
+	     std::vector<bool>& found)
+    {
+      int ret;
+      std::vector<std::string> cdata;
+      std::vector<int> status;
+
+      // get all records in one batch
+      try {
+	ret = getDataBatch <K0> (this->db->dbh_, keys, cdata, status);
+      }
+      catch (SerializeException& e) {
+	std::cerr << "Retrieve record number information error : " << e.what () << std::endl;
+	return -1;
+      }
+
+      vs.assign (keys.size(), std::vector< D0 >());
+      found.assign (keys.size(), false);
+      for (std::size_t i = 0; i < keys.size(); i++) {
+	if (status[i] != 0)
+	  continue;
+	if (unpack<D0> (cdata[i], vs[i]) != 0)
+	  return -1;
+	found[i] = true;
+      }
+
+      return ret;
+    }
+
 
    /**
      * Return a vector of complex numbers corresponding to a key
@@ -542,34 +685,29 @@ namespace FILEDB
 	ret = this->insert (key, thr);
       }
       else {
-	// first find out where this record is going to be located
-	std::string cdata;
-	
-	try {
-	  ret = getData<K, std::string> (this->db->dbh_, key, cdata);
-	}
-	catch (SerializeException& e) {
-	  std::cerr << "Get data error for update " << e.what () << std::endl;
-	  return -1;
-	}
-      
-	if (ret != 0) {
-	  std::cerr << "Fatal in update: this key is not found here " << std::endl;
-	  return -1;
-	}
-	
+	// only the slice of this configuration is written in place
+	if (bytesize_ == 0) {
+	  std::string cdata;
+	  long datalen;
 
-	if (cdata.size() % nbin_ != 0) {
-	  std::cerr << "Retreived data size " << cdata.size() << " is not multiple of number of configurations " << nbin_ << std::endl;
-	  return -1;
-	}
-	// this the first time I am calling this get
-	if (bytesize_ == 0) 
-	  bytesize_ = cdata.size()/nbin_;
+	  try {
+	    ret = getDataRange<K> (this->db->dbh_, key, 0, 0, cdata, datalen);
+	  }
+	  catch (SerializeException& e) {
+	    std::cerr << "Get data error for update " << e.what () << std::endl;
+	    return -1;
+	  }
 
-	if ((std::size_t)bytesize_ != cdata.size()/nbin_) {
-	  std::cerr << "Previous byte size " << bytesize_ << " is not the same as the current one " << cdata.size()/nbin_ << std::endl;
-	  return -1;
+	  if (ret != 0) {
+	    std::cerr << "Fatal in update: this key is not found here " << std::endl;
+	    return -1;
+	  }
+
+	  if (datalen % nbin_ != 0) {
+	    std::cerr << "Retreived data size " << datalen << " is not multiple of number of configurations " << nbin_ << std::endl;
+	    return -1;
+	  }
+	  bytesize_ = datalen/nbin_;
 	}
 
 	// convert the value into string
@@ -586,19 +724,20 @@ namespace FILEDB
 	  return -1;
 	}
 
-	// Now update the content of this string
-	char *rdata = (char *)&cdata[0];
-	::memcpy (&rdata[index*bytesize_], &tmp[0], bytesize_);
-
-	// Now insert this one into the database again
+	// Now overwrite the content of this configuration
 	try {
-	  ret = insertData< K > (this->db->dbh_, key, cdata);
+	  ret = putDataRange< K > (this->db->dbh_, key, index*bytesize_, tmp);
 	}
 	catch (SerializeException& e) {
 	  std::cerr << "Update single item error: " << e.what() << std::endl;
 	  ret = -1;
 	}
 
+	if (ret == FFDB_NOT_FOUND) {
+	  std::cerr << "Fatal in update: this key is not found here " << std::endl;
+	  return -1;
+	}
+
 	return ret;
       }
 
@@ -613,44 +752,27 @@ namespace FILEDB
     void stringKeysAndData (std::vector<std::string>& keys, 
 		            std::vector< std::vector <D> >& values)
     {
+      if (this->db->dbh_ && this->db->scan_threads_ > 1) {
+	// every scanning thread converts its own values
+	parallelAllPairs (this->db->dbh_, keys, values, this->db->scan_threads_,
+			  [] (const std::string& s, std::string& k) {k = s;},
+			  [this] (const std::string& s, std::vector<D>& vals) {
+			    this->splitConfigs (s, vals);
+			  });
+	return;
+      }
+
       std::vector<std::string> bvalues;
 
       this->binaryKeysAndData (keys, bvalues);
 
       // walk through each vector of string convert it into vector of D
       for (std::size_t i = 0; i < bvalues.size(); i++) {
-	if (bvalues[i].length() % nbin_ != 0) {
-	  std::cerr << "Data element size " << bvalues[i].length() << " is not multiple of number of configuration " << nbin_ << std::endl;
-	  abort ();
-	}
-
-	// this is the beginning of the string buffer
-	char* dbuf = (char *)&bvalues[i][0];
 	std::vector<D> vals;
-	long bsize = bvalues[i].length()/nbin_;
-	if (bytesize_ == 0)
-	  bytesize_ = bsize;
-	
-	if (bsize != bytesize_) {
-	  std::cerr << "Individual element size " << bsize << " != expected " << bytesize_ << std::endl;
-	  abort ();
-	}
- 
-        vals.reserve(bvalues[i].length()/bsize);
-	for (std::size_t k = 0; k < bvalues[i].length(); k += bsize) {
-	  D elem;
-	  std::string tmp;
-	  tmp.assign (&dbuf[k], bsize);
-	  try {
-	    elem.readObject(tmp);
-	  }
-	  catch (SerializeException &e) {
-	    std::cerr << "Serialize individual element error: " << e.what() << std::endl;
-	    abort ();
-	  }
-	  // insert into the individual vector
-	  vals.push_back (elem);
-	}
+	if (bytesize_ == 0 && nbin_ > 0)
+	  bytesize_ = bvalues[i].length()/nbin_;
+
+	splitConfigs (bvalues[i], vals);
 	
 	// add this vector into the big vector
 	values.push_back (vals);
@@ -668,6 +790,24 @@ namespace FILEDB
     template <typename K0 = K, typename D0 = D>
     void keysAndData(std::vector<K0>& keys, std::vector<std::vector<D0>>& values)
     {
+      if (this->db->dbh_ && this->db->scan_threads_ > 1) {
+	// keys and values are converted by the scanning threads
+	parallelAllPairs (this->db->dbh_, keys, values, this->db->scan_threads_,
+			  [] (const std::string& s, K0& k) {
+			    try {
+			      k.readObject (s);
+			    }
+			    catch (SerializeException& e) {
+			      std::cerr << "Serialize individual key error: " << e.what() << std::endl;
+			      abort ();
+			    }
+			  },
+			  [this] (const std::string& s, std::vector<D0>& vals) {
+			    this->splitConfigs (s, vals);
+			  });
+	return;
+      }
+
       std::vector<std::string> binkeys;
 
       this->stringKeysAndData(binkeys, values);
@@ -57,12 +57,18 @@ namespace FILEDB
     // The array of DBs
     std::vector< AllConfStoreDB<K,D> > dbs_;
 
+    // keep a key filter of every DB
+    bool filter_;
+
+    // suffix of key filter side files appended to DB file names
+    std::string filter_suffix_;
+
   public:
 
     /**
      * Empty constructor for a data store for multiple DBs
      */
-    AllConfStoreMultipleDB (void) {}
+    AllConfStoreMultipleDB (void) : filter_(false) {}
 
     /**
      * Destructor
@@ -95,6 +101,21 @@ namespace FILEDB
     }
 
 
+    /**
+     * Keep a bloom filter of keys of every DB, so that a lookup skips
+     * the DBs which cannot hold the key without reading their pages
+     *
+     * This should be called before the open is called
+     * @param suffix appended to a DB file name to get its filter side file.
+     * No side file is used if the suffix is empty
+     */
+    virtual void enableKeyFilter (const std::string& suffix = std::string())
+    {
+      filter_ = true;
+      filter_suffix_ = suffix;
+    }
+
+
     /**
      * Check if a DB file exists before opening.
      */
@@ -116,6 +137,9 @@ namespace FILEDB
      * Open
      * @param files filenames holding all data and keys
      *
+     * All databases are opened read only, so reader threads share
+     * cached pages without blocking each other.
+     *
      * @return 0 on success, -1 on failure with proper errno set
      * 
      */
@@ -126,6 +150,8 @@ namespace FILEDB
       int ret = 0;
       for(int i=0; i < dbs_.size(); ++i)
       {
+	if (filter_)
+	  dbs_[i].enableKeyFilter(filter_suffix_.empty() ? std::string() : files[i] + filter_suffix_);
 	ret = dbs_[i].open(files[i], O_RDONLY, 0400);
 	if (ret != 0)
 	  return ret;
@@ -166,8 +192,12 @@ namespace FILEDB
       int ret = -1;
 
       try {
+	std::string keyObj;
+	key.writeObject (keyObj);
 	for(int i=0; i < dbs_.size(); ++i) 
 	{
+	  if (!dbs_[i].mayContain(keyObj))
+	    continue;
 	  ret = dbs_[i].get(key, vs);
 	  if (ret == 0)
 	    break;
@@ -191,8 +221,12 @@ namespace FILEDB
       bool ret = false;
       
       try {
+	std::string keyObj;
+	key.writeObject (keyObj);
 	for(int i=0; i < dbs_.size(); ++i)
 	{
+	  if (!dbs_[i].mayContain(keyObj))
+	    continue;
 	  ret = dbs_[i].exist(key);
 	  if (ret)
 	    break;
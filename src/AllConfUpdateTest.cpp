@@ -105,6 +105,15 @@ main (int argc, char** argv)
       dbtest.close ();
       return -1;
     }
+
+    // read back: the whole data checksum is verified by get
+    vector<UserData> rdatav;
+    if (dbtest.get (key, rdatav) != 0 || rdatav.size() != numconfigs ||
+	rdatav[4] != rep) {
+      cerr << "Updated data is wrong at " << i << endl;
+      dbtest.close ();
+      return -1;
+    }
     delete []datav;
   }
 
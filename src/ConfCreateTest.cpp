@@ -50,7 +50,7 @@ int
 main (int argc, char** argv)
 {
   if (argc < 6) {
-    cerr << "Usage: " << argv[0] << " pagesize numpages rearrange(0|1) dbasename stringfile" << endl;
+    cerr << "Usage: " << argv[0] << " pagesize numpages rearrange(0|1) dbasename stringfile [batchsize]" << endl;
     return -1;
   }
   
@@ -59,6 +59,9 @@ main (int argc, char** argv)
   int rearrange = atoi (argv[3]);
   std::string dbase (argv[4]);
   std::string strfile(argv[5]);
+  unsigned int batchsize = 1;
+  if (argc > 6)
+    batchsize = atoi (argv[6]);
 
   // open string file stream
   ifstream sf(argv[5]);
@@ -93,6 +96,8 @@ main (int argc, char** argv)
     return -1;
   }
 
+  vector<StringKey> keys;
+  vector<UserData> values;
   while (sf.good()) {
     string t1, t2;
 
@@ -102,7 +107,21 @@ main (int argc, char** argv)
     StringKey key(t1);
     UserData  data(t2);
 
-    if (dbtest.insert(key, data) != 0) {
+    if (batchsize > 1) {
+      keys.push_back (key);
+      values.push_back (data);
+      if (keys.size() < batchsize && sf.good())
+	continue;
+      if (dbtest.insert(keys, values) != 0) {
+	cerr << "Insert data batch error " << endl;
+	sf.close ();
+	dbtest.close ();
+	return -1;
+      }
+      keys.clear ();
+      values.clear ();
+    }
+    else if (dbtest.insert(key, data) != 0) {
       cerr << "Insert data error " << endl;
       sf.close ();
       dbtest.close ();
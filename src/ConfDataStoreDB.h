@@ -95,8 +95,34 @@ namespace FILEDB
       // opened database handle
       FFDB_DB *dbh_;
 
+      // number of threads scanning all keys and data
+      unsigned int scan_threads_;
+
+      // build an in memory key directory on a read only open
+      bool keydir_;
+
+      // side file holding the key directory
+      std::string keydir_file_;
+
+      // keep a bloom filter of all keys
+      bool filter_;
+
+      // side file holding the key filter
+      std::string filter_file_;
+
+      // split buckets in a background thread
+      bool bgsplit_;
+
+      // database is opened for writing
+      bool writable_;
+
       DB() {
         dbh_ = nullptr;
+        scan_threads_ = 1;
+        keydir_ = false;
+        filter_ = false;
+        bgsplit_ = false;
+        writable_ = false;
 
         ::memset(&options_, 0, sizeof(FFDB_HASHINFO));
         options_.bsize = FILEDB_DEFAULT_PAGESIZE;
@@ -113,6 +139,20 @@ namespace FILEDB
         if (!dbh_)
           return -1;
         filename_ = file;
+        writable_ = (open_flags & O_ACCMODE) != O_RDONLY;
+        // lookups still work without the directory
+        if (keydir_ && (open_flags & O_ACCMODE) == O_RDONLY &&
+            ffdb_keydir_open(dbh_, keydir_file_.empty() ? nullptr : keydir_file_.c_str(),
+                             scan_threads_) != 0)
+          std::cerr << "Cannot build key directory for " << file << std::endl;
+        if (filter_ &&
+            ffdb_filter_open(dbh_, filter_file_.empty() ? nullptr : filter_file_.c_str(),
+                             scan_threads_) != 0)
+          std::cerr << "Cannot build key filter for " << file << std::endl;
+        // inserts still split buckets themselves
+        if (bgsplit_ && (open_flags & O_ACCMODE) != O_RDONLY &&
+            ffdb_background_split(dbh_) != 0)
+          std::cerr << "Cannot start background split for " << file << std::endl;
         return 0;
       }
 
@@ -220,19 +260,139 @@ namespace FILEDB
 
 
     /**
-     * Set whether to move pages when close to save disk space
-     *
-     * This only effective on writable database
-     *
+     * Pages are no longer moved when a database is closed. These calls
+     * are kept for existing code and do nothing: call compact on the
+     * closed database to save disk space
      */
     virtual void enablePageMove (void)
     {
-      db->options_.rearrangepages = 1;
     }
 
     virtual void disablePageMove (void)
     {
-      db->options_.rearrangepages = 0;
+    }
+
+    /**
+     * Move pages into unused bucket pages and truncate the file to save
+     * disk space. The database must not be open anywhere. This takes
+     * time proportional to the number of pages moved, and the first open
+     * for write afterwards moves the pages back
+     *
+     * @param file filename holding all data and keys
+     *
+     * @return 0 on success, -1 on failure with proper errno set
+     */
+    virtual int compact (const std::string& file)
+    {
+      return ffdb_compact(file.c_str(), &db->options_);
+    }
+
+    /**
+     * Read only the header of an existing database on open
+     *
+     * User and configuration information are read on first use, and
+     * a writer finds its free and data pages on the first insert.
+     * A file whose pages were moved cannot be opened lazily for write.
+     * This should be called before the open is called
+     */
+    virtual void enableLazyOpen (void)
+    {
+      db->options_.openmode = FFDB_OPEN_LAZY;
+      db->options_.rearrangepages |= FFDB_INFO_OPENMODE;
+    }
+
+    virtual void disableLazyOpen (void)
+    {
+      db->options_.openmode = FFDB_OPEN_DEFAULT;
+      db->options_.rearrangepages |= FFDB_INFO_OPENMODE;
+    }
+
+    /**
+     * How many bytes of consecutive data pages are read or written at once
+     *
+     * Large data stored in a row of pages are moved in units of this size.
+     * This should be called before the open is called
+     * @param size number of bytes (0 selects the default of 256 KB)
+     */
+    virtual void setDataExtentSize (const unsigned int size)
+    {
+      db->options_.dextsize = size;
+      db->options_.rearrangepages |= FFDB_INFO_DEXTSIZE;
+    }
+
+    /**
+     * Set and get number of threads scanning all keys and data
+     *
+     * With more than one thread, every thread walks its own range of
+     * buckets and converts its own keys and data. The pairs are then
+     * returned in bucket order instead of the order of data pages.
+     */
+    virtual void setScanThreads (unsigned int num)
+    {
+      db->scan_threads_ = (num > 0) ? num : 1;
+    }
+
+    virtual unsigned int getScanThreads (void) const
+    {
+      return db->scan_threads_;
+    }
+
+    /**
+     * Keep a directory of all keys in memory on a read only open
+     *
+     * A lookup then reads the data page of a key directly. The directory
+     * is built by getScanThreads threads. If a side file is given, it is
+     * loaded from the file when the file matches the database, and saved
+     * into the file otherwise. This should be called before the open is called
+     */
+    virtual void enableKeyDirectory (const std::string& sidefile = std::string())
+    {
+      db->keydir_ = true;
+      db->keydir_file_ = sidefile;
+    }
+
+    virtual void disableKeyDirectory (void)
+    {
+      db->keydir_ = false;
+      db->keydir_file_.clear();
+    }
+
+    /**
+     * Keep a bloom filter of all keys in memory
+     *
+     * A lookup of a key not in the filter fails without reading any page.
+     * The filter is built by getScanThreads threads and updated by inserts.
+     * If a side file is given, it is loaded from the file when the file
+     * matches the database, and saved into the file on close.
+     * This should be called before the open is called
+     */
+    virtual void enableKeyFilter (const std::string& sidefile = std::string())
+    {
+      db->filter_ = true;
+      db->filter_file_ = sidefile;
+    }
+
+    virtual void disableKeyFilter (void)
+    {
+      db->filter_ = false;
+      db->filter_file_.clear();
+    }
+
+    /**
+     * Split buckets in a background thread on a writable open
+     *
+     * An insert filling up a bucket then only chains an overflow page
+     * and leaves the split to the thread.
+     * This should be called before the open is called
+     */
+    virtual void enableBackgroundSplit (void)
+    {
+      db->bgsplit_ = true;
+    }
+
+    virtual void disableBackgroundSplit (void)
+    {
+      db->bgsplit_ = false;
     }
 
     /**
@@ -323,6 +483,30 @@ namespace FILEDB
       return ret;
     }
 
+    /**
+     * Insert a batch of key and data pairs into the database
+     * @param keys user provided keys
+     * @param data user provided data for each key
+     *
+     * @return 0 on successful write, -1 on failure with proper errno set
+     */
+    int insert (const std::vector<K>& keys, const std::vector<D>& data)
+    {
+      if (!db->dbh_)
+        return -1;
+
+      int ret = 0;
+
+      try {
+	ret = insertDataBatch<K, D>(db->dbh_, keys, data);
+      }
+      catch (SerializeException& e) {
+	std::cerr << "ConfDataStoreDB batch insert error: " << e.what() << std::endl;
+	ret = -1;
+      }
+      return ret;
+    }
+
     /**
      * Insert a pair of data and key into the database
      * data is not ensemble, but a vector of complex.
@@ -397,6 +581,72 @@ namespace FILEDB
     }
 
 
+    /**
+     * Get data for a batch of keys
+     * @param keys user supplied keys
+     * @param data after the call data[i] will be populated for keys[i]
+     * @param found after the call found[i] is true if keys[i] is found
+     * @return 0 when all keys are found, 1 when some keys are not found,
+     * otherwise failure
+     */
+    int get (const std::vector<K>& keys, std::vector<D>& data,
+	     std::vector<bool>& found)
+    {
+      if (!db->dbh_)
+        return -1;
+
+      int ret = 0;
+      std::vector<std::string> bins;
+      std::vector<int> status;
+
+      try {
+	ret = getDataBatch<K>(db->dbh_, keys, bins, status);
+
+	data.resize (keys.size());
+	found.assign (keys.size(), false);
+	for (std::size_t i = 0; i < keys.size(); i++) {
+	  if (status[i] == 0) {
+	    data[i].readObject (bins[i]);
+	    found[i] = true;
+	  }
+	}
+      }
+      catch (SerializeException& e) {
+	std::cerr << "ConfDataStoreDB batch get error: " << e.what () << std::endl;
+	ret = -1;
+      }
+      return ret;
+    }
+
+
+    /**
+     * Get a read only view of data for a given key. When the database
+     * is opened read only, the view points into the page cache and no
+     * data is copied. The view has to be released before closing
+     *
+     * @param key user supplied key
+     * @param view after the call view holds data in binary form
+     * @return 0 on success, otherwise the key not found
+     */
+    int getView (const K& key, DBView& view)
+    {
+      if (!db->dbh_)
+        return -1;
+
+      int ret = 0;
+
+      try {
+	std::string keyObj;
+	key.writeObject (keyObj);
+	ret = view.get (db->dbh_, keyObj);
+      }
+      catch (SerializeException& e) {
+	std::cerr << "ConfDataStoreDB getView error: " << e.what () << std::endl;
+	ret = -1;
+      }
+      return ret;
+    }
+
     /**
      * Get data for a given key in binary form
      *
@@ -412,6 +662,21 @@ namespace FILEDB
       return getBinaryData (db->dbh_, key, data);
     }
 
+    /**
+     * Whether a key in binary form may be in the store without reading
+     * any page. Always true without a key filter
+     */
+    bool mayContain (const std::string& key) const
+    {
+      if (!db->dbh_)
+        return false;
+
+      FFDB_DBT dbkey;
+      dbkey.data = const_cast<char *>(key.data());
+      dbkey.size = key.size();
+      return ffdb_key_may_exist (db->dbh_, &dbkey) != 0;
+    }
+
     /**
      * Does this key exist in the store
      * @param key a key object
@@ -463,7 +728,11 @@ namespace FILEDB
      */
     virtual void keysAndData (std::vector<K>& keys, std::vector<D>& values)
     {
-      if (db->dbh_)
+      if (db->dbh_ && db->scan_threads_ > 1)
+        parallelAllPairs (db->dbh_, keys, values, db->scan_threads_,
+			  [] (const std::string& s, K& k) {k.readObject (s);},
+			  [] (const std::string& s, D& d) {d.readObject (s);});
+      else if (db->dbh_)
         allPairs<K, D>(db->dbh_, keys, values);
     }
 
@@ -490,7 +759,11 @@ namespace FILEDB
 
     virtual void stringKeysAndData(std::vector<std::string>& keys, std::vector<D>& values)
     {
-      if (db->dbh_)
+      if (db->dbh_ && db->scan_threads_ > 1)
+        parallelAllPairs (db->dbh_, keys, values, db->scan_threads_,
+			  [] (const std::string& s, std::string& k) {k = s;},
+			  [] (const std::string& s, D& d) {d.readObject (s);});
+      else if (db->dbh_)
         allPairsWithBinaryKeys<D>(db->dbh_, keys, values);
     }
 
@@ -503,7 +776,11 @@ namespace FILEDB
     virtual void binaryKeysAndData (std::vector<std::string>& keys,
 				    std::vector<std::string>& values)
     {
-      if (db->dbh_)
+      if (db->dbh_ && db->scan_threads_ > 1)
+        parallelAllPairs (db->dbh_, keys, values, db->scan_threads_,
+			  [] (const std::string& s, std::string& k) {k = s;},
+			  [] (const std::string& s, std::string& d) {d = s;});
+      else if (db->dbh_)
         binaryAllPairs(db->dbh_, keys, values);
     }
 
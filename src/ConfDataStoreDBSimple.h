@@ -94,8 +94,12 @@ namespace FILEDB
       // opened database handle
       FFDB_DB *dbh_;
 
+      // database is opened for writing
+      bool writable_;
+
       DB() {
         dbh_ = nullptr;
+        writable_ = false;
 
         ::memset(&options_, 0, sizeof(FFDB_HASHINFO));
         options_.bsize = FILEDB_DEFAULT_PAGESIZE;
@@ -111,6 +115,7 @@ namespace FILEDB
 	if (!dbh_)
 	  return -1;
 	filename_ = file;
+        writable_ = (open_flags & O_ACCMODE) != O_RDONLY;
         return 0;
       }
 
@@ -218,19 +223,64 @@ namespace FILEDB
 
 
     /**
-     * Set whether to move pages when close to save disk space
-     *
-     * This only effective on writable database
-     *
+     * Pages are no longer moved when a database is closed. These calls
+     * are kept for existing code and do nothing: call compact on the
+     * closed database to save disk space
      */
     void enablePageMove (void)
     {
-      db->options_.rearrangepages = 1;
     }
 
     void disablePageMove (void)
     {
-      db->options_.rearrangepages = 0;
+    }
+
+    /**
+     * Move pages into unused bucket pages and truncate the file to save
+     * disk space. The database must not be open anywhere. This takes
+     * time proportional to the number of pages moved, and the first open
+     * for write afterwards moves the pages back
+     *
+     * @param file filename holding all data and keys
+     *
+     * @return 0 on success, -1 on failure with proper errno set
+     */
+    int compact (const std::string& file)
+    {
+      return ffdb_compact(file.c_str(), &db->options_);
+    }
+
+    /**
+     * Read only the header of an existing database on open
+     *
+     * User and configuration information are read on first use, and
+     * a writer finds its free and data pages on the first insert.
+     * A file whose pages were moved cannot be opened lazily for write.
+     * This should be called before the open is called
+     */
+    void enableLazyOpen (void)
+    {
+      db->options_.openmode = FFDB_OPEN_LAZY;
+      db->options_.rearrangepages |= FFDB_INFO_OPENMODE;
+    }
+
+    void disableLazyOpen (void)
+    {
+      db->options_.openmode = FFDB_OPEN_DEFAULT;
+      db->options_.rearrangepages |= FFDB_INFO_OPENMODE;
+    }
+
+    /**
+     * How many bytes of consecutive data pages are read or written at once
+     *
+     * Large data stored in a row of pages are moved in units of this size.
+     * This should be called before the open is called
+     * @param size number of bytes (0 selects the default of 256 KB)
+     */
+    void setDataExtentSize (const unsigned int size)
+    {
+      db->options_.dextsize = size;
+      db->options_.rearrangepages |= FFDB_INFO_DEXTSIZE;
     }
 
     /**
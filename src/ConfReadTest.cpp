@@ -104,6 +104,23 @@ main (int argc, char** argv)
 	return -1;
       }
     }
+
+    // The same data through a view of the page cache
+    DBView view;
+    UserData vdata;
+    if (dbtest.getView(key, view) != 0) {
+      cerr << "Cannot find data view " << endl;
+      sf.close ();
+      dbtest.close ();
+      return -1;
+    }
+    vdata.readObject (string (view.data(), view.size()));
+    if ((string)vdata != t2) {
+      cerr << "Retreive data view error" << endl;
+      sf.close ();
+      dbtest.close ();
+      return -1;
+    }
   }
   sf.close ();
   dbtest.close ();
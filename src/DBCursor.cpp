@@ -35,6 +35,7 @@
  *
  *
  */
+#include <errno.h>
 #include "DBCursor.h"
 
 using namespace std;
@@ -45,15 +46,17 @@ namespace FILEDB
    * Implementation of wrapper class for Database cursor with reference  *
    ***********************************************************************/
   DBCursorRep::DBCursorRep (void)
-    :count_ (1), cursor_ (0)
+    :count_ (1), cursor_ (0), bulk_ (), pos_ (0)
   {
-    // empty
+    bulkbuf_.data = 0;
+    bulkbuf_.size = 0;
   }
 
   DBCursorRep::DBCursorRep (ffdb_cursor_t* cursor)
-    :count_(1), cursor_ (cursor)
+    :count_(1), cursor_ (cursor), bulk_ (), pos_ (0)
   {
-    // empty
+    bulkbuf_.data = 0;
+    bulkbuf_.size = 0;
   }
 
 
@@ -122,4 +125,38 @@ namespace FILEDB
     if (--rep_->count_ <= 0)
       delete rep_;
   }
+
+  int
+  DBCursor::nextKey (FFDB_DBT& key)
+  {
+    FFDB_DBT data;
+    unsigned int count;
+    int ret;
+
+    if (!rep_->cursor_)
+      return -1;
+
+    while (ffdb_bulk_next (&rep_->bulkbuf_, &rep_->pos_, &key, &data) != 0) {
+      // fetch the next batch of keys
+      if (rep_->bulk_.empty ())
+	rep_->bulk_.resize (FILEDB_BULK_BUFFER_SIZE);
+      rep_->bulkbuf_.data = &rep_->bulk_[0];
+      rep_->bulkbuf_.size = rep_->bulk_.size ();
+      rep_->pos_ = 0;
+
+      ret = ffdb_cursor_get_bulk (rep_->cursor_, &rep_->bulkbuf_,
+				  FFDB_NEXT | FFDB_BULK_KEYS, &count);
+      if (ret == -1 && errno == ENOMEM) {
+	// a single key larger than the buffer
+	rep_->bulk_.resize (rep_->bulkbuf_.size);
+	rep_->bulkbuf_.size = 0;
+	continue;
+      }
+      if (ret != 0) {
+	rep_->bulkbuf_.size = 0;
+	return ret;
+      }
+    }
+    return 0;
+  }
 }
@@ -52,6 +52,7 @@
 #ifndef _FILEDB_DBCURSOR_H
 #define _FILEDB_DBCURSOR_H
 
+#include <vector>
 #include "DBKey.h"
 #include "DBData.h"
 
@@ -74,6 +75,10 @@ namespace FILEDB
 
     int  count_;
     ffdb_cursor_t* cursor_;
+    // keys fetched in bulk and position of the next one
+    std::vector<char> bulk_;
+    FFDB_DBT bulkbuf_;
+    unsigned long pos_;
     friend class DBCursor;
   };
 
@@ -116,6 +121,14 @@ namespace FILEDB
      * This pointer could be null.
      */
     ffdb_cursor_t* cursor (void) const {return rep_->cursor_;}
+
+    /**
+     * Move to the next key. Keys are fetched from the database in bulk
+     * @param key pointing to the key, valid until the next call
+     * @return 0 on success. FFDB_NOT_FOUND past the last key. 
+     * Otherwise failure
+     */
+    int nextKey (FFDB_DBT& key);
     
   private:
     DBCursorRep* rep_;
@@ -150,13 +163,11 @@ namespace FILEDB
     get_next_key (ffdb_cursor_t* cursor)
     {
       T    mykey;
-      FFDB_DBT  key, data;
+      FFDB_DBT  key;
       int  ret;
       
-      // get everything from meta data
-      key.data = data.data = 0;
-      key.size = data.size = 0;
-      ret = cursor->get (cursor, &key, &data, FFDB_NEXT);
+      // get keys only in bulk
+      ret = cursor_.nextKey (key);
 
       if (ret == 0) {
 	// get network byte order and convert to host order
@@ -172,7 +183,6 @@ namespace FILEDB
 	  cursor = 0;
 	  ::exit (143);
 	}
-	free (key.data); free (data.data);
 	// depends on operator = defined in T
 	keyvalue_ = mykey;
       }
@@ -292,17 +302,15 @@ namespace FILEDB
     static DBKeyIterator<T, D> init (FFDB_DB* dbh)
     {
       T mykey;
-      D mydata;
-      FFDB_DBT  key, data;
+      FFDB_DBT  key;
       ffdb_cursor_t  *crp;
       int  ret;
       
       try {
 	dbh->cursor (dbh, &crp, FFDB_KEY_CURSOR);
-	
-	key.data = data.data = 0;
-	key.size = data.size = 0;
-	ret = crp->get (crp, &key, &data, FFDB_NEXT);
+	DBCursor cursor (crp);
+
+	ret = cursor.nextKey (key);
 
 	if (ret == 0) {
 	  // convert into key object
@@ -310,16 +318,14 @@ namespace FILEDB
 	  keyObj.assign((char*)key.data, key.size);
 	  mykey.readObject (keyObj);
 
-	  free (key.data); free(data.data);
-
-	  return DBKeyIterator<T, D>(DBCursor(crp), mykey, 0);
+	  return DBKeyIterator<T, D>(cursor, mykey, 0);
 	}
 	else if (ret != FFDB_NOT_FOUND) {
 	  std::cerr <<"Fatal: DB cursor  error " << std::endl;
 	  ::exit (143);
 	}
 	else
-	  return DBKeyIterator<T, D>(DBCursor(crp), mykey, 1);
+	  return DBKeyIterator<T, D>(cursor, mykey, 1);
       }
       catch (SerializeException& e) {
 	std::cerr << "Fatal: DB cursor error: " << e.what () << std::endl;
@@ -80,44 +80,11 @@ namespace FILEDB
 		      std::vector<std::string>& keys)
     noexcept (false)
   {
-    FFDB_DBT  dbkey, dbdata;
-    ffdb_cursor_t* crp;
-    int  ret;
-    
-    try {
-      // create cursor
-      ret = dbh->cursor (dbh, &crp, FFDB_KEY_CURSOR);
-      if (ret != 0) 
-	throw FileHashDBException ("DBFunc binaryAllKeys", "Create Cursor Error");
-
-      // get everything from meta data
-      dbkey.data = dbdata.data = 0;
-      dbkey.size = dbdata.size = 0;
-
-      while ((ret = crp->get (crp, &dbkey, &dbdata, FFDB_NEXT)) == 0) 
-      {
-	// convert into key object
-	std::string keyObj;
-	keyObj.assign((char*)dbkey.data, dbkey.size);
-
-	// put this new key into the vector
-	keys.push_back (keyObj);
-	
-	// free memory
-	free (dbkey.data); free (dbdata.data);
-	dbkey.data = dbdata.data = 0;
-	dbkey.size = dbdata.size = 0;
-      }
-      if (ret != FFDB_NOT_FOUND) 
-	throw FileHashDBException ("DBFunc binaryAllKeys", "Cursor Next Error");
-    }
-    catch (SerializeException& e) {
-      throw;
-    }
-    
-    // close cursor
-    if (crp != NULL)
-      crp->close(crp);
+    bulkPairs (dbh, FFDB_KEY_CURSOR, true,
+	       [&keys] (const FFDB_DBT& dbkey, const FFDB_DBT&) {
+		 keys.push_back (std::string ((char*)dbkey.data, dbkey.size));
+		 return true;
+	       });
   }
 
   void binaryAllPairs (FFDB_DB* dbh, 
@@ -125,51 +92,13 @@ namespace FILEDB
 		       std::vector<std::string>& data) 
     noexcept (false)
   {
-    FFDB_DBT  dbkey, dbdata;
-    ffdb_cursor_t* crp;
-    int  ret;
-    
-    try {
-      // create cursor
-      ret = dbh->cursor (dbh, &crp, FFDB_KEY_CURSOR);
-      if (ret != 0) 
-	throw FileHashDBException ("DBFunc binaryAllPairs", "Create Cursor Error");
-
-      // get everything from meta data
-      dbkey.data = dbdata.data = 0;
-      dbkey.size = dbdata.size = 0;
-
-      while ((ret = crp->get (crp, &dbkey, &dbdata, FFDB_NEXT)) == 0) 
-      {
-	// convert into key object
-	std::string keyObj;
-	keyObj.assign((char*)dbkey.data, dbkey.size);
-
-	// convert into data object
-	std::string dataObj;
-	dataObj.assign((char*)dbdata.data, dbdata.size);
-
-	// put this new key into the vector
-	keys.push_back (keyObj);
-	
-	// put this data into the other vector
-	data.push_back (dataObj);
-
-	// free memory
-	free (dbkey.data); free (dbdata.data);
-	dbkey.data = dbdata.data = 0;
-	dbkey.size = dbdata.size = 0;
-      }
-      if (ret != FFDB_NOT_FOUND) 
-	throw FileHashDBException ("DBFunc binaryAllPairs", "Cursor Next Error");
-    }
-    catch (SerializeException& e) {
-      throw;
-    }
-    
-    // close cursor
-    if (crp != NULL)
-      crp->close(crp);
+    // visit data pages in file order
+    bulkPairs (dbh, FFDB_DATA_CURSOR, false,
+	       [&] (const FFDB_DBT& dbkey, const FFDB_DBT& dbdata) {
+		 keys.push_back (std::string ((char*)dbkey.data, dbkey.size));
+		 data.push_back (std::string ((char*)dbdata.data, dbdata.size));
+		 return true;
+	       });
   }
 
   int getBinaryData (FFDB_DB* dbh, const std::string& key, std::string& data) 
@@ -53,7 +53,11 @@
 #include <sys/stat.h>
 #include <errno.h>
 #include <sstream>
+#include <thread>
+#include <exception>
+#include <iterator>
 #include "FileDB.h"
+#include "DBView.h"
 #include "ffdb_db.h"
 
 
@@ -261,6 +265,44 @@ namespace FILEDB
     return insertData(dbh, key, dataObj, flag);
   }
 
+  /**
+   * Insert a batch of key and data pairs into a database pointed by dbh.
+   * All pairs are written in one call in on-disk bucket order
+   *
+   * @param dbh database pointer
+   * @param keys keys. Each key must be subclass of DBKey
+   * @param data data for each key. Each data must be subclass of DBData
+   * @param flag database put flag: FFDB_NOOVERWRITE or 0
+   *
+   * @return 0 on success. Otherwise failure
+   */
+  template <typename K, typename D>
+  int insertDataBatch (FFDB_DB* dbh, const std::vector<K>& keys,
+		       const std::vector<D>& data, unsigned int flag = 0)
+  {
+    if (keys.size() != data.size())
+      return -1;
+    if (keys.empty())
+      return 0;
+
+    std::vector<std::string> keyObjs (keys.size());
+    std::vector<std::string> dataObjs (data.size());
+    std::vector<FFDB_DBT> dbkeys (keys.size());
+    std::vector<FFDB_DBT> dbdata (data.size());
+
+    // convert keys and data into binary form
+    for (std::size_t i = 0; i < keys.size(); i++) {
+      keys[i].writeObject (keyObjs[i]);
+      data[i].writeObject (dataObjs[i]);
+      dbkeys[i].data = &(keyObjs[i][0]);
+      dbkeys[i].size = keyObjs[i].size();
+      dbdata[i].data = &(dataObjs[i][0]);
+      dbdata[i].size = dataObjs[i].size();
+    }
+
+    return ffdb_mput (dbh, &dbkeys[0], &dbdata[0], keys.size(), flag, 0);
+  }
+
   /**
    * get key and data pair from a database pointed by pointer dbh
    *
@@ -286,26 +328,15 @@ namespace FILEDB
       throw;
     }
 
-    // create key
-    FFDB_DBT dbkey;
-    dbkey.data = &keyObj[0];
-    dbkey.size = keyObj.size();
-
-    // create and empty dbt data object
-    FFDB_DBT dbdata;
-    dbdata.data = 0;
-    dbdata.size = 0;
-
-    // now retrieve data from database
-    ret = dbh->get (dbh, &dbkey, &dbdata, 0);
+    // now retrieve a view of data from database
+    DBView view;
+    ret = view.get (dbh, keyObj);
     if (ret == 0) {
       try {
 	// convert object into a string
 	std::string dataObj;
-	dataObj.assign((char*)dbdata.data, dbdata.size);
+	dataObj.assign(view.data(), view.size());
 	data.readObject (dataObj);
-	// I have to use free since I use malloc in c code
-	free(dbdata.data);
       }
       catch (SerializeException& e) {
 	ret = -1;
@@ -341,140 +372,218 @@ namespace FILEDB
       throw;
     }
 
-    // create key
-    FFDB_DBT dbkey;
-    dbkey.data = &keyObj[0];
-    dbkey.size = keyObj.size();
-
-    // create and empty dbt data object
-    FFDB_DBT dbdata;
-    dbdata.data = 0;
-    dbdata.size = 0;
-
-    // now retrieve data from database
-    ret = dbh->get (dbh, &dbkey, &dbdata, 0);
+    // now retrieve a view of data from database
+    DBView view;
+    ret = view.get (dbh, keyObj);
     if (ret == 0) {
       // convert object into a string
-      data.assign((char*)dbdata.data, dbdata.size);
-      // I have to use free since I use malloc in c code
-      free(dbdata.data);
+      data.assign(view.data(), view.size());
     }
     return ret;
   }
 
 
   /**
-   * Return all keys to a vector provided by an application
+   * Get data for a batch of keys from a database pointed by pointer dbh.
+   * Keys are looked up in on-disk page order rather than one at a time.
+   * The data items are in binary string form
+   *
+   * @param dbh database pointer
+   * @param keys keys to look up. Each key must be subclass of DBKey
+   * @param data data for each key. Data of a missing key is empty
+   * @param status result for each key: 0 found, 1 not found, -1 failure
    *
+   * @return 0 when all keys are found, 1 when some keys are not found.
+   * Otherwise failure
    */
-  template <typename K, typename D>
-  void allKeys (FFDB_DB* dbh, std::vector<K>& keys) 
+  template <typename K>
+  int getDataBatch (FFDB_DB* dbh, const std::vector<K>& keys,
+		    std::vector<std::string>& data, std::vector<int>& status)
     noexcept (false)
   {
-    FFDB_DBT  dbkey;
-    ffdb_cursor_t *crp;
-    K    arg;
-    int  ret;
-    
-    try {
-      // create cursor
-      ret = dbh->cursor (dbh, &crp, FFDB_KEY_CURSOR);
-      if (ret != 0) 
-	throw FileHashDBException ("DBFunc allKeys", "Cannot create cursor");
-
-      // get everything from meta dat
-      dbkey.data = 0;
-      dbkey.size = 0;
-      while ((ret = crp->get (crp, &dbkey, 0, FFDB_NEXT)) == 0) {
-	// convert into key object
-	std::string keyObj;
-	keyObj.assign((char*)dbkey.data, dbkey.size);
-	arg.readObject (keyObj);
+    std::vector<std::string> keyObjs (keys.size());
+    std::vector<FFDB_DBT> dbkeys (keys.size());
+    std::vector<FFDB_DBT> dbdata (keys.size());
+
+    // first convert keys into binary buffers
+    for (std::size_t i = 0; i < keys.size(); i++) {
+      keys[i].writeObject (keyObjs[i]);
+      dbkeys[i].data = &(keyObjs[i][0]);
+      dbkeys[i].size = keyObjs[i].size();
+      dbdata[i].data = 0;
+      dbdata[i].size = 0;
+    }
 
-	// put this new key into the vector
-	keys.push_back (arg);
+    data.assign (keys.size(), std::string());
+    status.assign (keys.size(), FFDB_NOT_FOUND);
+    if (keys.empty())
+      return 0;
 
-	// free memory
-	free (dbkey.data);
+    int ret = ffdb_mget (dbh, &dbkeys[0], keys.size(), &dbdata[0], &status[0]);
 
-	dbkey.data = 0;
-	dbkey.size = 0;
+    for (std::size_t i = 0; i < keys.size(); i++) {
+      if (status[i] == 0) {
+	data[i].assign((char*)dbdata[i].data, dbdata[i].size);
+	// I have to use free since I use malloc in c code
+	free(dbdata[i].data);
       }
-      if (ret != FFDB_NOT_FOUND) 
-	throw FileHashDBException ("DBFunc AllKeys", "Cursor next error");
     }
-    catch (SerializeException& e) {
-      throw;
-    } 
-    
-    // close cursor
-    if (crp)
-      crp->close(crp);
+    return ret;
   }
 
 
+  /**
+   * Get a byte range of data for a key from a database pointed by
+   * pointer dbh. Only the data pages covering the range are read
+   *
+   * @param dbh database pointer
+   * @param key key must be subclass of DBKey
+   * @param offset where the range starts in the data
+   * @param len number of bytes to read
+   * @param data the bytes read in binary string form
+   * @param datalen total length of the data
+   *
+   * @return 0 on success, 1 if the key is not found. Otherwise failure
+   */
+  template <typename K>
+  int getDataRange (FFDB_DB* dbh, const K& key, long offset, long len,
+		    std::string& data, long& datalen)
+    noexcept (false)
+  {
+    FFDB_DBT dbkey;
+    std::string keyObj;
+
+    // first convert key into binary buffer
+    key.writeObject (keyObj);
+    dbkey.data = &keyObj[0];
+    dbkey.size = keyObj.size();
+
+    data.resize (len);
+    return ffdb_get_range (dbh, &dbkey, offset, len, 
+			   len > 0 ? &data[0] : 0, &datalen);
+  }
 
   /**
-   * Return all keys and data to vectors provided by an application
+   * Overwrite a byte range of data for a key in a database pointed by
+   * pointer dbh. The data length stays the same
+   *
+   * @param dbh database pointer
+   * @param key key must be subclass of DBKey
+   * @param offset where the range starts in the data
+   * @param data new bytes of the range in binary string form
    *
+   * @return 0 on success, 1 if the key is not found. Otherwise failure
    */
-  template <typename K, typename D>
-  void allPairs(FFDB_DB* dbh, std::vector<K>& keys, std::vector<D>& data,
-		bool only_one = false) noexcept(false)
+  template <typename K>
+  int putDataRange (FFDB_DB* dbh, const K& key, long offset,
+		    const std::string& data)
+    noexcept (false)
+  {
+    FFDB_DBT dbkey;
+    std::string keyObj;
+
+    // first convert key into binary buffer
+    key.writeObject (keyObj);
+    dbkey.data = &keyObj[0];
+    dbkey.size = keyObj.size();
+
+    return ffdb_put_range (dbh, &dbkey, offset, data.data(), data.size());
+  }
+
+  /**
+   * Visit all pairs of a database fetched in bulk by a cursor
+   *
+   * Pairs are packed into one buffer by ffdb_cursor_get_bulk and handed
+   * to visit(const FFDB_DBT& key, const FFDB_DBT& data) without extra 
+   * copies. The data are empty if keysonly is set. The walk stops early
+   * if visit returns false.
+   */
+  template <typename Visitor>
+  void bulkPairs (FFDB_DB* dbh, unsigned int type, bool keysonly,
+		  Visitor visit) noexcept (false)
   {
-    FFDB_DBT  dbkey, dbdata;
     ffdb_cursor_t* crp;
-    K    arg;
-    D    d;
+    std::vector<char> buf (FILEDB_BULK_BUFFER_SIZE);
+    FFDB_DBT  bulk, dbkey, dbdata;
+    unsigned int flags, count;
+    unsigned long pos;
+    bool more = true;
     int  ret;
-    
-    try {
-      // create cursor
-      ret = dbh->cursor (dbh, &crp, FFDB_KEY_CURSOR);
-      if (ret != 0) 
-	throw FileHashDBException ("DBFunc AllPairs", "Create Cursor Error");
 
-      // get everything from meta data
-      dbkey.data = dbdata.data = 0;
-      dbkey.size = dbdata.size = 0;
-      while ((ret = crp->get (crp, &dbkey, &dbdata, FFDB_NEXT)) == 0) {
-	// convert into key object
-	std::string keyObj;
-	keyObj.assign((char*)dbkey.data, dbkey.size);
-	arg.readObject (keyObj);
+    ret = dbh->cursor (dbh, &crp, type);
+    if (ret != 0) 
+      throw FileHashDBException ("DBFunc bulkPairs", "Create Cursor Error");
 
-	// convert into data object
-	std::string dataObj;
-	dataObj.assign((char*)dbdata.data, dbdata.size);
-	d.readObject (dataObj);
-
-	// put this new key into the vector
-	keys.push_back (arg);
-	
-	// put this data into the other vector
-	data.push_back (d);
-
-	// free memory
-	free (dbkey.data); free (dbdata.data);
-	dbkey.data = dbdata.data = 0;
-	dbkey.size = dbdata.size = 0;
-
-	if (only_one)
-	{
-	  ret = FFDB_NOT_FOUND;
-	  break;
+    flags = keysonly ? (FFDB_NEXT | FFDB_BULK_KEYS) : FFDB_NEXT;
+    try {
+      while (more) {
+	bulk.data = &buf[0];
+	bulk.size = buf.size();
+	ret = ffdb_cursor_get_bulk (crp, &bulk, flags, &count);
+	if (ret == -1 && errno == ENOMEM) {
+	  // a single pair larger than the buffer
+	  buf.resize (bulk.size);
+	  continue;
 	}
+	if (ret != 0)
+	  break;
+
+	pos = 0;
+	while (more && ffdb_bulk_next (&bulk, &pos, &dbkey, &dbdata) == 0)
+	  more = visit (dbkey, dbdata);
       }
-      if (ret != FFDB_NOT_FOUND) 
-	throw FileHashDBException ("DBFunc AllPairs", "Cursor Next Error");
+      if (more && ret != FFDB_NOT_FOUND) 
+	throw FileHashDBException ("DBFunc bulkPairs", "Cursor Next Error");
     }
-    catch (SerializeException& e) {
+    catch (...) {
+      crp->close (crp);
       throw;
     }
     
     // close cursor
-    if (crp != NULL)
-      crp->close(crp);
+    crp->close (crp);
+  }
+
+  /**
+   * Return all keys to a vector provided by an application
+   *
+   */
+  template <typename K, typename D>
+  void allKeys (FFDB_DB* dbh, std::vector<K>& keys) 
+    noexcept (false)
+  {
+    bulkPairs (dbh, FFDB_KEY_CURSOR, true,
+	       [&keys] (const FFDB_DBT& dbkey, const FFDB_DBT&) {
+		 // convert into key object
+		 K arg;
+		 arg.readObject (std::string ((char*)dbkey.data, dbkey.size));
+		 keys.push_back (arg);
+		 return true;
+	       });
+  }
+
+
+
+  /**
+   * Return all keys and data to vectors provided by an application
+   *
+   */
+  template <typename K, typename D>
+  void allPairs(FFDB_DB* dbh, std::vector<K>& keys, std::vector<D>& data,
+		bool only_one = false) noexcept(false)
+  {
+    // visit data pages in file order
+    bulkPairs (dbh, FFDB_DATA_CURSOR, false,
+	       [&] (const FFDB_DBT& dbkey, const FFDB_DBT& dbdata) {
+		 // convert into key and data objects
+		 K arg;
+		 D d;
+		 arg.readObject (std::string ((char*)dbkey.data, dbkey.size));
+		 d.readObject (std::string ((char*)dbdata.data, dbdata.size));
+		 keys.push_back (arg);
+		 data.push_back (d);
+		 return !only_one;
+	       });
   }
 
   /**
@@ -485,49 +594,96 @@ namespace FILEDB
   void allPairsWithBinaryKeys (FFDB_DB* dbh, std::vector<std::string>& keys, std::vector<D>& data) 
     noexcept (false)
   {
-    FFDB_DBT  dbkey, dbdata;
-    ffdb_cursor_t* crp;
-    D    d;
-    int  ret;
-    
-    try {
-      // create cursor
-      ret = dbh->cursor (dbh, &crp, FFDB_KEY_CURSOR);
-      if (ret != 0) 
-	throw FileHashDBException ("DBFunc AllPairs", "Create Cursor Error");
+    // visit data pages in file order
+    bulkPairs (dbh, FFDB_DATA_CURSOR, false,
+	       [&] (const FFDB_DBT& dbkey, const FFDB_DBT& dbdata) {
+		 D d;
+		 d.readObject (std::string ((char*)dbdata.data, dbdata.size));
+		 keys.push_back (std::string ((char*)dbkey.data, dbkey.size));
+		 data.push_back (d);
+		 return true;
+	       });
+  }
 
-      // get everything from meta data
-      dbkey.data = dbdata.data = 0;
-      dbkey.size = dbdata.size = 0;
-      while ((ret = crp->get (crp, &dbkey, &dbdata, FFDB_NEXT)) == 0) {
-	std::string keyObj((char*)dbkey.data, dbkey.size);
+  /**
+   * Return all keys and data to vectors scanned by threads in parallel
+   *
+   * Buckets are split into nthreads ranges, each walked by its own thread
+   * with a key cursor. A thread converts its own pairs with readKey and
+   * readData, which are called as readKey(const std::string&, K&) and
+   * readData(const std::string&, D&). Pairs are returned in bucket order.
+   */
+  template <typename K, typename D, typename KeyReader, typename DataReader>
+  void parallelAllPairs (FFDB_DB* dbh, std::vector<K>& keys, 
+			 std::vector<D>& data, unsigned int nthreads,
+			 KeyReader readKey, DataReader readData)
+    noexcept (false)
+  {
+    std::vector<ffdb_bucket_range_t> ranges (nthreads > 0 ? nthreads : 1);
+    int nranges = ffdb_bucket_ranges (dbh, &ranges[0], ranges.size());
+    if (nranges < 0)
+      throw FileHashDBException ("DBFunc parallelAllPairs", "Split Buckets Error");
+
+    std::vector< std::vector<K> > tkeys (nranges);
+    std::vector< std::vector<D> > tdata (nranges);
+    std::vector< std::exception_ptr > errors (nranges);
+    std::vector< std::thread > threads;
+
+    for (int i = 0; i < nranges; i++) {
+      threads.push_back (std::thread ([&, i] () {
+	FFDB_DBT  dbkey, dbdata;
+	ffdb_cursor_t* crp = 0;
+	int  ret;
+
+	try {
+	  if (dbh->cursor (dbh, &crp, FFDB_KEY_CURSOR) != 0) {
+	    crp = 0;
+	    throw FileHashDBException ("DBFunc parallelAllPairs", "Create Cursor Error");
+	  }
+	  if (ffdb_cursor_set_range (crp, &ranges[i]) != 0)
+	    throw FileHashDBException ("DBFunc parallelAllPairs", "Cursor Range Error");
+
+	  dbkey.data = dbdata.data = 0;
+	  dbkey.size = dbdata.size = 0;
+	  while ((ret = crp->get (crp, &dbkey, &dbdata, FFDB_NEXT)) == 0) {
+	    std::string keyObj ((char*)dbkey.data, dbkey.size);
+	    std::string dataObj ((char*)dbdata.data, dbdata.size);
+
+	    // free memory
+	    free (dbkey.data); free (dbdata.data);
+	    dbkey.data = dbdata.data = 0;
+	    dbkey.size = dbdata.size = 0;
+
+	    K arg;
+	    D d;
+	    readKey (keyObj, arg);
+	    readData (dataObj, d);
+	    tkeys[i].push_back (arg);
+	    tdata[i].push_back (d);
+	  }
+	  if (ret != FFDB_NOT_FOUND) 
+	    throw FileHashDBException ("DBFunc parallelAllPairs", "Cursor Next Error");
+	}
+	catch (...) {
+	  errors[i] = std::current_exception ();
+	}
+	if (crp)
+	  crp->close (crp);
+      }));
+    }
+    for (std::size_t i = 0; i < threads.size(); i++)
+      threads[i].join ();
 
-	// convert into data object
-	std::string dataObj;
-	dataObj.assign((char*)dbdata.data, dbdata.size);
-	d.readObject (dataObj);
-
-	// put this new key into the vector
-	keys.push_back (keyObj);
-	
-	// put this data into the other vector
-	data.push_back (d);
-
-	// free memory
-	free (dbkey.data); free (dbdata.data);
-	dbkey.data = dbdata.data = 0;
-	dbkey.size = dbdata.size = 0;
-      }
-      if (ret != FFDB_NOT_FOUND) 
-	throw FileHashDBException ("DBFunc AllPairs", "Cursor Next Error");
+    for (int i = 0; i < nranges; i++) {
+      if (errors[i])
+	std::rethrow_exception (errors[i]);
     }
-    catch (SerializeException& e) {
-      throw;
+    for (int i = 0; i < nranges; i++) {
+      keys.insert (keys.end(), std::make_move_iterator (tkeys[i].begin()),
+		   std::make_move_iterator (tkeys[i].end()));
+      data.insert (data.end(), std::make_move_iterator (tdata[i].begin()),
+		   std::make_move_iterator (tdata[i].end()));
     }
-    
-    // close cursor
-    if (crp != NULL)
-      crp->close(crp);
   }
 
   /**
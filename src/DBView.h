@@ -0,0 +1,137 @@
+// -*- C++ -*-
+/*----------------------------------------------------------------------------
+ * Copyright (c) 2007      Jefferson Science Associates, LLC
+ *                         Under U.S. DOE Contract No. DE-AC05-06OR23177
+ *
+ *                         Thomas Jefferson National Accelerator Facility
+ *
+ *                         Jefferson Lab
+ *                         Scientific Computing Group,
+ *                         12000 Jefferson Ave.,
+ *                         Newport News, VA 23606
+ *----------------------------------------------------------------------------
+ *
+ * Description:
+ *     Read only view of a data item stored in a database
+ *
+ * Author:
+ *     Jie Chen
+ *     Scientific Computing Group
+ *     Jefferson Lab
+ *
+ */
+#ifndef _FILEDB_DBVIEW_H
+#define _FILEDB_DBVIEW_H
+
+#include <string>
+#include "ffdb_db.h"
+
+namespace FILEDB
+{
+  /**
+   * Read only view of a data item
+   *
+   * On a database opened read only, the view points directly into the
+   * cached page holding the data item, which stays pinned as long as the
+   * view is alive. Otherwise the view owns a private copy of the data.
+   *
+   * A view can be moved but not copied. It has to be destroyed or
+   * released before the database is closed.
+   */
+  class DBView
+  {
+  public:
+    /**
+     * Default constructor: an empty view
+     */
+    DBView (void)
+      :dbh_ (0)
+    {
+      view_.data = view_.page = view_.buffer = 0;
+      view_.size = 0;
+    }
+
+    DBView (const DBView& v) = delete;
+    DBView& operator = (const DBView& v) = delete;
+
+    /**
+     * Move constructor
+     */
+    DBView (DBView&& v)
+      :dbh_ (v.dbh_), view_ (v.view_)
+    {
+      v.dbh_ = 0;
+      v.view_.data = v.view_.page = v.view_.buffer = 0;
+      v.view_.size = 0;
+    }
+
+    /**
+     * Move assignment operator
+     */
+    DBView& operator = (DBView&& v)
+    {
+      if (this != &v) {
+	release ();
+	dbh_ = v.dbh_;
+	view_ = v.view_;
+	v.dbh_ = 0;
+	v.view_.data = v.view_.page = v.view_.buffer = 0;
+	v.view_.size = 0;
+      }
+      return *this;
+    }
+
+    /**
+     * Destructor: release the page or the copy
+     */
+    ~DBView (void)
+    {
+      release ();
+    }
+
+    /**
+     * Look up a key in binary form and hold the view of its data
+     *
+     * @param dbh database pointer
+     * @param key binary key
+     *
+     * @return 0 on success. 1 if the key is not found. Otherwise failure
+     */
+    int get (FFDB_DB* dbh, const std::string& key)
+    {
+      FFDB_DBT dbkey;
+
+      release ();
+
+      dbkey.data = const_cast<char*>(key.data());
+      dbkey.size = key.size();
+
+      int ret = ffdb_get_view (dbh, &dbkey, &view_);
+      if (ret == 0)
+	dbh_ = dbh;
+      return ret;
+    }
+
+    /**
+     * Release the view now
+     */
+    void release (void)
+    {
+      if (dbh_)
+	ffdb_release_view (dbh_, &view_);
+      dbh_ = 0;
+    }
+
+    /**
+     * Data and its size
+     */
+    const char* data (void) const {return (const char *)view_.data;}
+    std::size_t size (void) const {return (std::size_t)view_.size;}
+    bool empty (void) const {return view_.size == 0;}
+
+  private:
+    FFDB_DB* dbh_;
+    ffdb_view_t view_;
+  };
+}
+#endif
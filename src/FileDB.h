@@ -41,6 +41,9 @@
 #define FILEDB_FIX_DATA_SIZE 0x1000
 #define FILEDB_VAR_DATA_SIZE 0x1001
 
+// initial buffer size of bulk cursor gets, enlarged for larger pairs
+#define FILEDB_BULK_BUFFER_SIZE 0x100000
+
 namespace FILEDB
 {
 
@@ -0,0 +1,163 @@
+/*----------------------------------------------------------------------------
+ * Copyright (c) 2007      Jefferson Science Associates, LLC
+ *                         Under U.S. DOE Contract No. DE-AC05-06OR23177
+ *
+ *                         Thomas Jefferson National Accelerator Facility
+ *
+ *                         Jefferson Lab
+ *                         Scientific Computing Group,
+ *                         12000 Jefferson Ave.,
+ *                         Newport News, VA 23606
+ *----------------------------------------------------------------------------
+ *
+ * Description:
+ *     Compare the built-in hash functions of the database with the
+ *     general purpose hash functions in HashFunc.h for speed and for
+ *     how evenly keys are spread over buckets
+ *
+ */
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+#include "ffdb_db.h"
+#include "HashFunc.h"
+
+using namespace std;
+using namespace FILEDB;
+
+/**
+ * A hash function either from HashFunc.h or from the database library
+ */
+struct HashEntry
+{
+  const char* name;
+  hash_func func;
+  unsigned int (*dbfunc) (const void*, unsigned int);
+
+  unsigned int operator () (const string& key) const
+  {
+    if (func)
+      return func ((char *)key.data(), key.size());
+    return dbfunc (key.data(), key.size());
+  }
+};
+
+/**
+ * Bucket quality: sum of b(b+1)/2 over buckets divided by what a random
+ * hash gives. Close to 1 is good, larger is worse
+ */
+static double
+quality (const vector<unsigned int>& buckets, double nkeys)
+{
+  double m = buckets.size(), sum = 0.0;
+
+  for (unsigned int i = 0; i < buckets.size(); i++)
+    sum += buckets[i] * (buckets[i] + 1.0) / 2.0;
+  return sum / ((nkeys / (2.0 * m)) * (nkeys + 2.0 * m - 1.0));
+}
+
+/**
+ * Hash all keys and report time per key and bucket quality
+ * both for a prime number of buckets and for a power of two number of
+ * buckets selected by the low bits as in the database
+ */
+static double
+run (const HashEntry& h, const vector<string>& keys, const char* kind)
+{
+  unsigned int nbuckets, mask, sink = 0;
+  const int nloops = 10;
+
+  auto start = chrono::steady_clock::now ();
+  for (int l = 0; l < nloops; l++)
+    for (unsigned int i = 0; i < keys.size(); i++)
+      sink += h (keys[i]);
+  auto end = chrono::steady_clock::now ();
+  double ns = chrono::duration<double, nano>(end - start).count () /
+    ((double)nloops * keys.size());
+
+  for (nbuckets = 1; nbuckets < keys.size() / 4; nbuckets <<= 1)
+    ;
+  mask = nbuckets - 1;
+  vector<unsigned int> prime (HASH_BUCKETS, 0), pow2 (nbuckets, 0);
+  for (unsigned int i = 0; i < keys.size(); i++) {
+    unsigned int v = h (keys[i]);
+    prime[v % HASH_BUCKETS]++;
+    pow2[v & mask]++;
+  }
+  double qp = quality (prime, keys.size());
+  double q2 = quality (pow2, keys.size());
+
+  cout << setw(10) << h.name << setw(8) << kind
+       << setw(12) << fixed << setprecision(2) << ns
+       << setw(12) << setprecision(4) << qp
+       << setw(12) << q2 << (sink == 0xffffffff ? " " : "") << endl;
+  return q2;
+}
+
+int
+main (int argc, char** argv)
+{
+  if (argc < 2) {
+    cerr << "Usage: " << argv[0] << " numkeys [longkeylen]" << endl;
+    return -1;
+  }
+  unsigned int numkeys = atoi (argv[1]);
+  unsigned int keylen = (argc > 2) ? atoi (argv[2]) : 256;
+
+  // keys used by the test programs and long binary keys
+  char keystr[80];
+  vector<string> skeys, lkeys;
+  for (unsigned int i = 0; i < numkeys; i++) {
+    ::sprintf (keystr, "Key Test Loop %d", i);
+    skeys.push_back (string (keystr));
+
+    string lkey (keylen, '\0');
+    for (unsigned int k = 0; k < keylen; k++)
+      lkey[k] = (char)((i >> (8 * (k % 4))) + k / 4);
+    lkeys.push_back (lkey);
+  }
+
+  HashEntry hashes[] = {
+    {"RS", RSHash, 0},
+    {"JS", JSHash, 0},
+    {"PJW", PJWHash, 0},
+    {"ELF", ELFHash, 0},
+    {"BKDR", BKDRHash, 0},
+    {"SDBM", SDBMHash, 0},
+    {"DJB", DJBHash, 0},
+    {"DEK", DEKHash, 0},
+    {"BP", BPHash, 0},
+    {"FNV", FNVHash, 0},
+    {"AP", APHash, 0},
+    {"ffdb-fnv", 0, ffdb_hash_function (FFDB_HASH_FNV)},
+    {"ffdb-wy", 0, ffdb_hash_function (FFDB_HASH_WY)},
+  };
+  unsigned int nhashes = sizeof (hashes) / sizeof (hashes[0]);
+
+  cout << setw(10) << "hash" << setw(8) << "keys" << setw(12) << "ns/key"
+       << setw(12) << "prime" << setw(12) << "pow2" << endl;
+
+  // the default hash of new databases has to spread both kinds of keys
+  HashEntry def = {"default", 0, ffdb_hash_function (FFDB_HASH_DEFAULT)};
+  double worst = 0.0;
+  for (unsigned int i = 0; i < nhashes; i++)
+    run (hashes[i], skeys, "short");
+  worst = run (def, skeys, "short");
+  for (unsigned int i = 0; i < nhashes; i++)
+    run (hashes[i], lkeys, "long");
+  double q = run (def, lkeys, "long");
+  if (q > worst)
+    worst = q;
+
+  if (worst > 1.1) {
+    cerr << "Default hash function spreads keys poorly: " << worst << endl;
+    return -1;
+  }
+  return 0;
+}